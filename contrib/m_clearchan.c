@@ -90,6 +90,7 @@ mo_clearchan(struct Client *client_p, struct Client *source_p, int parc, const c
 	{
 		msptr = ptr->data;
 		msptr->flags &= ~CHFL_CHANOP | CHFL_VOICE;
+		update_member_flags(msptr);
 	}
 
 	sendto_wallops_flags(UMODE_WALLOP, &me,
@@ -91,6 +91,7 @@ mo_opme(struct Client *client_p, struct Client *source_p, int parc, const char *
 		return 0;
 
 	msptr->flags |= CHFL_CHANOP;
+	update_member_flags(msptr);
 
 	sendto_wallops_flags(UMODE_WALLOP, &me,
 			     "OPME called for [%s] by %s!%s@%s",
@@ -27,6 +27,8 @@
 #ifndef INCLUDED_channel_h
 #define INCLUDED_channel_h
 
+#include "match.h"		/* struct compiled_mask */
+
 #define MODEBUFLEN      200
 
 /* Maximum mode changes allowed per client, per server is different */
@@ -35,6 +37,7 @@
 
 extern struct ev_entry *checksplit_ev;
 struct Client;
+struct chan_count;
 
 /* mode structure for channels */
 struct Mode
@@ -52,6 +55,8 @@ struct topic_info
 };
 
 /* channel structure */
+#define BAN_LISTS	4	/* banlist, exceptlist, invexlist, reoplist */
+
 struct Channel
 {
 	rb_dlink_node node;
@@ -61,12 +66,28 @@ struct Channel
 
 	rb_dlink_list members;	/* channel members */
 	rb_dlink_list locmembers;	/* local channel members */
+	rb_dlink_list uplinks;	/* server links with members behind them */
+
+	/* locmembers again as flat arrays, so local fanout walks memory in
+	 * order instead of chasing list nodes.  locflags mirrors the op and
+	 * voice bits of each member, see update_member_flags().
+	 */
+	struct Client **locclient;
+	uint8_t *locflags;
+	struct membership **locmsptr;
+	unsigned int loccount;
+	unsigned int locsize;
 
 	rb_dlink_list invites;
 	rb_dlink_list banlist;
 	rb_dlink_list exceptlist;
 	rb_dlink_list invexlist;
 	rb_dlink_list reoplist;
+	struct ban_index *banindex[BAN_LISTS];
+	struct names_cache *namescache[2];	/* see channel_member_names() */
+
+	rb_dlink_node countnode;		/* in member count order */
+	struct chan_count *countgroup;
 
 	time_t first_received_message_time;	/* channel flood control */
 	int received_number_of_privmsgs;
@@ -89,10 +110,30 @@ struct membership
 	struct Channel *chptr;
 	struct Client *client_p;
 	uint8_t flags;
+	unsigned int locindex;	/* slot in chptr->locclient, local members only */
 
 	uint32_t ban_serial;
 };
 
+/* how many members of a channel are behind one of our server links */
+struct chan_uplink
+{
+	rb_dlink_node node;
+	struct Client *client_p;
+	unsigned int members;
+};
+
+/* a run of channels with the same number of members, see
+ * first_channel_over()
+ */
+struct chan_count
+{
+	rb_dlink_node node;
+	struct Channel *first;
+	unsigned int count;
+	unsigned int channels;
+};
+
 #define BANLEN NICKLEN+USERLEN+HOSTLEN+6
 struct Ban
 {
@@ -100,6 +141,42 @@ struct Ban
 	char *who;
 	time_t when;
 	rb_dlink_node node;
+
+	/* literal part of the host mask, for struct ban_index */
+	const char *host;
+	uint8_t hostlen;
+	uint8_t hosttype;
+
+	struct compiled_mask cmask;
+};
+
+#define BAN_HOST_GLOB	0	/* anything else, always tried */
+#define BAN_HOST_EXACT	1	/* user@host.name */
+#define BAN_HOST_SUFFIX	2	/* user@*.host.name */
+#define BAN_HOST_PREFIX	3	/* user@10.0.* */
+
+/* a ban list sorted by host, so match_ban() only runs match() on bans
+ * that can apply.  built on first use, thrown away when the list changes
+ */
+/* NAMES as seen by a member, without the numeric and target in front.
+ * lines are \0 terminated one after another in buf, and short enough
+ * that any nick can be put in front of them.
+ */
+struct names_cache
+{
+	char *buf;
+	size_t len;
+	size_t size;
+	size_t last;		/* start of the last line */
+	size_t limit;		/* longest a line may get */
+};
+
+struct ban_index
+{
+	struct Ban **exact;	/* BAN_HOST_EXACT, open addressed on the host */
+	unsigned int exact_bits;
+	struct Ban **other;	/* the rest, in list order */
+	unsigned int other_count;
 };
 
 struct ChModeChange
@@ -224,7 +301,14 @@ const char *find_channel_status(struct membership *msptr, int combine);
 void add_user_to_channel(struct Channel *, struct Client *, int flags);
 void remove_user_from_channel(struct membership *);
 void remove_user_from_channels(struct Client *);
+void update_member_flags(struct membership *);
 void invalidate_bancache_user(struct Client *);
+rb_dlink_node *first_channel_over(unsigned int count);
+void invalidate_names_user(struct Client *);
+void invalidate_bancache(struct Channel *);
+void bancache_ban_added(struct Channel *, struct Ban *);
+void bancache_ban_removed(struct Channel *);
+extern unsigned long ban_cache_kept;
 
 void free_channel_list(rb_dlink_list *);
 
@@ -256,6 +340,8 @@ void send_cap_mode_changes(struct Client *client_p, struct Client *source_p,
 			   struct Channel *chptr, struct ChModeChange foo[], int);
 
 
-struct	Ban *match_ban(rb_dlink_list *bl, struct Client *who, char *nuhs, int init);
+struct	Ban *match_ban(struct Channel *chptr, rb_dlink_list *bl, struct Client *who,
+		   char *nuhs, int init);
+void ban_list_changed(struct Channel *chptr, rb_dlink_list *bl);
 void	expire_chandelay(void *unused);
 #endif /* INCLUDED_channel_h */
@@ -157,6 +157,7 @@ struct LocalUser;
 #define LFLAGS_FLUSH		0x00000002
 #define LFLAGS_CORK		0x00000004
 #define LFLAGS_SENTUSER		0x00000008
+#define LFLAGS_FLUSHPEND	0x00000010
 
 /* umodes, settable flags */
 
@@ -243,6 +244,10 @@ struct LocalUser;
 #define SetFlush(x)		((x)->localClient->localflags |= LFLAGS_FLUSH)
 #define ClearFlush(x)		((x)->localClient->localflags &= ~LFLAGS_FLUSH)
 
+#define IsFlushPending(x)	((x)->localClient->localflags & LFLAGS_FLUSHPEND)
+#define SetFlushPending(x)	((x)->localClient->localflags |= LFLAGS_FLUSHPEND)
+#define ClearFlushPending(x)	((x)->localClient->localflags &= ~LFLAGS_FLUSHPEND)
+
 #define HasSentUser(x)		((x)->localClient->localflags & LFLAGS_SENTUSER)
 #define SetSentUser(x)		((x)->localClient->localflags |= LFLAGS_SENTUSER)
 
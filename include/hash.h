@@ -27,31 +27,21 @@
 #ifndef INCLUDED_hash_h
 #define INCLUDED_hash_h
 
-extern rb_dlink_list resvTable[];
-extern rb_dlink_list ndTable[];
-
 /* Magic value for FNV hash functions */
 #define FNV1_32_INIT 0x811c9dc5UL
 
-/* Client hash table size, used in hash.c/s_debug.c */
-#define U_MAX_BITS 17
-#define U_MAX (1<<U_MAX_BITS)
+/* Starting sizes of the hash tables, they grow and shrink from there.
+ * used in hash.c
+ */
+#define U_MIN_BITS 10		/* clients and ids */
+#define CH_MIN_BITS 9		/* channels */
+#define HOST_MIN_BITS 9		/* hostnames */
+#define R_MIN_BITS 6		/* RESV */
+#define ND_MIN_BITS 6		/* nick delay */
 
 /* Client fd hash table size, used in hash.c */
 #define CLI_FD_MAX 4096
 
-/* Channel hash table size, hash.c/s_debug.c */
-#define CH_MAX_BITS 16
-#define CH_MAX (1<<CH_MAX_BITS)	/* 2^16 */
-
-/* hostname hash table size */
-#define HOST_MAX_BITS 17
-#define HOST_MAX (1<<HOST_MAX_BITS)	/* 2^17 */
-
-/* RESV/XLINE hash table size, used in hash.c */
-#define R_MAX_BITS 10
-#define R_MAX (1<<R_MAX_BITS)	/* 2^10 */
-
 
 #define HASH_WALK(i, max, ptr, table) for (i = 0; i < max; i++) { RB_DLINK_FOREACH(ptr, table[i].head)
 #define HASH_WALK_SAFE(i, max, ptr, nptr, table) for (i = 0; i < max; i++) { RB_DLINK_FOREACH_SAFE(ptr, nptr, table[i].head)
@@ -63,9 +53,12 @@ typedef enum
 	HASH_ID,
 	HASH_CHANNEL,
 	HASH_HOSTNAME,
-	HASH_RESV
+	HASH_RESV,
+	HASH_ND
 } hash_type;
 
+typedef void HASHWALK(void *data, void *arg);
+
 struct Client;
 struct Channel;
 struct ConfItem;
@@ -76,12 +69,14 @@ uint32_t fnv_hash_upper(const unsigned char *s, unsigned int bits, unsigned int
 uint32_t fnv_hash(const unsigned char *s, unsigned int bits, unsigned int unused);
 uint32_t fnv_hash_len(const unsigned char *s, unsigned int bits, unsigned int len);
 uint32_t fnv_hash_upper_len(const unsigned char *s, unsigned int bits, unsigned int len);
-uint32_t fnv_hash_channel(const unsigned char *s, unsigned int bits, unsigned int len);
+uint32_t siphash_upper(const unsigned char *s, unsigned int bits, unsigned int len);
+uint32_t siphash_channel(const unsigned char *s, unsigned int bits, unsigned int len);
 
 void init_hash(void);
 
 void add_to_hash(hash_type, const char *, void *);
 void del_from_hash(hash_type, const char *, void *);
+void hash_walk(hash_type, HASHWALK *, void *arg);
 
 struct Client *find_any_client(const char *name);
 struct Client *find_client(const char *name);
@@ -93,7 +88,7 @@ struct Client *find_id(const char *name);
 
 struct Channel *get_or_create_channel(struct Client *client_p, const char *chname, int *isnew);
 struct Channel *find_channel(const char *name);
-rb_dlink_node *find_channels(const char *name);
+struct Channel *find_channels(const char *name, struct Channel *prev);
 
 rb_dlink_node *find_hostname(const char *);
 
@@ -105,6 +100,7 @@ void clear_help_hash(void);
 struct cachefile *hash_find_help(const char *name, int flags);
 
 void add_to_nd_hash(const char *name, struct nd_entry *nd);
+void del_from_nd_hash(struct nd_entry *nd);
 struct nd_entry *hash_find_nd(const char *name);
 
 void add_to_cli_fd_hash(struct Client *client_p);
@@ -112,5 +108,6 @@ void del_from_cli_fd_hash(struct Client *client_p);
 struct Client *find_cli_fd_hash(int fd);
 
 void hash_stats(struct Client *);
+void count_hash_memory(hash_type, size_t *slots, size_t *mem);
 
 #endif /* INCLUDED_hash_h */
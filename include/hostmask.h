@@ -26,6 +26,9 @@
 
 #ifndef INCLUDE_hostmask_h
 #define INCLUDE_hostmask_h 1
+
+#include "match.h"		/* struct compiled_mask */
+
 enum
 {
 	HM_HOST,
@@ -62,19 +65,16 @@ int match_ipv6(struct sockaddr *, struct sockaddr *, int);
 #endif
 int match_ipv4(struct sockaddr *, struct sockaddr *, int);
 
-/* Hashtable stuff... */
-#define ATABLE_BITS 12
-#define ATABLE_SIZE (1<<ATABLE_BITS)
+/* every AddressRec, for walking them all */
+extern rb_dlink_list address_list;
 
-extern struct AddressRec *atable[ATABLE_SIZE];
-
-#define HOSTHASH_WALK(i, arec) for (i = 0; i < ATABLE_SIZE; i++) { for(arec = atable[i]; arec; arec = arec->next)
-#define HOSTHASH_WALK_SAFE(i, arec, arecn) \
-	for(i = 0; i < ATABLE_SIZE; i++) { \
-		for(arec = atable[i], arecn = arec ? arec->next : NULL; arec; \
-			arec = arecn, arecn = arecn ? arecn->next : NULL)
+#define HOSTHASH_WALK(ptr, arec) RB_DLINK_FOREACH(ptr, address_list.head) { arec = ptr->data;
+#define HOSTHASH_WALK_SAFE(ptr, nptr, arec) \
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, address_list.head) { arec = ptr->data;
 #define HOSTHASH_WALK_END }
 
+struct host_node;
+
 struct AddressRec
 {
 	/* masktype: HM_HOST, HM_IPV4, HM_IPV6 -A1kmm */
@@ -105,8 +105,23 @@ struct AddressRec
 	const char *username;
 	struct ConfItem *aconf;
 
-	/* The next record in this hash bucket. */
+	/* Mask.hostname for HM_HOST and username unless CONF_SKIPUSER,
+	 * compiled for match_compiled()
+	 */
+	struct compiled_mask host_cmask;
+	struct compiled_mask user_cmask;
+
+	/* The next record for this prefix or these labels. */
 	struct AddressRec *next;
+
+	/* where it is indexed, pnode for IP masks, hnode for host masks
+	 * unless they have no labels after the last wildcard
+	 */
+	rb_patricia_node_t *pnode;
+	struct host_node *hnode;
+
+	/* in address_list */
+	rb_dlink_node node;
 };
 
 
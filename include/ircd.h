@@ -108,5 +108,6 @@ extern int conf_parse_failure;
 extern int maxconnections;
 extern int ircd_ssl_ok;
 extern int zlib_ok;
+extern int zstd_ok;
 
 #endif
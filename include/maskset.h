@@ -0,0 +1,63 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  maskset.h: A list of match_esc() masks matched all at once.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ *  $Id$
+ */
+
+#ifndef INCLUDED_maskset_h
+#define INCLUDED_maskset_h
+
+struct ConfItem;
+struct maskset_node;
+struct maskset_pat;
+
+/* a list of ConfItems whose ->host is a match_esc() mask, such as the
+ * X-lines and nick RESVs.  every mask has the longest run of plain
+ * characters it must contain put into an Aho-Corasick automaton, so a
+ * lookup is one pass over the name, and match_esc() is only run on the
+ * masks whose run turned up, plus those that have no run at all.
+ *
+ * the automaton is rebuilt on the first lookup after maskset_changed(),
+ * which has to be called whenever the list is added to or removed from.
+ */
+struct mask_set
+{
+	rb_dlink_list *list;
+	int dirty;
+
+	struct maskset_node *nodes;
+	unsigned int nodecount;
+	unsigned int root[256];		/* the root's children, by character */
+
+	struct maskset_pat *pats;	/* in list order */
+	unsigned int patcount;
+	unsigned int *always;		/* masks without a run, in list order */
+	unsigned int alwayscount;
+	unsigned int *cand;		/* scratch for maskset_find() */
+	unsigned int stamp;
+};
+
+void maskset_init(struct mask_set *, rb_dlink_list *);
+void maskset_changed(struct mask_set *);
+struct ConfItem *maskset_find(struct mask_set *, const char *);
+size_t maskset_memory(struct mask_set *);
+
+#endif /* INCLUDED_maskset_h */
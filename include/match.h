@@ -45,6 +45,49 @@ int match_ips(const char *mask, const char *addr);
  * comp_with_mask - compares to IP address
  */
 int comp_with_mask(void *addr, void *dest, unsigned int mask);
+
+/*
+ * compiled_mask - a match() mask taken apart once, for masks that are
+ * kept around (bans, k/i-lines) or tried against every client.  the
+ * mask is collapsed and folded with ToLower(), and split into the
+ * literal runs between its '*'s.
+ *
+ * compile_mask - fills in a compiled_mask, free_compiled_mask frees it
+ * match_compiled - match() on a compiled mask
+ * match_compiled_lower - the same for a name already through ToLower()
+ */
+#define CMASK_ANY	0	/* "*" */
+#define CMASK_EXACT	1	/* "lit" */
+#define CMASK_PREFIX	2	/* "lit*" */
+#define CMASK_SUFFIX	3	/* "*lit" */
+#define CMASK_INFIX	4	/* "*lit*" */
+#define CMASK_GLOB	5	/* anything else */
+
+#define CMASK_START	0x1	/* first run is anchored to the start */
+#define CMASK_END	0x2	/* last run is anchored to the end */
+
+struct cmask_seg
+{
+	const char *text;	/* into compiled_mask.mask, not terminated */
+	unsigned short len;
+	unsigned short anchor;	/* first character that isn't '?', len if none */
+	unsigned char wild;	/* has a '?' */
+};
+
+struct compiled_mask
+{
+	char *mask;		/* collapsed and folded, for match() */
+	struct cmask_seg *seg;	/* one allocation with mask */
+	unsigned short nseg;
+	unsigned short minlen;	/* shortest name that can match */
+	unsigned char type;
+	unsigned char flags;
+};
+
+void compile_mask(struct compiled_mask *, const char *mask);
+void free_compiled_mask(struct compiled_mask *);
+int match_compiled(const struct compiled_mask *, const char *name);
+int match_compiled_lower(const struct compiled_mask *, const char *name);
 int comp_with_mask_sock(struct sockaddr *addr, struct sockaddr *dest, unsigned int mask);
 
 /*
@@ -47,6 +47,12 @@
 #define MAX_FLOOD 5
 #define MAX_FLOOD_BURST MAX_FLOOD * 8
 
+/* RECVQ_MIN_SIZE is what a client's receive buffer starts out as, it is
+ * grown when lines queue up behind the flood limits.  servers read
+ * READBUF_SIZE at a time.
+ */
+#define RECVQ_MIN_SIZE 1024
+
 extern PF read_ctrl_packet;
 extern PF read_packet;
 extern EVH flood_recalc;
@@ -145,6 +145,8 @@ struct config_file_entry
 	char *fname_ioerrorlog;
 
 	unsigned char compression_level;
+	int zstd_level;
+	char *zstd_dictionary;
 	int disable_fake_channels;
 	int dots_in_ident;
 	int failed_oper_notice;
@@ -192,6 +194,8 @@ struct config_file_entry
 	int min_nonwildcard_simple;
 	int default_floodcount;
 	int client_flood;
+	int server_flush_delay;
+	int epoll_persistent;
 	int use_egd;
 	int ping_cookie;
 	int tkline_expire_notices;
@@ -276,7 +280,9 @@ struct server_info
 	char *ssl_ca_cert;
 	char *ssl_cert;
 	char *ssl_dh_params;
+	int ssl_ktls;
 	int ssld_count;
+	int ssld_threads;
 	char *vhost_dns;
 #ifdef RB_IPV6
 	char *vhost6_dns;
@@ -39,6 +39,8 @@
 #include <openssl/rsa.h>
 #endif
 
+#include "maskset.h"
+
 struct ConfItem;
 
 extern rb_dlink_list cluster_conf_list;
@@ -48,6 +50,8 @@ extern rb_dlink_list hubleaf_conf_list;
 extern rb_dlink_list server_conf_list;
 extern rb_dlink_list xline_conf_list;
 extern rb_dlink_list resv_conf_list;
+extern struct mask_set xline_set;
+extern struct mask_set resv_set;
 extern rb_dlink_list tgchange_list;
 
 extern rb_patricia_tree_t *tgchange_tree;
@@ -191,6 +195,8 @@ struct server_conf
 	int flags;
 	int servers;
 	time_t hold;
+	int zip_flush_size;	/* ziplinks: flush at this many bytes... */
+	int zip_flush_delay;	/* ...or this many ms, 0 flushes every read */
 
 	struct rb_sockaddr_storage ipnum;
 	struct rb_sockaddr_storage my_ipnum;
@@ -250,9 +256,7 @@ struct nd_entry
 {
 	char name[NICKLEN + 1];
 	time_t expire;
-	unsigned int hashv;
 
-	rb_dlink_node hnode;	/* node in hash */
 	rb_dlink_node lnode;	/* node in ll */
 };
 
@@ -33,6 +33,30 @@ struct rb_dlink_list;
 struct monitor;
 
 void send_pop_queue(struct Client *);
+long send_flush_queued(void);
+void send_flush_cancel(struct Client *);
+
+/* a reply walking a list that may be too long to queue at once, from the
+ * given node to the end of its list.  fill is given one entry at a time
+ * while the sendq is under a quarter of the class sendq, and returns 0 to
+ * stop early.  done sends whatever ends the reply.  data is the command's
+ * own state, freed with the cursor.
+ */
+typedef int CURSORFILL(struct Client *, void *entry, void *data);
+typedef void CURSORDONE(struct Client *, void *data);
+
+struct Cursor
+{
+	rb_dlink_node node;
+	rb_dlink_node *pos;
+	CURSORFILL *fill;
+	CURSORDONE *done;
+	void *data;
+};
+
+void send_cursor(struct Client *, rb_dlink_node *, CURSORFILL *, CURSORDONE *, void *data);
+void cursor_drop_node(rb_dlink_node *);
+void free_cursor(struct Client *);
 void
 sendto_one(struct Client *target_p, const char *, ...)
 AFP(2, 3);
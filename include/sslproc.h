@@ -26,6 +26,7 @@
 
 struct _ssl_ctl;
 typedef struct _ssl_ctl ssl_ctl_t;
+struct Client;
 
 void init_ssld(void);
 int start_ssldaemon(int count, const char *ssl_cert, const char *ssl_private_key,
@@ -35,6 +36,11 @@ ssl_ctl_t *start_ssld_connect(rb_fde_t *sslF, rb_fde_t *plainF, int id);
 void start_zlib_session(void *data);
 void send_new_ssl_certs(const char *ssl_cert, const char *ssl_private_key,
 			const char *ssl_dh_params);
+void send_ssl_ktls(int enable);
+void send_zstd_dictionary(const char *path);
+unsigned int zstd_dictionary_id(void);
+void ssld_session_stats(unsigned long *handshakes, unsigned long *resumed);
+void report_ssld(struct Client *source_p);
 void ssld_decrement_clicount(ssl_ctl_t * ctl);
 int get_ssld_count(void);
 
@@ -30,9 +30,14 @@
 
 /*** client.h ***/
 
+struct membership;
+struct Cursor;
+
 struct User
 {
 	rb_dlink_list channel;	/* chain of channel pointer blocks */
+	struct membership **chanhash;	/* index of channel, once in many */
+	unsigned int chanhash_bits;
 	char *away;		/* pointer to away message */
 	char name[NICKLEN];
 #ifdef ENABLE_SERVICES
@@ -58,8 +63,10 @@ struct ZipStats
 	unsigned long long in_wire;
 	unsigned long long out;
 	unsigned long long out_wire;
+	unsigned long long out_blocks;	/* flushes, out / out_blocks is the block size */
 	double in_ratio;
 	double out_ratio;
+	const char *method;	/* zlib, zstd or zstd+dict */
 };
 
 struct Client
@@ -142,9 +149,17 @@ struct LocalUser
 
 	uint32_t serial;	/* used to enforce 1 send per nick */
 
-	/* Send and receive linebuf queues .. */
+	/* Send linebuf queue .. */
 	buf_head_t buf_sendq;
-	buf_head_t buf_recvq;
+
+	/* Raw receive buffer.  read() lands here and lines are parsed in
+	 * place, recvq_head..recvq_tail is the data not parsed yet.
+	 */
+	char *recvq_buf;
+	unsigned int recvq_size;
+	unsigned int recvq_head;
+	unsigned int recvq_tail;
+	uint8_t recvq_discard;	/* dropping the rest of an overlong line */
 
 	unsigned long long int sendB;	/* Statistics: total bytes sent */
 	unsigned long long int receiveB;	/* Statistics: total bytes received */
@@ -167,6 +182,7 @@ struct LocalUser
 	char *fullcaps;
 
 	int caps;		/* capabilities bit-field */
+	unsigned int zstd_dict;	/* id of the zstd dictionary the other end has */
 	rb_fde_t *F;
 
 	time_t last;
@@ -206,6 +222,9 @@ struct LocalUser
 	uint32_t localflags;
 	struct ZipStats *zipstats;	/* zipstats */
 	uint16_t cork_count;	/* used for corking/uncorking connections */
+	rb_dlink_node flush_node;	/* node on the end of loop flush list */
+	struct timeval flush_time;	/* when we were put on the flush list */
+	struct Cursor *cursor;	/* long reply still being sent, see send_cursor() */
 	struct ev_entry *event;	/* used for associated events */
 	/* XXX These two are only meaningful during registration. */
 	rb_dlink_list dnsbl_queries; /* list of struct BlacklistClient * */
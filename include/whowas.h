@@ -32,7 +32,7 @@
  */
 #define WW_MAX_BITS 16
 #define WW_MAX (1<<WW_MAX_BITS)
-#define hash_whowas_name(x) fnv_hash_upper((const unsigned char *)x, WW_MAX_BITS, 0)
+#define hash_whowas_name(x) siphash_upper((const unsigned char *)x, WW_MAX_BITS, 0)
 
 struct User;
 struct Client;
@@ -89,12 +89,43 @@ struct acceptdata
 	void *data;
 };
 
-/* Only have open flags for now, could be more later */
 #define FLAG_OPEN	0x1
 #define IsFDOpen(F)	(F->flags & FLAG_OPEN)
 #define SetFDOpen(F)	(F->flags |= FLAG_OPEN)
 #define ClearFDOpen(F)	(F->flags &= ~FLAG_OPEN)
 
+/*
+ * FLAG_READ_READY/FLAG_WRITE_READY track whether the fd may still have
+ * data/space left after the last read/write, for backends that only hear
+ * about edges (see the persistent mode in epoll.c).  FLAG_PERSIST marks an
+ * fd that is registered with the kernel for all events, once.
+ */
+#define FLAG_READ_READY		0x2
+#define FLAG_WRITE_READY	0x4
+#define FLAG_PERSIST		0x8
+
+/*
+ * rb_update_ready() - a full transfer leaves the fd marked as possibly
+ * ready, a short one or EAGAIN means the kernel side is drained.
+ */
+#define rb_update_ready(F, flag, ret, count) \
+	do { \
+		if((ret) == (count)) \
+			(F)->flags |= (flag); \
+		else if((ret) >= 0 || rb_ignore_errno(errno)) \
+			(F)->flags &= ~(flag); \
+	} while(0)
+
+#define rb_update_ssl_ready(F, flag, ret) \
+	do { \
+		if((ret) > 0) \
+			(F)->flags |= (flag); \
+		else if((ret) == RB_RW_SSL_NEED_READ) \
+			(F)->flags &= ~FLAG_READ_READY; \
+		else if((ret) == RB_RW_SSL_NEED_WRITE) \
+			(F)->flags &= ~FLAG_WRITE_READY; \
+	} while(0)
+
 
 struct _fde
 {
@@ -104,6 +135,7 @@ struct _fde
 	 * filedescriptor. Think though: when do you think we'll need more?
 	 */
 	rb_dlink_node node;
+	rb_dlink_node rnode;	/* for the persistent epoll ready list */
 	int fd;			/* So we can use the rb_fde_t as a callback ptr */
 	uint8_t flags;
 	uint8_t type;
@@ -133,7 +165,7 @@ typedef struct timer_data
 } *comm_event_id;
 #endif
 
-extern rb_dlink_list *rb_fd_table;
+extern RB_THREAD_LOCAL rb_dlink_list *rb_fd_table;
 
 static inline __rb_must_check rb_fde_t *
 rb_find_fd(int fd)
@@ -163,22 +195,17 @@ int rb_setup_fd(rb_fde_t *F);
 void rb_connect_callback(rb_fde_t *F, int status);
 
 
-int rb_io_sched_event(struct ev_entry *ev, int when);
-void rb_io_unsched_event(struct ev_entry *ev);
-int rb_io_supports_event(void);
-void rb_io_init_event(void);
-
 /* epoll versions */
 void rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_epoll(void);
 int rb_select_epoll(long);
 int rb_setup_fd_epoll(rb_fde_t *F);
 
-void rb_epoll_init_event(void);
-int rb_epoll_sched_event(struct ev_entry *event, int when);
-void rb_epoll_unsched_event(struct ev_entry *event);
-int rb_epoll_supports_event(void);
-
+/* io_uring versions */
+void rb_setselect_iouring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
+int rb_init_netio_iouring(void);
+int rb_select_iouring(long);
+int rb_setup_fd_iouring(rb_fde_t *F);
 
 /* poll versions */
 void rb_setselect_poll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
@@ -198,36 +225,18 @@ int rb_init_netio_sigio(void);
 int rb_select_sigio(long);
 int rb_setup_fd_sigio(rb_fde_t *F);
 
-void rb_sigio_init_event(void);
-int rb_sigio_sched_event(struct ev_entry *event, int when);
-void rb_sigio_unsched_event(struct ev_entry *event);
-int rb_sigio_supports_event(void);
-
-
 /* ports versions */
 void rb_setselect_ports(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_ports(void);
 int rb_select_ports(long);
 int rb_setup_fd_ports(rb_fde_t *F);
 
-void rb_ports_init_event(void);
-int rb_ports_sched_event(struct ev_entry *event, int when);
-void rb_ports_unsched_event(struct ev_entry *event);
-int rb_ports_supports_event(void);
-
-
 /* kqueue versions */
 void rb_setselect_kqueue(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_kqueue(void);
 int rb_select_kqueue(long);
 int rb_setup_fd_kqueue(rb_fde_t *F);
 
-void rb_kqueue_init_event(void);
-int rb_kqueue_sched_event(struct ev_entry *event, int when);
-void rb_kqueue_unsched_event(struct ev_entry *event);
-int rb_kqueue_supports_event(void);
-
-
 /* select versions */
 void rb_setselect_select(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
 int rb_init_netio_select(void);
@@ -23,6 +23,19 @@
  *  $Id: event-int.h 26272 2008-12-10 05:55:10Z androsyn $
  */
 
+typedef void TIMERCB(void *);
+
+/* an entry on the timing wheel in event.c, expires is in wheel milliseconds */
+struct rb_timer
+{
+	rb_dlink_node node;
+	uint64_t expires;
+	TIMERCB *func;
+	void *data;
+	uint8_t level;
+	uint8_t slot;
+};
+
 struct ev_entry
 {
 	rb_dlink_node node;
@@ -33,6 +46,12 @@ struct ev_entry
 	time_t when;
 	time_t next;
 	void *data;
-	void *comm_ptr;
+	struct rb_timer timer;
+	uint8_t running;
+	uint8_t dead;
 };
-void rb_event_io_register_all(void);
+
+#define rb_timer_pending(t)	((t)->node.data != NULL)
+void rb_timer_add(struct rb_timer *timer, long msec);
+void rb_timer_del(struct rb_timer *timer);
+long rb_timer_next(void);
@@ -74,6 +74,19 @@ char *alloca();
 #define rb_unlikely(x)	(x)
 #endif
 
+/*
+ * what rb_lib_init() sets up, the fd table, io backend, events, block
+ * heaps, clock and ssl contexts, is kept per thread.  a thread that
+ * calls rb_lib_init() itself can run its own rb_lib_loop() beside the
+ * main one, as long as the two never touch each other's fds.
+ */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define RB_THREAD_LOCAL	__thread __attribute__((tls_model("initial-exec")))
+#define RB_HAVE_THREAD_LOCAL 1
+#else
+#define RB_THREAD_LOCAL
+#endif
+
 
 
 #ifdef _WIN32
@@ -179,6 +192,7 @@ char *rb_strerror(int error);
 typedef void log_cb(const char *buffer);
 typedef void restart_cb(const char *buffer);
 typedef void die_cb(const char *buffer);
+typedef long loop_cb(void);
 
 char *rb_ctime(const time_t, char *, size_t);
 char *rb_date(const time_t, char *, size_t);
@@ -191,6 +205,7 @@ const char *rb_lib_version(void);
 void rb_lib_init(log_cb * xilog, restart_cb * irestart, die_cb * idie, int closeall, int maxfds,
 		 size_t dh_size, size_t fd_heap_size);
 void rb_lib_loop(long delay);
+void rb_lib_set_loop_cb(loop_cb * iloop);
 
 time_t rb_current_time(void);
 const struct timeval *rb_current_time_tv(void);
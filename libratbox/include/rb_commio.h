@@ -151,6 +151,8 @@ void rb_set_type(rb_fde_t *F, uint8_t type);
 uint8_t rb_get_type(rb_fde_t *F);
 
 const char *rb_get_iotype(void);
+void rb_set_epoll_persistent(int);
+unsigned long rb_epoll_saved_ctl(void);
 
 typedef enum
 {
@@ -172,6 +174,23 @@ int rb_supports_ssl(void);
 unsigned int rb_ssl_handshake_count(rb_fde_t *F);
 void rb_ssl_clear_handshake_count(rb_fde_t *F);
 
+/* which directions of a session the kernel does the TLS for */
+#define RB_SSL_KTLS_SEND	0x1
+#define RB_SSL_KTLS_RECV	0x2
+
+int rb_ssl_set_ktls(int enable);
+int rb_ssl_ktls(rb_fde_t *F);
+
+/* a session ticket key is a 16 byte name, a 32 byte HMAC-SHA256 key and
+ * a 32 byte AES-256 key.  the first key given issues tickets, the rest
+ * are only accepted.
+ */
+#define RB_SSL_TICKET_KEYLEN	80
+#define RB_SSL_TICKET_KEYS	2
+
+int rb_ssl_set_ticket_keys(const uint8_t *keys, int count);
+void rb_ssl_session_stats(unsigned long *handshakes, unsigned long *resumed);
+
 
 int rb_pass_fd_to_process(rb_fde_t *, pid_t, rb_fde_t *);
 rb_fde_t *rb_recv_fd(rb_fde_t *);
@@ -42,13 +42,17 @@ struct _buf_head;
 /* How big we want a buffer - 510 data bytes, plus space for a '\0' */
 #define BUF_DATA_SIZE		511
 
+/* lines are allocated from one of these many heaps, by size */
+#define LINEBUF_SIZE_CLASSES	4
+
 typedef struct _buf_line
 {
-	char buf[BUF_DATA_SIZE + 2];
 	uint8_t terminated;	/* Whether we've terminated the buffer */
 	uint8_t raw;		/* Whether this linebuf may hold 8-bit data */
+	uint8_t sclass;		/* Which size class this line came from */
 	int len;		/* How much data we've got */
 	int refcount;		/* how many linked lists are we in? */
+	char buf[];		/* sized by the class, at most BUF_DATA_SIZE + 2 */
 } buf_line_t;
 
 typedef struct _buf_head
@@ -77,7 +81,11 @@ void rb_linebuf_put(buf_head_t *, const char *, ...);
 void rb_linebuf_putbuf(buf_head_t * bufhead, const char *buffer);
 void rb_linebuf_attach(buf_head_t *, buf_head_t *);
 void rb_count_rb_linebuf_memory(size_t *, size_t *);
+int rb_count_rb_linebuf_class_memory(int, size_t *, size_t *, size_t *);
 int rb_linebuf_flush(rb_fde_t *F, buf_head_t *);
+char *rb_linebuf_find_eol(char *, size_t);
+const char *rb_linebuf_eol_kernel_name(void);
+int rb_linebuf_set_eol_kernel(const char *);
 
 
 #endif
@@ -71,7 +71,7 @@
 #endif
 #endif
 
-static uintptr_t offset_pad;
+static RB_THREAD_LOCAL uintptr_t offset_pad;
 
 /* status information for an allocated block in heap */
 struct rb_heap_block
@@ -98,7 +98,7 @@ struct rb_bh
 static int newblock(rb_bh *bh);
 static void rb_bh_gc_event(void *unused);
 #endif /* !NOBALLOC */
-static rb_dlink_list *heap_lists;
+static RB_THREAD_LOCAL rb_dlink_list *heap_lists;
 
 #if defined(WIN32)
 static HANDLE block_heap;
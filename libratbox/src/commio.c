@@ -41,19 +41,16 @@
 struct timeout_data
 {
 	rb_fde_t *F;
-	rb_dlink_node node;
-	time_t timeout;
+	struct rb_timer timer;
 	PF *timeout_handler;
 	void *timeout_data;
 };
 
-rb_dlink_list *rb_fd_table;
-static rb_bh *fd_heap;
+RB_THREAD_LOCAL rb_dlink_list *rb_fd_table;
+static RB_THREAD_LOCAL rb_bh *fd_heap;
 
-static rb_dlink_list timeout_list;
-static rb_dlink_list closed_list;
+static RB_THREAD_LOCAL rb_dlink_list closed_list;
 
-static struct ev_entry *rb_timeout_ev;
 
 
 static const char *rb_err_str[] = { "Comm OK", "Error during bind()",
@@ -63,8 +60,8 @@ static const char *rb_err_str[] = { "Comm OK", "Error during bind()",
 };
 
 /* Highest FD and number of open FDs .. */
-static int number_fd = 0;
-int rb_maxconnections = 0;
+static RB_THREAD_LOCAL int number_fd = 0;
+RB_THREAD_LOCAL int rb_maxconnections = 0;
 
 static PF rb_connect_timeout;
 static PF rb_connect_tryconnect;
@@ -251,10 +248,26 @@ rb_set_nb(rb_fde_t *F)
 	return 1;
 }
 
+static void
+rb_timeout_fire(void *data)
+{
+	struct timeout_data *td = data;
+	rb_fde_t *F = td->F;
+	PF *hdl;
+	void *cbdata;
+
+	hdl = td->timeout_handler;
+	cbdata = td->timeout_data;
+	F->timeout = NULL;
+	rb_free(td);
+	hdl(F, cbdata);
+}
+
 /*
  * rb_settimeout() - set the socket timeout
  *
- * Set the timeout for the fd
+ * Set the timeout for the fd, the handler is run off the timing wheel
+ * in event.c once it expires.
  */
 void
 rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
@@ -270,14 +283,9 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 	{
 		if(td == NULL)
 			return;
-		rb_dlinkDelete(&td->node, &timeout_list);
+		rb_timer_del(&td->timer);
 		rb_free(td);
 		F->timeout = NULL;
-		if(rb_dlink_list_length(&timeout_list) == 0)
-		{
-			rb_event_delete(rb_timeout_ev);
-			rb_timeout_ev = NULL;
-		}
 		return;
 	}
 
@@ -285,49 +293,23 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 		td = F->timeout = rb_malloc(sizeof(struct timeout_data));
 
 	td->F = F;
-	td->timeout = rb_current_time() + timeout;
 	td->timeout_handler = callback;
 	td->timeout_data = cbdata;
-	rb_dlinkAdd(td, &td->node, &timeout_list);
-	if(rb_timeout_ev == NULL)
-	{
-		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 5);
-	}
+	td->timer.func = rb_timeout_fire;
+	td->timer.data = td;
+	rb_timer_add(&td->timer, (long)timeout * 1000);
 }
 
 /*
  * rb_checktimeouts() - check the socket timeouts
  *
- * All this routine does is call the given callback/cbdata, without closing
- * down the file descriptor. When close handlers have been implemented,
- * this will happen.
+ * Timeouts live on the timing wheel now and fire on their own as
+ * rb_lib_loop() runs it; this just runs whatever is already due.
  */
 void
 rb_checktimeouts(void *notused)
 {
-	rb_dlink_node *ptr, *next;
-	struct timeout_data *td;
-	rb_fde_t *F;
-	PF *hdl;
-	void *data;
-
-	RB_DLINK_FOREACH_SAFE(ptr, next, timeout_list.head)
-	{
-		td = ptr->data;
-		F = td->F;
-		if(F == NULL || !IsFDOpen(F))
-			continue;
-
-		if(td->timeout < rb_current_time())
-		{
-			hdl = td->timeout_handler;
-			data = td->timeout_data;
-			rb_dlinkDelete(&td->node, &timeout_list);
-			F->timeout = NULL;
-			rb_free(td);
-			hdl(F, data);
-		}
-	}
+	rb_event_run();
 }
 
 static void
@@ -770,7 +752,7 @@ rb_listen(rb_fde_t *F, int backlog)
 void
 rb_fdlist_init(int closeall, int maxfds, size_t heapsize)
 {
-	static int initialized = 0;
+	static RB_THREAD_LOCAL int initialized = 0;
 #ifdef _WIN32
 	WSADATA wsaData;
 	int err;
@@ -974,7 +956,9 @@ rb_read(rb_fde_t *F, void *buf, int count)
 #ifdef HAVE_SSL
 	if(F->type & RB_FD_SSL)
 	{
-		return rb_ssl_read(F, buf, count);
+		ret = rb_ssl_read(F, buf, count);
+		rb_update_ssl_ready(F, FLAG_READ_READY, ret);
+		return ret;
 	}
 #endif
 	if(F->type & RB_FD_SOCKET)
@@ -984,12 +968,15 @@ rb_read(rb_fde_t *F, void *buf, int count)
 		{
 			rb_get_errno();
 		}
+		rb_update_ready(F, FLAG_READ_READY, ret, count);
 		return ret;
 	}
 
 
 	/* default case */
-	return read(F->fd, buf, count);
+	ret = read(F->fd, buf, count);
+	rb_update_ready(F, FLAG_READ_READY, ret, count);
+	return ret;
 }
 
 
@@ -1003,7 +990,9 @@ rb_write(rb_fde_t *F, const void *buf, int count)
 #ifdef HAVE_SSL
 	if(F->type & RB_FD_SSL)
 	{
-		return rb_ssl_write(F, buf, count);
+		ret = rb_ssl_write(F, buf, count);
+		rb_update_ssl_ready(F, FLAG_WRITE_READY, ret);
+		return ret;
 	}
 #endif
 	if(F->type & RB_FD_SOCKET)
@@ -1013,10 +1002,13 @@ rb_write(rb_fde_t *F, const void *buf, int count)
 		{
 			rb_get_errno();
 		}
+		rb_update_ready(F, FLAG_WRITE_READY, ret, count);
 		return ret;
 	}
 
-	return write(F->fd, buf, count);
+	ret = write(F->fd, buf, count);
+	rb_update_ready(F, FLAG_WRITE_READY, ret, count);
+	return ret;
 }
 
 #if defined(HAVE_SSL) || defined(WIN32) || !defined(HAVE_WRITEV)
@@ -1054,6 +1046,9 @@ rb_writev(rb_fde_t *F, struct rb_iovec * vecount, int count)
 ssize_t
 rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 {
+	ssize_t ret, len = 0;
+	int i;
+
 	if(F == NULL)
 	{
 		errno = EBADF;
@@ -1065,6 +1060,8 @@ rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 		return rb_fake_writev(F, vector, count);
 	}
 #endif /* HAVE_SSL */
+	for(i = 0; i < count; i++)
+		len += vector[i].iov_len;
 #ifdef HAVE_SENDMSG
 	if(F->type & RB_FD_SOCKET)
 	{
@@ -1072,11 +1069,14 @@ rb_writev(rb_fde_t *F, struct rb_iovec * vector, int count)
 		memset(&msg, 0, sizeof(msg));
 		msg.msg_iov = (struct iovec *)vector;
 		msg.msg_iovlen = count;
-		return sendmsg(F->fd, &msg, MSG_NOSIGNAL);
+		ret = sendmsg(F->fd, &msg, MSG_NOSIGNAL);
+		rb_update_ready(F, FLAG_WRITE_READY, ret, len);
+		return ret;
 	}
 #endif /* HAVE_SENDMSG */
-	return writev(F->fd, (struct iovec *)vector, count);
-
+	ret = writev(F->fd, (struct iovec *)vector, count);
+	rb_update_ready(F, FLAG_WRITE_READY, ret, len);
+	return ret;
 }
 #endif
 
@@ -1127,7 +1127,7 @@ static const char *IpQuadTab[] = {
 static const char *
 inetntoa(const char *in)
 {
-	static char buf[16];
+	static RB_THREAD_LOCAL char buf[16];
 	char *bufptr = buf;
 	const unsigned char *a = (const unsigned char *)in;
 	const char *n;
@@ -1796,14 +1796,10 @@ rb_inet_socketpair(int family, int type, int protocol, int fd[2])
 #endif
 
 
-static void (*setselect_handler) (rb_fde_t *, unsigned int, PF *, void *);
-static int (*select_handler) (long);
-static int (*setup_fd_handler) (rb_fde_t *);
-static int (*io_sched_event) (struct ev_entry *, int);
-static void (*io_unsched_event) (struct ev_entry *);
-static int (*io_supports_event) (void);
-static void (*io_init_event) (void);
-static char iotype[25];
+static RB_THREAD_LOCAL void (*setselect_handler) (rb_fde_t *, unsigned int, PF *, void *);
+static RB_THREAD_LOCAL int (*select_handler) (long);
+static RB_THREAD_LOCAL int (*setup_fd_handler) (rb_fde_t *);
+static RB_THREAD_LOCAL char iotype[25];
 
 const char *
 rb_get_iotype(void)
@@ -1812,9 +1808,17 @@ rb_get_iotype(void)
 }
 
 static int
-rb_unsupported_event(void)
+try_iouring(void)
 {
-	return 0;
+	if(!rb_init_netio_iouring())
+	{
+		setselect_handler = rb_setselect_iouring;
+		select_handler = rb_select_iouring;
+		setup_fd_handler = rb_setup_fd_iouring;
+		rb_strlcpy(iotype, "io_uring", sizeof(iotype));
+		return 0;
+	}
+	return -1;
 }
 
 static int
@@ -1825,10 +1829,6 @@ try_kqueue(void)
 		setselect_handler = rb_setselect_kqueue;
 		select_handler = rb_select_kqueue;
 		setup_fd_handler = rb_setup_fd_kqueue;
-		io_sched_event = rb_kqueue_sched_event;
-		io_unsched_event = rb_kqueue_unsched_event;
-		io_init_event = rb_kqueue_init_event;
-		io_supports_event = rb_kqueue_supports_event;
 		rb_strlcpy(iotype, "kqueue", sizeof(iotype));
 		return 0;
 	}
@@ -1843,10 +1843,6 @@ try_epoll(void)
 		setselect_handler = rb_setselect_epoll;
 		select_handler = rb_select_epoll;
 		setup_fd_handler = rb_setup_fd_epoll;
-		io_sched_event = rb_epoll_sched_event;
-		io_unsched_event = rb_epoll_unsched_event;
-		io_supports_event = rb_epoll_supports_event;
-		io_init_event = rb_epoll_init_event;
 		rb_strlcpy(iotype, "epoll", sizeof(iotype));
 		return 0;
 	}
@@ -1861,10 +1857,6 @@ try_ports(void)
 		setselect_handler = rb_setselect_ports;
 		select_handler = rb_select_ports;
 		setup_fd_handler = rb_setup_fd_ports;
-		io_sched_event = rb_ports_sched_event;
-		io_unsched_event = rb_ports_unsched_event;
-		io_init_event =  rb_ports_init_event;
-		io_supports_event = rb_ports_supports_event;
 		rb_strlcpy(iotype, "ports", sizeof(iotype));
 		return 0;
 	}
@@ -1879,10 +1871,6 @@ try_devpoll(void)
 		setselect_handler = rb_setselect_devpoll;
 		select_handler = rb_select_devpoll;
 		setup_fd_handler = rb_setup_fd_devpoll;
-		io_sched_event = NULL;
-		io_unsched_event = NULL;
-		io_init_event = NULL;
-		io_supports_event = rb_unsupported_event;
 		rb_strlcpy(iotype, "devpoll", sizeof(iotype));
 		return 0;
 	}
@@ -1897,11 +1885,6 @@ try_sigio(void)
 		setselect_handler = rb_setselect_sigio;
 		select_handler = rb_select_sigio;
 		setup_fd_handler = rb_setup_fd_sigio;
-		io_sched_event = rb_sigio_sched_event;
-		io_unsched_event = rb_sigio_unsched_event;
-		io_supports_event = rb_sigio_supports_event;
-		io_init_event = rb_sigio_init_event;
-
 		rb_strlcpy(iotype, "sigio", sizeof(iotype));
 		return 0;
 	}
@@ -1916,10 +1899,6 @@ try_poll(void)
 		setselect_handler = rb_setselect_poll;
 		select_handler = rb_select_poll;
 		setup_fd_handler = rb_setup_fd_poll;
-		io_sched_event = NULL;
-		io_unsched_event = NULL;
-		io_init_event = NULL;
-		io_supports_event = rb_unsupported_event;
 		rb_strlcpy(iotype, "poll", sizeof(iotype));
 		return 0;
 	}
@@ -1934,10 +1913,6 @@ try_win32(void)
 		setselect_handler = rb_setselect_win32;
 		select_handler = rb_select_win32;
 		setup_fd_handler = rb_setup_fd_win32;
-		io_sched_event = NULL;
-		io_unsched_event = NULL;
-		io_init_event = NULL;
-		io_supports_event = rb_unsupported_event;
 		rb_strlcpy(iotype, "win32", sizeof(iotype));
 		return 0;
 	}
@@ -1952,10 +1927,6 @@ try_select(void)
 		setselect_handler = rb_setselect_select;
 		select_handler = rb_select_select;
 		setup_fd_handler = rb_setup_fd_select;
-		io_sched_event = NULL;
-		io_unsched_event = NULL;
-		io_init_event = NULL;
-		io_supports_event = rb_unsupported_event;
 		rb_strlcpy(iotype, "select", sizeof(iotype));
 		return 0;
 	}
@@ -1963,39 +1934,6 @@ try_select(void)
 }
 
 
-int
-rb_io_sched_event(struct ev_entry *ev, int when)
-{
-	if(ev == NULL || io_supports_event == NULL || io_sched_event == NULL
-	   || !io_supports_event())
-		return 0;
-	return io_sched_event(ev, when);
-}
-
-void
-rb_io_unsched_event(struct ev_entry *ev)
-{
-	if(ev == NULL || io_supports_event == NULL || io_unsched_event == NULL
-	   || !io_supports_event())
-		return;
-	io_unsched_event(ev);
-}
-
-int
-rb_io_supports_event(void)
-{
-	if(io_supports_event == NULL)
-		return 0;
-	return io_supports_event();
-}
-
-void
-rb_io_init_event(void)
-{
-	io_init_event();
-	rb_event_io_register_all();
-}
-
 void
 rb_init_netio(void)
 {
@@ -2010,6 +1948,12 @@ rb_init_netio(void)
 			if(!try_epoll())
 				return;
 		}
+		else if(!strcmp("io_uring", ioenv) || !strcmp("iouring", ioenv))
+		{
+			/* falls through to the usual order, so epoll if this fails */
+			if(!try_iouring())
+				return;
+		}
 		else if(!strcmp("kqueue", ioenv))
 		{
 			if(!try_kqueue())
@@ -32,9 +32,9 @@
 #if defined(HAVE_DEVPOLL) && (HAVE_SYS_DEVPOLL_H)
 #include <sys/devpoll.h>
 
-static int dpfd;
-static int maxfd;
-static short *fdmask;
+static RB_THREAD_LOCAL int dpfd;
+static RB_THREAD_LOCAL int maxfd;
+static RB_THREAD_LOCAL short *fdmask;
 static void devpoll_update_events(rb_fde_t *, short, PF *);
 static void devpoll_write_update(int, int);
 
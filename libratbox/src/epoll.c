@@ -36,18 +36,6 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 
-#if defined(HAVE_SIGNALFD) && (HAVE_SYS_SIGNALFD_H) && (USE_TIMER_CREATE) && (HAVE_SYS_UIO_H)
-#include <signal.h>
-#include <sys/signalfd.h>
-#include <sys/uio.h>
-#define EPOLL_SCHED_EVENT 1
-#endif
-
-#if defined(USE_TIMERFD_CREATE)
-#include <sys/timerfd.h>
-#endif
-
-#define RTSIGNAL SIGRTMIN
 struct epoll_info
 {
 	int ep;
@@ -55,9 +43,22 @@ struct epoll_info
 	int pfd_size;
 };
 
-static struct epoll_info *ep_info;
-static int can_do_event;
-static int can_do_timerfd;
+static RB_THREAD_LOCAL struct epoll_info *ep_info;
+
+/*
+ * In persistent mode an fd is added once with EPOLLIN|EPOLLOUT|EPOLLET and
+ * left alone until it is closed; handler changes only touch the rb_fde_t.
+ * Edges that arrive while no handler is set are latched in F->flags, and
+ * an fd that gets a handler while still marked ready is put on ep_ready
+ * so rb_select_epoll() runs it without waiting for an edge that will never
+ * come.  F->pflags keeps tracking the mask the classic mode would have had
+ * registered, so we can count the epoll_ctl() calls that were skipped.
+ */
+static RB_THREAD_LOCAL int ep_persist;
+static RB_THREAD_LOCAL unsigned long ep_saved_ctl;
+static RB_THREAD_LOCAL rb_dlink_list ep_ready;
+
+static void rb_setselect_epoll_persist(rb_fde_t *F, unsigned int type, int op);
 
 /*
  * rb_init_netio
@@ -68,8 +69,6 @@ static int can_do_timerfd;
 int
 rb_init_netio_epoll(void)
 {
-	can_do_event = 0;	/* shut up gcc */
-	can_do_timerfd = 0;
 	ep_info = rb_malloc(sizeof(struct epoll_info));
 	ep_info->pfd_size = getdtablesize();
 	ep_info->ep = epoll_create(ep_info->pfd_size);
@@ -132,7 +131,7 @@ rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_da
 	}
 
 	if(old_flags == 0 && F->pflags == 0)
-		return;
+		op = -1;
 	else if(F->pflags <= 0)
 		op = EPOLL_CTL_DEL;
 	else if(old_flags == 0 && F->pflags > 0)
@@ -140,6 +139,12 @@ rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_da
 	else if(F->pflags != old_flags)
 		op = EPOLL_CTL_MOD;
 
+	if(F->flags & FLAG_PERSIST)
+	{
+		rb_setselect_epoll_persist(F, type, op);
+		return;
+	}
+
 	if(op == -1)
 		return;
 
@@ -147,7 +152,16 @@ rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_da
 	ep_event.data.ptr = F;
 
 	if(op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD)
+	{
 		ep_event.events |= EPOLLET;
+		if(ep_persist)
+		{
+			/* switch this fd over to being registered for everything */
+			ep_event.events |= EPOLLIN | EPOLLOUT;
+			F->flags |= FLAG_PERSIST;
+			F->flags &= ~(FLAG_READ_READY | FLAG_WRITE_READY);
+		}
+	}
 
 	if(epoll_ctl(ep_info->ep, op, F->fd, &ep_event) != 0)
 	{
@@ -158,6 +172,174 @@ rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_da
 
 }
 
+/*
+ * rb_setselect_epoll_persist
+ *
+ * rb_setselect for an fd that is already registered for all events.  The
+ * only epoll_ctl() left is the EPOLL_CTL_DEL when the fd is being torn
+ * down, so a stale registration can't outlive the rb_fde_t.
+ */
+static void
+rb_setselect_epoll_persist(rb_fde_t *F, unsigned int type, int op)
+{
+	struct epoll_event ep_event;
+
+	if(F->pflags == 0 && (type & (RB_SELECT_READ | RB_SELECT_WRITE)) ==
+	   (RB_SELECT_READ | RB_SELECT_WRITE))
+	{
+		if(F->rnode.data != NULL)
+		{
+			rb_dlinkDelete(&F->rnode, &ep_ready);
+			F->rnode.data = NULL;
+		}
+		F->flags &= ~(FLAG_PERSIST | FLAG_READ_READY | FLAG_WRITE_READY);
+		ep_event.events = 0;
+		ep_event.data.ptr = F;
+		if(epoll_ctl(ep_info->ep, EPOLL_CTL_DEL, F->fd, &ep_event) != 0)
+		{
+			rb_lib_log("rb_setselect_epoll(): epoll_ctl failed: %m");
+			abort();
+		}
+		return;
+	}
+
+	if(!ep_persist)
+	{
+		/* persistent mode was turned off, fall back to the classic mask */
+		ep_event.events = F->pflags | EPOLLET;
+		ep_event.data.ptr = F;
+		F->flags &= ~FLAG_PERSIST;
+		if(epoll_ctl(ep_info->ep, F->pflags ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, F->fd,
+			     &ep_event) != 0)
+			rb_lib_log("rb_setselect_epoll(): epoll_ctl failed: %m");
+		return;
+	}
+
+	if(op != -1)
+		ep_saved_ctl++;
+
+	if(F->rnode.data != NULL)
+		return;
+
+	if((F->read_handler != NULL && (F->flags & FLAG_READ_READY)) ||
+	   (F->write_handler != NULL && (F->flags & FLAG_WRITE_READY)))
+		rb_dlinkAddTail(F, &F->rnode, &ep_ready);
+}
+
+/*
+ * rb_epoll_dispatch
+ *
+ * runs the handlers of a persistently registered fd for whatever it is
+ * marked ready for.  Returns 0 if F went away underneath us.
+ */
+static int
+rb_epoll_dispatch(rb_fde_t *F)
+{
+	PF *hdl;
+	void *data;
+
+	if((F->flags & FLAG_READ_READY) && F->read_handler != NULL)
+	{
+		hdl = F->read_handler;
+		data = F->read_data;
+		F->read_handler = NULL;
+		F->read_data = NULL;
+		F->flags &= ~FLAG_READ_READY;
+		hdl(F, data);
+		if(!IsFDOpen(F))
+			return 0;
+	}
+
+	if((F->flags & FLAG_WRITE_READY) && F->write_handler != NULL)
+	{
+		hdl = F->write_handler;
+		data = F->write_data;
+		F->write_handler = NULL;
+		F->write_data = NULL;
+		F->flags &= ~FLAG_WRITE_READY;
+		hdl(F, data);
+		if(!IsFDOpen(F))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * rb_epoll_persist_event
+ *
+ * handles an event on a persistently registered fd, then brings pflags
+ * back in line with the handlers without telling the kernel.
+ */
+static void
+rb_epoll_persist_event(rb_fde_t *F, uint32_t events)
+{
+	int flags, old_flags = F->pflags;
+
+	if(!IsFDOpen(F))
+		return;
+
+	if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		F->flags |= FLAG_READ_READY;
+	if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		F->flags |= FLAG_WRITE_READY;
+
+	if(!rb_epoll_dispatch(F))
+		return;
+
+	flags = 0;
+	if(F->read_handler != NULL)
+		flags |= EPOLLIN;
+	if(F->write_handler != NULL)
+		flags |= EPOLLOUT;
+
+	if(old_flags != flags)
+	{
+		F->pflags = flags;
+		ep_saved_ctl++;
+	}
+}
+
+/*
+ * rb_epoll_run_ready
+ *
+ * dispatches fds that got a handler back while still marked ready.
+ */
+static void
+rb_epoll_run_ready(void)
+{
+	rb_dlink_node *ptr;
+	rb_fde_t *F;
+	unsigned long count;
+
+	/* handlers may requeue their fd, leave those for the next pass */
+	count = rb_dlink_list_length(&ep_ready);
+	while(count-- > 0 && (ptr = ep_ready.head) != NULL)
+	{
+		F = ptr->data;
+		rb_dlinkDelete(ptr, &ep_ready);
+		F->rnode.data = NULL;
+		rb_epoll_persist_event(F, 0);
+	}
+}
+
+/*
+ * rb_set_epoll_persistent
+ *
+ * turns the "always registered" mode on or off.  fds switch over the next
+ * time their handlers change.
+ */
+void
+rb_set_epoll_persistent(int enable)
+{
+	ep_persist = enable ? 1 : 0;
+}
+
+unsigned long
+rb_epoll_saved_ctl(void)
+{
+	return ep_saved_ctl;
+}
+
 /*
  * rb_select
  *
@@ -175,6 +357,10 @@ rb_select_epoll(long delay)
 	int o_errno;
 	void *data;
 
+	/* fds left ready by the last pass must not wait for another edge */
+	if(rb_dlink_list_length(&ep_ready) > 0)
+		delay = 0;
+
 	num = epoll_wait(ep_info->ep, ep_info->pfd, ep_info->pfd_size, delay);
 
 	/* save errno as rb_set_time() will likely clobber it */
@@ -186,12 +372,22 @@ rb_select_epoll(long delay)
 		return RB_ERROR;
 
 	if(num <= 0)
+	{
+		rb_epoll_run_ready();
 		return RB_OK;
+	}
 
 	for(i = 0; i < num; i++)
 	{
 		PF *hdl;
 		rb_fde_t *F = ep_info->pfd[i].data.ptr;
+
+		if(F->flags & FLAG_PERSIST)
+		{
+			rb_epoll_persist_event(F, ep_info->pfd[i].events);
+			continue;
+		}
+
 		old_flags = F->pflags;
 		if(ep_info->pfd[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
 		{
@@ -248,278 +444,10 @@ rb_select_epoll(long delay)
 		}
 
 	}
+	rb_epoll_run_ready();
 	return RB_OK;
 }
 
-#ifdef EPOLL_SCHED_EVENT
-int
-rb_epoll_supports_event(void)
-{
-	/* try to detect at runtime if everything we need actually works */
-	timer_t timer;
-	struct sigevent ev;
-	int fd;
-	sigset_t set;
-
-	if(can_do_event == 1)
-		return 1;
-	if(can_do_event == -1)
-		return 0;
-
-#ifdef USE_TIMERFD_CREATE
-	if((fd = timerfd_create(CLOCK_REALTIME, 0)) >= 0)
-	{
-		close(fd);
-		can_do_event = 1;
-		can_do_timerfd = 1;
-		return 1;
-	}
-#endif
-
-	ev.sigev_signo = SIGVTALRM;
-	ev.sigev_notify = SIGEV_SIGNAL;
-	if(timer_create(CLOCK_REALTIME, &ev, &timer) != 0)
-	{
-		can_do_event = -1;
-		return 0;
-	}
-	timer_delete(timer);
-	sigemptyset(&set);
-	fd = signalfd(-1, &set, 0);
-	if(fd < 0)
-	{
-		can_do_event = -1;
-		return 0;
-	}
-	close(fd);
-	can_do_event = 1;
-	return 1;
-}
-
-
-/* bleh..work around a glibc header bug on 32bit systems */
-struct our_signalfd_siginfo
-{
-	uint32_t signo;
-	int32_t err;
-	int32_t code;
-	uint32_t pid;
-	uint32_t uid;
-	int32_t fd;
-	uint32_t tid;
-	uint32_t band;
-	uint32_t overrun;
-	uint32_t trapno;
-	int32_t status;
-	int32_t svint;
-	uint64_t svptr;
-	uint64_t utime;
-	uint64_t stime;
-	uint64_t addr;
-	uint8_t pad[48];
-};
-
-
-#define SIGFDIOV_COUNT 16
-static void
-signalfd_handler(rb_fde_t *F, void *data)
-{
-	static struct our_signalfd_siginfo fdsig[SIGFDIOV_COUNT];
-	static struct iovec iov[SIGFDIOV_COUNT];
-	struct ev_entry *ev;
-	int ret, x;
-
-	for(x = 0; x < SIGFDIOV_COUNT; x++)
-	{
-		iov[x].iov_base = &fdsig[x];
-		iov[x].iov_len = sizeof(struct our_signalfd_siginfo);
-	}
-
-	while(1)
-	{
-		ret = readv(rb_get_fd(F), iov, SIGFDIOV_COUNT);
-
-		if(ret == 0 || (ret < 0 && !rb_ignore_errno(errno)))
-		{
-			rb_close(F);
-			rb_epoll_init_event();
-			return;
-		}
-
-		if(ret < 0)
-		{
-			rb_setselect(F, RB_SELECT_READ, signalfd_handler, NULL);
-			return;
-		}
-		for(x = 0; x < ret / (int)sizeof(struct our_signalfd_siginfo); x++)
-		{
-#if __WORDSIZE == 32 && defined(__sparc__)
-			uint32_t *q = (uint32_t *)&fdsig[x].svptr;
-			ev = (struct ev_entry *)q[0];
-#else
-			ev = (struct ev_entry *)(uintptr_t)(fdsig[x].svptr);
-
-#endif
-			if(ev == NULL)
-				continue;
-			rb_run_event(ev);
-		}
-	}
-}
-
-void
-rb_epoll_init_event(void)
-{
-
-	sigset_t ss;
-	rb_fde_t *F;
-	int sfd;
-	rb_epoll_supports_event();
-	if(!can_do_timerfd)
-	{
-		sigemptyset(&ss);
-		sigaddset(&ss, RTSIGNAL);
-		sigprocmask(SIG_BLOCK, &ss, 0);
-		sigemptyset(&ss);
-		sigaddset(&ss, RTSIGNAL);
-		sfd = signalfd(-1, &ss, 0);
-		if(sfd == -1)
-		{
-			can_do_event = -1;
-			return;
-		}
-		F = rb_open(sfd, RB_FD_UNKNOWN, "signalfd");
-		rb_set_nb(F);
-		signalfd_handler(F, NULL);
-	}
-}
-
-static int
-rb_epoll_sched_event_signalfd(struct ev_entry *event, int when)
-{
-	timer_t *id;
-	struct sigevent ev;
-	struct itimerspec ts;
-
-	memset(&ev, 0, sizeof(&ev));
-	event->comm_ptr = rb_malloc(sizeof(timer_t));
-	id = event->comm_ptr;
-	ev.sigev_notify = SIGEV_SIGNAL;
-	ev.sigev_signo = RTSIGNAL;
-	ev.sigev_value.sival_ptr = event;
-
-	if(timer_create(CLOCK_REALTIME, &ev, id) < 0)
-	{
-		rb_lib_log("timer_create: %m");
-		return 0;
-	}
-	memset(&ts, 0, sizeof(ts));
-	ts.it_value.tv_sec = when;
-	ts.it_value.tv_nsec = 0;
-	if(event->frequency != 0)
-		ts.it_interval = ts.it_value;
-
-	if(timer_settime(*id, 0, &ts, NULL) < 0)
-	{
-		rb_lib_log("timer_settime: %m");
-		return 0;
-	}
-	return 1;
-}
-
-#ifdef USE_TIMERFD_CREATE
-static void
-rb_read_timerfd(rb_fde_t *F, void *data)
-{
-	struct ev_entry *event = (struct ev_entry *)data;
-	int retlen;
-	uint64_t count;
-
-	if(event == NULL)
-	{
-		rb_close(F);
-		return;
-	}
-
-	retlen = rb_read(F, &count, sizeof(count));
-
-	if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
-	{
-		rb_close(F);
-		rb_lib_log("rb_read_timerfd: timerfd[%s] closed on error: %m", event->name);
-		return;
-	}
-	rb_setselect(F, RB_SELECT_READ, rb_read_timerfd, event);
-	rb_run_event(event);
-}
-
-
-static int
-rb_epoll_sched_event_timerfd(struct ev_entry *event, int when)
-{
-	struct itimerspec ts;
-	static char buf[FD_DESC_SZ + 8];
-	int fd;
-	rb_fde_t *F;
-
-	if((fd = timerfd_create(CLOCK_REALTIME, 0)) < 0)
-	{
-		rb_lib_log("timerfd_create: %m");
-		return 0;
-	}
-
-	memset(&ts, 0, sizeof(ts));
-	ts.it_value.tv_sec = when;
-	ts.it_value.tv_nsec = 0;
-	if(event->frequency != 0)
-		ts.it_interval = ts.it_value;
-
-	if(timerfd_settime(fd, 0, &ts, NULL) < 0)
-	{
-		rb_lib_log("timerfd_settime: %m");
-		close(fd);
-		return 0;
-	}
-	rb_snprintf(buf, sizeof(buf), "timerfd: %s", event->name);
-	F = rb_open(fd, RB_FD_UNKNOWN, buf);
-	rb_set_nb(F);
-	event->comm_ptr = F;
-	rb_setselect(F, RB_SELECT_READ, rb_read_timerfd, event);
-	return 1;
-}
-#endif
-
-
-
-int
-rb_epoll_sched_event(struct ev_entry *event, int when)
-{
-#ifdef USE_TIMERFD_CREATE
-	if(can_do_timerfd)
-	{
-		return rb_epoll_sched_event_timerfd(event, when);
-	}
-#endif
-	return rb_epoll_sched_event_signalfd(event, when);
-}
-
-void
-rb_epoll_unsched_event(struct ev_entry *event)
-{
-#ifdef USE_TIMERFD_CREATE
-	if(can_do_timerfd)
-	{
-		rb_close((rb_fde_t *)event->comm_ptr);
-		event->comm_ptr = NULL;
-		return;
-	}
-#endif
-	timer_delete(*((timer_t *) event->comm_ptr));
-	rb_free(event->comm_ptr);
-	event->comm_ptr = NULL;
-}
-#endif /* EPOLL_SCHED_EVENT */
-
 #else /* epoll not supported here */
 int
 rb_init_netio_epoll(void)
@@ -548,33 +476,17 @@ rb_setup_fd_epoll(rb_fde_t *F)
 	return -1;
 }
 
-
-#endif
-
-#if !defined(USING_EPOLL) || !defined(EPOLL_SCHED_EVENT)
 void
-rb_epoll_init_event(void)
+rb_set_epoll_persistent(int enable)
 {
 	return;
 }
 
-int
-rb_epoll_sched_event(struct ev_entry *event, int when)
+unsigned long
+rb_epoll_saved_ctl(void)
 {
-	errno = ENOSYS;
-	return -1;
+	return 0;
 }
 
-void
-rb_epoll_unsched_event(struct ev_entry *event)
-{
-	return;
-}
 
-int
-rb_epoll_supports_event(void)
-{
-	errno = ENOSYS;
-	return 0;
-}
-#endif /* !USING_EPOLL || !EPOLL_SCHED_EVENT */
+#endif
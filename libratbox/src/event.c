@@ -48,10 +48,298 @@
 #include <event-int.h>
 
 #define EV_NAME_LEN 33
-static char last_event_ran[EV_NAME_LEN];
-static rb_dlink_list event_list;
+static RB_THREAD_LOCAL char last_event_ran[EV_NAME_LEN];
+static RB_THREAD_LOCAL rb_dlink_list event_list;
 
-static time_t event_time_min = -1;
+/*
+ * The timing wheel.  Everything that wants to run at some point in the
+ * future -- events and fd timeouts -- hangs off a struct rb_timer in one
+ * of these slots.  Level 0 has one slot per millisecond, each level above
+ * covers 256 slots of the level below it, so four levels reach about 49
+ * days.  Adding and removing a timer is O(1); a timer in a higher level is
+ * moved down ("cascaded") when the wheel below it wraps around, in the
+ * fashion of the classic BSD/Linux callout wheels.
+ *
+ * The wheel runs on its own millisecond clock, which follows
+ * rb_current_time_tv() but never goes backwards, so a clock step back just
+ * stalls the wheel for a moment instead of holding timers for the size of
+ * the step.
+ */
+#define WHEEL_BITS	8
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_MAX	((((uint64_t)1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+#define WHEEL_WORDS	(WHEEL_SIZE / 64)
+
+struct timer_wheel
+{
+	rb_dlink_list slot[WHEEL_LEVELS][WHEEL_SIZE];
+	uint64_t used[WHEEL_LEVELS][WHEEL_WORDS];
+	unsigned long count[WHEEL_LEVELS];
+	uint64_t next;		/* the next tick that has not been run yet */
+	uint64_t clock;		/* current wheel time */
+	uint64_t last_real;	/* last wall clock reading, in ms */
+};
+
+static RB_THREAD_LOCAL struct timer_wheel wheel;
+
+static void
+rb_timer_clock(void)
+{
+	const struct timeval *tv = rb_current_time_tv();
+	uint64_t now;
+
+	now = (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+	if(wheel.last_real == 0)
+	{
+		wheel.last_real = now;
+		return;
+	}
+	if(now > wheel.last_real)
+		wheel.clock += now - wheel.last_real;
+	wheel.last_real = now;
+}
+
+/* first used slot at or after start in the given level, or WHEEL_SIZE */
+static unsigned int
+rb_timer_find_slot(unsigned int level, unsigned int start)
+{
+	unsigned int word = start / 64;
+	uint64_t bits;
+
+	if(start >= WHEEL_SIZE)
+		return WHEEL_SIZE;
+
+	bits = wheel.used[level][word] & (~(uint64_t)0 << (start % 64));
+	while(1)
+	{
+		if(bits != 0)
+			return word * 64 + __builtin_ctzll(bits);
+		if(++word == WHEEL_WORDS)
+			return WHEEL_SIZE;
+		bits = wheel.used[level][word];
+	}
+}
+
+static void
+rb_timer_link(struct rb_timer *timer)
+{
+	uint64_t delta;
+	unsigned int level, slot;
+
+	if(timer->expires < wheel.next)
+		delta = 0;
+	else
+		delta = timer->expires - wheel.next;
+
+	if(delta > WHEEL_MAX)
+	{
+		delta = WHEEL_MAX;
+		timer->expires = wheel.next + WHEEL_MAX;
+	}
+
+	for(level = 0; level < WHEEL_LEVELS - 1; level++)
+	{
+		if(delta < ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	if(delta == 0)
+		slot = wheel.next & WHEEL_MASK;
+	else
+		slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	timer->level = level;
+	timer->slot = slot;
+	rb_dlinkAddTail(timer, &timer->node, &wheel.slot[level][slot]);
+	wheel.used[level][slot / 64] |= (uint64_t)1 << (slot % 64);
+	wheel.count[level]++;
+}
+
+static void
+rb_timer_unlink(struct rb_timer *timer)
+{
+	rb_dlink_list *list = &wheel.slot[timer->level][timer->slot];
+
+	rb_dlinkDelete(&timer->node, list);
+	timer->node.data = NULL;
+	wheel.count[timer->level]--;
+	if(list->head == NULL)
+		wheel.used[timer->level][timer->slot / 64] &= ~((uint64_t)1 << (timer->slot % 64));
+}
+
+/*
+ * rb_timer_add
+ *
+ * (re)schedules timer to fire msec milliseconds from now.
+ */
+void
+rb_timer_add(struct rb_timer *timer, long msec)
+{
+	if(rb_timer_pending(timer))
+		rb_timer_unlink(timer);
+
+	rb_timer_clock();
+	if(msec < 0)
+		msec = 0;
+	timer->expires = wheel.clock + msec;
+	rb_timer_link(timer);
+}
+
+void
+rb_timer_del(struct rb_timer *timer)
+{
+	if(rb_timer_pending(timer))
+		rb_timer_unlink(timer);
+}
+
+/* move the timers in one slot of a higher level down the wheel */
+static void
+rb_timer_cascade(unsigned int level, unsigned int slot)
+{
+	rb_dlink_list *list = &wheel.slot[level][slot];
+	struct rb_timer *timer;
+
+	while(list->head != NULL)
+	{
+		timer = list->head->data;
+		rb_timer_unlink(timer);
+		rb_timer_link(timer);
+	}
+}
+
+/*
+ * rb_timer_run
+ *
+ * fires every timer that has come due.  Empty stretches of level 0 are
+ * skipped with the slot bitmap rather than walked a millisecond at a time.
+ */
+static void
+rb_timer_run(void)
+{
+	rb_dlink_list *list;
+	struct rb_timer *timer;
+	unsigned int idx, level, found;
+	uint64_t skip;
+
+	rb_timer_clock();
+
+	while(wheel.next <= wheel.clock)
+	{
+		idx = wheel.next & WHEEL_MASK;
+		if(idx == 0)
+		{
+			for(level = 1; level < WHEEL_LEVELS; level++)
+			{
+				rb_timer_cascade(level, (wheel.next >> (WHEEL_BITS * level)) & WHEEL_MASK);
+				if(((wheel.next >> (WHEEL_BITS * level)) & WHEEL_MASK) != 0)
+					break;
+			}
+		}
+
+		found = rb_timer_find_slot(0, idx);
+		if(found != idx)
+		{
+			skip = found - idx;
+			if(wheel.next + skip > wheel.clock + 1)
+				skip = wheel.clock + 1 - wheel.next;
+			wheel.next += skip;
+			continue;
+		}
+
+		wheel.next++;
+		list = &wheel.slot[0][idx];
+		while(list->head != NULL)
+		{
+			timer = list->head->data;
+			/* anything a callback just added here is for the next time around */
+			if(timer->expires >= wheel.next)
+				break;
+			rb_timer_unlink(timer);
+			timer->func(timer->data);
+		}
+	}
+}
+
+/* earliest expiry among the first used slot of a level, searching from start */
+static uint64_t
+rb_timer_slot_min(unsigned int level, unsigned int start)
+{
+	rb_dlink_node *ptr;
+	struct rb_timer *timer;
+	unsigned int slot;
+	uint64_t min = WHEEL_MAX + wheel.next;
+
+	slot = rb_timer_find_slot(level, start);
+	if(slot == WHEEL_SIZE && start != 0)
+		slot = rb_timer_find_slot(level, 0);
+	if(slot == WHEEL_SIZE)
+		return min;
+
+	RB_DLINK_FOREACH(ptr, wheel.slot[level][slot].head)
+	{
+		timer = ptr->data;
+		if(timer->expires < min)
+			min = timer->expires;
+	}
+	return min;
+}
+
+/*
+ * rb_timer_next
+ *
+ * returns the number of milliseconds until the next timer is due, or -1
+ * if nothing is scheduled.
+ */
+long
+rb_timer_next(void)
+{
+	unsigned int level, idx;
+	uint64_t min, t;
+
+	if(wheel.count[0] == 0 && wheel.count[1] == 0 && wheel.count[2] == 0
+	   && wheel.count[3] == 0)
+		return -1;
+
+	rb_timer_clock();
+	min = WHEEL_MAX + wheel.next;
+
+	if(wheel.count[0] != 0)
+	{
+		/* level 0 slots map straight onto the next 256ms */
+		idx = wheel.next & WHEEL_MASK;
+		t = rb_timer_find_slot(0, idx);
+		if(t != WHEEL_SIZE)
+			min = wheel.next + (t - idx);
+		else
+			min = wheel.next + (WHEEL_SIZE - idx) + rb_timer_find_slot(0, 0);
+	}
+
+	for(level = 1; level < WHEEL_LEVELS; level++)
+	{
+		if(wheel.count[level] == 0)
+			continue;
+		/*
+		 * the slot under the cursor may either be about to cascade or
+		 * already hold timers for the next time around, so look at it
+		 * and at the first used one after it.
+		 */
+		idx = (wheel.next >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		t = rb_timer_slot_min(level, idx);
+		if(t < min)
+			min = t;
+		t = rb_timer_slot_min(level, idx + 1);
+		if(t < min)
+			min = t;
+	}
+
+	if(min <= wheel.clock)
+		return 0;
+	if(min - wheel.clock > LONG_MAX)
+		return LONG_MAX;
+	return (long)(min - wheel.clock);
+}
 
 /*
  * struct ev_entry * 
@@ -76,6 +364,31 @@ rb_event_find(EVH * func, void *arg)
 	return NULL;
 }
 
+static void
+rb_event_timer(void *data)
+{
+	rb_run_event(data);
+}
+
+static struct ev_entry *
+rb_event_new(const char *name, EVH * func, void *arg, time_t when, time_t frequency)
+{
+	struct ev_entry *ev;
+	ev = rb_malloc(sizeof(struct ev_entry));
+	ev->func = func;
+	ev->name = rb_strndup(name, EV_NAME_LEN);
+	ev->arg = arg;
+	ev->when = rb_current_time() + when;
+	ev->next = when;
+	ev->frequency = frequency;
+	ev->timer.func = rb_event_timer;
+	ev->timer.data = ev;
+
+	rb_dlinkAdd(ev, &ev->node, &event_list);
+	rb_timer_add(&ev->timer, when * 1000);
+	return ev;
+}
+
 /*
  * struct ev_entry * 
  * rb_event_add(const char *name, EVH *func, void *arg, time_t when)
@@ -88,42 +401,22 @@ rb_event_find(EVH * func, void *arg)
 struct ev_entry *
 rb_event_add(const char *name, EVH * func, void *arg, time_t when)
 {
-	struct ev_entry *ev;
-	ev = rb_malloc(sizeof(struct ev_entry));
-	ev->func = func;
-	ev->name = rb_strndup(name, EV_NAME_LEN);
-	ev->arg = arg;
-	ev->when = rb_current_time() + when;
-	ev->next = when;
-	ev->frequency = when;
-
-	if((ev->when < event_time_min) || (event_time_min == -1))
-	{
-		event_time_min = ev->when;
-	}
-	rb_dlinkAdd(ev, &ev->node, &event_list);
-	rb_io_sched_event(ev, when);
-	return ev;
+	return rb_event_new(name, func, arg, when, when);
 }
 
 struct ev_entry *
 rb_event_addonce(const char *name, EVH * func, void *arg, time_t when)
 {
-	struct ev_entry *ev;
-	ev = rb_malloc(sizeof(struct ev_entry));
-	ev->func = func;
-	ev->name = rb_strndup(name, EV_NAME_LEN);
-	ev->arg = arg;
-	ev->when = rb_current_time() + when;
-	ev->next = when;
-	ev->frequency = 0;
-
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+	return rb_event_new(name, func, arg, when, 0);
+}
 
-	rb_dlinkAdd(ev, &ev->node, &event_list);
-	rb_io_sched_event(ev, when);
-	return ev;
+static void
+rb_event_free(struct ev_entry *ev)
+{
+	rb_dlinkDelete(&ev->node, &event_list);
+	rb_timer_del(&ev->timer);
+	rb_free(ev->name);
+	rb_free(ev);
 }
 
 /*
@@ -139,10 +432,14 @@ rb_event_delete(struct ev_entry *ev)
 	if(ev == NULL)
 		return;
 
-	rb_dlinkDelete(&ev->node, &event_list);
-	rb_io_unsched_event(ev);
-	rb_free(ev->name);
-	rb_free(ev);
+	/* an event deleting itself is freed once its callback returns */
+	if(ev->running)
+	{
+		ev->dead = 1;
+		rb_timer_del(&ev->timer);
+		return;
+	}
+	rb_event_free(ev);
 }
 
 /*
@@ -188,17 +485,17 @@ void
 rb_run_event(struct ev_entry *ev)
 {
 	rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+	ev->running = 1;
 	ev->func(ev->arg);
-	if(!ev->frequency)
+	ev->running = 0;
+	if(!ev->frequency || ev->dead)
 	{
-		rb_io_unsched_event(ev);
-		rb_dlinkDelete(&ev->node, &event_list);
-		rb_free(ev);
+		rb_event_free(ev);
 		return;
 	}
 	ev->when = rb_current_time() + ev->frequency;
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+	if(!rb_timer_pending(&ev->timer))
+		rb_timer_add(&ev->timer, ev->frequency * 1000);
 }
 
 /*
@@ -206,61 +503,12 @@ rb_run_event(struct ev_entry *ev)
  *
  * Input: None
  * Output: None
- * Side Effects: Runs pending events in the event list
+ * Side Effects: Runs pending events and fd timeouts off the timing wheel
  */
 void
 rb_event_run(void)
 {
-	rb_dlink_node *ptr, *next;
-	struct ev_entry *ev;
-
-	if(rb_io_supports_event())
-		return;
-
-	event_time_min = -1;
-	RB_DLINK_FOREACH_SAFE(ptr, next, event_list.head)
-	{
-		ev = ptr->data;
-		if(ev->when <= rb_current_time())
-		{
-			rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
-			ev->func(ev->arg);
-
-			/* event is scheduled more than once */
-			if(ev->frequency)
-			{
-				ev->when = rb_current_time() + ev->frequency;
-				if((ev->when < event_time_min) || (event_time_min == -1))
-					event_time_min = ev->when;
-			}
-			else
-			{
-				rb_dlinkDelete(&ev->node, &event_list);
-				rb_free(ev);
-			}
-		}
-		else
-		{
-			if((ev->when < event_time_min) || (event_time_min == -1))
-				event_time_min = ev->when;
-		}
-	}
-}
-
-void
-rb_event_io_register_all(void)
-{
-	rb_dlink_node *ptr;
-	struct ev_entry *ev;
-
-	if(!rb_io_supports_event())
-		return;
-
-	RB_DLINK_FOREACH(ptr, event_list.head)
-	{
-		ev = ptr->data;
-		rb_io_sched_event(ev, ev->next);
-	}
+	rb_timer_run();
 }
 
 /*
@@ -274,6 +522,7 @@ void
 rb_event_init(void)
 {
 	rb_strlcpy(last_event_ran, "NONE", sizeof(last_event_ran));
+	rb_timer_clock();
 }
 
 void
@@ -283,19 +532,31 @@ rb_dump_events(void (*func) (char *, void *), void *ptr)
 	char buf[512];
 	rb_dlink_node *dptr;
 	struct ev_entry *ev;
+	long next;
 	len = sizeof(buf);
 
 	rb_snprintf(buf, len, "Last event to run: %s", last_event_ran);
 	func(buf, ptr);
 
+	rb_timer_clock();
+	rb_snprintf(buf, len, "Timer wheel: %lu/%lu/%lu/%lu timers on levels 0-3, next in %ldms",
+		    wheel.count[0], wheel.count[1], wheel.count[2], wheel.count[3],
+		    rb_timer_next());
+	func(buf, ptr);
+
 	rb_strlcpy(buf, "Operation                    Next Execution", len);
 	func(buf, ptr);
 
 	RB_DLINK_FOREACH(dptr, event_list.head)
 	{
 		ev = dptr->data;
-		rb_snprintf(buf, len, "%-28s %-4ld seconds", ev->name,
-			    ev->when - (long)rb_current_time());
+		if(!rb_timer_pending(&ev->timer))
+			continue;
+		if(ev->timer.expires > wheel.clock)
+			next = (long)((ev->timer.expires - wheel.clock) / 1000);
+		else
+			next = 0;
+		rb_snprintf(buf, len, "%-28s %-4ld seconds", ev->name, next);
 		func(buf, ptr);
 	}
 }
@@ -304,21 +565,13 @@ rb_dump_events(void (*func) (char *, void *), void *ptr)
  * void rb_set_back_events(time_t by)
  * Input: Time to set back events by.
  * Output: None.
- * Side-effects: Sets back all events by "by" seconds.
+ * Side-effects: None any more, the timing wheel keeps its own clock that
+ *		 never runs backwards.
  */
 void
 rb_set_back_events(time_t by)
 {
-	rb_dlink_node *ptr;
-	struct ev_entry *ev;
-	RB_DLINK_FOREACH(ptr, event_list.head)
-	{
-		ev = ptr->data;
-		if(ev->when > by)
-			ev->when -= by;
-		else
-			ev->when = 0;
-	}
+	return;
 }
 
 void
@@ -333,12 +586,19 @@ rb_event_update(struct ev_entry *ev, time_t freq)
 	 * than the new frequency
 	 */
 	if((rb_current_time() + freq) < ev->when)
+	{
 		ev->when = rb_current_time() + freq;
+		rb_timer_add(&ev->timer, freq * 1000);
+	}
 	return;
 }
 
 time_t
 rb_event_next(void)
 {
-	return event_time_min;
+	long next = rb_timer_next();
+
+	if(next < 0)
+		return -1;
+	return rb_current_time() + (next + 999) / 1000;
 }
@@ -32,8 +32,8 @@
 #include <gnutls/gnutls.h>
 #include <gcrypt.h>
 
-static gnutls_certificate_credentials x509;
-static gnutls_dh_params dh_params;
+static RB_THREAD_LOCAL gnutls_certificate_credentials x509;
+static RB_THREAD_LOCAL gnutls_dh_params dh_params;
 
 
 
@@ -502,6 +502,32 @@ rb_supports_ssl(void)
 	return 1;
 }
 
+/* gnutls can't hand sessions to kernel TLS */
+int
+rb_ssl_set_ktls(int enable)
+{
+	return 0;
+}
+
+int
+rb_ssl_ktls(rb_fde_t *F)
+{
+	return 0;
+}
+
+/* XXX gnutls keeps its own session ticket key per process */
+int
+rb_ssl_set_ticket_keys(const uint8_t *keys, int count)
+{
+	return 0;
+}
+
+void
+rb_ssl_session_stats(unsigned long *handshakes, unsigned long *resumed)
+{
+	*handshakes = *resumed = 0;
+}
+
 void
 rb_get_ssl_info(char *buf, size_t len)
 {
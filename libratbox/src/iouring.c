@@ -0,0 +1,512 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  iouring.c: Linux io_uring compatible network routines.
+ *
+ *  This is a readiness-only backend, a drop-in for epoll.c: the ring
+ *  carries POLL_ADD requests and nothing else.  Accepts, reads and
+ *  writevs are still plain system calls made by rb_accept_tcp(),
+ *  rb_read() and rb_writev() once an fd is ready, and read_packet()
+ *  does not use registered buffers.  What it saves is the epoll_ctl()
+ *  per interest change, not the data path syscalls.
+ *
+ *  Copyright (C) 2002-2005 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ *  $Id$
+ */
+#define _GNU_SOURCE 1
+
+#include <libratbox_config.h>
+#include <ratbox_lib.h>
+#include <commio-int.h>
+#include <event-int.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(IORING_FEAT_EXT_ARG)
+#define USING_IOURING
+#include <sys/mman.h>
+#include <poll.h>
+
+/*
+ * We only use the ring for readiness notification: every interested fd
+ * has one oneshot IORING_OP_POLL_ADD outstanding, and every change of
+ * interest is queued on the submission ring rather than being pushed into
+ * the kernel one epoll_ctl() at a time.  The whole batch of changes goes
+ * in with the io_uring_enter() that waits for the next completions, so a
+ * busy loop pass costs one system call no matter how many fds changed.
+ *
+ * A poll request holds its own reference to the file, so a completion can
+ * arrive for an fd that has since been closed and reused.  user_data
+ * therefore carries the fd plus a per-fd generation, and anything that
+ * does not match the current generation is dropped.
+ */
+#define IOURING_ENTRIES		1024
+#define IOURING_IGNORE		(~(uint64_t)0)
+#define IOURING_UDATA(fd, gen)	(((uint64_t)(gen) << 32) | (uint32_t)(fd))
+
+struct iouring_ring
+{
+	unsigned int *head;
+	unsigned int *tail;
+	unsigned int *mask;
+	unsigned int *array;
+	void *ptr;
+	size_t size;
+};
+
+struct iouring_info
+{
+	int fd;
+	unsigned int features;
+	struct iouring_ring sq;
+	struct iouring_ring cq;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+	unsigned int sq_tail;
+	unsigned int pending;
+	uint32_t *gen;
+	int gen_size;
+};
+
+static RB_THREAD_LOCAL struct iouring_info *iu_info;
+
+static int
+iouring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+iouring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg,
+	      size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, iu_info->fd, to_submit, min_complete, flags, arg,
+			    argsz);
+}
+
+static void *
+iouring_map(size_t size, off_t offset)
+{
+	void *ptr;
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, iu_info->fd,
+		   offset);
+	if(ptr == MAP_FAILED)
+		return NULL;
+	return ptr;
+}
+
+/*
+ * iouring_submit
+ *
+ * pushes everything queued on the submission ring into the kernel,
+ * optionally waiting for completions at the same time.
+ */
+static int
+iouring_submit(unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+	int ret;
+
+	ret = iouring_enter(iu_info->pending, min_complete, flags, arg, argsz);
+	if(ret > 0)
+	{
+		if((unsigned int)ret > iu_info->pending)
+			ret = iu_info->pending;
+		iu_info->pending -= ret;
+	}
+	return ret;
+}
+
+static struct io_uring_sqe *
+iouring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, idx;
+
+	head = __atomic_load_n(iu_info->sq.head, __ATOMIC_ACQUIRE);
+	if(iu_info->sq_tail - head >= iu_info->sq_entries)
+	{
+		/* ring is full, hand what we have to the kernel first */
+		if(iouring_submit(0, 0, NULL, 0) < 0 && !rb_ignore_errno(errno) && errno != EBUSY)
+		{
+			rb_lib_log("iouring_get_sqe(): io_uring_enter failed: %m");
+			abort();
+		}
+		head = __atomic_load_n(iu_info->sq.head, __ATOMIC_ACQUIRE);
+		if(iu_info->sq_tail - head >= iu_info->sq_entries)
+		{
+			rb_lib_log("iouring_get_sqe(): submission ring stuck full");
+			abort();
+		}
+	}
+
+	idx = iu_info->sq_tail & *iu_info->sq.mask;
+	sqe = &iu_info->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	iu_info->sq.array[idx] = idx;
+	iu_info->sq_tail++;
+	iu_info->pending++;
+	__atomic_store_n(iu_info->sq.tail, iu_info->sq_tail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/*
+ * iouring_update
+ *
+ * brings the poll request the kernel holds for F in line with the
+ * handlers that are currently set on it.
+ */
+static void
+iouring_update(rb_fde_t *F)
+{
+	struct io_uring_sqe *sqe;
+	int flags = 0;
+
+	if(F->read_handler != NULL)
+		flags |= POLLIN;
+	if(F->write_handler != NULL)
+		flags |= POLLOUT;
+
+	if(flags == F->pflags)
+		return;
+
+	if(F->fd < 0 || F->fd >= iu_info->gen_size)
+	{
+		rb_lib_log("iouring_update(): fd %d out of range", F->fd);
+		abort();
+	}
+
+	if(F->pflags != 0)
+	{
+		sqe = iouring_get_sqe();
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = IOURING_UDATA(F->fd, iu_info->gen[F->fd]);
+		sqe->user_data = IOURING_IGNORE;
+		iu_info->gen[F->fd]++;
+	}
+
+	F->pflags = flags;
+	if(flags == 0)
+		return;
+
+	sqe = iouring_get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = F->fd;
+	sqe->poll32_events = flags;
+	sqe->user_data = IOURING_UDATA(F->fd, iu_info->gen[F->fd]);
+}
+
+/*
+ * iouring_teardown
+ *
+ * undoes a partial rb_init_netio_iouring(), so the caller can fall back
+ * to another backend.
+ */
+static void
+iouring_teardown(void)
+{
+	if(iu_info->sqes != NULL)
+		munmap(iu_info->sqes, iu_info->sqes_size);
+	if(iu_info->cq.size != 0 && iu_info->cq.ptr != NULL)
+		munmap(iu_info->cq.ptr, iu_info->cq.size);
+	if(iu_info->sq.ptr != NULL)
+		munmap(iu_info->sq.ptr, iu_info->sq.size);
+	close(iu_info->fd);
+	rb_free(iu_info);
+	iu_info = NULL;
+}
+
+/*
+ * rb_init_netio
+ *
+ * This is a needed exported function which will be called to initialise
+ * the network loop code.
+ */
+int
+rb_init_netio_iouring(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	iu_info = rb_malloc(sizeof(struct iouring_info));
+	iu_info->fd = -1;
+
+	memset(&p, 0, sizeof(p));
+	iu_info->gen_size = getdtablesize();
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = IOURING_ENTRIES * 2;
+	while(p.cq_entries < (unsigned int)iu_info->gen_size)
+		p.cq_entries <<= 1;
+
+	fd = iouring_setup(IOURING_ENTRIES, &p);
+	if(fd < 0)
+	{
+		rb_free(iu_info);
+		iu_info = NULL;
+		return -1;
+	}
+	iu_info->fd = fd;
+	iu_info->features = p.features;
+
+	iu_info->sq.size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	iu_info->cq.size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(iu_info->cq.size > iu_info->sq.size)
+			iu_info->sq.size = iu_info->cq.size;
+		iu_info->cq.size = 0;
+	}
+
+	iu_info->sq.ptr = iouring_map(iu_info->sq.size, IORING_OFF_SQ_RING);
+	if(iu_info->cq.size != 0)
+		iu_info->cq.ptr = iouring_map(iu_info->cq.size, IORING_OFF_CQ_RING);
+	else
+		iu_info->cq.ptr = iu_info->sq.ptr;
+	iu_info->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	iu_info->sqes = iouring_map(iu_info->sqes_size, IORING_OFF_SQES);
+
+	if(iu_info->sq.ptr == NULL || iu_info->cq.ptr == NULL || iu_info->sqes == NULL)
+	{
+		rb_lib_log("rb_init_netio_iouring(): mmap failed: %m");
+		iouring_teardown();
+		return -1;
+	}
+
+	iu_info->sq.head = (unsigned int *)((char *)iu_info->sq.ptr + p.sq_off.head);
+	iu_info->sq.tail = (unsigned int *)((char *)iu_info->sq.ptr + p.sq_off.tail);
+	iu_info->sq.mask = (unsigned int *)((char *)iu_info->sq.ptr + p.sq_off.ring_mask);
+	iu_info->sq.array = (unsigned int *)((char *)iu_info->sq.ptr + p.sq_off.array);
+	iu_info->cq.head = (unsigned int *)((char *)iu_info->cq.ptr + p.cq_off.head);
+	iu_info->cq.tail = (unsigned int *)((char *)iu_info->cq.ptr + p.cq_off.tail);
+	iu_info->cq.mask = (unsigned int *)((char *)iu_info->cq.ptr + p.cq_off.ring_mask);
+	iu_info->cqes = (struct io_uring_cqe *)((char *)iu_info->cq.ptr + p.cq_off.cqes);
+	iu_info->sq_entries = p.sq_entries;
+	iu_info->sq_tail = *iu_info->sq.tail;
+
+	if(rb_open(fd, RB_FD_UNKNOWN, "io_uring file descriptor") == NULL)
+	{
+		rb_lib_log("Unable to rb_open io_uring fd");
+		iouring_teardown();
+		return -1;
+	}
+	iu_info->gen = rb_malloc(sizeof(uint32_t) * iu_info->gen_size);
+	return 0;
+}
+
+int
+rb_setup_fd_iouring(rb_fde_t *F)
+{
+	return 0;
+}
+
+
+/*
+ * rb_setselect
+ *
+ * This is a needed exported function which will be called to register
+ * and deregister interest in a pending IO state for a given FD.
+ */
+void
+rb_setselect_iouring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data)
+{
+	lrb_assert(IsFDOpen(F));
+
+	if(type & RB_SELECT_READ)
+	{
+		F->read_handler = handler;
+		F->read_data = client_data;
+	}
+
+	if(type & RB_SELECT_WRITE)
+	{
+		F->write_handler = handler;
+		F->write_data = client_data;
+	}
+
+	iouring_update(F);
+}
+
+/*
+ * rb_select
+ *
+ * Called to do the new-style IO, courtesy of squid (like most of this
+ * new IO code). This routine handles the stuff we've hidden in
+ * rb_setselect and fd_table[] and calls callbacks for IO ready
+ * events.
+ */
+
+int
+rb_select_iouring(long delay)
+{
+	static RB_THREAD_LOCAL struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, flags = 0, wait = 0;
+	int num, o_errno;
+	void *data;
+
+	if(delay >= 0)
+	{
+		ts.tv_sec = delay / 1000;
+		ts.tv_nsec = (delay % 1000) * 1000000;
+	}
+
+	head = *iu_info->cq.head;
+	if(head == __atomic_load_n(iu_info->cq.tail, __ATOMIC_ACQUIRE) && delay != 0)
+	{
+		wait = 1;
+		flags = IORING_ENTER_GETEVENTS;
+	}
+
+	if(wait && delay > 0 && (iu_info->features & IORING_FEAT_EXT_ARG))
+	{
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		num = iouring_submit(wait, flags, &arg, sizeof(arg));
+	}
+	else
+	{
+		if(wait && delay > 0)
+		{
+			/* older kernels: a timeout that also fires on the first completion */
+			sqe = iouring_get_sqe();
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (uint64_t)(uintptr_t)&ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = IOURING_IGNORE;
+		}
+		if(iu_info->pending == 0 && !wait)
+			num = 0;
+		else
+			num = iouring_submit(wait, flags, NULL, 0);
+	}
+
+	/* save errno as rb_set_time() will likely clobber it */
+	o_errno = errno;
+	rb_set_time();
+	errno = o_errno;
+
+	if(num < 0 && !rb_ignore_errno(o_errno) && o_errno != ETIME && o_errno != EBUSY)
+		return RB_ERROR;
+
+	head = *iu_info->cq.head;
+	tail = __atomic_load_n(iu_info->cq.tail, __ATOMIC_ACQUIRE);
+
+	for(; head != tail; head++)
+	{
+		PF *hdl;
+		rb_fde_t *F;
+		uint64_t udata;
+		int fd, res;
+
+		cqe = &iu_info->cqes[head & *iu_info->cq.mask];
+		udata = cqe->user_data;
+		res = cqe->res;
+
+		/* hand the slot back before the handlers run and queue more work */
+		__atomic_store_n(iu_info->cq.head, head + 1, __ATOMIC_RELEASE);
+
+		if(udata == IOURING_IGNORE)
+			continue;
+
+		fd = (int)(udata & 0xffffffff);
+		if(fd < 0 || fd >= iu_info->gen_size || iu_info->gen[fd] != (uint32_t)(udata >> 32))
+			continue;
+
+		F = rb_find_fd(fd);
+		if(F == NULL || !IsFDOpen(F))
+			continue;
+
+		/* the oneshot poll is spent, whatever happens next needs a new one */
+		iu_info->gen[fd]++;
+		F->pflags = 0;
+
+		if(res < 0)
+			res = POLLERR;
+
+		if(res & (POLLIN | POLLHUP | POLLERR))
+		{
+			hdl = F->read_handler;
+			data = F->read_data;
+			F->read_handler = NULL;
+			F->read_data = NULL;
+			if(hdl)
+				hdl(F, data);
+		}
+
+		if(!IsFDOpen(F))
+			continue;
+		if(res & (POLLOUT | POLLHUP | POLLERR))
+		{
+			hdl = F->write_handler;
+			data = F->write_data;
+			F->write_handler = NULL;
+			F->write_data = NULL;
+			if(hdl)
+				hdl(F, data);
+		}
+
+		if(!IsFDOpen(F))
+			continue;
+
+		iouring_update(F);
+	}
+	return RB_OK;
+}
+
+#else /* io_uring not supported here */
+int
+rb_init_netio_iouring(void)
+{
+	return ENOSYS;
+}
+
+void
+rb_setselect_iouring(rb_fde_t *F, unsigned int type, PF * handler, void *client_data)
+{
+	errno = ENOSYS;
+	return;
+}
+
+int
+rb_select_iouring(long delay)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+rb_setup_fd_iouring(rb_fde_t *F)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
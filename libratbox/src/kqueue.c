@@ -47,19 +47,15 @@
 } while(0)
 #endif
 
-#ifdef EVFILT_TIMER
-#define KQUEUE_SCHED_EVENT
-#endif
-
 
 static void kq_update_events(rb_fde_t *, short, PF *);
-static int kq;
-static struct timespec zero_timespec;
+static RB_THREAD_LOCAL int kq;
+static RB_THREAD_LOCAL struct timespec zero_timespec;
 
-static struct kevent *kqlst;	/* kevent buffer */
-static struct kevent *kqout;	/* kevent output buffer */
-static int kqmax;		/* max structs to buffer */
-static int kqoff;		/* offset into the buffer */
+static RB_THREAD_LOCAL struct kevent *kqlst;	/* kevent buffer */
+static RB_THREAD_LOCAL struct kevent *kqout;	/* kevent output buffer */
+static RB_THREAD_LOCAL int kqmax;		/* max structs to buffer */
+static RB_THREAD_LOCAL int kqoff;		/* offset into the buffer */
 
 
 int
@@ -280,11 +276,6 @@ rb_select_kqueue(long delay)
 				hdl(F, F->write_data);
 			}
 			break;
-#if defined(EVFILT_TIMER)
-		case EVFILT_TIMER:
-			rb_run_event(kqout[i].udata);
-			break;
-#endif
 		default:
 			/* Bad! -- adrian */
 			break;
@@ -293,67 +284,6 @@ rb_select_kqueue(long delay)
 	return RB_OK;
 }
 
-#if defined(KQUEUE_SCHED_EVENT)
-static int can_do_event = 0;
-int
-rb_kqueue_supports_event(void)
-{
-	struct kevent kv;
-	struct timespec ts;
-	int xkq;
-
-	if(can_do_event == 1)
-		return 1;
-	if(can_do_event == -1)
-		return 0;
-
-	xkq = kqueue();
-	ts.tv_sec = 0;
-	ts.tv_nsec = 1000;
-
-
-	EV_SET(&kv, (uintptr_t)0x0, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, 1, 0);
-	if(kevent(xkq, &kv, 1, NULL, 0, NULL) < 0)
-	{
-		can_do_event = -1;
-		close(xkq);
-		return 0;
-	}
-	close(xkq);
-	can_do_event = 1;
-	return 1;
-}
-
-int
-rb_kqueue_sched_event(struct ev_entry *event, int when)
-{
-	struct kevent kev;
-	int kep_flags;
-
-	kep_flags = EV_ADD;
-	if(event->frequency == 0)
-		kep_flags |= EV_ONESHOT;
-	EV_SET(&kev, (uintptr_t)event, EVFILT_TIMER, kep_flags, 0, when * 1000, event);
-	if(kevent(kq, &kev, 1, NULL, 0, NULL) < 0)
-		return 0;
-	return 1;
-}
-
-void
-rb_kqueue_unsched_event(struct ev_entry *event)
-{
-	struct kevent kev;
-	EV_SET(&kev, (uintptr_t)event, EVFILT_TIMER, EV_DELETE, 0, 0, event);
-	kevent(kq, &kev, 1, NULL, 0, NULL);
-}
-
-void
-rb_kqueue_init_event(void)
-{
-	return;
-}
-#endif /* KQUEUE_SCHED_EVENT */
-
 #else /* kqueue not supported */
 int
 rb_init_netio_kqueue(void)
@@ -384,31 +314,3 @@ rb_setup_fd_kqueue(rb_fde_t *F)
 }
 
 #endif
-
-#if !defined(HAVE_KEVENT) || !defined(KQUEUE_SCHED_EVENT)
-void
-rb_kqueue_init_event(void)
-{
-	return;
-}
-
-int
-rb_kqueue_sched_event(struct ev_entry *event, int when)
-{
-	errno = ENOSYS;
-	return -1;
-}
-
-void
-rb_kqueue_unsched_event(struct ev_entry *event)
-{
-	return;
-}
-
-int
-rb_kqueue_supports_event(void)
-{
-	errno = ENOSYS;
-	return 0;
-}
-#endif /* !HAVE_KEVENT || !KQUEUE_SCHED_EVENT */
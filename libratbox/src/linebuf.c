@@ -28,11 +28,30 @@
 #include <ratbox_lib.h>
 #include <commio-int.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LINEBUF_SIMD 1
+#include <immintrin.h>
+#endif
+
 #ifndef NOBALLOC
-static rb_bh *rb_linebuf_heap;
+static RB_THREAD_LOCAL rb_bh *rb_linebuf_heap[LINEBUF_SIZE_CLASSES];
 #endif
 
-static int bufline_count = 0;
+/* how much buf each size class holds.  most lines are well under 128
+ * bytes, so only the odd long one needs a full sized line
+ */
+static const int rb_linebuf_class_size[LINEBUF_SIZE_CLASSES] = {
+	64, 128, 256, BUF_DATA_SIZE + 2
+};
+
+static const char *rb_linebuf_class_name[LINEBUF_SIZE_CLASSES] = {
+	"librb_linebuf_heap_64", "librb_linebuf_heap_128",
+	"librb_linebuf_heap_256", "librb_linebuf_heap"
+};
+
+static RB_THREAD_LOCAL int bufline_count = 0;
+
+static void rb_linebuf_select_eol_kernel(void);
 
 #ifndef LINEBUF_HEAP_SIZE
 #define LINEBUF_HEAP_SIZE 2048
@@ -47,14 +66,30 @@ static int bufline_count = 0;
 void
 rb_linebuf_init(size_t heap_size)
 {
-	rb_linebuf_heap = rb_bh_create(sizeof(buf_line_t), heap_size, "librb_linebuf_heap");
+	int i;
+
+	rb_linebuf_select_eol_kernel();
+
+	for(i = 0; i < LINEBUF_SIZE_CLASSES; i++)
+		rb_linebuf_heap[i] =
+			rb_bh_create(sizeof(buf_line_t) + rb_linebuf_class_size[i], heap_size,
+				     rb_linebuf_class_name[i]);
 }
 
 static buf_line_t *
-rb_linebuf_allocate(void)
+rb_linebuf_allocate(int size)
 {
 	buf_line_t *t;
-	t = rb_bh_alloc(rb_linebuf_heap);
+	int i;
+
+	for(i = 0; i < LINEBUF_SIZE_CLASSES - 1; i++)
+	{
+		if(size <= rb_linebuf_class_size[i])
+			break;
+	}
+
+	t = rb_bh_alloc(rb_linebuf_heap[i]);
+	t->sclass = i;
 	return (t);
 
 }
@@ -62,22 +97,22 @@ rb_linebuf_allocate(void)
 static void
 rb_linebuf_free(buf_line_t * p)
 {
-	rb_bh_free(rb_linebuf_heap, p);
+	rb_bh_free(rb_linebuf_heap[p->sclass], p);
 }
 
 /*
  * rb_linebuf_new_line
  *
- * Create a new line, and link it to the given linebuf.
- * It will be initially empty.
+ * Create a new line able to hold size bytes, and link it to the given
+ * linebuf.  It will be initially empty.
  */
 static buf_line_t *
-rb_linebuf_new_line(buf_head_t * bufhead)
+rb_linebuf_new_line(buf_head_t * bufhead, int size)
 {
 	buf_line_t *bufline;
 	rb_dlink_node *node;
 
-	bufline = rb_linebuf_allocate();
+	bufline = rb_linebuf_allocate(size);
 	if(bufline == NULL)
 		return NULL;
 	++bufline_count;
@@ -127,6 +162,134 @@ rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *
 }
 
 
+/*
+ * rb_linebuf_find_eol
+ *
+ * Find the first '\r' or '\n' in len bytes of data, NULL if there is
+ * none.  This is where the receive path spends its time on a burst, so
+ * on x86 it picks an SSE2 or AVX2 version at init time.
+ */
+static char *rb_linebuf_find_eol_scalar(char *ch, size_t len);
+
+static char *(*rb_linebuf_find_eol_impl) (char *, size_t) = rb_linebuf_find_eol_scalar;
+static const char *rb_linebuf_eol_kernel = "scalar";
+
+static char *
+rb_linebuf_find_eol_scalar(char *ch, size_t len)
+{
+	for(; len; len--, ch++)
+	{
+		if(*ch == '\r' || *ch == '\n')
+			return ch;
+	}
+	return NULL;
+}
+
+#ifdef LINEBUF_SIMD
+__attribute__ ((target("sse2")))
+static char *
+rb_linebuf_find_eol_sse2(char *ch, size_t len)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	__m128i v;
+	int mask;
+
+	for(; len >= 16; len -= 16, ch += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)ch);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+						      _mm_cmpeq_epi8(v, lf)));
+		if(mask != 0)
+			return ch + __builtin_ctz(mask);
+	}
+	return rb_linebuf_find_eol_scalar(ch, len);
+}
+
+__attribute__ ((target("avx2")))
+static char *
+rb_linebuf_find_eol_avx2(char *ch, size_t len)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	__m256i v;
+	unsigned int mask;
+
+	for(; len >= 32; len -= 32, ch += 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)ch);
+		mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+									 _mm256_cmpeq_epi8(v, lf)));
+		if(mask != 0)
+			return ch + __builtin_ctz(mask);
+	}
+	return rb_linebuf_find_eol_sse2(ch, len);
+}
+#endif
+
+static void
+rb_linebuf_select_eol_kernel(void)
+{
+#ifdef LINEBUF_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		rb_linebuf_find_eol_impl = rb_linebuf_find_eol_avx2;
+		rb_linebuf_eol_kernel = "avx2";
+	}
+	else if(__builtin_cpu_supports("sse2"))
+	{
+		rb_linebuf_find_eol_impl = rb_linebuf_find_eol_sse2;
+		rb_linebuf_eol_kernel = "sse2";
+	}
+#endif
+}
+
+char *
+rb_linebuf_find_eol(char *ch, size_t len)
+{
+	return rb_linebuf_find_eol_impl(ch, len);
+}
+
+const char *
+rb_linebuf_eol_kernel_name(void)
+{
+	return rb_linebuf_eol_kernel;
+}
+
+/*
+ * rb_linebuf_set_eol_kernel
+ *
+ * Use the named kernel from now on, so tools/ can check and time each of
+ * them.  Returns -1 if it wasn't built or this cpu can't run it.
+ */
+int
+rb_linebuf_set_eol_kernel(const char *name)
+{
+	if(!strcmp(name, "scalar"))
+	{
+		rb_linebuf_find_eol_impl = rb_linebuf_find_eol_scalar;
+		rb_linebuf_eol_kernel = "scalar";
+		return 0;
+	}
+#ifdef LINEBUF_SIMD
+	__builtin_cpu_init();
+	if(!strcmp(name, "sse2") && __builtin_cpu_supports("sse2"))
+	{
+		rb_linebuf_find_eol_impl = rb_linebuf_find_eol_sse2;
+		rb_linebuf_eol_kernel = "sse2";
+		return 0;
+	}
+	if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+	{
+		rb_linebuf_find_eol_impl = rb_linebuf_find_eol_avx2;
+		rb_linebuf_eol_kernel = "avx2";
+		return 0;
+	}
+#endif
+	return -1;
+}
+
 /*
  * skip to end of line or the crlfs, return the number of bytes ..
  */
@@ -134,15 +297,14 @@ static inline int
 rb_linebuf_skip_crlf(char *ch, int len)
 {
 	int orig_len = len;
+	char *eol;
 
 	/* First, skip until the first non-CRLF */
-	for(; len; len--, ch++)
-	{
-		if(*ch == '\r')
-			break;
-		else if(*ch == '\n')
-			break;
-	}
+	eol = rb_linebuf_find_eol_impl(ch, len);
+	if(eol == NULL)
+		return orig_len;
+	len -= eol - ch;
+	ch = eol;
 
 	/* Then, skip until the last CRLF */
 	for(; len; len--, ch++)
@@ -202,15 +364,16 @@ rb_linebuf_donebuf(buf_head_t * bufhead)
  * This still sucks in my opinion, but it seems to work.
  *
  * -Aaron
+ *
+ * clen is how much of data makes up this line, CRLFs included, as found
+ * by rb_linebuf_skip_crlf().
  */
 static int
-rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
+rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int clen)
 {
 	int cpylen = 0;		/* how many bytes we've copied */
 	char *ch = data;	/* Pointer to where we are in the read data */
 	char *bufch = bufline->buf + bufline->len;
-	int clen = 0;		/* how many bytes we've processed,
-				   and don't ever want to see again.. */
 
 	/* If its full or terminated, ignore it */
 
@@ -219,9 +382,7 @@ rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
 	if(bufline->terminated == 1)
 		return 0;
 
-	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
-	if(clen == -1)
-		return -1;
+	cpylen = clen;
 
 	/* This is the ~overflow case..This doesn't happen often.. */
 	if(cpylen > (BUF_DATA_SIZE - bufline->len - 1))
@@ -274,16 +435,15 @@ rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
  *
  * Copy as much data as possible directly into a linebuf,
  * splitting at \r\n, but without altering any data.
+ * clen is as for rb_linebuf_copy_line().
  *
  */
 static int
-rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
+rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int clen)
 {
 	int cpylen = 0;		/* how many bytes we've copied */
 	char *ch = data;	/* Pointer to where we are in the read data */
 	char *bufch = bufline->buf + bufline->len;
-	int clen = 0;		/* how many bytes we've processed,
-				   and don't ever want to see again.. */
 
 	/* If its full or terminated, ignore it */
 
@@ -292,9 +452,7 @@ rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
 	if(bufline->terminated == 1)
 		return 0;
 
-	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
-	if(clen == -1)
-		return -1;
+	cpylen = clen;
 
 	/* This is the overflow case..This doesn't happen often.. */
 	if(cpylen > (BUF_DATA_SIZE - bufline->len - 1))
@@ -352,6 +510,7 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 {
 	buf_line_t *bufline;
 	int cpylen;
+	int clen;
 	int linecnt = 0;
 
 	/* First, if we have a partial buffer, try to squeze data into it */
@@ -360,10 +519,11 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 		/* Check we're doing the partial buffer thing */
 		bufline = bufhead->list.tail->data;
 		/* just try, the worst it could do is *reject* us .. */
+		clen = rb_linebuf_skip_crlf(data, len);
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, clen);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, clen);
 
 		if(cpylen == -1)
 			return -1;
@@ -382,14 +542,21 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 	/* Next, the loop */
 	while(len > 0)
 	{
-		/* We obviously need a new buffer, so .. */
-		bufline = rb_linebuf_new_line(bufhead);
+		clen = rb_linebuf_skip_crlf(data, len);
+
+		/* We obviously need a new buffer.  A complete line only needs
+		 * room for itself and the '\0', a partial one may still grow.
+		 */
+		if(clen < BUF_DATA_SIZE && (data[clen - 1] == '\r' || data[clen - 1] == '\n'))
+			bufline = rb_linebuf_new_line(bufhead, clen + 1);
+		else
+			bufline = rb_linebuf_new_line(bufhead, BUF_DATA_SIZE + 2);
 
 		/* And parse */
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, clen);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, clen);
 
 		if(cpylen == -1)
 			return -1;
@@ -498,188 +665,127 @@ rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 
 
 /*
- * rb_linebuf_putmsg
+ * rb_linebuf_put_line
  *
- * Similar to rb_linebuf_put, but designed for use by send.c.
- *
- * prefixfmt is used as a format for the varargs, and is inserted first.
- * Then format/va_args is appended to the buffer.
+ * Terminate a formatted line held in buf (which must have room for
+ * BUF_DATA_SIZE + 2 bytes) with a CRLF, truncating it if required,
+ * then copy it to a new line of the right size on the linebuf.
  */
-void
-rb_linebuf_putmsg(buf_head_t * bufhead, const char *format, va_list * va_args,
-		  const char *prefixfmt, ...)
+static void
+rb_linebuf_put_line(buf_head_t * bufhead, char *buf, int len)
 {
 	buf_line_t *bufline;
-	int len = 0;
-	va_list prefix_args;
-
-	/* make sure the previous line is terminated */
-#ifndef NDEBUG
-	if(bufhead->list.tail)
-	{
-		bufline = bufhead->list.tail->data;
-		lrb_assert(bufline->terminated);
-	}
-#endif
-	/* Create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
-
-	if(prefixfmt != NULL)
-	{
-		va_start(prefix_args, prefixfmt);
-		len = rb_vsnprintf(bufline->buf, BUF_DATA_SIZE, prefixfmt, prefix_args);
-		va_end(prefix_args);
-	}
-
-	if(va_args != NULL)
-	{
-		len += rb_vsnprintf((bufline->buf + len), (BUF_DATA_SIZE - len), format, *va_args);
-	}
-
-	bufline->terminated = 1;
 
 	/* Truncate the data if required */
 	if(rb_unlikely(len > 510))
 	{
 		len = 510;
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
+		buf[len++] = '\r';
+		buf[len++] = '\n';
 	}
 	else if(rb_unlikely(len == 0))
 	{
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
-		bufline->buf[len] = '\0';
+		buf[len++] = '\r';
+		buf[len++] = '\n';
+		buf[len] = '\0';
 	}
 	else
 	{
 		/* Chop trailing CRLF's .. */
-		while((bufline->buf[len] == '\r') || (bufline->buf[len] == '\n')
-		      || (bufline->buf[len] == '\0'))
+		while(len >= 0 && ((buf[len] == '\r') || (buf[len] == '\n') || (buf[len] == '\0')))
 		{
 			len--;
 		}
 
-		bufline->buf[++len] = '\r';
-		bufline->buf[++len] = '\n';
-		bufline->buf[++len] = '\0';
+		buf[++len] = '\r';
+		buf[++len] = '\n';
+		buf[++len] = '\0';
 	}
 
+	/* Create a new line */
+	bufline = rb_linebuf_new_line(bufhead, len + 1);
+	memcpy(bufline->buf, buf, len + 1);
+	bufline->terminated = 1;
 	bufline->len = len;
 	bufhead->len += len;
 }
 
-void
-rb_linebuf_putbuf(buf_head_t * bufhead, const char *buffer)
-{
-	buf_line_t *bufline;
-	int len = 0;
-
-	/* make sure the previous line is terminated */
 #ifndef NDEBUG
-	if(bufhead->list.tail)
-	{
-		bufline = bufhead->list.tail->data;
-		lrb_assert(bufline->terminated);
-	}
+/* make sure the previous line is terminated */
+#define rb_linebuf_assert_terminated(bufhead) \
+	lrb_assert((bufhead)->list.tail == NULL || \
+		   ((buf_line_t *)(bufhead)->list.tail->data)->terminated)
+#else
+#define rb_linebuf_assert_terminated(bufhead)
 #endif
-	/* Create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
 
-	if(rb_unlikely(buffer != NULL))
-		len = rb_strlcpy(bufline->buf, buffer, BUF_DATA_SIZE);
+/*
+ * rb_linebuf_putmsg
+ *
+ * Similar to rb_linebuf_put, but designed for use by send.c.
+ *
+ * prefixfmt is used as a format for the varargs, and is inserted first.
+ * Then format/va_args is appended to the buffer.
+ */
+void
+rb_linebuf_putmsg(buf_head_t * bufhead, const char *format, va_list * va_args,
+		  const char *prefixfmt, ...)
+{
+	char buf[BUF_DATA_SIZE + 2];
+	int len = 0;
+	va_list prefix_args;
 
-	bufline->terminated = 1;
+	rb_linebuf_assert_terminated(bufhead);
 
-	/* Truncate the data if required */
-	if(rb_unlikely(len > 510))
+	buf[0] = '\0';
+	if(prefixfmt != NULL)
 	{
-		len = 510;
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
+		va_start(prefix_args, prefixfmt);
+		len = rb_vsnprintf(buf, BUF_DATA_SIZE, prefixfmt, prefix_args);
+		va_end(prefix_args);
 	}
-	else if(rb_unlikely(len == 0))
+
+	if(va_args != NULL)
 	{
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
-		bufline->buf[len] = '\0';
+		len += rb_vsnprintf((buf + len), (BUF_DATA_SIZE - len), format, *va_args);
 	}
-	else
-	{
-		/* Chop trailing CRLF's .. */
-		while((bufline->buf[len] == '\r') || (bufline->buf[len] == '\n')
-		      || (bufline->buf[len] == '\0'))
-		{
-			len--;
-		}
 
-		bufline->buf[++len] = '\r';
-		bufline->buf[++len] = '\n';
-		bufline->buf[++len] = '\0';
-	}
+	rb_linebuf_put_line(bufhead, buf, len);
+}
 
-	bufline->len = len;
-	bufhead->len += len;
+void
+rb_linebuf_putbuf(buf_head_t * bufhead, const char *buffer)
+{
+	char buf[BUF_DATA_SIZE + 2];
+	int len = 0;
+
+	rb_linebuf_assert_terminated(bufhead);
 
+	buf[0] = '\0';
+	if(rb_unlikely(buffer != NULL))
+		len = rb_strlcpy(buf, buffer, BUF_DATA_SIZE);
 
+	rb_linebuf_put_line(bufhead, buf, len);
 }
 
 void
 rb_linebuf_put(buf_head_t * bufhead, const char *format, ...)
 {
-	buf_line_t *bufline;
+	char buf[BUF_DATA_SIZE + 2];
 	int len = 0;
 	va_list args;
 
-	/* make sure the previous line is terminated */
-#ifndef NDEBUG
-	if(bufhead->list.tail)
-	{
-		bufline = bufhead->list.tail->data;
-		lrb_assert(bufline->terminated);
-	}
-#endif
-	/* Create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
+	rb_linebuf_assert_terminated(bufhead);
 
+	buf[0] = '\0';
 	if(rb_unlikely(format != NULL))
 	{
 		va_start(args, format);
-		len = rb_vsnprintf(bufline->buf, BUF_DATA_SIZE, format, args);
+		len = rb_vsnprintf(buf, BUF_DATA_SIZE, format, args);
 		va_end(args);
 	}
 
-	bufline->terminated = 1;
-
-	/* Truncate the data if required */
-	if(rb_unlikely(len > 510))
-	{
-		len = 510;
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
-	}
-	else if(rb_unlikely(len == 0))
-	{
-		bufline->buf[len++] = '\r';
-		bufline->buf[len++] = '\n';
-		bufline->buf[len] = '\0';
-	}
-	else
-	{
-		/* Chop trailing CRLF's .. */
-		while((bufline->buf[len] == '\r') || (bufline->buf[len] == '\n')
-		      || (bufline->buf[len] == '\0'))
-		{
-			len--;
-		}
-
-		bufline->buf[++len] = '\r';
-		bufline->buf[++len] = '\n';
-		bufline->buf[++len] = '\0';
-	}
-
-	bufline->len = len;
-	bufhead->len += len;
+	rb_linebuf_put_line(bufhead, buf, len);
 }
 
 
@@ -712,7 +818,7 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 		rb_dlink_node *ptr;
 		int x = 0, y;
 		int xret;
-		static struct rb_iovec vec[RB_UIO_MAXIOV];
+		static RB_THREAD_LOCAL struct rb_iovec vec[RB_UIO_MAXIOV];
 
 		memset(vec, 0, sizeof(vec));
 		/* Check we actually have a first buffer */
@@ -837,5 +943,32 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 void
 rb_count_rb_linebuf_memory(size_t *count, size_t *rb_linebuf_memory_used)
 {
-	rb_bh_usage(rb_linebuf_heap, count, NULL, rb_linebuf_memory_used, NULL);
+	size_t c, m;
+	int i;
+
+	*count = 0;
+	*rb_linebuf_memory_used = 0;
+
+	for(i = 0; i < LINEBUF_SIZE_CLASSES; i++)
+	{
+		rb_bh_usage(rb_linebuf_heap[i], &c, NULL, &m, NULL);
+		*count += c;
+		*rb_linebuf_memory_used += m;
+	}
+}
+
+/*
+ * same again, for a single size class.  returns 0 once sclass runs off
+ * the end of the classes.
+ */
+int
+rb_count_rb_linebuf_class_memory(int sclass, size_t *linesize, size_t *count,
+				 size_t *rb_linebuf_memory_used)
+{
+	if(sclass < 0 || sclass >= LINEBUF_SIZE_CLASSES)
+		return 0;
+
+	*linesize = rb_linebuf_class_size[sclass];
+	rb_bh_usage(rb_linebuf_heap[sclass], count, NULL, rb_linebuf_memory_used, NULL);
+	return 1;
 }
@@ -163,6 +163,30 @@ rb_ssl_clear_handshake_count(rb_fde_t *F)
 	return;
 }
 
+int
+rb_ssl_set_ktls(int enable)
+{
+	return 0;
+}
+
+int
+rb_ssl_ktls(rb_fde_t *F)
+{
+	return 0;
+}
+
+int
+rb_ssl_set_ticket_keys(const uint8_t *keys, int count)
+{
+	return 0;
+}
+
+void
+rb_ssl_session_stats(unsigned long *handshakes, unsigned long *resumed)
+{
+	*handshakes = *resumed = 0;
+}
+
 void
 rb_get_ssl_info(char *buf, size_t len)
 {
@@ -34,10 +34,17 @@
 #include <openssl/dh.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+static RB_THREAD_LOCAL SSL_CTX *ssl_server_ctx;
+static RB_THREAD_LOCAL SSL_CTX *ssl_client_ctx;
+static RB_THREAD_LOCAL int libratbox_index = -1;
 
-static SSL_CTX *ssl_server_ctx;
-static SSL_CTX *ssl_client_ctx;
-static int libratbox_index = -1;
+static RB_THREAD_LOCAL uint8_t ssl_ticket_keys[RB_SSL_TICKET_KEYS][RB_SSL_TICKET_KEYLEN];
+static RB_THREAD_LOCAL int ssl_ticket_key_count;
 
 static unsigned long
 get_last_err(void)
@@ -281,6 +288,103 @@ rb_ssl_write(rb_fde_t *F, const void *buf, size_t count)
 	return rb_ssl_read_or_write(1, F, NULL, buf, count);
 }
 
+/*
+ * session tickets are encrypted with keys ircd hands to every ssld, so
+ * a client can resume with whichever ssld it lands on next time.
+ */
+static uint8_t *
+rb_ssl_find_ticket_key(const unsigned char *name, int *current)
+{
+	int i;
+
+	for(i = 0; i < ssl_ticket_key_count; i++)
+	{
+		if(memcmp(name, ssl_ticket_keys[i], 16) == 0)
+		{
+			*current = (i == 0);
+			return ssl_ticket_keys[i];
+		}
+	}
+	return NULL;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int
+rb_ssl_ticket_cb(SSL * ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX * ectx,
+		 EVP_MAC_CTX * hctx, int enc)
+#else
+static int
+rb_ssl_ticket_cb(SSL * ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX * ectx,
+		 HMAC_CTX * hctx, int enc)
+#endif
+{
+	static char digest[] = "SHA256";
+	uint8_t *key;
+	int current = 1;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[3];
+#endif
+
+	if(ssl_ticket_key_count == 0)
+		return -1;
+
+	if(enc)
+	{
+		key = ssl_ticket_keys[0];
+		if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0)
+			return -1;
+		memcpy(name, key, 16);
+	}
+	else if((key = rb_ssl_find_ticket_key(name, &current)) == NULL)
+		return 0;	/* unknown or expired key, do a full handshake */
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key + 16, 32);
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if(!EVP_MAC_CTX_set_params(hctx, params))
+		return -1;
+#else
+	if(!HMAC_Init_ex(hctx, key + 16, 32, EVP_sha256(), NULL))
+		return -1;
+#endif
+	if(enc)
+	{
+		if(!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key + 48, iv))
+			return -1;
+		return 1;
+	}
+
+	if(!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key + 48, iv))
+		return -1;
+
+	/* 2 asks for a fresh ticket under the current key */
+	return current ? 1 : 2;
+}
+
+int
+rb_ssl_set_ticket_keys(const uint8_t *keys, int count)
+{
+	if(count > RB_SSL_TICKET_KEYS)
+		count = RB_SSL_TICKET_KEYS;
+
+	memcpy(ssl_ticket_keys, keys, count * RB_SSL_TICKET_KEYLEN);
+	ssl_ticket_key_count = count;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_server_ctx, rb_ssl_ticket_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ssl_server_ctx, rb_ssl_ticket_cb);
+#endif
+	return 1;
+}
+
+void
+rb_ssl_session_stats(unsigned long *handshakes, unsigned long *resumed)
+{
+	*handshakes = SSL_CTX_sess_accept_good(ssl_server_ctx);
+	*resumed = SSL_CTX_sess_hits(ssl_server_ctx);
+}
+
 int
 rb_init_ssl(void)
 {
@@ -299,6 +403,12 @@ rb_init_ssl(void)
 	/* Disable SSLv2, make the client use our settings */
 	SSL_CTX_set_options(ssl_server_ctx, SSL_OP_NO_SSLv2 | SSL_OP_CIPHER_SERVER_PREFERENCE);
 
+	/* session ids only resume on the ssld that issued them, tickets work
+	 * everywhere once ircd has sent us the keys
+	 */
+	SSL_CTX_set_session_cache_mode(ssl_server_ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(ssl_server_ctx, (const unsigned char *)"ratbox", 6);
+
 	ssl_client_ctx = SSL_CTX_new(TLSv1_client_method());
 
 	if(ssl_client_ctx == NULL)
@@ -599,6 +709,47 @@ rb_get_pseudo_random(void *buf, size_t length)
 	return 1;
 }
 
+/*
+ * rb_ssl_set_ktls - ask OpenSSL to hand new sessions to kernel TLS once
+ * the handshake is done.  OpenSSL quietly stays in userland when the
+ * kernel or cipher can't do it.  returns 0 if this OpenSSL can't.
+ */
+int
+rb_ssl_set_ktls(int enable)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	if(enable)
+	{
+		SSL_CTX_set_options(ssl_server_ctx, SSL_OP_ENABLE_KTLS);
+		SSL_CTX_set_options(ssl_client_ctx, SSL_OP_ENABLE_KTLS);
+	}
+	else
+	{
+		SSL_CTX_clear_options(ssl_server_ctx, SSL_OP_ENABLE_KTLS);
+		SSL_CTX_clear_options(ssl_client_ctx, SSL_OP_ENABLE_KTLS);
+	}
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+int
+rb_ssl_ktls(rb_fde_t *F)
+{
+	int ktls = 0;
+
+	if(F == NULL || F->ssl == NULL)
+		return 0;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	if(BIO_get_ktls_send(SSL_get_wbio((SSL *) F->ssl)))
+		ktls |= RB_SSL_KTLS_SEND;
+	if(BIO_get_ktls_recv(SSL_get_rbio((SSL *) F->ssl)))
+		ktls |= RB_SSL_KTLS_RECV;
+#endif
+	return ktls;
+}
+
 const char *
 rb_get_ssl_strerror(rb_fde_t *F)
 {
@@ -49,7 +49,7 @@ struct _pollfd_list
 
 typedef struct _pollfd_list pollfd_list_t;
 
-static pollfd_list_t pollfd_list;
+static RB_THREAD_LOCAL pollfd_list_t pollfd_list;
 
 int
 rb_setup_fd_poll(rb_fde_t *F)
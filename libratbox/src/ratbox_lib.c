@@ -27,13 +27,15 @@
 #include <ratbox_lib.h>
 #include <commio-int.h>
 #include <commio-ssl.h>
+#include <event-int.h>
 
-static log_cb *rb_log;
-static restart_cb *rb_restart;
-static die_cb *rb_die;
+static RB_THREAD_LOCAL log_cb *rb_log;
+static RB_THREAD_LOCAL restart_cb *rb_restart;
+static RB_THREAD_LOCAL die_cb *rb_die;
+static RB_THREAD_LOCAL loop_cb *rb_loop;
 
-static struct timeval rb_time;
-static char errbuf[512];
+static RB_THREAD_LOCAL struct timeval rb_time;
+static RB_THREAD_LOCAL char errbuf[512];
 
 /* this doesn't do locales...oh well i guess */
 
@@ -62,7 +64,7 @@ rb_ctime(const time_t t, char *buf, size_t len)
 {
 	char *p;
 	struct tm *tp;
-	static char timex[128];
+	static RB_THREAD_LOCAL char timex[128];
 	size_t tlen;
 #if defined(HAVE_GMTIME_R)
 	struct tm tmr;
@@ -208,45 +210,51 @@ rb_lib_init(log_cb * ilog, restart_cb * irestart, die_cb * idie, int closeall, i
 	rb_fdlist_init(closeall, maxcon, fd_heap_size);
 	rb_init_netio();
 	rb_init_rb_dlink_nodes(dh_size);
-	if(rb_io_supports_event())
-	{
-		rb_io_init_event();
-	}
 }
 
+/*
+ * rb_lib_set_loop_cb
+ *
+ * inputs	- callback to run once per pass through rb_lib_loop()
+ * outputs	-
+ * side effects	- the callback is run before every rb_select(), after the
+ *		  previous pass' io handlers and events have run.  It may
+ *		  return a delay in milliseconds it wants to be called again
+ *		  within, or -1 if it doesn't care.
+ */
 void
-rb_lib_loop(long delay)
+rb_lib_set_loop_cb(loop_cb * iloop)
 {
-	time_t next;
-	rb_set_time();
+	rb_loop = iloop;
+}
 
-	if(rb_io_supports_event())
-	{
-		if(delay == 0)
-			delay = -1;
-		while(1)
-			rb_select(-1);
-	}
+static long
+rb_run_loop_cb(long delay)
+{
+	long wait;
 
+	if(rb_loop == NULL)
+		return delay;
+
+	wait = rb_loop();
+	if(wait >= 0 && (delay < 0 || wait < delay))
+		return wait;
+	return delay;
+}
+
+void
+rb_lib_loop(long delay)
+{
+	long next;
+	rb_set_time();
 
 	while(1)
 	{
-		if(delay == 0)
-		{
-			if((next = rb_event_next()) > 0)
-			{
-				next -= rb_current_time();
-				if(next <= 0)
-					next = 1000;
-				else
-					next *= 1000;
-			}
-			else
-				next = -1;
-			rb_select(next);
-		}
-		else
-			rb_select(delay);
+		/* sleep until the next timer on the wheel is due */
+		next = rb_timer_next();
+		if(delay != 0 && (next < 0 || next > delay))
+			next = delay;
+		rb_select(rb_run_loop_cb(next));
 		rb_event_run();
 	}
 }
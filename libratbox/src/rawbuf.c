@@ -42,7 +42,7 @@ struct _rawbuf_head
 	int written;
 };
 
-static rb_bh *rawbuf_heap;
+static RB_THREAD_LOCAL rb_bh *rawbuf_heap;
 
 
 static rawbuf_t *
@@ -48,18 +48,18 @@
  *   -- adrian
  */
 
-static fd_set select_readfds;
-static fd_set select_writefds;
+static RB_THREAD_LOCAL fd_set select_readfds;
+static RB_THREAD_LOCAL fd_set select_writefds;
 
 /*
  * You know, I'd rather have these local to rb_select but for some
  * reason my gcc decides that I can't modify them at all..
  *   -- adrian
  */
-static fd_set tmpreadfds;
-static fd_set tmpwritefds;
+static RB_THREAD_LOCAL fd_set tmpreadfds;
+static RB_THREAD_LOCAL fd_set tmpwritefds;
 
-static int rb_maxfd = -1;
+static RB_THREAD_LOCAL int rb_maxfd = -1;
 static void select_update_selectfds(rb_fde_t *F, short event, PF * handler);
 
 /* XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX */
@@ -132,7 +132,7 @@ rb_setup_fd_select(rb_fde_t *F)
  * This is a needed exported function which will be called to initialise
  * the network loop code.
  */
-extern int rb_maxconnections;
+extern RB_THREAD_LOCAL int rb_maxconnections;
 int
 rb_init_netio_select(void)
 {
@@ -46,12 +46,7 @@
 #include <signal.h>
 #include <sys/poll.h>
 
-#if defined(USE_TIMER_CREATE)
-#define SIGIO_SCHED_EVENT 1
-#endif
-
 #define RTSIGIO SIGRTMIN
-#define RTSIGTIM (SIGRTMIN+1)
 
 
 struct _pollfd_list
@@ -64,7 +59,6 @@ struct _pollfd_list
 typedef struct _pollfd_list pollfd_list_t;
 
 pollfd_list_t pollfd_list;
-static int can_do_event = 0;
 static int sigio_is_screwed = 0;	/* We overflowed our sigio queue */
 static sigset_t our_sigset;
 
@@ -93,9 +87,6 @@ rb_init_netio_sigio(void)
 	sigemptyset(&our_sigset);
 	sigaddset(&our_sigset, RTSIGIO);
 	sigaddset(&our_sigset, SIGIO);
-#ifdef SIGIO_SCHED_EVENT
-	sigaddset(&our_sigset, RTSIGTIM);
-#endif
 	sigprocmask(SIG_BLOCK, &our_sigset, NULL);
 	return 0;
 }
@@ -238,7 +229,7 @@ rb_select_sigio(long delay)
 	struct siginfo si;
 
 	struct timespec timeout;
-	if(rb_sigio_supports_event() || delay >= 0)
+	if(delay >= 0)
 	{
 		timeout.tv_sec = (delay / 1000);
 		timeout.tv_nsec = (delay % 1000) * 1000000;
@@ -248,7 +239,7 @@ rb_select_sigio(long delay)
 	{
 		if(!sigio_is_screwed)
 		{
-			if(can_do_event || delay < 0)
+			if(delay < 0)
 			{
 				sig = sigwaitinfo(&our_sigset, &si);
 			}
@@ -267,16 +258,6 @@ rb_select_sigio(long delay)
 					sigio_is_screwed = 1;
 					break;
 				}
-#ifdef SIGIO_SCHED_EVENT
-				if(sig == RTSIGTIM && can_do_event)
-				{
-					struct ev_entry *ev = (struct ev_entry *)si.si_ptr;
-					if(ev == NULL)
-						continue;
-					rb_run_event(ev);
-					continue;
-				}
-#endif
 				fd = si.si_fd;
 				pollfd_list.pollfds[fd].revents |= si.si_band;
 				revents = pollfd_list.pollfds[fd].revents;
@@ -375,81 +356,6 @@ rb_select_sigio(long delay)
 	return 0;
 }
 
-#if defined(SIGIO_SCHED_EVENT)
-void
-rb_sigio_init_event(void)
-{
-	rb_sigio_supports_event();
-}
-
-
-int
-rb_sigio_supports_event(void)
-{
-	timer_t timer;
-	struct sigevent ev;
-	if(can_do_event == 1)
-		return 1;
-	if(can_do_event == -1)
-		return 0;
-
-	ev.sigev_signo = SIGVTALRM;
-	ev.sigev_notify = SIGEV_SIGNAL;
-	if(timer_create(CLOCK_REALTIME, &ev, &timer) != 0)
-	{
-		can_do_event = -1;
-		return 0;
-	}
-	timer_delete(timer);
-	can_do_event = 1;
-	return 1;
-}
-
-int
-rb_sigio_sched_event(struct ev_entry *event, int when)
-{
-	timer_t *id;
-	struct sigevent ev;
-	struct itimerspec ts;
-	if(can_do_event <= 0)
-		return 0;
-
-	memset(&ev, 0, sizeof(&ev));
-	event->comm_ptr = rb_malloc(sizeof(timer_t));
-	id = event->comm_ptr;
-	ev.sigev_notify = SIGEV_SIGNAL;
-	ev.sigev_signo = RTSIGTIM;
-	ev.sigev_value.sival_ptr = event;
-
-	if(timer_create(CLOCK_REALTIME, &ev, id) < 0)
-	{
-		rb_lib_log("timer_create: %m");
-		return 0;
-	}
-	memset(&ts, 0, sizeof(ts));
-	ts.it_value.tv_sec = when;
-	ts.it_value.tv_nsec = 0;
-	if(event->frequency != 0)
-		ts.it_interval = ts.it_value;
-
-	if(timer_settime(*id, 0, &ts, NULL) < 0)
-	{
-		rb_lib_log("timer_settime: %m");
-		return 0;
-	}
-	return 1;
-}
-
-void
-rb_sigio_unsched_event(struct ev_entry *event)
-{
-	if(can_do_event <= 0)
-		return;
-	timer_delete(*((timer_t *) event->comm_ptr));
-	rb_free(event->comm_ptr);
-	event->comm_ptr = NULL;
-}
-#endif /* SIGIO_SCHED_EVENT */
 
 #else
 
@@ -481,31 +387,3 @@ rb_setup_fd_sigio(rb_fde_t *F)
 }
 
 #endif
-
-#if !defined(USING_SIGIO) || !defined(SIGIO_SCHED_EVENT)
-void
-rb_sigio_init_event(void)
-{
-	return;
-}
-
-int
-rb_sigio_sched_event(struct ev_entry *event, int when)
-{
-	errno = ENOSYS;
-	return -1;
-}
-
-void
-rb_sigio_unsched_event(struct ev_entry *event)
-{
-	return;
-}
-
-int
-rb_sigio_supports_event(void)
-{
-	errno = ENOSYS;
-	return 0;
-}
-#endif /* !USING_SIGIO || !SIGIO_SCHED_EVENT */
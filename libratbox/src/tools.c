@@ -42,7 +42,7 @@
  * init_rb_dlink_nodes
  *
  */
-static rb_bh *dnode_heap;
+static RB_THREAD_LOCAL rb_bh *dnode_heap;
 void
 rb_init_rb_dlink_nodes(size_t dh_size)
 {
@@ -189,7 +189,7 @@ m_join(struct Client *client_p, struct Client *source_p, int parc, const char *p
 		/* IRCNet !channels, creation logic moved from hash.c */
 		if (*name == '!')
 		{
-			rb_dlink_node *lp;
+			struct Channel *clash;
 			int creating = 0;
 			char *sn = name + 1; /* shortname */
 
@@ -200,11 +200,11 @@ m_join(struct Client *client_p, struct Client *source_p, int parc, const char *p
 			}
 
 			/* there could be more channels with the same shortname;
-			   therefore the list */
-			lp = find_channels(sn);
+			   find_channels() is asked again for those */
+			chptr = find_channels(sn, NULL);
 
 			/* non-existant, great. */
-			if (!lp)
+			if (!chptr)
 			{
 				static char chname[CHANNELLEN+1];
 
@@ -226,20 +226,17 @@ m_join(struct Client *client_p, struct Client *source_p, int parc, const char *p
 			} else {
 				int nclashes = 0;
 				/* channel name found, so we'll check if there's more ..*/
-				chptr = lp->data;
 
 				/* remember the full name */
 				name = chptr->chname;
 
 				/* if theres no full name match there may be more with short name.. */
-				if (irccmp(name+1, sn)) RB_DLINK_FOREACH(lp, lp->next)
+				if (irccmp(name+1, sn))
 				{
-					chptr = lp->data;
-
-					if ((chptr->chname[0] == '!') &&
-					    !irccmp(sn, chptr->chname + 1 + CHIDLEN)) {
+					for(clash = chptr; (clash = find_channels(sn, clash)) != NULL;)
+					{
 						sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
-						   me.name, source_p->name, chptr->chname);
+						   me.name, source_p->name, clash->chname);
 						nclashes++;
 					}
 				}
@@ -981,7 +978,7 @@ ms_sjoin(struct Client *client_p, struct Client *source_p, int parc, const char
 			remove_ban_list(chptr, source_p, &chptr->reoplist,
 					'R', CAP_IRCNET, ONLY_CHANOPS);
 
-		chptr->ban_serial++;
+		invalidate_bancache(chptr);
 	}
 
 
@@ -1065,7 +1062,7 @@ can_join(struct Client *source_p, struct Channel *chptr, char *key)
 		{
 			if(!ConfigChannel.use_invex)
 				return (ERR_INVITEONLYCHAN);
-			if (!match_ban(&chptr->invexlist, source_p, NULL, 0))
+			if (!match_ban(chptr, &chptr->invexlist, source_p, NULL, 0))
 				return ERR_INVITEONLYCHAN;
 		}
 	}
@@ -1082,7 +1079,7 @@ can_join(struct Client *source_p, struct Channel *chptr, char *key)
 	if(over_limit) {
 		/* if the channel is opless and the client matches a reop mask,
 		 * override +l limit. */
-		if (!lp && match_ban(&chptr->reoplist, source_p, NULL, 0))
+		if (!lp && match_ban(chptr, &chptr->reoplist, source_p, NULL, 0))
 		{
 			RB_DLINK_FOREACH(lp, chptr->members.head)
 			{
@@ -1093,7 +1090,7 @@ can_join(struct Client *source_p, struct Channel *chptr, char *key)
 					return (ERR_CHANNELISFULL);
 
 				chptr->reop = rb_current_time();
-				if (match_ban(&chptr->reoplist, m->client_p, NULL, 0))
+				if (match_ban(chptr, &chptr->reoplist, m->client_p, NULL, 0))
 					return (ERR_CHANNELISFULL);
 			}
 
@@ -1268,6 +1265,7 @@ remove_our_modes(struct Channel *chptr)
 		if(is_chanop(msptr))
 		{
 			msptr->flags &= ~CHFL_CHANOP;
+			update_member_flags(msptr);
 			*mbuf++ = 'o';
 			pbuf += rb_sprintf(pbuf, " %s", Anon(msptr->client_p->name));
 
@@ -1290,6 +1288,7 @@ remove_our_modes(struct Channel *chptr)
 				}
 
 				msptr->flags &= ~CHFL_VOICE;
+				update_member_flags(msptr);
 				*mbuf++ = 'v';
 				count++;
 				pbuf += rb_sprintf(pbuf, " %s", Anon(msptr->client_p->name));
@@ -1298,6 +1297,7 @@ remove_our_modes(struct Channel *chptr)
 		else if(is_voiced(msptr))
 		{
 			msptr->flags &= ~CHFL_VOICE;
+			update_member_flags(msptr);
 			*mbuf++ = 'v';
 			count++;
 			pbuf += rb_sprintf(pbuf, " %s", Anon(msptr->client_p->name));
@@ -1389,4 +1389,5 @@ remove_ban_list(struct Channel *chptr, struct Client *source_p,
 
 	list->head = list->tail = NULL;
 	list->length = 0;
+	ban_list_changed(chptr, list);
 }
@@ -456,10 +456,13 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid,
 	actualBan->when = rb_current_time();
 
 	rb_dlinkAdd(actualBan, &actualBan->node, list);
+	ban_list_changed(chptr, list);
 
-	/* invalidate the can_send() cache */
-	if(mode_type == CHFL_BAN || mode_type == CHFL_EXCEPTION)
-		chptr->ban_serial++;
+	/* update the can_send() cache */
+	if(mode_type == CHFL_BAN)
+		bancache_ban_added(chptr, actualBan);
+	else if(mode_type == CHFL_EXCEPTION)
+		invalidate_bancache(chptr);
 
 	return 1;
 }
@@ -487,10 +490,13 @@ del_id(struct Channel *chptr, const char *banid, rb_dlink_list *list, long mode_
 		{
 			rb_dlinkDelete(&banptr->node, list);
 			free_ban(banptr);
+			ban_list_changed(chptr, list);
 
-			/* invalidate the can_send() cache */
-			if(mode_type == CHFL_BAN || mode_type == CHFL_EXCEPTION)
-				chptr->ban_serial++;
+			/* update the can_send() cache */
+			if(mode_type == CHFL_BAN)
+				bancache_ban_removed(chptr);
+			else if(mode_type == CHFL_EXCEPTION)
+				invalidate_bancache(chptr);
 
 			return 1;
 		}
@@ -1025,6 +1031,7 @@ chm_op(struct Client *source_p, struct Channel *chptr,
 			mstptr->flags |= CHFL_UNIQOP;
 		mstptr->flags |= CHFL_CHANOP;
 		mstptr->flags &= ~CHFL_DEOPPED;
+		update_member_flags(mstptr);
 	}
 	else
 	{
@@ -1048,6 +1055,7 @@ chm_op(struct Client *source_p, struct Channel *chptr,
 
 		chptr->reop = rb_current_time();
 		mstptr->flags &= ~(CHFL_CHANOP|CHFL_UNIQOP);
+		update_member_flags(mstptr);
 	}
 }
 
@@ -1113,6 +1121,7 @@ chm_voice(struct Client *source_p, struct Channel *chptr,
 		mode_changes[mode_count++].client = targ_p;
 
 		mstptr->flags |= CHFL_VOICE;
+		update_member_flags(mstptr);
 	}
 	else
 	{
@@ -1126,6 +1135,7 @@ chm_voice(struct Client *source_p, struct Channel *chptr,
 		mode_changes[mode_count++].client = targ_p;
 
 		mstptr->flags &= ~CHFL_VOICE;
+		update_member_flags(mstptr);
 	}
 }
 
@@ -666,6 +666,7 @@ change_local_nick(struct Client *client_p, struct Client *source_p, char *nick,
 	del_from_hash(HASH_CLIENT, source_p->name, source_p);
 	strcpy(source_p->user->name, nick);
 	add_to_hash(HASH_CLIENT, nick, source_p);
+	invalidate_names_user(source_p);
 
 	if(!samenick)
 		monitor_signon(source_p);
@@ -728,6 +729,7 @@ change_remote_nick(struct Client *client_p, struct Client *source_p,
 
 	strcpy(source_p->user->name, nick);
 	add_to_hash(HASH_CLIENT, nick, source_p);
+	invalidate_names_user(source_p);
 
 	if(!samenick)
 		monitor_signon(source_p);
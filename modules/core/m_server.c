@@ -631,7 +631,11 @@ check_server(const char *name, struct Client *client_p)
 
 	/* clear ZIP/TB if they support but we dont want them */
 	if(!ServerConfCompressed(server_p))
-		ClearCap(client_p, CAP_ZIP);
+		ClearCap(client_p, CAP_ZIP | CAP_ZSTD);
+
+	/* ZSTD is only advertised alongside ZIP, and picks the method */
+	if(!zstd_ok || NotCapable(client_p, CAP_ZIP))
+		ClearCap(client_p, CAP_ZSTD);
 
 	if(!ServerConfTb(server_p))
 		ClearCap(client_p, CAP_TB);
@@ -1130,6 +1134,7 @@ server_estab(struct Client *client_p, const char *name)
 #endif
 			send_capabilities(client_p, default_server_capabs
 				  | (ServerConfCompressed(server_p) && zlib_ok ? CAP_ZIP : 0)
+				  | (ServerConfCompressed(server_p) && zlib_ok && zstd_ok ? CAP_ZSTD : 0)
 				  | (ServerConfTb(server_p) ? CAP_TB : 0));
 			/* this is mr_server() for TS6. */
 			if (ServerConfMask(server_p, me.name) != me.name && !ConfigServerHide.hidden) {
@@ -1169,7 +1174,10 @@ server_estab(struct Client *client_p, const char *name)
 	 * In any case, this saves on system calls, and for ziplinks it
 	 * is required so that we only start sending it when ssld confirms
 	 * it has enabled compression ('R' message on control pipe).
+	 * The handshake itself has to go out uncompressed, so push out
+	 * whatever is still waiting for the end of loop flush first.
 	 */
+	send_pop_queue(client_p);
 	SetCork(client_p);
 
 	/* Enable compression now */
@@ -84,6 +84,12 @@ mr_capab(struct Client *client_p, struct Client *source_p, int parc, const char
 		char *t = LOCAL_COPY(parv[i]);
 		for(s = rb_strtok_r(t, " ", &p); s; s = rb_strtok_r(NULL, " ", &p))
 		{
+			if(!strncmp(s, "ZSTDDICT=", 9))
+			{
+				client_p->localClient->zstd_dict = strtoul(s + 9, NULL, 16);
+				continue;
+			}
+
 			for(cap = captab; cap->name; cap++)
 			{
 				if(!irccmp(cap->name, s))
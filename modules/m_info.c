@@ -407,6 +407,12 @@ static struct InfoStruct info_table[] = {
 		{ &ConfigFileEntry.dots_in_ident }, 
 		"Number of permissable dots in an ident"
 	},
+	{
+		"epoll_persistent",
+		OUTPUT_BOOLEAN_YN,
+		{ &ConfigFileEntry.epoll_persistent }, 
+		"Register fds with epoll once instead of on every handler change"
+	},
 	{
 		"failed_oper_notice",
 		OUTPUT_BOOLEAN,
@@ -648,6 +654,12 @@ static struct InfoStruct info_table[] = {
 		{ &ConfigFileEntry.reject_duration }, 
 		"Client rejection cache duration",
 	},
+	{
+		"server_flush_delay",
+		OUTPUT_DECIMAL,
+		{ &ConfigFileEntry.server_flush_delay }, 
+		"Microseconds to hold server link output for coalescing",
+	},
 	{
 		"short_motd",
 		OUTPUT_BOOLEAN_YN,
@@ -697,10 +697,10 @@ remove_perm_kline(struct Client *source_p, const char *user, const char *host)
 {
 	struct AddressRec *arec;
 	struct ConfItem *aconf;
-	int i;
+	rb_dlink_node *ptr;
 
 	/* dont need to be safe, as we're quitting once we've done anything */
-	HOSTHASH_WALK(i, arec)
+	HOSTHASH_WALK(ptr, arec)
 	{
 		if((arec->type & ~CONF_SKIPUSER) == CONF_KILL)
 		{
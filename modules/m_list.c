@@ -106,6 +106,61 @@ mo_list(struct Client *client_p, struct Client *source_p, int parc, const char *
 	return 0;
 }
 
+struct list_query
+{
+	int min;
+	int max;
+};
+
+static int
+list_channel(struct Client *source_p, void *entry, void *data)
+{
+	struct Channel *chptr = entry;
+	struct list_query *query = data;
+	int users = rb_dlink_list_length(&chptr->members);
+
+	/* limited lists walk in member count order, nothing after this fits */
+	if(users >= query->max)
+		return 0;
+
+	if(users <= query->min)
+		return 1;
+
+	if(SecretChannel(chptr) && !IsMember(source_p, chptr))
+		return 1;
+
+	sendto_one(source_p, form_str(RPL_LIST),
+		   me.name, source_p->name, chptr->chname, users,
+		   chptr->topic == NULL ? "" : chptr->topic->topic);
+	return 1;
+}
+
+static void
+list_end(struct Client *source_p, void *data)
+{
+	sendto_one(source_p, form_str(RPL_LISTEND), me.name, source_p->name);
+}
+
+/* list_channels()
+ *
+ * inputs	- pointer to client requesting list, channel to start at,
+ *		  member count bounds
+ * output	-
+ * side effects	- channels are listed to source_p as its sendq drains
+ */
+static void
+list_channels(struct Client *source_p, rb_dlink_node *start, int min, int max)
+{
+	struct list_query *query;
+
+	query = rb_malloc(sizeof(struct list_query));
+	query->min = min;
+	query->max = max;
+
+	sendto_one(source_p, form_str(RPL_LISTSTART), me.name, source_p->name);
+	send_cursor(source_p, start, list_channel, list_end, query);
+}
+
 /* list_all_channels()
  *
  * inputs	- pointer to client requesting list
@@ -115,62 +170,17 @@ mo_list(struct Client *client_p, struct Client *source_p, int parc, const char *
 static void
 list_all_channels(struct Client *source_p)
 {
-	struct Channel *chptr;
-	rb_dlink_node *ptr;
-	int sendq_limit;
-	int count = 0;
-	/* give them an output limit of 90% of their sendq. --fl */
-	sendq_limit = (int)get_sendq(source_p);
-	sendq_limit /= 10;
-	sendq_limit *= 9;
-
-	sendto_one(source_p, form_str(RPL_LISTSTART), me.name, source_p->name);
-	SetCork(source_p);
-
-	RB_DLINK_FOREACH(ptr, global_channel_list.head)
-	{
-		chptr = ptr->data;
-
-		/* if theyre overflowing their sendq, stop. --fl */
-		if(rb_linebuf_len(&source_p->localClient->buf_sendq) > sendq_limit)
-		{
-			sendto_one(source_p, form_str(ERR_TOOMANYMATCHES),
-				   me.name, source_p->name, "LIST");
-			break;
-		}
-
-		if(SecretChannel(chptr) && !IsMember(source_p, chptr))
-			continue;
-		sendto_one(source_p, form_str(RPL_LIST),
-			   me.name, source_p->name, chptr->chname,
-			   rb_dlink_list_length(&chptr->members),
-			   chptr->topic == NULL ? "" : chptr->topic->topic);
-
-		if(count++ >= 10)
-		{
-			ClearCork(source_p);
-			send_pop_queue(source_p);
-			SetCork(source_p);
-			count = 0;
-		}
-	}
-	ClearCork(source_p);
-	sendto_one(source_p, form_str(RPL_LISTEND), me.name, source_p->name);
-	return;
+	list_channels(source_p, global_channel_list.head, -1, INT_MAX);
 }
 
 static void
 list_limit_channels(struct Client *source_p, const char *param)
 {
-	struct Channel *chptr;
 	char *args;
 	char *p;
-	rb_dlink_node *ptr;
-	int sendq_limit;
 	int max = INT_MAX;
 	int min = 0;
 	int i;
-	int count = 0;
 
 	args = LOCAL_COPY(param);
 
@@ -198,49 +208,8 @@ list_limit_channels(struct Client *source_p, const char *param)
 			args = p;
 	}
 
-	/* give them an output limit of 90% of their sendq. --fl */
-	sendq_limit = (unsigned int)get_sendq(source_p);
-	sendq_limit /= 10;
-	sendq_limit *= 9;
-
-	sendto_one(source_p, form_str(RPL_LISTSTART), me.name, source_p->name);
-	SetCork(source_p);
-
-	RB_DLINK_FOREACH(ptr, global_channel_list.head)
-	{
-		chptr = ptr->data;
-
-		/* if theyre overflowing their sendq, stop. --fl */
-		if(rb_linebuf_len(&source_p->localClient->buf_sendq) > sendq_limit)
-		{
-			sendto_one(source_p, form_str(ERR_TOOMANYMATCHES),
-				   me.name, source_p->name, "LIST");
-			break;
-		}
-
-		if((int)rb_dlink_list_length(&chptr->members) >= max ||
-		   (int)rb_dlink_list_length(&chptr->members) <= min)
-			continue;
-
-		if(SecretChannel(chptr) && !IsMember(source_p, chptr))
-			continue;
-
-		sendto_one(source_p, form_str(RPL_LIST),
-			   me.name, source_p->name, chptr->chname,
-			   rb_dlink_list_length(&chptr->members),
-			   chptr->topic == NULL ? "" : chptr->topic->topic);
-
-		if(count++ >= 10)
-		{
-			ClearCork(source_p);
-			send_pop_queue(source_p);
-			SetCork(source_p);
-			count = 0;
-		}
-	}
-	ClearCork(source_p);
-	sendto_one(source_p, form_str(RPL_LISTEND), me.name, source_p->name);
-	return;
+	/* straight to the first channel over min in member count order */
+	list_channels(source_p, first_channel_over(min), min, max);
 }
 
 
@@ -275,15 +244,11 @@ list_named_channel(struct Client *source_p, const char *name)
 
 	if(chptr == NULL)
 	{
-		rb_dlink_node *lp;
-
 		/* this means the user was using shortname */
-		if (*n == '!' && (lp = find_channels(n + 1))) {
+		if (*n == '!' && (chptr = find_channels(n + 1, NULL))) {
 			int showit;
 
-			RB_DLINK_FOREACH(lp, lp) {
-				chptr = lp->data;
-
+			for(; chptr != NULL; chptr = find_channels(n + 1, chptr)) {
 				if ((chptr->chname[0] != '!') ||
 				     irccmp(n + 1, chptr->chname + 1 + CHIDLEN))
 					continue;
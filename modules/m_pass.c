@@ -79,6 +79,11 @@ mr_pass(struct Client *client_p, struct Client *source_p, int parc, const char *
 				client_p->localClient->caps |= CAP_TB;
 			if (strchr(parv[4], 'j'))
 				client_p->localClient->caps |= CAP_JAPANESE;
+			/* we send zstd support and our dictionary on top of 2.11's */
+			if (strchr(parv[4], 'z'))
+				client_p->localClient->caps |= CAP_ZSTD;
+			if (parc > 5 && !strncmp(parv[5], "ZSTDDICT=", 9))
+				client_p->localClient->zstd_dict = strtoul(parv[5] + 9, NULL, 16);
 
 			if (!strcmp(parv[2], IRCNET_VERSTRING)) {
 				/* nah, it's just us pretending, we're going to receive CAPAB.
@@ -198,6 +198,20 @@ rehash_txlines(struct Client *source_p)
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
+
+	maskset_changed(&xline_set);
+}
+
+static void
+rehash_tresv(void *data, void *unused)
+{
+	struct ConfItem *aconf = data;
+
+	if((aconf->flags & CONF_FLAGS_TEMPORARY) == 0)
+		return;
+
+	del_from_hash(HASH_RESV, aconf->host, aconf);
+	free_conf(aconf);
 }
 
 static void
@@ -206,22 +220,13 @@ rehash_tresvs(struct Client *source_p)
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
-	int i;
 
 	sendto_realops_flags(UMODE_ALL, L_ALL, "%s is clearing temp resvs",
 			     get_oper_name(source_p));
 
-	HASH_WALK_SAFE(i, R_MAX, ptr, next_ptr, resvTable)
-	{
-		aconf = ptr->data;
-
-		if((aconf->flags & CONF_FLAGS_TEMPORARY) == 0)
-			continue;
+	hash_walk(HASH_RESV, rehash_tresv, NULL);
 
-		free_conf(aconf);
-		rb_dlinkDestroy(ptr, &resvTable[i]);
-	}
-	HASH_WALK_END RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
 	{
 		aconf = ptr->data;
 
@@ -231,6 +236,8 @@ rehash_tresvs(struct Client *source_p)
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
+
+	maskset_changed(&resv_set);
 }
 
 static void
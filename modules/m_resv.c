@@ -307,6 +307,7 @@ parse_resv(struct Client *source_p, const char *name, const char *reason, int te
 			aconf->flags |= CONF_FLAGS_LOCKED;
 
 		rb_dlinkAddAlloc(aconf, &resv_conf_list);
+		maskset_changed(&resv_set);
 
 		notify_resv(source_p, aconf->host, aconf->passwd, temp_time);
 
@@ -440,6 +441,7 @@ remove_resv(struct Client *source_p, const char *name)
 
 		/* already have ptr from the loop above.. */
 		rb_dlinkDestroy(ptr, &resv_conf_list);
+		maskset_changed(&resv_set);
 		free_conf(aconf);
 	}
 
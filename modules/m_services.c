@@ -212,6 +212,7 @@ me_rsfnc(struct Client *client_p, struct Client *source_p, int parc, const char
 	del_from_hash(HASH_CLIENT, target_p->name, target_p);
 	strcpy(target_p->user->name, parv[2]);
 	add_to_hash(HASH_CLIENT, target_p->name, target_p);
+	invalidate_names_user(target_p);
 
 	monitor_signon(target_p);
 
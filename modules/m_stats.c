@@ -52,6 +52,7 @@
 #include "scache.h"
 #include "s_log.h"
 #include "blacklist.h"
+#include "sslproc.h"
 
 static int m_stats(struct Client *, struct Client *, int, const char **);
 
@@ -120,7 +121,7 @@ static void stats_gecos(struct Client *);
 static void stats_class(struct Client *);
 static void stats_memory(struct Client *);
 static void stats_servlinks(struct Client *);
-static void stats_ltrace(struct Client *, int, const char **);
+static int stats_ltrace(struct Client *, int, const char **);
 static void stats_ziplinks(struct Client *);
 static void stats_comm(struct Client *);
 /* This table contains the possible stats items, in order:
@@ -192,6 +193,7 @@ m_stats(struct Client *client_p, struct Client *source_p, int parc, const char *
 {
 	static time_t last_used = 0;
 	int i;
+	int pending = 0;
 	char statchar;
 
 	statchar = parv[1][0];
@@ -236,7 +238,7 @@ m_stats(struct Client *client_p, struct Client *source_p, int parc, const char *
 			SetCork(source_p);
 			/* Blah, stats L needs the parameters, none of the others do.. */
 			if(statchar == 'L' || statchar == 'l')
-				stats_ltrace(source_p, parc, parv);
+				pending = stats_ltrace(source_p, parc, parv);
 			else
 				stats_cmd_table[i].handler(source_p);
 			ClearCork(source_p);
@@ -244,8 +246,9 @@ m_stats(struct Client *client_p, struct Client *source_p, int parc, const char *
 		}
 	}
 
-	/* Send the end of stats notice */
-	sendto_one_numeric(source_p, RPL_ENDOFSTATS, form_str(RPL_ENDOFSTATS), statchar);
+	/* Send the end of stats notice, unless stats L is still going */
+	if(!pending)
+		sendto_one_numeric(source_p, RPL_ENDOFSTATS, form_str(RPL_ENDOFSTATS), statchar);
 
 	return 0;
 }
@@ -257,18 +260,19 @@ stats_dns_servers(struct Client *source_p)
 }
 
 static void
-stats_delay(struct Client *source_p)
+stats_delay_entry(void *data, void *arg)
 {
-	struct nd_entry *nd;
-	rb_dlink_node *ptr;
-	int i;
+	struct nd_entry *nd = data;
 
-	HASH_WALK(i, U_MAX, ptr, ndTable)
-	{
-		nd = ptr->data;
-		sendto_one_notice(source_p, "Delaying: %s for %ld", nd->name, (long)nd->expire);
-	}
-HASH_WALK_END}
+	sendto_one_notice((struct Client *)arg, "Delaying: %s for %ld", nd->name,
+			  (long)nd->expire);
+}
+
+static void
+stats_delay(struct Client *source_p)
+{
+	hash_walk(HASH_ND, stats_delay_entry, source_p);
+}
 
 static void
 stats_hash(struct Client *source_p)
@@ -497,7 +501,8 @@ stats_auth(struct Client *source_p)
 	const char *name, *host, *pass, *user, *classname;
 	struct AddressRec *arec;
 	struct ConfItem *aconf;
-	int i, port;
+	rb_dlink_node *ptr;
+	int port;
 
 	/* Oper only, if unopered, return ERR_NOPRIVS */
 	if((ConfigFileEntry.stats_i_oper_only == 2) && !IsOper(source_p))
@@ -527,7 +532,7 @@ stats_auth(struct Client *source_p)
 	/* Theyre opered, or allowed to see all auth blocks */
 	else
 	{
-		HOSTHASH_WALK(i, arec)
+		HOSTHASH_WALK(ptr, arec)
 		{
 			if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT)
 			{
@@ -620,7 +625,7 @@ stats_klines(struct Client *source_p)
 	struct ConfItem *aconf;
 	const char *host, *pass, *user, *oper_reason;
 	struct AddressRec *arec;
-	int i;
+	rb_dlink_node *ptr;
 
 	/* Oper only, if unopered, return ERR_NOPRIVS */
 	if((ConfigFileEntry.stats_k_oper_only == 2) && !IsOper(source_p))
@@ -657,7 +662,7 @@ stats_klines(struct Client *source_p)
 	/* Theyre opered, or allowed to see all klines */
 	else
 	{
-		HOSTHASH_WALK(i, arec)
+		HOSTHASH_WALK(ptr, arec)
 		{
 			if((arec->type & ~CONF_SKIPUSER) == CONF_KILL)
 			{
@@ -801,12 +806,31 @@ stats_ports(struct Client *source_p)
 		show_ports(source_p);
 }
 
+struct stats_resv_query
+{
+	struct Client *source_p;
+	int temp;
+};
+
+static void
+stats_resv_entry(void *data, void *arg)
+{
+	struct stats_resv_query *query = arg;
+	struct ConfItem *aconf = data;
+
+	if(((aconf->flags & CONF_FLAGS_TEMPORARY) != 0) != query->temp)
+		return;
+
+	sendto_one_numeric(query->source_p, RPL_STATSQLINE, form_str(RPL_STATSQLINE),
+			   query->temp ? 'q' : 'Q', aconf->port, aconf->host, aconf->passwd);
+}
+
 static void
 stats_tresv(struct Client *source_p)
 {
+	struct stats_resv_query query = { source_p, 1 };
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
-	int i;
 
 	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
 	{
@@ -817,23 +841,16 @@ stats_tresv(struct Client *source_p)
 					   'q', aconf->port, aconf->host, aconf->passwd);
 	}
 
-	HASH_WALK(i, R_MAX, ptr, resvTable)
-	{
-		aconf = ptr->data;
-		if(aconf->flags & CONF_FLAGS_TEMPORARY)
-			sendto_one_numeric(source_p, RPL_STATSQLINE,
-					   form_str(RPL_STATSQLINE),
-					   'q', aconf->port, aconf->host, aconf->passwd);
-	}
-HASH_WALK_END}
+	hash_walk(HASH_RESV, stats_resv_entry, &query);
+}
 
 
 static void
 stats_resv(struct Client *source_p)
 {
+	struct stats_resv_query query = { source_p, 0 };
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
-	int i;
 
 	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
 	{
@@ -844,15 +861,8 @@ stats_resv(struct Client *source_p)
 					   'Q', aconf->port, aconf->host, aconf->passwd);
 	}
 
-	HASH_WALK(i, R_MAX, ptr, resvTable)
-	{
-		aconf = ptr->data;
-		if((aconf->flags & CONF_FLAGS_TEMPORARY) == 0)
-			sendto_one_numeric(source_p, RPL_STATSQLINE,
-					   form_str(RPL_STATSQLINE),
-					   'Q', aconf->port, aconf->host, aconf->passwd);
-	}
-HASH_WALK_END}
+	hash_walk(HASH_RESV, stats_resv_entry, &query);
+}
 
 static void
 stats_usage(struct Client *source_p)
@@ -913,6 +923,7 @@ stats_tstats(struct Client *source_p)
 	struct Client *target_p;
 	struct ServerStatistics sp;
 	rb_dlink_node *ptr;
+	unsigned long handshakes, resumed;
 
 	memcpy(&sp, &ServerStats, sizeof(struct ServerStatistics));
 
@@ -953,6 +964,11 @@ stats_tstats(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :numerics seen %u", sp.is_num);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :auth successes %u fails %u", sp.is_asuc, sp.is_abad);
+	ssld_session_stats(&handshakes, &resumed);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "T :TLS handshakes %lu resumed %lu (%lu%%)", handshakes, resumed,
+			   handshakes ? resumed * 100 / handshakes : 0);
+	report_ssld(source_p);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :Client Server");
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :connected %u %u", sp.is_cl, sp.is_sv);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
@@ -1185,6 +1201,7 @@ stats_memory(struct Client *source_p)
 	struct Ban *actualBan;
 	rb_dlink_node *dlink;
 	rb_dlink_node *ptr;
+	int i;
 	int channel_count = 0;
 	int local_client_conf_count = 0;	/* local client conf links */
 	int users_counted = 0;	/* user structs */
@@ -1200,6 +1217,7 @@ stats_memory(struct Client *source_p)
 	int conf_count = 0;	/* conf lines */
 	int users_invited_count = 0;	/* users invited */
 	int user_channels = 0;	/* users in channels */
+	int user_chanhash = 0;	/* users with a channel index */
 	int aways_counted = 0;
 	size_t number_servers_cached;	/* number of servers cached by scache */
 
@@ -1208,13 +1226,18 @@ stats_memory(struct Client *source_p)
 	size_t channel_except_memory = 0;
 	size_t channel_invex_memory = 0;
 
+	size_t user_chanhash_memory = 0;
 	size_t away_memory = 0;	/* memory used by aways */
 	size_t wwm = 0;		/* whowas array memory used */
 	size_t conf_memory = 0;	/* memory used by conf lines */
 	size_t mem_servers_cached;	/* memory used by scache */
+	size_t client_hash_slots, client_hash_mem;
+	size_t chan_hash_slots, chan_hash_mem;
+	size_t host_hash_slots, host_hash_mem;
 
 	size_t rb_linebuf_count = 0;
 	size_t rb_linebuf_memory_used = 0;
+	size_t rb_linebuf_size = 0;
 
 	size_t total_channel_memory = 0;
 	size_t totww = 0;
@@ -1251,6 +1274,12 @@ stats_memory(struct Client *source_p)
 				users_invited_count +=
 					rb_dlink_list_length(&target_p->localClient->invited);
 			user_channels += rb_dlink_list_length(&target_p->user->channel);
+			if(target_p->user->chanhash != NULL)
+			{
+				user_chanhash++;
+				user_chanhash_memory +=
+					sizeof(struct membership *) << target_p->user->chanhash_bits;
+			}
 			if(target_p->user->away)
 			{
 				aways_counted++;
@@ -1307,9 +1336,10 @@ stats_memory(struct Client *source_p)
 			   users_invited_count, users_invited_count * sizeof(rb_dlink_node));
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
-			   "z :User channels %u(%zu) Aways %u(%zu)",
+			   "z :User channels %u(%zu) index %u(%zu) Aways %u(%zu)",
 			   user_channels,
-			   user_channels * sizeof(rb_dlink_node), aways_counted, away_memory);
+			   user_channels * sizeof(rb_dlink_node),
+			   user_chanhash, user_chanhash_memory, aways_counted, away_memory);
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :Attached confs %u(%zu)",
@@ -1334,6 +1364,9 @@ stats_memory(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :Invex %u(%zu)", channel_invex, channel_invex_memory);
 
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :Ban cache entries kept over ban changes %lu", ban_cache_kept);
+
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :Channel members %u(%zu) invite %u(%zu)",
 			   channel_users,
@@ -1352,13 +1385,24 @@ stats_memory(struct Client *source_p)
 
 	totww = wwu * sizeof(struct User) + wwm;
 
+	count_hash_memory(HASH_CLIENT, &client_hash_slots, &client_hash_mem);
+	count_hash_memory(HASH_CHANNEL, &chan_hash_slots, &chan_hash_mem);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
-			   "z :Hash: client %u(%zu) chan %u(%zu)",
-			   U_MAX, (U_MAX * sizeof(rb_dlink_list)),
-			   CH_MAX, (CH_MAX * sizeof(rb_dlink_list)));
+			   "z :Hash: client %zu(%zu) chan %zu(%zu)",
+			   client_hash_slots, client_hash_mem,
+			   chan_hash_slots, chan_hash_mem);
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
-			   "z :linebuf %zu(%zu)", rb_linebuf_count, rb_linebuf_memory_used);
+			   "z :linebuf %zu(%zu), %s line scan", rb_linebuf_count,
+			   rb_linebuf_memory_used, rb_linebuf_eol_kernel_name());
+
+	for(i = 0; rb_count_rb_linebuf_class_memory(i, &rb_linebuf_size,
+						     &rb_linebuf_count, &rb_linebuf_memory_used); i++)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "z :linebuf size %zu: %zu(%zu)", rb_linebuf_size,
+				   rb_linebuf_count, rb_linebuf_memory_used);
+	}
 
 	count_scache(&number_servers_cached, &mem_servers_cached);
 
@@ -1366,9 +1410,14 @@ stats_memory(struct Client *source_p)
 			   "z :scache %ld(%ld)",
 			   (long)number_servers_cached, (long)mem_servers_cached);
 
+	count_hash_memory(HASH_HOSTNAME, &host_hash_slots, &host_hash_mem);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
-			   "z :hostname hash %d(%ld)",
-			   HOST_MAX, (long)HOST_MAX * sizeof(rb_dlink_list));
+			   "z :hostname hash %zu(%zu)", host_hash_slots, host_hash_mem);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :xline masks %lu(%zu) resv masks %lu(%zu)",
+			   rb_dlink_list_length(&xline_conf_list), maskset_memory(&xline_set),
+			   rb_dlink_list_length(&resv_conf_list), maskset_memory(&resv_set));
 
 	total_memory = totww + total_channel_memory + conf_memory +
 		class_count * sizeof(struct Class);
@@ -1404,6 +1453,7 @@ stats_ziplinks(struct Client *source_p)
 	rb_dlink_node *ptr;
 	struct Client *target_p;
 	struct ZipStats *zipstats;
+	unsigned long long blocks;
 	int sent_data = 0;
 	char buf[128], buf1[128];
 	RB_DLINK_FOREACH(ptr, serv_list.head)
@@ -1414,14 +1464,16 @@ stats_ziplinks(struct Client *source_p)
 			zipstats = target_p->localClient->zipstats;
 			sprintf(buf, "%.2f%%", zipstats->out_ratio);
 			sprintf(buf1, "%.2f%%", zipstats->in_ratio);
+			blocks = zipstats->out_blocks ? zipstats->out_blocks : 1;
 			sendto_one_numeric(source_p, RPL_STATSDEBUG,
-					   "Z :ZipLinks stats for %s send[%s compression "
-					   "(%llu kB data/%llu kB wire)] recv[%s compression "
-					   "(%llu kB data/%llu kB wire)]",
-					   target_p->name,
+					   "Z :ZipLinks stats for %s (%s) send[%s compression "
+					   "(%llu kB data/%llu kB wire) avg block %llu/%llu bytes] "
+					   "recv[%s compression (%llu kB data/%llu kB wire)]",
+					   target_p->name, zipstats->method,
 					   buf, zipstats->out >> 10,
-					   zipstats->out_wire >> 10, buf1,
-					   zipstats->in >> 10, zipstats->in_wire >> 10);
+					   zipstats->out_wire >> 10,
+					   zipstats->out / blocks, zipstats->out_wire / blocks,
+					   buf1, zipstats->in >> 10, zipstats->in_wire >> 10);
 			sent_data++;
 		}
 	}
@@ -1502,11 +1554,67 @@ stats_servlinks(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "? :Server recv: %s", buf);
 }
 
+struct stats_l_query
+{
+	int doall;
+	int wilds;
+	int servers;		/* serv_list after the clients */
+	char statchar;
+	char name[BUFSIZE];
+};
+
+static int
+stats_l_entry(struct Client *source_p, void *entry, void *data)
+{
+	struct stats_l_query *query = data;
+	struct Client *target_p = entry;
+
+	if(!query->doall && query->wilds && !match(query->name, target_p->name))
+		return 1;
+
+	stats_l_client(source_p, target_p, query->statchar);
+	return 1;
+}
+
 static void
+stats_l_end(struct Client *source_p, void *data)
+{
+	struct stats_l_query *query = data;
+
+	if(query->servers)
+		stats_l_list(source_p, query->name, query->doall, query->wilds,
+			     &serv_list, query->statchar);
+
+	sendto_one_numeric(source_p, RPL_ENDOFSTATS, form_str(RPL_ENDOFSTATS), query->statchar);
+}
+
+/* stats_l_cursor()
+ *
+ * lclient_list can be long, so it goes out as source_p's sendq drains
+ * and the end of stats is sent after it
+ */
+static void
+stats_l_cursor(struct Client *source_p, const char *name, int doall, int wilds,
+	       int servers, char statchar)
+{
+	struct stats_l_query *query;
+
+	query = rb_malloc(sizeof(struct stats_l_query));
+	query->doall = doall;
+	query->wilds = wilds;
+	query->servers = servers;
+	query->statchar = statchar;
+	rb_strlcpy(query->name, name, sizeof(query->name));
+
+	send_cursor(source_p, lclient_list.head, stats_l_entry, stats_l_end, query);
+}
+
+static int
 stats_ltrace(struct Client *source_p, int parc, const char *parv[])
 {
 	int doall = 0;
 	int wilds = 0;
+	int servers;
 	const char *name;
 	char statchar = parv[1][0];
 
@@ -1544,7 +1652,7 @@ stats_ltrace(struct Client *source_p, int parc, const char *parv[])
 				sendto_one_numeric(source_p, ERR_NOSUCHSERVER,
 						   form_str(ERR_NOSUCHSERVER), name);
 
-			return;
+			return 0;
 		}
 	}
 	else
@@ -1557,34 +1665,34 @@ stats_ltrace(struct Client *source_p, int parc, const char *parv[])
 
 	if(doall)
 	{
+		servers = !ConfigServerHide.flatten_links || IsOper(source_p) ||
+			IsExemptShide(source_p);
+
 		/* local opers get everyone */
 		if(MyOper(source_p))
 		{
 			stats_l_list(source_p, name, doall, wilds, &unknown_list, statchar);
-			stats_l_list(source_p, name, doall, wilds, &lclient_list, statchar);
+			stats_l_cursor(source_p, name, doall, wilds, servers, statchar);
+			return 1;
 		}
-		else
-		{
-			/* they still need themselves if theyre local.. */
-			if(MyClient(source_p))
-				stats_l_client(source_p, source_p, statchar);
 
-			stats_l_list(source_p, name, doall, wilds, &oper_list, statchar);
-		}
+		/* they still need themselves if theyre local.. */
+		if(MyClient(source_p))
+			stats_l_client(source_p, source_p, statchar);
+
+		stats_l_list(source_p, name, doall, wilds, &oper_list, statchar);
 
-		if (!ConfigServerHide.flatten_links || IsOper(source_p) ||
-				IsExemptShide(source_p))
+		if(servers)
 			stats_l_list(source_p, name, doall, wilds, &serv_list, statchar);
 
-		return;
+		return 0;
 	}
 
 	/* ok, at this point theyre looking for a specific client whos on
 	 * our server.. but it contains a wildcard.  --fl
 	 */
-	stats_l_list(source_p, name, doall, wilds, &lclient_list, statchar);
-
-	return;
+	stats_l_cursor(source_p, name, doall, wilds, 0, statchar);
+	return 1;
 }
 
 
@@ -1673,6 +1781,11 @@ rb_dump_fd_callback(int fd, const char *desc, void *data)
 static void
 stats_comm(struct Client *source_p)
 {
+	if(!strcmp(rb_get_iotype(), "epoll"))
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "F :epoll persistent %s, %lu epoll_ctl calls saved",
+				   ConfigFileEntry.epoll_persistent ? "on" : "off",
+				   rb_epoll_saved_ctl());
 	rb_dump_fd(rb_dump_fd_callback, source_p);
 	send_pop_queue(source_p);
 }
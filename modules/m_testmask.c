@@ -63,6 +63,7 @@ static int
 mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
 	struct Client *target_p;
+	struct compiled_mask umask, hmask, nmask;
 	int lcount = 0;
 	int gcount = 0;
 	char *name, *username, *hostname;
@@ -103,6 +104,11 @@ mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const ch
 		collapse_esc(gecos);
 	}
 
+	compile_mask(&umask, username);
+	compile_mask(&hmask, hostname);
+	if(name)
+		compile_mask(&nmask, name);
+
 	RB_DLINK_FOREACH(ptr, global_client_list.head)
 	{
 		target_p = ptr->data;
@@ -117,11 +123,11 @@ mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const ch
 		else
 			sockhost = target_p->sockhost;
 
-		if(match(username, target_p->username) &&
-		   (match(hostname, target_p->host) || match(hostname, sockhost)
+		if(match_compiled(&umask, target_p->username) &&
+		   (match_compiled(&hmask, target_p->host) || match_compiled(&hmask, sockhost)
 		    || match_ips(hostname, sockhost)))
 		{
-			if(name && !match(name, target_p->name))
+			if(name && !match_compiled(&nmask, target_p->name))
 				continue;
 
 			if(gecos && !match_esc(gecos, target_p->info))
@@ -134,6 +140,11 @@ mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const ch
 		}
 	}
 
+	free_compiled_mask(&umask);
+	free_compiled_mask(&hmask);
+	if(name)
+		free_compiled_mask(&nmask);
+
 	sendto_one(source_p, form_str(RPL_TESTMASKGECOS),
 		   me.name, source_p->name,
 		   lcount, gcount, name ? name : "*", username, hostname, gecos ? gecos : "*");
@@ -92,6 +92,100 @@ mapi_hlist_av2 trace_hlist[] = {
 DECLARE_MODULE_AV2(trace, NULL, NULL, trace_clist, trace_hlist, NULL, "$Revision$");
 
 
+struct trace_query
+{
+	int doall;
+	int wilds;
+	int dow;
+	int cnt;
+	char tname[BUFSIZE];
+};
+
+static int
+trace_local_client(struct Client *source_p, void *entry, void *data)
+{
+	struct Client *target_p = entry;
+	struct trace_query *query = data;
+
+	/* dont show invisible users to remote opers */
+	if(IsInvisible(target_p) && query->dow && !MyConnect(source_p) && !IsOper(target_p))
+		return 1;
+
+	if(!query->doall && query->wilds && !match(query->tname, target_p->name))
+		return 1;
+
+	query->cnt = report_this_status(source_p, target_p);
+	return 1;
+}
+
+/* the rest of an oper's trace, once the local clients are done */
+static void
+trace_end(struct Client *source_p, void *data)
+{
+	struct trace_query *query = data;
+	struct Client *target_p;
+	struct Class *cltmp;
+	rb_dlink_node *ptr;
+
+	SetCork(source_p);
+	RB_DLINK_FOREACH(ptr, serv_list.head)
+	{
+		target_p = ptr->data;
+
+		if(!query->doall && query->wilds && !match(query->tname, target_p->name))
+			continue;
+
+		query->cnt = report_this_status(source_p, target_p);
+	}
+
+	if(MyConnect(source_p))
+	{
+		RB_DLINK_FOREACH(ptr, unknown_list.head)
+		{
+			target_p = ptr->data;
+
+			if(!query->doall && query->wilds && !match(query->tname, target_p->name))
+				continue;
+
+			query->cnt = report_this_status(source_p, target_p);
+		}
+	}
+	ClearCork(source_p);
+	/*
+	 * Add these lines to summarize the above which can get rather long
+	 * and messy when done remotely - Avalon
+	 */
+	if(!query->cnt)
+	{
+		sendto_one_numeric(source_p, ERR_NOSUCHSERVER, form_str(ERR_NOSUCHSERVER),
+				   query->tname);
+
+		/* let the user have some idea that its at the end of the
+		 * trace
+		 */
+		sendto_one_numeric(source_p, RPL_ENDOFTRACE, form_str(RPL_ENDOFTRACE),
+				   query->tname);
+		return;
+	}
+
+	if(query->doall)
+	{
+		SetCork(source_p);
+		RB_DLINK_FOREACH(ptr, class_list.head)
+		{
+			cltmp = ptr->data;
+
+			if(CurrUsers(cltmp) > 0)
+				sendto_one_numeric(source_p, RPL_TRACECLASS,
+						   form_str(RPL_TRACECLASS),
+						   ClassName(cltmp), CurrUsers(cltmp));
+		}
+		ClearCork(source_p);
+	}
+
+	sendto_one_numeric(source_p, RPL_ENDOFTRACE, form_str(RPL_ENDOFTRACE), query->tname);
+}
+
 /*
  * m_trace
  *      parv[0] = sender prefix
@@ -101,10 +195,10 @@ static int
 m_trace(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
 	struct Client *target_p = NULL;
-	struct Class *cltmp;
 	const char *tname;
 	int doall = 0;
-	int cnt = 0, wilds, dow;
+	struct trace_query *query;
+	int wilds, dow;
 	rb_dlink_node *ptr;
 
 	if(parc > 1)
@@ -257,76 +351,14 @@ m_trace(struct Client *client_p, struct Client *source_p, int parc, const char *
 	}
 
 	/* source_p is opered */
-	SetCork(source_p);
-	/* report all direct connections */
-	RB_DLINK_FOREACH(ptr, lclient_list.head)
-	{
-		target_p = ptr->data;
-
-		/* dont show invisible users to remote opers */
-		if(IsInvisible(target_p) && dow && !MyConnect(source_p) && !IsOper(target_p))
-			continue;
-
-		if(!doall && wilds && !match(tname, target_p->name))
-			continue;
-
-		cnt = report_this_status(source_p, target_p);
-	}
-
-	RB_DLINK_FOREACH(ptr, serv_list.head)
-	{
-		target_p = ptr->data;
-
-		if(!doall && wilds && !match(tname, target_p->name))
-			continue;
-
-		cnt = report_this_status(source_p, target_p);
-	}
-
-	if(MyConnect(source_p))
-	{
-		RB_DLINK_FOREACH(ptr, unknown_list.head)
-		{
-			target_p = ptr->data;
-
-			if(!doall && wilds && !match(tname, target_p->name))
-				continue;
-
-			cnt = report_this_status(source_p, target_p);
-		}
-	}
-	ClearCork(source_p);
-	/*
-	 * Add these lines to summarize the above which can get rather long
-	 * and messy when done remotely - Avalon
-	 */
-	if(!cnt)
-	{
-		sendto_one_numeric(source_p, ERR_NOSUCHSERVER, form_str(ERR_NOSUCHSERVER), tname);
-
-		/* let the user have some idea that its at the end of the
-		 * trace
-		 */
-		sendto_one_numeric(source_p, RPL_ENDOFTRACE, form_str(RPL_ENDOFTRACE), tname);
-		return 0;
-	}
+	query = rb_malloc(sizeof(struct trace_query));
+	query->doall = doall;
+	query->wilds = wilds;
+	query->dow = dow;
+	rb_strlcpy(query->tname, tname, sizeof(query->tname));
 
-	if(doall)
-	{
-		SetCork(source_p);
-		RB_DLINK_FOREACH(ptr, class_list.head)
-		{
-			cltmp = ptr->data;
-
-			if(CurrUsers(cltmp) > 0)
-				sendto_one_numeric(source_p, RPL_TRACECLASS,
-						   form_str(RPL_TRACECLASS),
-						   ClassName(cltmp), CurrUsers(cltmp));
-		}
-		ClearCork(source_p);
-	}
-
-	sendto_one_numeric(source_p, RPL_ENDOFTRACE, form_str(RPL_ENDOFTRACE), tname);
+	/* report all direct connections */
+	send_cursor(source_p, lclient_list.head, trace_local_client, trace_end, query);
 
 	return 0;
 }
@@ -661,8 +693,15 @@ match_masktrace(struct Client *source_p, rb_dlink_list *list, const char *userna
 		const char *hostname, const char *name, const char *gecos)
 {
 	struct Client *target_p;
+	struct compiled_mask umask, hmask, nmask;
 	rb_dlink_node *ptr;
 	const char *sockhost;
+
+	compile_mask(&umask, username);
+	compile_mask(&hmask, hostname);
+	if(name != NULL)
+		compile_mask(&nmask, name);
+
 	RB_DLINK_FOREACH(ptr, list->head)
 	{
 		target_p = ptr->data;
@@ -676,11 +715,11 @@ match_masktrace(struct Client *source_p, rb_dlink_list *list, const char *userna
 		else
 			sockhost = target_p->sockhost;
 
-		if(match(username, target_p->username) && (match(hostname, target_p->host) ||
-							   match(hostname, sockhost)
-							   || match_ips(hostname, sockhost)))
+		if(match_compiled(&umask, target_p->username) &&
+		   (match_compiled(&hmask, target_p->host) || match_compiled(&hmask, sockhost)
+		    || match_ips(hostname, sockhost)))
 		{
-			if(name != NULL && !match(name, target_p->name))
+			if(name != NULL && !match_compiled(&nmask, target_p->name))
 				continue;
 
 			if(gecos != NULL && !match_esc(gecos, target_p->info))
@@ -694,6 +733,11 @@ match_masktrace(struct Client *source_p, rb_dlink_list *list, const char *userna
 				   sockhost, target_p->info);
 		}
 	}
+
+	free_compiled_mask(&umask);
+	free_compiled_mask(&hmask);
+	if(name != NULL)
+		free_compiled_mask(&nmask);
 }
 
 static int
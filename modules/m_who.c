@@ -176,13 +176,10 @@ m_who(struct Client *client_p, struct Client *source_p, int parc, const char *pa
 	 * request a full list.  I presume its because of too many typos
 	 * with "/who" ;) --fl
 	 */
-	SetCork(source_p);
 	if((*(mask + 1) == '\0') && (*mask == '0'))
-		who_global(source_p, NULL, server_oper, 0);
+		who_global(source_p, mask, server_oper, 0);
 	else
 		who_global(source_p, mask, server_oper, operspy);
-	ClearCork(source_p);
-	sendto_one(source_p, form_str(RPL_ENDOFWHO), me.name, source_p->name, mask);
 
 	return 0;
 }
@@ -232,25 +229,82 @@ who_common_channel(struct Client *source_p, struct Channel *chptr,
 	}
 }
 
+struct who_query
+{
+	int server_oper;
+	int operspy;
+	int all;		/* who 0 */
+	int maxmatches;
+	char mask[BUFSIZE];
+};
+
+static int
+who_global_client(struct Client *source_p, void *entry, void *data)
+{
+	struct Client *target_p = entry;
+	struct who_query *query = data;
+	const char *mask = query->mask;
+
+	if(query->maxmatches <= 0)
+		return 0;
+
+	if(!IsClient(target_p))
+		return 1;
+
+	/* invisible clients on common channels are already done */
+	if(IsInvisible(target_p) && !query->operspy)
+		return 1;
+
+	if(query->server_oper && !IsOper(target_p))
+		return 1;
+
+	if(query->all ||
+	   match(mask, target_p->name) || match(mask, target_p->username) ||
+	   match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
+	   match(mask, target_p->info))
+	{
+		do_who(source_p, target_p, NULL, "");
+		--query->maxmatches;
+	}
+	return 1;
+}
+
+static void
+who_global_end(struct Client *source_p, void *data)
+{
+	struct who_query *query = data;
+
+	if(query->maxmatches <= 0)
+		sendto_one(source_p, form_str(ERR_TOOMANYMATCHES), me.name, source_p->name, "WHO");
+	sendto_one(source_p, form_str(RPL_ENDOFWHO), me.name, source_p->name, query->mask);
+}
+
 /*
  * who_global
  *
  * inputs	- pointer to client requesting who
- *		- char * mask to match
+ *		- char * mask to match, "0" for everyone
  *		- int if oper on a server or not
  * output	- NONE
  * side effects - do a global scan of all clients looking for match
  *		  this is slightly expensive on EFnet ...
- *		  marks assumed cleared for all clients initially
- *		  and will be left cleared on return
+ *		  the scan goes out as source_p's sendq drains, so the
+ *		  marks of the common channel pass are cleared before
+ *		  it starts rather than along the way
  */
 static void
 who_global(struct Client *source_p, const char *mask, int server_oper, int operspy)
 {
+	struct who_query *query;
 	struct membership *msptr;
-	struct Client *target_p;
 	rb_dlink_node *lp, *ptr;
-	int maxmatches = 500;
+
+	query = rb_malloc(sizeof(struct who_query));
+	query->server_oper = server_oper;
+	query->operspy = operspy;
+	query->all = !strcmp(mask, "0");
+	query->maxmatches = 500;
+	rb_strlcpy(query->mask, mask, sizeof(query->mask));
 
 	/* first, list all matching INvisible clients on common channels
 	 * if this is not an operspy who
@@ -260,48 +314,26 @@ who_global(struct Client *source_p, const char *mask, int server_oper, int opers
 		RB_DLINK_FOREACH(lp, source_p->user->channel.head)
 		{
 			msptr = lp->data;
-			who_common_channel(source_p, msptr->chptr, mask, server_oper, &maxmatches);
+			who_common_channel(source_p, msptr->chptr, query->all ? NULL : mask,
+					   server_oper, &query->maxmatches);
 		}
-	}
-	else
-		report_operspy(source_p, "WHO", mask);
-
-	/* second, list all matching visible clients and clear all marks
-	 * on invisible clients
-	 * if this is an operspy who, list all matching clients, no need
-	 * to clear marks
-	 */
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
-	{
-		target_p = ptr->data;
-		if(!IsClient(target_p))
-			continue;
-
-		if(IsInvisible(target_p) && !operspy)
-		{
-			ClearMark(target_p);
-			continue;
-		}
-
-		if(server_oper && !IsOper(target_p))
-			continue;
 
-		if(maxmatches > 0)
+		RB_DLINK_FOREACH(lp, source_p->user->channel.head)
 		{
-			if(!mask ||
-			   match(mask, target_p->name) || match(mask, target_p->username) ||
-			   match(mask, target_p->host) || match(mask, target_p->servptr->name) ||
-			   match(mask, target_p->info))
+			msptr = lp->data;
+			RB_DLINK_FOREACH(ptr, msptr->chptr->members.head)
 			{
-				do_who(source_p, target_p, NULL, "");
-				--maxmatches;
+				ClearMark(((struct membership *)ptr->data)->client_p);
 			}
 		}
-
 	}
+	else
+		report_operspy(source_p, "WHO", mask);
 
-	if(maxmatches <= 0)
-		sendto_one(source_p, form_str(ERR_TOOMANYMATCHES), me.name, source_p->name, "WHO");
+	/* second, list all matching visible clients, or every matching
+	 * client if this is an operspy who
+	 */
+	send_cursor(source_p, global_client_list.head, who_global_client, who_global_end, query);
 }
 
 /*
@@ -343,6 +343,7 @@ apply_xline(struct Client *source_p, const char *name, const char *reason, int t
 	}
 
 	rb_dlinkAddAlloc(aconf, &xline_conf_list);
+	maskset_changed(&xline_set);
 	check_xlines();
 }
 
@@ -431,6 +432,7 @@ remove_xline(struct Client *source_p, const char *name)
 
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
+		maskset_changed(&xline_set);
 		return;
 	}
 
@@ -353,7 +353,10 @@ bandb_handle_finish(void)
 
 		case CONF_XLINE:
 			if(bandb_check_xline(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+				maskset_changed(&xline_set);
+			}
 			else
 				free_conf(aconf);
 
@@ -369,7 +372,10 @@ bandb_handle_finish(void)
 
 		case CONF_RESV_NICK:
 			if(bandb_check_resv_nick(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+				maskset_changed(&resv_set);
+			}
 			else
 				free_conf(aconf);
 
@@ -47,8 +47,13 @@ static rb_bh *channel_heap;
 static rb_bh *ban_heap;
 static rb_bh *topic_heap;
 static rb_bh *member_heap;
+static rb_bh *uplink_heap;
+static rb_bh *count_heap;
 struct ev_entry *checksplit_ev;
 
+/* member ban caches kept valid across a ban list change */
+unsigned long ban_cache_kept;
+
 static int channel_capabs[] = { CAP_EX, CAP_IE, CAP_IRCNET,
 #ifdef ENABLE_SERVICES
 	CAP_SERVICE,
@@ -62,6 +67,10 @@ static int channel_capabs[] = { CAP_EX, CAP_IE, CAP_IRCNET,
 static struct ChCapCombo chcap_combos[NCHCAP_COMBOS];
 
 static void free_topic(struct Channel *chptr);
+static void names_cache_member(struct Channel *chptr, struct membership *msptr);
+static void invalidate_names(struct Channel *chptr);
+static void update_channel_count(struct Channel *chptr);
+static void count_unlink(struct Channel *chptr);
 
 /* init_channels()
  *
@@ -76,6 +85,8 @@ init_channels(void)
 	ban_heap = rb_bh_create(sizeof(struct Ban), BAN_HEAP_SIZE, "ban_heap");
 	topic_heap = rb_bh_create(sizeof(struct topic_info), TOPIC_HEAP_SIZE, "topic_heap");
 	member_heap = rb_bh_create(sizeof(struct membership), MEMBER_HEAP_SIZE, "member_heap");
+	uplink_heap = rb_bh_create(sizeof(struct chan_uplink), UPLINK_HEAP_SIZE, "uplink_heap");
+	count_heap = rb_bh_create(sizeof(struct chan_count), COUNT_HEAP_SIZE, "count_heap");
 }
 
 /*
@@ -87,14 +98,19 @@ allocate_channel(const char *chname)
 	struct Channel *chptr;
 	chptr = rb_bh_alloc(channel_heap);
 	chptr->chname = rb_strndup(chname, CHANNELLEN);
+	/* new memberships start at 0, ie. not cached */
+	chptr->ban_serial = 1;
 	if (*chname == '+')
 		chptr->mode.mode |= MODE_TOPICLIMIT;
+	update_channel_count(chptr);
 	return (chptr);
 }
 
 void
 free_channel(struct Channel *chptr)
 {
+	invalidate_names(chptr);
+	count_unlink(chptr);
 	rb_free(chptr->chname);
 	rb_bh_free(channel_heap, chptr);
 }
@@ -103,9 +119,41 @@ struct Ban *
 allocate_ban(const char *banstr, const char *who)
 {
 	struct Ban *bptr;
+	const char *p;
+	size_t len;
+
 	bptr = rb_bh_alloc(ban_heap);
 	bptr->banstr = rb_strndup(banstr, BANLEN);
 	bptr->who = rb_strndup(who, BANLEN);
+	compile_mask(&bptr->cmask, bptr->banstr);
+
+	/* nick!user@host has exactly one @, so a mask with one @ can only
+	 * match on what follows it.  sort out how that part matches here.
+	 */
+	p = strchr(bptr->banstr, '@');
+	if(p == NULL || strchr(++p, '@') != NULL)
+		return (bptr);
+
+	while(*p == '*' && p[1] == '*')
+		p++;
+	len = strcspn(p, "*?");
+
+	if(*p == '*')
+	{
+		p++;
+		if(*p != '\0' && p[strcspn(p, "*?")] == '\0')
+			bptr->hosttype = BAN_HOST_SUFFIX;
+	}
+	else if(p[len] == '\0')
+		bptr->hosttype = BAN_HOST_EXACT;
+	else if(len > 0 && p[len] == '*' && p[len + 1 + strspn(p + len + 1, "*")] == '\0')
+		bptr->hosttype = BAN_HOST_PREFIX;
+
+	if(bptr->hosttype != BAN_HOST_GLOB)
+	{
+		bptr->host = p;
+		bptr->hostlen = bptr->hosttype == BAN_HOST_PREFIX ? len : strlen(p);
+	}
 
 	return (bptr);
 }
@@ -115,10 +163,115 @@ free_ban(struct Ban *bptr)
 {
 	rb_free(bptr->banstr);
 	rb_free(bptr->who);
+	free_compiled_mask(&bptr->cmask);
 	rb_bh_free(ban_heap, bptr);
 }
 
 
+/* a client in more than MEMBER_HASH_MIN channels gets an open addressed
+ * table of its memberships keyed on the channel, kept at most half full.
+ * it goes away again once the client is down to half that.
+ */
+#define MEMBER_HASH_MIN		16
+#define MEMBER_HASH_MINBITS	5
+
+static inline unsigned int
+member_hash(struct Channel *chptr, unsigned int bits)
+{
+	return ((uint32_t)((uintptr_t)chptr >> 4) * 2654435761U) >> (32 - bits);
+}
+
+static void
+member_hash_insert(struct User *user, struct membership *msptr)
+{
+	unsigned int mask = (1U << user->chanhash_bits) - 1;
+	unsigned int i;
+
+	i = member_hash(msptr->chptr, user->chanhash_bits);
+	while(user->chanhash[i] != NULL)
+		i = (i + 1) & mask;
+	user->chanhash[i] = msptr;
+}
+
+static void
+member_hash_rebuild(struct User *user)
+{
+	rb_dlink_node *ptr;
+	unsigned int bits = MEMBER_HASH_MINBITS;
+
+	while((1U << bits) < rb_dlink_list_length(&user->channel) * 2)
+		bits++;
+
+	rb_free(user->chanhash);
+	user->chanhash = rb_malloc(sizeof(struct membership *) << bits);
+	user->chanhash_bits = bits;
+
+	RB_DLINK_FOREACH(ptr, user->channel.head)
+		member_hash_insert(user, ptr->data);
+}
+
+static void
+member_hash_add(struct User *user, struct membership *msptr)
+{
+	unsigned long count = rb_dlink_list_length(&user->channel);
+
+	if(user->chanhash == NULL)
+	{
+		if(count > MEMBER_HASH_MIN)
+			member_hash_rebuild(user);
+	}
+	else if(count * 2 > (1UL << user->chanhash_bits))
+		member_hash_rebuild(user);
+	else
+		member_hash_insert(user, msptr);
+}
+
+/* linear probing, so entries after the hole that would no longer be
+ * reachable are shifted back into it
+ */
+static void
+member_hash_del(struct User *user, struct membership *msptr)
+{
+	struct membership **table = user->chanhash;
+	unsigned int bits = user->chanhash_bits;
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int i, j, k;
+
+	if(table == NULL)
+		return;
+
+	if(rb_dlink_list_length(&user->channel) < MEMBER_HASH_MIN / 2)
+	{
+		rb_free(user->chanhash);
+		user->chanhash = NULL;
+		user->chanhash_bits = 0;
+		return;
+	}
+
+	i = member_hash(msptr->chptr, bits);
+	while(table[i] != msptr)
+	{
+		if(table[i] == NULL)
+		{
+			s_assert(0);
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	table[i] = NULL;
+	for(j = (i + 1) & mask; table[j] != NULL; j = (j + 1) & mask)
+	{
+		k = member_hash(table[j]->chptr, bits);
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		table[i] = table[j];
+		table[j] = NULL;
+		i = j;
+	}
+}
+
 /* find_channel_membership()
  *
  * input	- channel to find them in, client to find
@@ -130,10 +283,23 @@ find_channel_membership(struct Channel *chptr, struct Client *client_p)
 {
 	struct membership *msptr;
 	rb_dlink_node *ptr;
+	unsigned int i, mask;
 
 	if(!IsClient(client_p))
 		return NULL;
 
+	if(client_p->user->chanhash != NULL)
+	{
+		mask = (1U << client_p->user->chanhash_bits) - 1;
+		i = member_hash(chptr, client_p->user->chanhash_bits);
+		for(; (msptr = client_p->user->chanhash[i]) != NULL; i = (i + 1) & mask)
+		{
+			if(msptr->chptr == chptr)
+				return msptr;
+		}
+		return NULL;
+	}
+
 	/* Pick the most efficient list to use to be nice to things like
 	 * CHANSERV which could be in a large number of channels
 	 */
@@ -192,6 +358,264 @@ find_channel_status(struct membership *msptr, int combine)
 	return buffer;
 }
 
+#define LOCAL_MEMBER_FLAGS	(CHFL_CHANOP|CHFL_VOICE)
+
+/* add_local_member()
+ *
+ * input	- local membership
+ * output	-
+ * side effects - member is appended to the channel's local arrays
+ */
+static void
+add_local_member(struct Channel *chptr, struct membership *msptr)
+{
+	if(chptr->loccount == chptr->locsize)
+	{
+		chptr->locsize = chptr->locsize ? chptr->locsize * 2 : 8;
+		chptr->locclient = rb_realloc(chptr->locclient,
+					      chptr->locsize * sizeof(struct Client *));
+		chptr->locflags = rb_realloc(chptr->locflags, chptr->locsize);
+		chptr->locmsptr = rb_realloc(chptr->locmsptr,
+					     chptr->locsize * sizeof(struct membership *));
+	}
+
+	msptr->locindex = chptr->loccount++;
+	chptr->locclient[msptr->locindex] = msptr->client_p;
+	chptr->locflags[msptr->locindex] = msptr->flags & LOCAL_MEMBER_FLAGS;
+	chptr->locmsptr[msptr->locindex] = msptr;
+}
+
+/* del_local_member()
+ *
+ * input	- local membership
+ * output	-
+ * side effects - the last member is moved into its slot
+ */
+static void
+del_local_member(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int last = --chptr->loccount;
+	struct membership *moved;
+
+	if(msptr->locindex != last)
+	{
+		moved = chptr->locmsptr[last];
+		moved->locindex = msptr->locindex;
+		chptr->locclient[moved->locindex] = chptr->locclient[last];
+		chptr->locflags[moved->locindex] = chptr->locflags[last];
+		chptr->locmsptr[moved->locindex] = moved;
+	}
+
+	if(chptr->loccount == 0)
+	{
+		rb_free(chptr->locclient);
+		rb_free(chptr->locflags);
+		rb_free(chptr->locmsptr);
+		chptr->locclient = NULL;
+		chptr->locflags = NULL;
+		chptr->locmsptr = NULL;
+		chptr->locsize = 0;
+	}
+}
+
+/* update_member_flags()
+ *
+ * input	- membership whose op or voice just changed
+ * output	-
+ * side effects - the copy local fanout filters on is brought up to date,
+ *		  cached NAMES are dropped
+ */
+void
+update_member_flags(struct membership *msptr)
+{
+	if(MyClient(msptr->client_p))
+		msptr->chptr->locflags[msptr->locindex] = msptr->flags & LOCAL_MEMBER_FLAGS;
+	invalidate_names(msptr->chptr);
+}
+
+/* add_channel_uplink()
+ *
+ * input	- channel, remote client joining it
+ * output	-
+ * side effects - the member is counted against the link it is behind,
+ *		  sendto_channel_flags() sends once down each counted link
+ *		  rather than walking every member to find them.
+ */
+static void
+add_channel_uplink(struct Channel *chptr, struct Client *client_p)
+{
+	struct chan_uplink *uplink;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, chptr->uplinks.head)
+	{
+		uplink = ptr->data;
+		if(uplink->client_p == client_p->from)
+		{
+			uplink->members++;
+			return;
+		}
+	}
+
+	uplink = rb_bh_alloc(uplink_heap);
+	uplink->client_p = client_p->from;
+	uplink->members = 1;
+	rb_dlinkAdd(uplink, &uplink->node, &chptr->uplinks);
+}
+
+/* del_channel_uplink()
+ *
+ * input	- channel, remote client leaving it
+ * output	-
+ * side effects - the link is dropped once nobody is behind it
+ */
+static void
+del_channel_uplink(struct Channel *chptr, struct Client *client_p)
+{
+	struct chan_uplink *uplink;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, chptr->uplinks.head)
+	{
+		uplink = ptr->data;
+		if(uplink->client_p != client_p->from)
+			continue;
+
+		if(--uplink->members == 0)
+		{
+			rb_dlinkDelete(&uplink->node, &chptr->uplinks);
+			rb_bh_free(uplink_heap, uplink);
+		}
+		return;
+	}
+	s_assert(0);
+}
+
+/* channels in order of member count, so LIST >n can start where the
+ * bound is met and LIST <n can stop.  channels with the same count are
+ * next to each other in chan_count_list, and each such run has a
+ * struct chan_count in chan_count_groups, lowest count first.  a
+ * channel moves by one member at a time, which is to the head of the
+ * run next to its own, or to a new run there.
+ */
+static rb_dlink_list chan_count_list;
+static rb_dlink_list chan_count_groups;
+
+/* count_unlink()
+ *
+ * input	- channel
+ * output	-
+ * side effects - channel is taken out of the member count order
+ */
+static void
+count_unlink(struct Channel *chptr)
+{
+	struct chan_count *group = chptr->countgroup;
+
+	cursor_drop_node(&chptr->countnode);
+
+	if(--group->channels == 0)
+	{
+		rb_dlinkDelete(&group->node, &chan_count_groups);
+		rb_bh_free(count_heap, group);
+	}
+	else if(group->first == chptr)
+		group->first = chptr->countnode.next->data;
+
+	rb_dlinkDelete(&chptr->countnode, &chan_count_list);
+	chptr->countgroup = NULL;
+}
+
+/* update_channel_count()
+ *
+ * input	- channel whose member count may have changed
+ * output	-
+ * side effects - channel is moved to its place in the member count order
+ */
+static void
+update_channel_count(struct Channel *chptr)
+{
+	struct chan_count *group = chptr->countgroup;
+	struct chan_count *target;
+	unsigned int count = rb_dlink_list_length(&chptr->members);
+	rb_dlink_node *gptr;
+
+	if(group != NULL && group->count == count)
+		return;
+
+	/* find the lowest run with at least count members, our own run
+	 * only counts if it is not about to go away
+	 */
+	if(group == NULL || count > group->count)
+	{
+		gptr = group == NULL ? chan_count_groups.head : group->node.next;
+		while(gptr != NULL && ((struct chan_count *) gptr->data)->count < count)
+			gptr = gptr->next;
+	}
+	else
+	{
+		gptr = &group->node;
+		while(gptr->prev != NULL && ((struct chan_count *) gptr->prev->data)->count >= count)
+			gptr = gptr->prev;
+		if(gptr == &group->node && group->channels == 1)
+			gptr = group->node.next;
+	}
+
+	if(group != NULL)
+		count_unlink(chptr);
+
+	if(gptr != NULL && ((struct chan_count *) gptr->data)->count == count)
+	{
+		target = gptr->data;
+		rb_dlinkAddBefore(&target->first->countnode, chptr, &chptr->countnode,
+				  &chan_count_list);
+	}
+	else
+	{
+		target = rb_bh_alloc(count_heap);
+		target->count = count;
+
+		if(gptr != NULL)
+		{
+			rb_dlinkAddBefore(&((struct chan_count *) gptr->data)->first->countnode,
+					  chptr, &chptr->countnode, &chan_count_list);
+			rb_dlinkAddBefore(gptr, target, &target->node, &chan_count_groups);
+		}
+		else
+		{
+			rb_dlinkAddTail(chptr, &chptr->countnode, &chan_count_list);
+			rb_dlinkAddTail(target, &target->node, &chan_count_groups);
+		}
+	}
+
+	target->first = chptr;
+	target->channels++;
+	chptr->countgroup = target;
+}
+
+/* first_channel_over()
+ *
+ * input	- member count
+ * output	- node in the member count order of the first channel with
+ *		  more members than that, or NULL if there is none
+ * side effects -
+ */
+rb_dlink_node *
+first_channel_over(unsigned int count)
+{
+	struct chan_count *group = NULL;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH_PREV(ptr, chan_count_groups.tail)
+	{
+		if(((struct chan_count *) ptr->data)->count <= count)
+			break;
+		group = ptr->data;
+	}
+
+	return group != NULL ? &group->first->countnode : NULL;
+}
+
 /* add_user_to_channel()
  *
  * input	- channel to add client to, client to add, channel flags
@@ -214,10 +638,18 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 	msptr->flags = flags;
 
 	rb_dlinkAdd(msptr, &msptr->usernode, &client_p->user->channel);
+	member_hash_add(client_p->user, msptr);
 	rb_dlinkAdd(msptr, &msptr->channode, &chptr->members);
+	names_cache_member(chptr, msptr);
+	update_channel_count(chptr);
 
 	if(MyClient(client_p))
+	{
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
+		add_local_member(chptr, msptr);
+	}
+	else
+		add_channel_uplink(chptr, client_p);
 }
 
 /* remove_user_from_channel()
@@ -245,10 +677,18 @@ remove_user_from_channel(struct membership *msptr)
 	}
 
 	rb_dlinkDelete(&msptr->usernode, &client_p->user->channel);
+	member_hash_del(client_p->user, msptr);
 	rb_dlinkDelete(&msptr->channode, &chptr->members);
+	invalidate_names(chptr);
+	update_channel_count(chptr);
 
 	if(client_p->servptr == &me)
+	{
 		rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
+		del_local_member(chptr, msptr);
+	}
+	else
+		del_channel_uplink(chptr, client_p);
 
 	if(rb_dlink_list_length(&chptr->members) <= 0)
 		destroy_channel(chptr);
@@ -281,9 +721,16 @@ remove_user_from_channels(struct Client *client_p)
 		chptr = msptr->chptr;
 
 		rb_dlinkDelete(&msptr->channode, &chptr->members);
+		invalidate_names(chptr);
+		update_channel_count(chptr);
 
 		if(client_p->servptr == &me)
+		{
 			rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
+			del_local_member(chptr, msptr);
+		}
+		else
+			del_channel_uplink(chptr, client_p);
 
 		if(rb_dlink_list_length(&chptr->members) <= 0)
 			destroy_channel(chptr);
@@ -293,6 +740,10 @@ remove_user_from_channels(struct Client *client_p)
 
 	client_p->user->channel.head = client_p->user->channel.tail = NULL;
 	client_p->user->channel.length = 0;
+
+	rb_free(client_p->user->chanhash);
+	client_p->user->chanhash = NULL;
+	client_p->user->chanhash_bits = 0;
 }
 
 /* invalidate_bancache_user()
@@ -319,6 +770,23 @@ invalidate_bancache_user(struct Client *client_p)
 	}
 }
 
+/* invalidate_names_user()
+ *
+ * input	- user whose nick changed
+ * output	-
+ * side effects - cached NAMES of every channel they are in are dropped
+ */
+void
+invalidate_names_user(struct Client *client_p)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, client_p->user->channel.head)
+	{
+		invalidate_names(((struct membership *)ptr->data)->chptr);
+	}
+}
+
 /* get_channelmask()
  *
  * input	- channel name
@@ -503,6 +971,12 @@ kill_channel_modes(struct Channel *chptr)
 	free_channel_list(&chptr->banlist);
 	free_channel_list(&chptr->exceptlist);
 	free_channel_list(&chptr->invexlist);
+
+	ban_list_changed(chptr, &chptr->banlist);
+	ban_list_changed(chptr, &chptr->exceptlist);
+	ban_list_changed(chptr, &chptr->invexlist);
+	ban_list_changed(chptr, &chptr->reoplist);
+	invalidate_bancache(chptr);
 }
 
 /* destroy_channel()
@@ -524,6 +998,7 @@ destroy_channel(struct Channel *chptr)
 	/* Free the topic */
 	free_topic(chptr);
 
+	cursor_drop_node(&chptr->node);
 	rb_dlinkDelete(&chptr->node, &global_channel_list);
 	del_from_hash(HASH_CHANNEL, chptr->chname, chptr);
 	free_channel(chptr);
@@ -545,6 +1020,108 @@ channel_pub_or_secret(struct Channel *chptr)
 	return ("*");
 }
 
+/* NAMES of a channel with at least NAMES_CACHE_MIN members is rendered
+ * once for members, with and without multi-prefix, and kept until a
+ * member leaves, changes nick or is opped/voiced.  joins just add to the
+ * end of what is there.
+ */
+#define NAMES_CACHE_MIN		64
+
+static void
+names_cache_add(struct names_cache *nc, const char *status, const char *name)
+{
+	size_t slen = strlen(status);
+	size_t nlen = strlen(name);
+
+	while(nc->len + slen + nlen + 2 > nc->size)
+	{
+		nc->size = nc->size ? nc->size * 2 : BUFSIZE * 2;
+		nc->buf = rb_realloc(nc->buf, nc->size);
+	}
+
+	/* join the last line if it fits, else start another */
+	if(nc->len > 0 && nc->len - nc->last + slen + nlen <= nc->limit)
+		nc->buf[nc->len - 1] = ' ';
+	else
+		nc->last = nc->len;
+
+	memcpy(nc->buf + nc->len, status, slen);
+	memcpy(nc->buf + nc->len + slen, name, nlen);
+	nc->len += slen + nlen;
+	nc->buf[nc->len++] = '\0';
+}
+
+static struct names_cache *
+names_cache_build(struct Channel *chptr, int stack)
+{
+	struct names_cache *nc;
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+
+	nc = rb_malloc(sizeof(struct names_cache));
+
+	/* room for the longest ":me 353 nick = #chan :" in front */
+	nc->limit = BUFSIZE - 6 - (strlen(me.name) + NICKLEN + strlen(chptr->chname) + 11);
+
+	RB_DLINK_FOREACH(ptr, chptr->members.head)
+	{
+		msptr = ptr->data;
+		names_cache_add(nc, find_channel_status(msptr, stack), msptr->client_p->name);
+	}
+
+	return nc;
+}
+
+static void
+names_cache_member(struct Channel *chptr, struct membership *msptr)
+{
+	int i;
+
+	for(i = 0; i < 2; i++)
+	{
+		if(chptr->namescache[i] != NULL)
+			names_cache_add(chptr->namescache[i], find_channel_status(msptr, i),
+					msptr->client_p->name);
+	}
+}
+
+static void
+invalidate_names(struct Channel *chptr)
+{
+	int i;
+
+	for(i = 0; i < 2; i++)
+	{
+		if(chptr->namescache[i] != NULL)
+		{
+			rb_free(chptr->namescache[i]->buf);
+			rb_free(chptr->namescache[i]);
+			chptr->namescache[i] = NULL;
+		}
+	}
+}
+
+static void
+send_names_cache(struct Channel *chptr, struct Client *client_p, int stack)
+{
+	struct names_cache *nc;
+	char lbuf[BUFSIZE];
+	size_t pos;
+	int mlen;
+
+	if((nc = chptr->namescache[stack]) == NULL)
+		nc = chptr->namescache[stack] = names_cache_build(chptr, stack);
+
+	mlen = rb_sprintf(lbuf, form_str(RPL_NAMREPLY), me.name, client_p->name,
+			  channel_pub_or_secret(chptr), chptr->chname);
+
+	for(pos = 0; pos < nc->len; pos += strlen(nc->buf + pos) + 1)
+	{
+		rb_strlcpy(lbuf + mlen, nc->buf + pos, sizeof(lbuf) - mlen);
+		sendto_one_buffer(client_p, lbuf);
+	}
+}
+
 /* channel_member_names()
  *
  * input	- channel to list, client to list to, show endofnames
@@ -563,12 +1140,18 @@ channel_member_names(struct Channel *chptr, struct Client *client_p, int show_eo
 	int tlen;
 	int cur_len;
 	int is_member;
-	int stack = IsCapable(client_p, CLICAP_MULTI_PREFIX);
+	int stack = IsCapable(client_p, CLICAP_MULTI_PREFIX) ? 1 : 0;
 	SetCork(client_p);
-	if(ShowChannel(client_p, chptr))
-	{
-		is_member = IsMember(client_p, chptr);
+	is_member = IsMember(client_p, chptr);
 
+	if(is_member && !IsAnonymous(chptr) &&
+	   (chptr->namescache[stack] != NULL ||
+	    rb_dlink_list_length(&chptr->members) >= NAMES_CACHE_MIN))
+	{
+		send_names_cache(chptr, client_p, stack);
+	}
+	else if(ShowChannel(client_p, chptr))
+	{
 		cur_len = mlen = rb_sprintf(lbuf, form_str(RPL_NAMREPLY),
 					    me.name, client_p->name,
 					    channel_pub_or_secret(chptr), chptr->chname);
@@ -636,41 +1219,209 @@ del_invite(struct Channel *chptr, struct Client *who)
 	rb_dlinkFindDestroy(chptr, &who->localClient->invited);
 }
 
+static struct ban_index **
+ban_list_index(struct Channel *chptr, rb_dlink_list *bl)
+{
+	if(bl == &chptr->banlist)
+		return &chptr->banindex[0];
+	if(bl == &chptr->exceptlist)
+		return &chptr->banindex[1];
+	if(bl == &chptr->invexlist)
+		return &chptr->banindex[2];
+	s_assert(bl == &chptr->reoplist);
+	return &chptr->banindex[3];
+}
+
+/* ban_list_changed()
+ *
+ * input	- channel, one of its ban lists
+ * output	-
+ * side effects - the index for the list is dropped, match_ban() builds
+ *		  a new one when it is next needed
+ */
+void
+ban_list_changed(struct Channel *chptr, rb_dlink_list *bl)
+{
+	struct ban_index **idx = ban_list_index(chptr, bl);
+
+	if(*idx == NULL)
+		return;
+
+	rb_free((*idx)->exact);
+	rb_free((*idx)->other);
+	rb_free(*idx);
+	*idx = NULL;
+}
+
+static struct ban_index *
+build_ban_index(rb_dlink_list *bl)
+{
+	struct ban_index *idx = rb_malloc(sizeof(struct ban_index));
+	struct Ban *ban;
+	rb_dlink_node *ptr;
+	unsigned int exact = 0, mask, i;
+
+	RB_DLINK_FOREACH(ptr, bl->head)
+	{
+		ban = ptr->data;
+		if(ban->hosttype == BAN_HOST_EXACT)
+			exact++;
+	}
+
+	if(exact > 0)
+	{
+		/* keep it at most half full */
+		for(idx->exact_bits = 3; (1U << idx->exact_bits) < exact * 2; idx->exact_bits++)
+			;
+		idx->exact = rb_malloc(sizeof(struct Ban *) << idx->exact_bits);
+	}
+	if(rb_dlink_list_length(bl) > exact)
+		idx->other = rb_malloc(sizeof(struct Ban *) * (rb_dlink_list_length(bl) - exact));
+
+	mask = (1U << idx->exact_bits) - 1;
+
+	RB_DLINK_FOREACH(ptr, bl->head)
+	{
+		ban = ptr->data;
+		if(ban->hosttype != BAN_HOST_EXACT)
+		{
+			idx->other[idx->other_count++] = ban;
+			continue;
+		}
+
+		i = fnv_hash_upper((const unsigned char *)ban->host, idx->exact_bits, 0) & mask;
+		while(idx->exact[i] != NULL)
+			i = (i + 1) & mask;
+		idx->exact[i] = ban;
+	}
+
+	return idx;
+}
+
+/* the nuhs are only ever matched against, so they are folded with
+ * ToLower() here once rather than for every ban
+ */
+static void
+build_ban_nuhs(struct Client *who, char *nuhs)
+{
+	char *p;
+	int i;
+
+	rb_sprintf(&nuhs[0], "%s!%s@%s", who->name, who->username, who->host);
+	rb_sprintf(&nuhs[USERHOST_REPLYLEN], "%s!%s@%s", who->name, who->username, who->sockhost);
+	rb_sprintf(&nuhs[USERHOST_REPLYLEN*2], "%s!%s@%s", who->id, who->username, who->host);
+	rb_sprintf(&nuhs[USERHOST_REPLYLEN*3], "%s!%s@%s", who->id, who->username, who->sockhost);
+
+	for(i = 0; i < 4; i++)
+		for(p = &nuhs[i * USERHOST_REPLYLEN]; *p != '\0'; p++)
+			*p = ToLower(*p);
+}
+
+static int
+match_ban_nuhs(struct Ban *ban, const char *nuhs)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		if(match_compiled_lower(&ban->cmask, &nuhs[i * USERHOST_REPLYLEN]))
+			return 1;
+	return 0;
+}
+
+static int
+ban_host_possible(struct Ban *ban, const char *host, size_t hostlen)
+{
+	switch (ban->hosttype)
+	{
+	case BAN_HOST_SUFFIX:
+		return hostlen >= ban->hostlen &&
+			!ircncmp(host + hostlen - ban->hostlen, ban->host, ban->hostlen);
+	case BAN_HOST_PREFIX:
+		return hostlen >= ban->hostlen && !ircncmp(host, ban->host, ban->hostlen);
+	default:
+		return 1;
+	}
+}
+
+static struct Ban *
+match_ban_exact(struct ban_index *idx, const char *host, const char *nuhs)
+{
+	struct Ban *ban;
+	unsigned int mask = (1U << idx->exact_bits) - 1;
+	unsigned int i;
+
+	i = fnv_hash_upper((const unsigned char *)host, idx->exact_bits, 0) & mask;
+	for(; (ban = idx->exact[i]) != NULL; i = (i + 1) & mask)
+	{
+		if(!irccmp(ban->host, host) && match_ban_nuhs(ban, nuhs))
+			return ban;
+	}
+	return NULL;
+}
+
 /*
  * match_ban()
  *
- * input  - banlist (&chptr->banlist etc), 'who' is to be matched
+ * input  - channel and one of its ban lists, 'who' is to be matched
  *	    if 'nuhs' is specified it must point to buffer of MATCHBANSZ
  *	    'init' being non-zero initializes the cache, otherwise values
- *	    from previous call are used.
- * output - the ban matched by the user 'who'
+ *	    from previous call are used.  an empty list returns before
+ *	    touching the cache.
+ * output - a ban matched by the user 'who'
  *
+ * only bans whose host part can match who's host or ip are tried, see
+ * allocate_ban() and struct ban_index.
  */
-struct	Ban *match_ban(rb_dlink_list *bl, struct Client *who, char *nuhs, int init)
+struct	Ban *match_ban(struct Channel *chptr, rb_dlink_list *bl, struct Client *who,
+		       char *nuhs, int init)
 {
 	char my_nuhs[MATCHBANSZ];
+	struct ban_index **idxp, *idx;
 	struct Ban *ban;
-	rb_dlink_node *ptr;
+	size_t hostlen, iplen;
+	unsigned int i;
+	int sameip;
+
+	if(rb_dlink_list_length(bl) == 0)
+		return NULL;
 
 	if (!nuhs) {
 		nuhs = my_nuhs;
 		init = 1;
 	}
 
- 	if (init) {
-		rb_sprintf(&nuhs[0], "%s!%s@%s", who->name, who->username, who->host);
-		rb_sprintf(&nuhs[USERHOST_REPLYLEN], "%s!%s@%s", who->name, who->username, who->sockhost);
-		rb_sprintf(&nuhs[USERHOST_REPLYLEN*2], "%s!%s@%s", who->id, who->username, who->host);
-		rb_sprintf(&nuhs[USERHOST_REPLYLEN*3], "%s!%s@%s", who->id, who->username, who->sockhost);
+ 	if (init)
+		build_ban_nuhs(who, nuhs);
+
+	idxp = ban_list_index(chptr, bl);
+	if(*idxp == NULL)
+		*idxp = build_ban_index(bl);
+	idx = *idxp;
+
+	sameip = !irccmp(who->host, who->sockhost);
+
+	if(idx->exact != NULL)
+	{
+		if((ban = match_ban_exact(idx, who->host, nuhs)) != NULL)
+			return ban;
+		if(!sameip && (ban = match_ban_exact(idx, who->sockhost, nuhs)) != NULL)
+			return ban;
+	}
+
+	hostlen = strlen(who->host);
+	iplen = strlen(who->sockhost);
+
+	for(i = 0; i < idx->other_count; i++)
+	{
+		ban = idx->other[i];
+
+		if(!ban_host_possible(ban, who->host, hostlen) &&
+		   (sameip || !ban_host_possible(ban, who->sockhost, iplen)))
+			continue;
+
+		if(match_ban_nuhs(ban, nuhs))
+			return ban;
 	}
-	
-	RB_DLINK_FOREACH(ptr, bl->head) {
-		int i;
-		ban = ptr->data;
-		for (i = 0; i < 4; i++)
-			if (match(ban->banstr, &nuhs[i*USERHOST_REPLYLEN]))
-				return ban;
-	};
 	return NULL;
 }
 
@@ -689,12 +1440,14 @@ is_banned(struct Channel *chptr, struct Client *who, struct membership *msptr)
 	if(!MyClient(who))
 		return 0;
 
-	if (match_ban(&chptr->banlist, who, bufmb, 1)) {
-		if (ConfigChannel.use_except && match_ban(&chptr->exceptlist, who, bufmb, 0)) {
-			if (msptr)
-				msptr->flags &= ~CHFL_BANNED;
+	if (msptr) {
+		msptr->ban_serial = chptr->ban_serial;
+		msptr->flags &= ~CHFL_BANNED;
+	}
+
+	if (match_ban(chptr, &chptr->banlist, who, bufmb, 1)) {
+		if (ConfigChannel.use_except && match_ban(chptr, &chptr->exceptlist, who, bufmb, 0))
 			return CHFL_EXCEPTION;
-		}
 		if (msptr)
 			msptr->flags |= CHFL_BANNED;
 		return CHFL_BAN;
@@ -702,6 +1455,110 @@ is_banned(struct Channel *chptr, struct Client *who, struct membership *msptr)
 	return 0;
 }
 
+/* invalidate_bancache()
+ *
+ * input	- channel
+ * output	-
+ * side effects - every member's cached ban state is dropped, to be
+ *                recomputed by is_banned() on the next can_send()
+ */
+void
+invalidate_bancache(struct Channel *chptr)
+{
+	if(++chptr->ban_serial == 0)
+		chptr->ban_serial = 1;
+}
+
+static int
+ban_host_candidate(struct Ban *ban, struct Client *who)
+{
+	if(ban->hosttype == BAN_HOST_EXACT)
+		return !irccmp(ban->host, who->host) || !irccmp(ban->host, who->sockhost);
+
+	return ban_host_possible(ban, who->host, strlen(who->host)) ||
+		ban_host_possible(ban, who->sockhost, strlen(who->sockhost));
+}
+
+/* bancache_ban_added()
+ *
+ * input	- channel, ban just added to its banlist
+ * output	-
+ * side effects - local members with a valid cache are tested against
+ *                the new ban alone.  only a member it matches needs the
+ *                exceptions checked, nobody else's state can change.
+ */
+void
+bancache_ban_added(struct Channel *chptr, struct Ban *banptr)
+{
+	char nuhs[MATCHBANSZ];
+	struct membership *msptr;
+	struct Client *who;
+	unsigned int i;
+
+	/* the cache is only read with quiet_on_ban */
+	if(!ConfigChannel.quiet_on_ban)
+	{
+		invalidate_bancache(chptr);
+		return;
+	}
+
+	for(i = 0; i < chptr->loccount; i++)
+	{
+		msptr = chptr->locmsptr[i];
+		if(msptr->ban_serial != chptr->ban_serial)
+			continue;
+
+		ban_cache_kept++;
+		if(can_send_banned(msptr))
+			continue;
+
+		who = msptr->client_p;
+		if(!ban_host_candidate(banptr, who))
+			continue;
+
+		build_ban_nuhs(who, nuhs);
+		if(!match_ban_nuhs(banptr, nuhs))
+			continue;
+
+		if(ConfigChannel.use_except && match_ban(chptr, &chptr->exceptlist, who, nuhs, 0))
+			continue;
+
+		msptr->flags |= CHFL_BANNED;
+	}
+}
+
+/* bancache_ban_removed()
+ *
+ * input	- channel a ban was just removed from
+ * output	-
+ * side effects - only members cached as banned can change, they are
+ *                checked against the remaining bans
+ */
+void
+bancache_ban_removed(struct Channel *chptr)
+{
+	struct membership *msptr;
+	unsigned int i;
+
+	if(!ConfigChannel.quiet_on_ban)
+	{
+		invalidate_bancache(chptr);
+		return;
+	}
+
+	for(i = 0; i < chptr->loccount; i++)
+	{
+		msptr = chptr->locmsptr[i];
+		if(msptr->ban_serial != chptr->ban_serial)
+			continue;
+
+		if(can_send_banned(msptr))
+			is_banned(chptr, msptr->client_p, msptr);
+		else
+			ban_cache_kept++;
+	}
+}
+
 /* can_send()
  *
  * input	- user to check in channel, membership pointer
@@ -1243,7 +2100,7 @@ static void	reop_channel(struct Channel *chptr)
 
 		if ((!matched ||
 			(matched->client_p->localClient->lasttime < msptr->client_p->localClient->lasttime)) &&
-			match_ban(&chptr->reoplist, msptr->client_p, NULL, 0))
+			match_ban(chptr, &chptr->reoplist, msptr->client_p, NULL, 0))
 		{
 			matched = msptr;
 		}
@@ -1257,6 +2114,7 @@ static void	reop_channel(struct Channel *chptr)
 		sendto_channel_flags(&me, ALL_MEMBERS, &me, chptr, "NOTICE %s :Enforcing channel mode +%c (%ld)",
 			chptr->chname, enforcing, rb_current_time() - chptr->reop);
 		matched->flags |= CHFL_CHANOP;
+		update_member_flags(matched);
 		sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s +o %s",
 			me.name, chptr->chname, Anon(matched->client_p->name));
 		sendto_server(&me, chptr, CAP_TS6, NOCAPS, ":%s TMODE %ld %s +o %s",
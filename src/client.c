@@ -187,6 +187,9 @@ free_local_client(struct Client *client_p)
 		client_p->localClient->listener = 0;
 	}
 
+	send_flush_cancel(client_p);
+	free_cursor(client_p);
+
 	if(client_p->localClient->F != NULL)
 	{
 		del_from_cli_fd_hash(client_p);
@@ -199,6 +202,7 @@ free_local_client(struct Client *client_p)
 		rb_free(client_p->localClient->passwd);
 	}
 
+	rb_free(client_p->localClient->recvq_buf);
 	rb_free(client_p->localClient->chal_resp);
 	rb_free(client_p->localClient->fullcaps);
 	rb_free(client_p->localClient->opername);
@@ -665,6 +669,7 @@ remove_client_from_list(struct Client *client_p)
 	if(client_p->node.prev == NULL && client_p->node.next == NULL)
 		return;
 
+	cursor_drop_node(&client_p->node);
 	rb_dlinkDelete(&client_p->node, &global_client_list);
 
 	update_client_exit_stats(client_p);
@@ -1451,6 +1456,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 	clear_monitor(source_p);
 
 	s_assert(IsClient(source_p));
+	cursor_drop_node(&source_p->localClient->tnode);
 	rb_dlinkDelete(&source_p->localClient->tnode, &lclient_list);
 	rb_dlinkDelete(&source_p->lnode, &me.serv->users);
 
@@ -1856,13 +1862,14 @@ close_connection(struct Client *client_p)
 		/* attempt to flush any pending linebufs. Evil, but .. -- adrian */
 		if(!IsIOError(client_p))
 			send_pop_queue(client_p);
+		send_flush_cancel(client_p);
 		del_from_cli_fd_hash(client_p);
 		rb_close(client_p->localClient->F);
 		client_p->localClient->F = NULL;
 	}
 
 	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
-	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	client_p->localClient->recvq_head = client_p->localClient->recvq_tail = 0;
 	detach_conf(client_p);
 
 	/* XXX shouldnt really be done here. */
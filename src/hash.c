@@ -39,53 +39,109 @@
 #include "s_log.h"
 #include "uid.h"
 
-#define hash_nick(x) (fnv_hash_upper((const unsigned char *)(x), U_MAX_BITS, 0))
-#define hash_id(x) (fnv_hash((const unsigned char *)(x), U_MAX_BITS, 0))
-#define hash_channel(x) (fnv_hash_channel((const unsigned char *)(x), CH_MAX_BITS, 30))
-#define hash_channel_raw(x) (fnv_hash_upper_len((const unsigned char *)(x), CH_MAX_BITS, 30))
-#define hash_hostname(x) (fnv_hash_upper_len((const unsigned char *)(x), HOST_MAX_BITS, 30))
-#define hash_resv(x) (fnv_hash_upper_len((const unsigned char *)(x), R_MAX_BITS, 30))
+#define hash_nick(x) (siphash_upper((const unsigned char *)(x), 32, 0))
+#define hash_id(x) (fnv_hash((const unsigned char *)(x), 32, 0))
+#define hash_channel(x) (siphash_channel((const unsigned char *)(x), 32, 30))
+#define hash_channel_raw(x) (siphash_upper((const unsigned char *)(x), 32, 30))
+#define hash_hostname(x) (siphash_upper((const unsigned char *)(x), 32, 30))
+#define hash_resv(x) (siphash_upper((const unsigned char *)(x), 32, 30))
 #define hash_cli_fd(x)	(x % CLI_FD_MAX)
 
+/* a slot's home is the top bits of the hash times 2^32/phi, which
+ * spreads fnv hashes that only differ in their low bits
+ */
+#define HASH_HOME(hashv, bits) (((uint32_t)(hashv) * 0x9E3779B9U) >> (32 - (bits)))
+
+/* old slots moved into a resized table per add or delete */
+#define HASH_MOVE_STEPS 8
+
+struct hash_slot
+{
+	uint32_t hashv;
+	void *data;
+};
+
+struct hash_table
+{
+	struct hash_slot *slots;
+	struct hash_slot *old;		/* left over from a resize */
+	unsigned int bits;
+	unsigned int oldbits;
+	unsigned int moved;		/* slots of old before this are empty */
+	unsigned int count;
+	unsigned int minbits;
+	const char *name;
+	uint32_t (*func) (unsigned const char *, unsigned int, unsigned int);
+	unsigned int hashlen;
+};
+
+struct hash_iter
+{
+	struct hash_table *table;
+	uint32_t hashv;
+	unsigned int pos;
+	unsigned int dist;
+	int old;
+};
+
+/* every client with the same host, HASH_HOSTNAME keeps one of these
+ * per host instead of one slot per client
+ */
+struct hostname_entry
+{
+	rb_dlink_list clients;
+	char host[HOSTLEN + 1];
+};
+
+/* in hash_type order */
+static struct hash_table hash_tables[] =
+{
+	{ NULL, NULL, 0, 0, 0, 0, U_MIN_BITS, "Client", siphash_upper, 0 },
+	{ NULL, NULL, 0, 0, 0, 0, U_MIN_BITS, "ID", fnv_hash, 0 },
+	{ NULL, NULL, 0, 0, 0, 0, CH_MIN_BITS, "Channel", siphash_channel, 30 },
+	{ NULL, NULL, 0, 0, 0, 0, HOST_MIN_BITS, "Hostname", siphash_upper, 30 },
+	{ NULL, NULL, 0, 0, 0, 0, R_MIN_BITS, "Resv", siphash_upper, 30 },
+	{ NULL, NULL, 0, 0, 0, 0, ND_MIN_BITS, "Nick delay", siphash_upper, 0 }
+};
 
-static rb_dlink_list clientbyfdTable[U_MAX];
-static rb_dlink_list clientTable[U_MAX];
-static rb_dlink_list channelTable[CH_MAX];
-static rb_dlink_list idTable[U_MAX];
-rb_dlink_list resvTable[R_MAX];
-static rb_dlink_list hostTable[HOST_MAX];
+static rb_dlink_list clientbyfdTable[CLI_FD_MAX];
 static rb_dlink_list helpTable[HELP_MAX];
-rb_dlink_list ndTable[U_MAX];
+
+/* key for siphash_upper(), new each boot */
+static uint64_t hash_seed[2];
 
 /*
  * Hashing.
  *
- *   The server uses a chained hash table to provide quick and efficient
- * hash table maintenance (providing the hash function works evenly over
- * the input range).  The hash table is thus not susceptible to problems
- * of filling all the buckets or the need to rehash.
- *    It is expected that the hash table would look something like this
- * during use:
- *                   +-----+    +-----+    +-----+   +-----+
- *                ---| 224 |----| 225 |----| 226 |---| 227 |---
- *                   +-----+    +-----+    +-----+   +-----+
- *                      |          |          |
- *                   +-----+    +-----+    +-----+
- *                   |  A  |    |  C  |    |  D  |
- *                   +-----+    +-----+    +-----+
- *                      |
- *                   +-----+
- *                   |  B  |
- *                   +-----+
+ *   Clients, ids, channels, hosts, resvs and nick delays are kept in
+ * open addressing tables.  Each slot holds the full hash of its entry
+ * and a pointer to it, so a probe only looks at the entry itself when
+ * the hash matches.  Entries go in robin hood order: an entry further
+ * from its home slot takes the place of one that is closer to its own,
+ * which keeps every entry near home, and lets a lookup stop as soon as
+ * it reaches an entry closer to home than it would be.  Deleting shifts
+ * the rest of the run back a slot, so there are no tombstones.
  *
- * A - GOPbot, B - chang, C - hanuaway, D - *.mu.OZ.AU
+ *                    home  home  home
+ *                     |     |     |
+ *                  +-----+-----+-----+-----+-----+
+ *                  |  A  |  B  |  C  |  D  |     |
+ *                  +-----+-----+-----+-----+-----+
+ *                    0     1     1     2
  *
- * The order shown above is just one instant of the server. 
+ * A - GOPbot, B - chang, C - hanuaway, D - *.mu.OZ.AU, below each the
+ * number of slots away from home.
  *
+ * A table doubles when it is 3/4 full and halves when under 1/8 full,
+ * down to its starting size.  The old slots are moved across a few at a
+ * time on each add and delete after that, lookups look at what is left
+ * of the old table until it is empty.
  *
- * The hash functions currently used are based Fowler/Noll/Vo hashes
- * which work amazingly well and have a extremely low collision rate
- * For more info see http://www.isthe.com/chongo/tech/comp/fnv/index.html
+ * Anything a user gets to name (nicks, channels, hosts) is hashed with
+ * SipHash-1-3 under a key picked at startup, so nobody can work out a
+ * set of names that all land on the same slots.  ids are made up by
+ * the servers and still use a Fowler/Noll/Vo hash, see
+ * http://www.isthe.com/chongo/tech/comp/fnv/index.html
  *
  * 
  */
@@ -97,7 +153,22 @@ rb_dlink_list ndTable[U_MAX];
 void
 init_hash(void)
 {
-	/* nothing to do here */
+	struct hash_table *table;
+	unsigned int i;
+
+	if(rb_get_random(hash_seed, sizeof(hash_seed)) == -1)
+	{
+		/* srand() was seeded by seed_random() */
+		hash_seed[0] = ((uint64_t)rand() << 32) ^ rand() ^ rb_current_time();
+		hash_seed[1] = ((uint64_t)rand() << 32) ^ rand() ^ getpid();
+	}
+
+	for(i = 0; i < sizeof(hash_tables) / sizeof(hash_tables[0]); i++)
+	{
+		table = &hash_tables[i];
+		table->bits = table->minbits;
+		table->slots = rb_malloc(sizeof(struct hash_slot) << table->bits);
+	}
 }
 
 
@@ -159,14 +230,100 @@ fnv_hash_upper_len(const unsigned char *s, unsigned int bits, unsigned int len)
 	return h;
 }
 
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do { \
+	v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+	v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+} while(0)
+
+/* ToUpper() on eight bytes at once, 'a' to 'z' lose 0x20.  the top bit
+ * of each byte is set in ge_a for bytes from 'a' up and in gt_z for
+ * bytes past 'z', the low seven bits can't carry into the next byte.
+ */
+static inline uint64_t
+toupper_word(uint64_t x)
+{
+	uint64_t low = x & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t ge_a = low + 0x1f1f1f1f1f1f1f1fULL;
+	uint64_t gt_z = low + 0x0505050505050505ULL;
+
+	return x ^ ((ge_a & ~gt_z & ~x & 0x8080808080808080ULL) >> 2);
+}
+
+/* siphash_upper()
+ *
+ * inputs	- string, bits of hash wanted, most characters to hash or 0
+ * outputs	- SipHash-1-3 of the string in upper case, keyed with
+ *		  hash_seed, in host byte order
+ * side effects -
+ */
+uint32_t
+siphash_upper(const unsigned char *s, unsigned int bits, unsigned int len)
+{
+	uint64_t v0 = hash_seed[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = hash_seed[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = hash_seed[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = hash_seed[1] ^ 0x7465646279746573ULL;
+	uint64_t m;
+	size_t n = strlen((const char *)s);
+	size_t i;
+	uint32_t h;
+
+	if(len != 0 && n > len)
+		n = len;
+
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		memcpy(&m, s + i, sizeof(m));
+		m = toupper_word(m);
+		v3 ^= m;
+		SIP_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	/* the last few bytes go in with the length */
+	m = (uint64_t)n << 56;
+	switch(n - i)
+	{
+	case 7:
+		m |= (uint64_t)s[i + 6] << 48;
+	case 6:
+		m |= (uint64_t)s[i + 5] << 40;
+	case 5:
+		m |= (uint64_t)s[i + 4] << 32;
+	case 4:
+		m |= (uint64_t)s[i + 3] << 24;
+	case 3:
+		m |= (uint64_t)s[i + 2] << 16;
+	case 2:
+		m |= (uint64_t)s[i + 1] << 8;
+	case 1:
+		m |= (uint64_t)s[i];
+	}
+	m = toupper_word(m);
+	v3 ^= m;
+	SIP_ROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+
+	m = v0 ^ v1 ^ v2 ^ v3;
+	h = (uint32_t)(m >> 32) ^ (uint32_t)m;
+	return bits >= 32 ? h : h >> (32 - bits);
+}
+
 /* hash only the part after CHIDLEN for '!' channels */
 uint32_t
-fnv_hash_channel(const unsigned char *s, unsigned bits, unsigned int len)
+siphash_channel(const unsigned char *s, unsigned int bits, unsigned int len)
 {
-	int l = strlen((const char*)s);
-	if ((s[0] == '!') && (l > CHIDLEN+1))
-		return fnv_hash_upper_len(s + CHIDLEN + 1, bits, len);
-	return fnv_hash_upper_len(s, bits, len);
+	if(s[0] == '!' && strlen((const char *)s) > CHIDLEN + 1)
+		s += CHIDLEN + 1;
+	return siphash_upper(s, bits, len);
 }
 
 static unsigned int
@@ -182,55 +339,350 @@ hash_help(const char *name)
 	return (h % HELP_MAX);
 }
 
-static struct _hash_function
+/* hash_probe()
+ *
+ * inputs	- slots, their size, hash, position and distance from home
+ *		  to carry on from
+ * outputs	- 1 with pos at the next slot holding hashv, 0 if there
+ *		  are no more
+ * side effects -
+ */
+static int
+hash_probe(struct hash_slot *slots, unsigned int bits, uint32_t hashv,
+	   unsigned int *pos, unsigned int *dist)
 {
-	uint32_t (*func) (unsigned const char *, unsigned int, unsigned int);
-	rb_dlink_list *table;
-	unsigned int hashbits;
-	unsigned int hashlen;
-} hash_function[] =
+	struct hash_slot *slot;
+	unsigned int mask = (1U << bits) - 1;
+
+	for(;; *pos = (*pos + 1) & mask, (*dist)++)
+	{
+		slot = &slots[*pos];
+
+		/* anything of ours would have taken this slot */
+		if(slot->data == NULL || ((*pos - HASH_HOME(slot->hashv, bits)) & mask) < *dist)
+			return 0;
+
+		if(slot->hashv == hashv)
+			return 1;
+	}
+}
+
+static void
+hash_slot_insert(struct hash_slot *slots, unsigned int bits, uint32_t hashv, void *data)
+{
+	struct hash_slot *slot;
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int pos = HASH_HOME(hashv, bits);
+	unsigned int dist = 0, sdist;
+	uint32_t thashv;
+	void *tdata;
+
+	for(;; pos = (pos + 1) & mask, dist++)
+	{
+		slot = &slots[pos];
+
+		if(slot->data == NULL)
+		{
+			slot->hashv = hashv;
+			slot->data = data;
+			return;
+		}
+
+		/* take the slot from an entry nearer its home, and carry on
+		 * placing that one instead
+		 */
+		sdist = (pos - HASH_HOME(slot->hashv, bits)) & mask;
+		if(sdist < dist)
+		{
+			thashv = slot->hashv;
+			tdata = slot->data;
+			slot->hashv = hashv;
+			slot->data = data;
+			hashv = thashv;
+			data = tdata;
+			dist = sdist;
+		}
+	}
+}
+
+/* empty a slot, moving the rest of its run back one */
+static void
+hash_slot_remove(struct hash_slot *slots, unsigned int bits, unsigned int pos)
+{
+	struct hash_slot *next;
+	unsigned int mask = (1U << bits) - 1;
+
+	for(;;)
+	{
+		next = &slots[(pos + 1) & mask];
+		if(next->data == NULL || HASH_HOME(next->hashv, bits) == ((pos + 1) & mask))
+			break;
+
+		slots[pos] = *next;
+		pos = (pos + 1) & mask;
+	}
+
+	slots[pos].hashv = 0;
+	slots[pos].data = NULL;
+}
+
+static int
+hash_slot_delete(struct hash_slot *slots, unsigned int bits, uint32_t hashv, void *data)
 {
+	unsigned int pos = HASH_HOME(hashv, bits);
+	unsigned int dist = 0;
+
+	while(hash_probe(slots, bits, hashv, &pos, &dist))
 	{
-	fnv_hash_upper, clientTable, U_MAX_BITS, 0},
+		if(slots[pos].data == data)
+		{
+			hash_slot_remove(slots, bits, pos);
+			return 1;
+		}
+		pos = (pos + 1) & ((1U << bits) - 1);
+		dist++;
+	}
+
+	return 0;
+}
+
+/* hash_move()
+ *
+ * inputs	- table, how many old slots to deal with
+ * outputs	-
+ * side effects - entries of a resized table are moved to the new slots
+ */
+static void
+hash_move(struct hash_table *table, unsigned int steps)
+{
+	struct hash_slot *slot;
+	unsigned int size;
+
+	if(table->old == NULL)
+		return;
+
+	size = 1U << table->oldbits;
+	while(table->moved < size && steps-- > 0)
 	{
-	fnv_hash, idTable, U_MAX_BITS, 0},
+		slot = &table->old[table->moved];
+
+		/* removing it may pull the next one back into this slot,
+		 * so the ones below moved stay empty
+		 */
+		if(slot->data != NULL)
+		{
+			hash_slot_insert(table->slots, table->bits, slot->hashv, slot->data);
+			hash_slot_remove(table->old, table->oldbits, table->moved);
+		}
+		else
+			table->moved++;
+	}
+
+	if(table->moved == size)
 	{
-	fnv_hash_channel, channelTable, CH_MAX_BITS, 30},
+		rb_free(table->old);
+		table->old = NULL;
+	}
+}
+
+static void
+hash_resize(struct hash_table *table, unsigned int bits)
+{
+	/* finish off the last one first */
+	hash_move(table, UINT_MAX);
+
+	table->old = table->slots;
+	table->oldbits = table->bits;
+	table->moved = 0;
+	table->bits = bits;
+	table->slots = rb_malloc(sizeof(struct hash_slot) << bits);
+}
+
+static void
+hash_insert(struct hash_table *table, uint32_t hashv, void *data)
+{
+	hash_move(table, HASH_MOVE_STEPS);
+
+	if(table->bits < 30 && table->count >= (3U << table->bits) / 4)
+		hash_resize(table, table->bits + 1);
+
+	hash_slot_insert(table->slots, table->bits, hashv, data);
+	table->count++;
+}
+
+static void
+hash_delete(struct hash_table *table, uint32_t hashv, void *data)
+{
+	if(!hash_slot_delete(table->slots, table->bits, hashv, data) &&
+	   (table->old == NULL || !hash_slot_delete(table->old, table->oldbits, hashv, data)))
+		return;
+
+	table->count--;
+	hash_move(table, HASH_MOVE_STEPS);
+
+	if(table->old == NULL && table->bits > table->minbits &&
+	   table->count < (1U << table->bits) / 8)
+		hash_resize(table, table->bits - 1);
+}
+
+/* hash_next()
+ *
+ * inputs	- iterator from hash_first()
+ * outputs	- next entry with the iterator's hash, or NULL
+ * side effects -
+ */
+static void *
+hash_next(struct hash_iter *iter)
+{
+	struct hash_table *table = iter->table;
+	struct hash_slot *slots;
+	unsigned int bits;
+
+	for(;;)
 	{
-	fnv_hash_upper_len, hostTable, HOST_MAX_BITS, 30},
+		slots = iter->old ? table->old : table->slots;
+		bits = iter->old ? table->oldbits : table->bits;
+
+		if(hash_probe(slots, bits, iter->hashv, &iter->pos, &iter->dist))
+		{
+			void *data = slots[iter->pos].data;
+
+			iter->pos = (iter->pos + 1) & ((1U << bits) - 1);
+			iter->dist++;
+			return data;
+		}
+
+		/* not in the new slots, may not have been moved yet */
+		if(iter->old || table->old == NULL)
+			return NULL;
+
+		iter->old = 1;
+		iter->pos = HASH_HOME(iter->hashv, table->oldbits);
+		iter->dist = 0;
+	}
+}
+
+static void *
+hash_first(struct hash_iter *iter, hash_type type, uint32_t hashv)
+{
+	iter->table = &hash_tables[type];
+	iter->hashv = hashv;
+	iter->pos = HASH_HOME(hashv, iter->table->bits);
+	iter->dist = 0;
+	iter->old = 0;
+	return hash_next(iter);
+}
+
+static uint32_t
+hash_key(hash_type type, const char *hashindex)
+{
+	return (hash_tables[type].func) ((const unsigned char *)hashindex, 32,
+					 hash_tables[type].hashlen);
+}
+
+static struct hostname_entry *
+find_hostname_entry(const char *hostname)
+{
+	struct hostname_entry *hent;
+	struct hash_iter iter;
+
+	for(hent = hash_first(&iter, HASH_HOSTNAME, hash_hostname(hostname)); hent != NULL;
+	    hent = hash_next(&iter))
 	{
-	fnv_hash_upper_len, resvTable, R_MAX_BITS, 30}
-};
+		if(irccmp(hostname, hent->host) == 0)
+			return hent;
+	}
+
+	return NULL;
+}
 
 void
 add_to_hash(hash_type type, const char *hashindex, void *pointer)
 {
-	rb_dlink_list *table = hash_function[type].table;
-	unsigned int hashv;
+	struct hostname_entry *hent;
 
 	if(EmptyString(hashindex) || (pointer == NULL))
 		return;
 
-	hashv = (hash_function[type].func) ((const unsigned char *)hashindex,
-					    hash_function[type].hashbits,
-					    hash_function[type].hashlen);
-//      rb_dlinkAddAlloc(pointer, &hash_function[type].table[hashv]);
-	rb_dlinkAddAlloc(pointer, &table[hashv]);
+	if(type == HASH_HOSTNAME)
+	{
+		if((hent = find_hostname_entry(hashindex)) == NULL)
+		{
+			hent = rb_malloc(sizeof(struct hostname_entry));
+			rb_strlcpy(hent->host, hashindex, sizeof(hent->host));
+			hash_insert(&hash_tables[HASH_HOSTNAME], hash_hostname(hashindex), hent);
+		}
+
+		rb_dlinkAddAlloc(pointer, &hent->clients);
+		return;
+	}
+
+	hash_insert(&hash_tables[type], hash_key(type, hashindex), pointer);
 }
 
 void
 del_from_hash(hash_type type, const char *hashindex, void *pointer)
 {
-	rb_dlink_list *table = hash_function[type].table;
-	unsigned int hashv;
+	struct hostname_entry *hent;
 
 	if(EmptyString(hashindex) || (pointer == NULL))
 		return;
 
-	hashv = (hash_function[type].func) ((const unsigned char *)hashindex,
-					    hash_function[type].hashbits,
-					    hash_function[type].hashlen);
-	rb_dlinkFindDestroy(pointer, &table[hashv]);
+	if(type == HASH_HOSTNAME)
+	{
+		if((hent = find_hostname_entry(hashindex)) == NULL)
+			return;
+
+		rb_dlinkFindDestroy(pointer, &hent->clients);
+		if(rb_dlink_list_length(&hent->clients) == 0)
+		{
+			hash_delete(&hash_tables[HASH_HOSTNAME], hash_hostname(hashindex), hent);
+			rb_free(hent);
+		}
+		return;
+	}
+
+	hash_delete(&hash_tables[type], hash_key(type, hashindex), pointer);
+}
+
+/* hash_walk()
+ *
+ * inputs	- table, function to call on each entry, its argument
+ * outputs	-
+ * side effects - func is called on a copy of the table taken first, so
+ *		  it may delete the entry it is given
+ */
+void
+hash_walk(hash_type type, HASHWALK *func, void *arg)
+{
+	struct hash_table *table = &hash_tables[type];
+	void **entries;
+	unsigned int i, count = 0;
+
+	if(table->count == 0)
+		return;
+
+	entries = rb_malloc(sizeof(void *) * table->count);
+
+	for(i = 0; i < (1U << table->bits); i++)
+	{
+		if(table->slots[i].data != NULL)
+			entries[count++] = table->slots[i].data;
+	}
+
+	if(table->old != NULL)
+	{
+		for(i = table->moved; i < (1U << table->oldbits); i++)
+		{
+			if(table->old[i].data != NULL)
+				entries[count++] = table->old[i].data;
+		}
+	}
+
+	for(i = 0; i < count; i++)
+		func(entries[i], arg);
+
+	rb_free(entries);
 }
 
 void
@@ -248,8 +700,13 @@ add_to_help_hash(const char *name, struct cachefile *hptr)
 void
 add_to_nd_hash(const char *name, struct nd_entry *nd)
 {
-	nd->hashv = hash_nick(name);
-	rb_dlinkAdd(nd, &nd->hnode, &ndTable[nd->hashv]);
+	hash_insert(&hash_tables[HASH_ND], hash_nick(name), nd);
+}
+
+void
+del_from_nd_hash(struct nd_entry *nd)
+{
+	hash_delete(&hash_tables[HASH_ND], hash_nick(nd->name), nd);
 }
 
 void
@@ -277,18 +734,14 @@ struct Client *
 find_id(const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_id(name);
-
-	RB_DLINK_FOREACH(ptr, idTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_ID, hash_id(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if(strcmp(name, target_p->id) == 0)
 			return target_p;
 	}
@@ -344,8 +797,7 @@ struct Client *
 find_any_client(const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
@@ -355,12 +807,9 @@ find_any_client(const char *name)
 	if(IsDigit(*name))
 		return (find_id(name));
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, clientTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_CLIENT, hash_nick(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if(irccmp(name, target_p->name) == 0)
 			return target_p;
 	}
@@ -377,8 +826,7 @@ struct Client *
 find_client(const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
@@ -388,12 +836,9 @@ find_client(const char *name)
 	if(IsDigit(*name))
 		return (find_id(name));
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, clientTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_CLIENT, hash_nick(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if(irccmp(name, target_p->name) == 0) {
 			/* this should return only clients/servers */
 			if (IsSService(target_p))
@@ -413,19 +858,15 @@ struct Client *
 find_service(const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, clientTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_CLIENT, hash_nick(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if(irccmp(name, target_p->name) == 0) {
 			/* this should return only clients/servers */
 			if (!IsSService(target_p))
@@ -446,19 +887,15 @@ struct Client *
 find_named_client(const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, clientTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_CLIENT, hash_nick(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if(irccmp(name, target_p->name) == 0)
 			return target_p;
 	}
@@ -474,8 +911,7 @@ struct Client *
 find_server(struct Client *source_p, const char *name)
 {
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	if(EmptyString(name))
 		return NULL;
@@ -486,12 +922,9 @@ find_server(struct Client *source_p, const char *name)
 		return (target_p);
 	}
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, clientTable[hashv].head)
+	for(target_p = hash_first(&iter, HASH_CLIENT, hash_nick(name)); target_p != NULL;
+	    target_p = hash_next(&iter))
 	{
-		target_p = ptr->data;
-
 		if((IsServer(target_p) || IsMe(target_p)) && irccmp(name, target_p->name) == 0)
 			return target_p;
 	}
@@ -502,21 +935,22 @@ find_server(struct Client *source_p, const char *name)
 
 /* find_hostname()
  *
- * finds a hostname dlink list from the hostname hash table.
- * we return the full dlink list, because you can have multiple
- * entries with the same hostname
+ * finds the clients with a hostname from the hostname hash table.
+ * we return the head of their dlink list, because you can have
+ * multiple entries with the same hostname
  */
 rb_dlink_node *
 find_hostname(const char *hostname)
 {
-	unsigned int hashv;
+	struct hostname_entry *hent;
 
 	if(EmptyString(hostname))
 		return NULL;
 
-	hashv = hash_hostname(hostname);
+	if((hent = find_hostname_entry(hostname)) == NULL)
+		return NULL;
 
-	return hostTable[hashv].head;
+	return hent->clients.head;
 }
 
 /* find_channel()
@@ -527,19 +961,15 @@ struct Channel *
 find_channel(const char *name)
 {
 	struct Channel *chptr;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_channel(name);
-
-	RB_DLINK_FOREACH(ptr, channelTable[hashv].head)
+	for(chptr = hash_first(&iter, HASH_CHANNEL, hash_channel(name)); chptr != NULL;
+	    chptr = hash_next(&iter))
 	{
-		chptr = ptr->data;
-
 		if(irccmp(name, chptr->chname) == 0)
 			return chptr;
 	}
@@ -550,39 +980,43 @@ find_channel(const char *name)
 /* find_channels()
  * input - the channel name with or without CHIDLEN prefix,
  *         !, !! and !# are expected to be stripped.
+ *       - the channel last returned, or NULL to start
  *
- * try to find !channels, return the list of bucket chain
- * so the caller can find out other colliding names.
+ * try to find !channels, called again with the last one returned
+ * the caller can find out other colliding names.
  */
-rb_dlink_node *find_channels(const char *name)
+struct Channel *
+find_channels(const char *name, struct Channel *prev)
 {
 	struct Channel *chptr;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
+	int started = (prev != NULL);
 
 	/* assume the channel is without SID */
-	hashv = hash_channel_raw(name);
-
-	RB_DLINK_FOREACH(ptr, channelTable[hashv].head)
+	for(chptr = hash_first(&iter, HASH_CHANNEL, hash_channel_raw(name)); chptr != NULL;
+	    chptr = hash_next(&iter))
 	{
-		chptr = ptr->data;
+		if (prev != NULL)
+		{
+			if (chptr == prev)
+				prev = NULL;
+			continue;
+		}
 
 		if (chptr->chname[0] == '!' &&
 			(!irccmp(name, chptr->chname + 1 + CHIDLEN)))
-				return ptr;
+				return chptr;
 	}
 
 	/* ok, nothing found or to be created. perhaps there is a prefix in the name? */
-	if (strlen(name) <= CHIDLEN)
+	if (started || strlen(name) <= CHIDLEN)
 		return NULL;
-	hashv = hash_channel_raw(name + CHIDLEN);
-	RB_DLINK_FOREACH(ptr, channelTable[hashv].head)
+	for(chptr = hash_first(&iter, HASH_CHANNEL, hash_channel_raw(name + CHIDLEN));
+	    chptr != NULL; chptr = hash_next(&iter))
 	{
-		chptr = ptr->data;
-
 		if (chptr->chname[0] == '!' &&
 			(!irccmp(name, chptr->chname + 1)))
-				return ptr;
+				return chptr;
 	}
 	return NULL;
 }
@@ -602,8 +1036,8 @@ struct Channel *
 get_or_create_channel(struct Client *client_p, const char *chname, int *isnew)
 {
 	struct Channel *chptr;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
+	uint32_t hashv;
 	int len;
 	const char *s = chname;
 
@@ -625,10 +1059,8 @@ get_or_create_channel(struct Client *client_p, const char *chname, int *isnew)
 
 	hashv = hash_channel(s);
 
-	RB_DLINK_FOREACH(ptr, channelTable[hashv].head)
+	for(chptr = hash_first(&iter, HASH_CHANNEL, hashv); chptr != NULL; chptr = hash_next(&iter))
 	{
-		chptr = ptr->data;
-
 		if(irccmp(s, chptr->chname) == 0)
 		{
 			if(isnew != NULL)
@@ -646,7 +1078,7 @@ get_or_create_channel(struct Client *client_p, const char *chname, int *isnew)
 
 	chptr->channelts = rb_current_time();	/* doesn't hurt to set it here */
 
-	rb_dlinkAddAlloc(chptr, &channelTable[hashv]);
+	hash_insert(&hash_tables[HASH_CHANNEL], hashv, chptr);
 
 	channel_cacheflags(chptr);
 
@@ -661,19 +1093,15 @@ struct ConfItem *
 hash_find_resv(const char *name)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	s_assert(name != NULL);
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_resv(name);
-
-	RB_DLINK_FOREACH(ptr, resvTable[hashv].head)
+	for(aconf = hash_first(&iter, HASH_RESV, hash_resv(name)); aconf != NULL;
+	    aconf = hash_next(&iter))
 	{
-		aconf = ptr->data;
-
 		if(!irccmp(name, aconf->host))
 		{
 			aconf->port++;
@@ -707,43 +1135,36 @@ hash_find_help(const char *name, int flags)
 	return NULL;
 }
 
-void
-clear_resv_hash(void)
+static void
+clear_resv_entry(void *data, void *unused)
 {
-	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
-	int i;
+	struct ConfItem *aconf = data;
 
-	HASH_WALK_SAFE(i, R_MAX, ptr, next_ptr, resvTable)
-	{
-		aconf = ptr->data;
+	/* skip temp resvs */
+	if(aconf->flags & CONF_FLAGS_TEMPORARY)
+		return;
 
-		/* skip temp resvs */
-		if(aconf->flags & CONF_FLAGS_TEMPORARY)
-			continue;
+	del_from_hash(HASH_RESV, aconf->host, aconf);
+	free_conf(aconf);
+}
 
-		free_conf(ptr->data);
-		rb_dlinkDestroy(ptr, &resvTable[i]);
-	}
-HASH_WALK_END}
+void
+clear_resv_hash(void)
+{
+	hash_walk(HASH_RESV, clear_resv_entry, NULL);
+}
 
 struct nd_entry *
 hash_find_nd(const char *name)
 {
 	struct nd_entry *nd;
-	rb_dlink_node *ptr;
-	unsigned int hashv;
+	struct hash_iter iter;
 
 	if(EmptyString(name))
 		return NULL;
 
-	hashv = hash_nick(name);
-
-	RB_DLINK_FOREACH(ptr, ndTable[hashv].head)
+	for(nd = hash_first(&iter, HASH_ND, hash_nick(name)); nd != NULL; nd = hash_next(&iter))
 	{
-		nd = ptr->data;
-
 		if(!irccmp(name, nd->name))
 			return nd;
 	}
@@ -851,16 +1272,111 @@ count_hash(struct Client *source_p, rb_dlink_list *table, int length, const char
 	output_hash(source_p, name, length, counts, deepest);
 }
 
+/* probe lengths of entries in a set of slots, ie. how many slots a
+ * lookup for each looks at
+ */
+static void
+count_probes(struct hash_slot *slots, unsigned int bits, unsigned int *counts,
+	     unsigned long *total, unsigned int *deepest)
+{
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int i, probe;
+
+	for(i = 0; i <= mask; i++)
+	{
+		if(slots[i].data == NULL)
+			continue;
+
+		probe = ((i - HASH_HOME(slots[i].hashv, bits)) & mask) + 1;
+		counts[probe >= 10 ? 10 : probe]++;
+		*total += probe;
+		if(probe > *deepest)
+			*deepest = probe;
+	}
+}
+
+static void
+count_table(struct Client *source_p, struct hash_table *table)
+{
+	unsigned int counts[11];
+	unsigned long total = 0;
+	unsigned int deepest = 0;
+	unsigned int size = 1U << table->bits;
+	char buf[128];
+	int i;
+
+	memset(counts, 0, sizeof(counts));
+	count_probes(table->slots, table->bits, counts, &total, &deepest);
+	if(table->old != NULL)
+		count_probes(table->old, table->oldbits, counts, &total, &deepest);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :%s Hash Statistics", table->name);
+
+	/* rb_snprintf which sendto_one_* uses doesn't support float formats */
+#ifdef HAVE_SNPRINTF
+	snprintf(buf, sizeof(buf),
+#else
+	sprintf(buf,
+#endif
+		"%.3f%%", (float)table->count * 100 / (float)size);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Size: %u Entries: %u Load: %s",
+			   size, table->count, buf);
+
+	if(table->old != NULL)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "B :Resizing from %u, %u slots moved",
+				   1U << table->oldbits, table->moved);
+
+	if(table->count == 0)
+		return;
+
+#ifdef HAVE_SNPRINTF
+	snprintf(buf, sizeof(buf),
+#else
+	sprintf(buf,
+#endif
+		"%.3f", (float)total / (float)table->count);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "B :Average probe length: %s Longest probe: %u", buf, deepest);
+
+	for(i = 1; i < 11; i++)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "B :Entries with probe length %d%s: %u", i,
+				   i == 10 ? "+" : "", counts[i]);
+	}
+}
+
+/* count_hash_memory()
+ *
+ * inputs	- table, where to put its slot count and memory use
+ * outputs	-
+ * side effects -
+ */
+void
+count_hash_memory(hash_type type, size_t *slots, size_t *mem)
+{
+	struct hash_table *table = &hash_tables[type];
+
+	*slots = 1U << table->bits;
+	if(table->old != NULL)
+		*slots += 1U << table->oldbits;
+	*mem = *slots * sizeof(struct hash_slot);
+
+	if(type == HASH_HOSTNAME)
+		*mem += table->count * sizeof(struct hostname_entry);
+}
+
 void
 hash_stats(struct Client *source_p)
 {
-	count_hash(source_p, channelTable, CH_MAX, "Channel");
+	count_table(source_p, &hash_tables[HASH_CHANNEL]);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
-	count_hash(source_p, clientTable, U_MAX, "Client");
+	count_table(source_p, &hash_tables[HASH_CLIENT]);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
-	count_hash(source_p, idTable, U_MAX, "ID");
+	count_table(source_p, &hash_tables[HASH_ID]);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
-	count_hash(source_p, hostTable, HOST_MAX, "Hostname");
+	count_table(source_p, &hash_tables[HASH_HOSTNAME]);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
 	count_hash(source_p, clientbyfdTable, CLI_FD_MAX, "Client by FD");
 }
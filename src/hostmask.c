@@ -34,12 +34,6 @@
 #include "send.h"
 #include "match.h"
 
-#ifdef RB_IPV6
-static uint32_t hash_ipv6(struct sockaddr *, int);
-#endif
-static uint32_t hash_ipv4(struct sockaddr *, int);
-
-
 /* int parse_netmask(const char *, struct rb_sockaddr_storage *, int *);
  * Input: A hostmask, or an IPV4/6 address.
  * Output: An integer describing whether it is an IPV4, IPV6 address or a
@@ -110,308 +104,423 @@ parse_netmask(const char *text, struct sockaddr *naddr, int *nb)
 	return HM_HOST;
 }
 
-/* Hashtable stuff...now external as its used in m_stats.c */
-struct AddressRec *atable[ATABLE_SIZE];
+/* IP masks go into a patricia tree per address family, each node
+ * holding the AddressRecs for its prefix.  host masks go into a trie of
+ * the labels right of their last wildcard, read from the right, so
+ * "*.example.com" hangs off "com" -> "example" and a lookup only visits
+ * the labels of the name.  host masks without such labels ("*",
+ * "foo.*") are kept on wild_arecs and tried on every lookup.
+ */
+static rb_patricia_tree_t *ipv4_tree;
+#ifdef RB_IPV6
+static rb_patricia_tree_t *ipv6_tree;
+#endif
+
+struct host_node
+{
+	struct host_node *parent;	/* NULL for the top level labels */
+	struct host_node *hnext;	/* next in this host_table bucket */
+	struct AddressRec *arec;	/* masks whose labels end here */
+	unsigned int children;
+	uint32_t hashv;
+	unsigned int len;
+	char label[1];			/* folded with ToLower(), not terminated */
+};
+
+#define HOST_TABLE_MIN_BITS	8
+#define HOST_LABELS_MAX		64
+
+/* host_nodes, hashed on their parent and label */
+static struct host_node **host_table;
+static unsigned int host_table_bits;
+static unsigned int host_node_count;
+
+static struct AddressRec *wild_arecs;
+
+/* every AddressRec, in the order they were added.  external as its used
+ * in m_stats.c and m_kline.c
+ */
+rb_dlink_list address_list;
 
 void
 init_host_hash(void)
 {
-	memset(&atable, 0, sizeof(atable));
+	ipv4_tree = rb_new_patricia(32);
+#ifdef RB_IPV6
+	ipv6_tree = rb_new_patricia(128);
+#endif
+	host_table_bits = HOST_TABLE_MIN_BITS;
+	host_table = rb_malloc(sizeof(struct host_node *) << host_table_bits);
 }
 
-/* uint32_t hash_ipv4(struct rb_sockaddr_storage*)
- * Input: An IP address.
- * Output: A hash value of the IP address.
- * Side effects: None
+static rb_patricia_tree_t *
+ip_tree(int fam)
+{
+#ifdef RB_IPV6
+	if(fam == AF_INET6)
+		return ipv6_tree;
+#endif
+	if(fam == AF_INET)
+		return ipv4_tree;
+	return NULL;
+}
+
+/* the longest prefix in the tree covering addr, the shorter ones are
+ * among its parents.  same as rb_match_ip() without allocating a prefix.
  */
-static uint32_t
-hash_ipv4(struct sockaddr *saddr, int bits)
+static rb_patricia_node_t *
+ip_best(rb_patricia_tree_t *tree, void *ipptr, int fam)
 {
-	struct sockaddr_in *addr = (struct sockaddr_in *)(void *)saddr;
+	rb_prefix_t prefix;
 
-	if(bits != 0)
+	memset(&prefix, 0, sizeof(prefix));
+	prefix.family = fam;
+#ifdef RB_IPV6
+	if(fam == AF_INET6)
 	{
-		uint32_t av = ntohl(addr->sin_addr.s_addr) & ~((1 << (32 - bits)) - 1);
-		return (av ^ (av >> 12) ^ (av >> 24)) & (ATABLE_SIZE - 1);
+		prefix.bitlen = 128;
+		memcpy(&prefix.add.sin6, ipptr, sizeof(struct in6_addr));
+	}
+	else
+#endif
+	{
+		prefix.bitlen = 32;
+		memcpy(&prefix.add.sin, ipptr, sizeof(struct in_addr));
 	}
 
-	return 0;
+	return rb_patricia_search_best(tree, &prefix);
 }
 
-/* uint32_t hash_ipv6(struct rb_sockaddr_storage*)
- * Input: An IP address.
- * Output: A hash value of the IP address.
+/* uint32_t hash_label(struct host_node *, const char *, unsigned int)
+ * Input: The parent node, a label and its length.
+ * Output: FNV-1a of the label folded with ToLower(), mixed with the parent.
  * Side effects: None
  */
-#ifdef RB_IPV6
 static uint32_t
-hash_ipv6(struct sockaddr *saddr, int bits)
+hash_label(struct host_node *parent, const char *label, unsigned int len)
 {
-	struct sockaddr_in6 *addr = (struct sockaddr_in6 *)(void *)saddr;
-	uint32_t v = 0, n;
-	for(n = 0; n < 16; n++)
+	uint32_t h = 0x811c9dc5UL ^ (uint32_t)((uintptr_t)parent >> 3);
+
+	while(len--)
 	{
-		if(bits >= 8)
+		h ^= ToLower(*label++);
+		h *= 0x01000193UL;
+	}
+
+	return h;
+}
+
+static struct host_node *
+host_node_find(struct host_node *parent, const char *label, unsigned int len)
+{
+	struct host_node *node;
+	uint32_t hashv = hash_label(parent, label, len);
+	unsigned int i;
+
+	for(node = host_table[hashv & ((1U << host_table_bits) - 1)]; node; node = node->hnext)
+	{
+		if(node->hashv != hashv || node->parent != parent || node->len != len)
+			continue;
+
+		for(i = 0; i < len && node->label[i] == ToLower(label[i]); i++)
+			;
+		if(i == len)
+			return node;
+	}
+
+	return NULL;
+}
+
+static void
+host_table_grow(void)
+{
+	struct host_node **table;
+	struct host_node *node, *next;
+	unsigned int bits = host_table_bits + 1;
+	unsigned int i, pos;
+
+	table = rb_malloc(sizeof(struct host_node *) << bits);
+
+	for(i = 0; i < (1U << host_table_bits); i++)
+	{
+		for(node = host_table[i]; node; node = next)
 		{
-			v ^= addr->sin6_addr.s6_addr[n];
-			bits -= 8;
+			next = node->hnext;
+			pos = node->hashv & ((1U << bits) - 1);
+			node->hnext = table[pos];
+			table[pos] = node;
 		}
-		else if(bits)
+	}
+
+	rb_free(host_table);
+	host_table = table;
+	host_table_bits = bits;
+}
+
+static struct host_node *
+host_node_create(struct host_node *parent, const char *label, unsigned int len)
+{
+	struct host_node *node;
+	unsigned int i, pos;
+
+	if(++host_node_count > (1U << host_table_bits))
+		host_table_grow();
+
+	node = rb_malloc(sizeof(struct host_node) + len);
+	node->parent = parent;
+	node->hashv = hash_label(parent, label, len);
+	node->len = len;
+	for(i = 0; i < len; i++)
+		node->label[i] = ToLower(label[i]);
+
+	pos = node->hashv & ((1U << host_table_bits) - 1);
+	node->hnext = host_table[pos];
+	host_table[pos] = node;
+
+	if(parent != NULL)
+		parent->children++;
+
+	return node;
+}
+
+/* host_node_release()
+ *
+ * inputs	- a host_node that may have lost its last mask
+ * outputs	- none
+ * side effects - the node and any parents left with nothing under
+ *		  them are freed
+ */
+static void
+host_node_release(struct host_node *node)
+{
+	struct host_node *parent, **hp;
+
+	while(node != NULL && node->arec == NULL && node->children == 0)
+	{
+		for(hp = &host_table[node->hashv & ((1U << host_table_bits) - 1)];
+		    *hp != node; hp = &(*hp)->hnext)
+			;
+		*hp = node->hnext;
+		host_node_count--;
+
+		parent = node->parent;
+		if(parent != NULL)
+			parent->children--;
+		rb_free(node);
+		node = parent;
+	}
+}
+
+/* host_node_key()
+ *
+ * inputs	- the labels of a mask, as from get_mask_key()
+ *		- whether to create the nodes that are missing
+ * outputs	- the node for the last label read, the leftmost
+ * side effects - none unless create is set
+ */
+static struct host_node *
+host_node_key(const char *key, int create)
+{
+	struct host_node *node = NULL, *child;
+	const char *end = key + strlen(key);
+	const char *p;
+
+	for(;;)
+	{
+		for(p = end; p > key && p[-1] != '.'; p--)
+			;
+
+		if((child = host_node_find(node, p, end - p)) == NULL)
 		{
-			v ^= addr->sin6_addr.s6_addr[n] & ~((1 << (8 - bits)) - 1);
-			return v & (ATABLE_SIZE - 1);
+			if(!create)
+				return NULL;
+			child = host_node_create(node, p, end - p);
 		}
-		else
-			return v & (ATABLE_SIZE - 1);
+		node = child;
+
+		if(p == key)
+			return node;
+		end = p - 1;
 	}
-	return v & (ATABLE_SIZE - 1);
 }
-#endif
 
-/* int hash_text(const char *start)
- * Input: The start of the text to hash.
- * Output: The hash of the string between 1 and (TH_MAX-1)
- * Side-effects: None.
+/* host_node_path()
+ *
+ * inputs	- a hostname, array of HOST_LABELS_MAX
+ * outputs	- the number of nodes matching the labels of the name from
+ *		  the right, which are put into path, shortest first
+ * side effects - none
  */
-static uint32_t
-hash_text(const char *start)
+static int
+host_node_path(const char *name, struct host_node **path)
 {
-	const char *p = start;
-	uint32_t h = 0;
+	struct host_node *node = NULL;
+	const char *end = name + strlen(name);
+	const char *p;
+	int depth = 0;
 
-	while(*p)
+	while(depth < HOST_LABELS_MAX)
 	{
-		h = (h << 4) - (h + (unsigned char)ToLower(*p++));
+		for(p = end; p > name && p[-1] != '.'; p--)
+			;
+
+		if((node = host_node_find(node, p, end - p)) == NULL)
+			break;
+		path[depth++] = node;
+
+		if(p == name)
+			break;
+		end = p - 1;
 	}
 
-	return (h & (ATABLE_SIZE - 1));
+	return depth;
 }
 
-/* uint32_t get_hash_mask(const char *)
- * Input: The text to hash.
- * Output: The hash of the string right of the first '.' past the last
- *         wildcard in the string.
+/* const char *get_mask_key(const char *)
+ * Input: A host mask.
+ * Output: The labels right of the first '.' past the last wildcard in
+ *         the mask, the whole mask if there are no wildcards, or "".
  * Side-effects: None.
  */
-static uint32_t
-get_mask_hash(const char *text)
+static const char *
+get_mask_key(const char *text)
 {
 	const char *hp = "", *p;
 
 	for(p = text + strlen(text) - 1; p >= text; p--)
 		if(*p == '*' || *p == '?')
-			return hash_text(hp);
+			return hp;
 		else if(*p == '.')
 			hp = p + 1;
-	return hash_text(text);
+	return text;
 }
 
-/* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
- *         int type, int fam, const char *username)
- * Input: The hostname, the address, the type of mask to find, the address
- *        family, the username.
- * Output: The matching value with the highest precedence.
- * Side-effects: None
+/* whether arec is a type record for username, that would beat hprecv */
+static inline int
+arec_wanted(struct AddressRec *arec, int type, const char *username, uint32_t hprecv)
+{
+	if(type != (arec->type & ~CONF_SKIPUSER))
+		return 0;
+	if(type == CONF_CLIENT && arec->precedence <= hprecv)
+		return 0;
+	return (arec->type & CONF_SKIPUSER) || match_compiled(&arec->user_cmask, username);
+}
+
+/* find_address_rec()
+ *
+ * inputs	- hostname, sockhost, address and its family, the type of
+ *		  record and username to match
+ * outputs	- for CONF_CLIENT the matching record with the highest
+ *		  precedence, otherwise the first match found, trying
+ *		  the longest IP prefixes and the host masks with the most
+ *		  labels first
+ * side effects - none
  */
-struct ConfItem *
-find_auth(const char *name, const char *sockhost,
-	  struct sockaddr *addr, int fam, const char *username)
+static struct ConfItem *
+find_address_rec(const char *name, const char *sockhost, struct sockaddr *addr,
+		 int fam, int type, const char *username)
 {
-	uint32_t hprecv = 0;
+	struct host_node *path[HOST_LABELS_MAX];
 	struct ConfItem *hprec = NULL;
 	struct AddressRec *arec;
-	int b;
+	rb_patricia_tree_t *tree;
+	rb_patricia_node_t *pnode;
+	uint32_t hprecv = 0;
+	void *ipptr;
+	int depth;
 
 	if(username == NULL)
 		username = "";
 
-	if(addr)
+	if(addr != NULL && (tree = ip_tree(fam)) != NULL)
 	{
-		/* Check for IPV6 matches... */
 #ifdef RB_IPV6
 		if(fam == AF_INET6)
-		{
-
-			for(b = 128; b >= 0; b -= 16)
-			{
-				for(arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-				{
-					if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.
-							       ipa.addr, arec->Mask.ipa.bits)
-					   && (arec->type & CONF_SKIPUSER
-					       || match(arec->username, username))
-					   && arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-				}
-			}
-		}
+			ipptr = &((struct sockaddr_in6 *)(void *)addr)->sin6_addr;
 		else
 #endif
-		if(fam == AF_INET)
+			ipptr = &((struct sockaddr_in *)(void *)addr)->sin_addr;
+
+		for(pnode = ip_best(tree, ipptr, fam); pnode != NULL; pnode = pnode->parent)
 		{
-			for(b = 32; b >= 0; b -= 8)
+			if(pnode->prefix == NULL || pnode->data == NULL ||
+			   !comp_with_mask(ipptr, rb_prefix_touchar(pnode->prefix),
+					   pnode->prefix->bitlen))
+				continue;
+
+			for(arec = pnode->data; arec; arec = arec->next)
 			{
-				for(arec = atable[hash_ipv4(addr, b)]; arec; arec = arec->next)
-					if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-					   arec->masktype == HM_IPV4 &&
-					   arec->precedence > hprecv &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.
-							       ipa.addr, arec->Mask.ipa.bits)
-					   && (arec->type & CONF_SKIPUSER
-					       || match(arec->username, username)))
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
+				if(!arec_wanted(arec, type, username, hprecv))
+					continue;
+				if(type != CONF_CLIENT)
+					return arec->aconf;
+				hprecv = arec->precedence;
+				hprec = arec->aconf;
 			}
 		}
 	}
 
 	if(name != NULL)
 	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for(p = name; p != NULL;)
-		{
-			for(arec = atable[hash_text(p)]; arec; arec = arec->next)
-			{
-				if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, name) &&
-				   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			}
+		depth = host_node_path(name, path);
 
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for(arec = atable[0]; arec; arec = arec->next)
+		while(depth-- > 0)
 		{
-			if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
+			for(arec = path[depth]->arec; arec; arec = arec->next)
 			{
+				if(!arec_wanted(arec, type, username, hprecv) ||
+				   !match_compiled(&arec->host_cmask, name))
+					continue;
+				if(type != CONF_CLIENT)
+					return arec->aconf;
 				hprecv = arec->precedence;
 				hprec = arec->aconf;
 			}
 		}
+
+		for(arec = wild_arecs; arec; arec = arec->next)
+		{
+			if(!arec_wanted(arec, type, username, hprecv) ||
+			   !(match_compiled(&arec->host_cmask, name) ||
+			     (sockhost && match_compiled(&arec->host_cmask, sockhost))))
+				continue;
+			if(type != CONF_CLIENT)
+				return arec->aconf;
+			hprecv = arec->precedence;
+			hprec = arec->aconf;
+		}
 	}
+
 	return hprec;
 }
 
+/* struct ConfItem* find_auth(const char*, const char *,
+ *         struct rb_sockaddr_storage*, int fam, const char *username)
+ * Input: The hostname, the sockhost, the address, the address family,
+ *        the username.
+ * Output: The matching auth {} with the highest precedence.
+ * Side-effects: None
+ */
+struct ConfItem *
+find_auth(const char *name, const char *sockhost,
+	  struct sockaddr *addr, int fam, const char *username)
+{
+	return find_address_rec(name, sockhost, addr, fam, CONF_CLIENT, username);
+}
+
 
 /* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
  *         int type, int fam, const char *username)
  * Input: The hostname, the address, the type of mask to find, the address
  *        family, the username.
- * Output: The matching value with the highest precedence.
+ * Output: The most specific matching record of that type.
  * Side-effects: None
  */
 struct ConfItem *
 find_conf_by_address(const char *name, const char *sockhost,
 		     struct sockaddr *addr, int type, int fam, const char *username)
 {
-	struct AddressRec *arec;
-	int b;
-
-	if(username == NULL)
-		username = "";
-
-	if(addr)
-	{
-		/* Check for IPV6 matches... */
-#ifdef RB_IPV6
-		if(fam == AF_INET6)
-		{
-
-			for(b = 128; b >= 0; b -= 16)
-			{
-				for(arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-				{
-					if(type == (arec->type & ~CONF_SKIPUSER) &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.
-							       ipa.addr, arec->Mask.ipa.bits)
-					   && (arec->type & CONF_SKIPUSER
-					       || match(arec->username, username)))
-						return arec->aconf;
-				}
-			}
-		}
-		else
-#endif
-		if(fam == AF_INET)
-		{
-			for(b = 32; b >= 0; b -= 8)
-			{
-				for(arec = atable[hash_ipv4(addr, b)]; arec; arec = arec->next)
-				{
-					if(type == (arec->type & ~CONF_SKIPUSER) &&
-					   arec->masktype == HM_IPV4 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.
-							       ipa.addr, arec->Mask.ipa.bits)
-					   && (arec->type & CONF_SKIPUSER
-					       || match(arec->username, username)))
-						return arec->aconf;
-				}
-			}
-		}
-	}
-
-	if(name != NULL)
-	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for(p = name; p != NULL;)
-		{
-			for(arec = atable[hash_text(p)]; arec; arec = arec->next)
-			{
-				if(type == (arec->type & ~CONF_SKIPUSER) &&
-				   (arec->masktype == HM_HOST) &&
-				   match(arec->Mask.hostname, name) &&
-				   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-					return arec->aconf;
-			}
-
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for(arec = atable[0]; arec; arec = arec->next)
-		{
-			if(type == (arec->type & ~CONF_SKIPUSER) &&
-			   arec->masktype == HM_HOST &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-				return arec->aconf;
-		}
-	}
-
-	return NULL;
+	return find_address_rec(name, sockhost, addr, fam, type, username);
 }
 
 /* struct ConfItem* find_address_conf(const char*, const char*,
@@ -480,50 +589,59 @@ find_address_conf(const char *host, const char *sockhost, const char *user,
  *         struct ConfItem *aconf)
  * Input: 
  * Output: None
- * Side-effects: Adds this entry to the hash table.
+ * Side-effects: Adds this entry to the IP trees or the host trie.
  */
 void
 add_conf_by_address(const char *address, int type, const char *username, struct ConfItem *aconf)
 {
 	static uint32_t prec_value = 0xFFFFFFFF;
 	int masktype, bits;
-	uint32_t hv;
 	struct AddressRec *arec;
+	struct host_node *hnode;
+	rb_patricia_node_t *pnode;
+	const char *key;
 
 	if(address == NULL)
 		address = "/NOMATCH!/";
 	arec = rb_malloc(sizeof(struct AddressRec));
 	masktype = parse_netmask(address, (struct sockaddr *)&arec->Mask.ipa.addr, &bits);
-	arec->Mask.ipa.bits = bits;
+
+	/* a negative cidr never matched anything, keep it that way */
+	if(masktype != HM_HOST && bits < 0)
+		masktype = HM_HOST;
+
 	arec->masktype = masktype;
-#ifdef RB_IPV6
-	if(masktype == HM_IPV6)
+	if(masktype != HM_HOST)
 	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 16;
-		arec->next =
-			atable[(hv = hash_ipv6((struct sockaddr *)&arec->Mask.ipa.addr, bits))];
-		atable[hv] = arec;
-	}
-	else
-#endif
-	if(masktype == HM_IPV4)
-	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 8;
-		arec->next =
-			atable[(hv = hash_ipv4((struct sockaddr *)&arec->Mask.ipa.addr, bits))];
-		atable[hv] = arec;
+		arec->Mask.ipa.bits = bits;
+		pnode = make_and_lookup_ip(ip_tree(GET_SS_FAMILY(&arec->Mask.ipa.addr)),
+					   (struct sockaddr *)&arec->Mask.ipa.addr, bits);
+		arec->next = pnode->data;
+		pnode->data = arec;
+		arec->pnode = pnode;
 	}
 	else
 	{
 		arec->Mask.hostname = address;
-		arec->next = atable[(hv = get_mask_hash(address))];
-		atable[hv] = arec;
+		key = get_mask_key(address);
+
+		if(*key != '\0')
+		{
+			hnode = host_node_key(key, 1);
+			arec->next = hnode->arec;
+			hnode->arec = arec;
+			arec->hnode = hnode;
+		}
+		else
+		{
+			arec->next = wild_arecs;
+			wild_arecs = arec;
+		}
 	}
 	arec->username = username;
 	arec->aconf = aconf;
 	arec->type = type;
+	rb_dlinkAddTail(arec, &arec->node, &address_list);
 
 	/* only auth {}; gets a precedence */
 	if(type == CONF_CLIENT)
@@ -531,6 +649,58 @@ add_conf_by_address(const char *address, int type, const char *username, struct
 
 	if(EmptyString(username) || (username[0] == '*' && username[1] == '\0'))
 		arec->type |= CONF_SKIPUSER;
+	else
+		compile_mask(&arec->user_cmask, username);
+
+	if(masktype == HM_HOST)
+		compile_mask(&arec->host_cmask, address);
+}
+
+static struct AddressRec *
+unlink_arec(struct AddressRec *head, struct AddressRec *arec)
+{
+	struct AddressRec *prev;
+
+	if(head == arec)
+		return arec->next;
+
+	for(prev = head; prev->next != arec; prev = prev->next)
+		;
+	prev->next = arec->next;
+	return head;
+}
+
+/* remove_arec()
+ *
+ * inputs	- an AddressRec
+ * outputs	- none
+ * side effects - takes it out of the IP trees or host trie and frees it,
+ *		  but not the ConfItem
+ */
+static void
+remove_arec(struct AddressRec *arec)
+{
+	rb_patricia_node_t *pnode;
+
+	if(arec->masktype != HM_HOST)
+	{
+		pnode = arec->pnode;
+		pnode->data = unlink_arec(pnode->data, arec);
+		if(pnode->data == NULL)
+			rb_patricia_remove(ip_tree(GET_SS_FAMILY(&arec->Mask.ipa.addr)), pnode);
+	}
+	else if(arec->hnode != NULL)
+	{
+		arec->hnode->arec = unlink_arec(arec->hnode->arec, arec);
+		host_node_release(arec->hnode);
+	}
+	else
+		wild_arecs = unlink_arec(wild_arecs, arec);
+
+	rb_dlinkDelete(&arec->node, &address_list);
+	free_compiled_mask(&arec->host_cmask);
+	free_compiled_mask(&arec->user_cmask);
+	rb_free(arec);
 }
 
 /* void delete_one_address(const char*, struct ConfItem*)
@@ -543,117 +713,102 @@ void
 delete_one_address_conf(const char *address, struct ConfItem *aconf)
 {
 	int masktype, bits;
-	uint32_t hv;
-	struct AddressRec *arec, *arecl = NULL;
+	struct AddressRec *arec;
+	struct host_node *hnode;
+	rb_patricia_node_t *pnode;
 	struct rb_sockaddr_storage addr;
+	const char *key;
+
 	masktype = parse_netmask(address, (struct sockaddr *)&addr, &bits);
-#ifdef RB_IPV6
-	if(masktype == HM_IPV6)
+	if(masktype != HM_HOST && bits < 0)
+		masktype = HM_HOST;
+
+	if(masktype != HM_HOST)
 	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 16;
-		hv = hash_ipv6((struct sockaddr *)&addr, bits);
+		pnode = rb_match_ip_exact(ip_tree(GET_SS_FAMILY(&addr)),
+					  (struct sockaddr *)&addr, bits);
+		if(pnode == NULL)
+			return;
+		arec = pnode->data;
 	}
-	else
-#endif
-	if(masktype == HM_IPV4)
+	else if(*(key = get_mask_key(address)) != '\0')
 	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 8;
-		hv = hash_ipv4((struct sockaddr *)&addr, bits);
+		if((hnode = host_node_key(key, 0)) == NULL)
+			return;
+		arec = hnode->arec;
 	}
 	else
-		hv = get_mask_hash(address);
-	for(arec = atable[hv]; arec; arec = arec->next)
+		arec = wild_arecs;
+
+	for(; arec; arec = arec->next)
 	{
 		if(arec->aconf == aconf)
 		{
-			if(arecl)
-				arecl->next = arec->next;
-			else
-				atable[hv] = arec->next;
+			remove_arec(arec);
 			aconf->status |= CONF_ILLEGAL;
 			if(!aconf->clients)
 				free_conf(aconf);
-			rb_free(arec);
 			return;
 		}
-		arecl = arec;
 	}
 }
 
 /* void clear_out_address_conf(void)
  * Input: None
  * Output: None
- * Side effects: Clears out all address records in the hash table,
- *               frees them, and frees the ConfItems if nothing references
- *               them, otherwise sets them as illegal.
+ * Side effects: Clears out all address records in the IP trees and host
+ *               trie, frees them, and frees the ConfItems if nothing
+ *               references them, otherwise sets them as illegal.
  */
 void
 clear_out_address_conf(void)
 {
-	int i;
-	struct AddressRec **store_next;
-	struct AddressRec *arec, *arecn;
+	struct AddressRec *arec;
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
 
-	for(i = 0; i < ATABLE_SIZE; i++)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, address_list.head)
 	{
-		store_next = &atable[i];
-		for(arec = atable[i]; arec; arec = arecn)
-		{
-			arecn = arec->next;
-			/* We keep the temporary K-lines and destroy the
-			 * permanent ones, just to be confusing :) -A1kmm */
-			if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
-			   ((arec->type & ~CONF_SKIPUSER) != CONF_CLIENT &&
-			    (arec->type & ~CONF_SKIPUSER) != CONF_EXEMPTDLINE))
-			{
-				*store_next = arec;
-				store_next = &arec->next;
-			}
-			else
-			{
-				arec->aconf->status |= CONF_ILLEGAL;
-				if(!arec->aconf->clients)
-					free_conf(arec->aconf);
-				rb_free(arec);
-			}
-		}
-		*store_next = NULL;
+		arec = ptr->data;
+		aconf = arec->aconf;
+
+		/* We keep the temporary K-lines and destroy the
+		 * permanent ones, just to be confusing :) -A1kmm */
+		if(aconf->flags & CONF_FLAGS_TEMPORARY ||
+		   ((arec->type & ~CONF_SKIPUSER) != CONF_CLIENT &&
+		    (arec->type & ~CONF_SKIPUSER) != CONF_EXEMPTDLINE))
+			continue;
+
+		remove_arec(arec);
+		aconf->status |= CONF_ILLEGAL;
+		if(!aconf->clients)
+			free_conf(aconf);
 	}
 }
 
 void
 clear_out_address_conf_bans(void)
 {
-	int i;
-	struct AddressRec **store_next;
-	struct AddressRec *arec, *arecn;
+	struct AddressRec *arec;
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
 
-	for(i = 0; i < ATABLE_SIZE; i++)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, address_list.head)
 	{
-		store_next = &atable[i];
-		for(arec = atable[i]; arec; arec = arecn)
-		{
-			arecn = arec->next;
-			/* We keep the temporary K-lines and destroy the
-			 * permanent ones, just to be confusing :) -A1kmm */
-			if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
-			   ((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT ||
-			    (arec->type & ~CONF_SKIPUSER) == CONF_EXEMPTDLINE))
-			{
-				*store_next = arec;
-				store_next = &arec->next;
-			}
-			else
-			{
-				arec->aconf->status |= CONF_ILLEGAL;
-				if(!arec->aconf->clients)
-					free_conf(arec->aconf);
-				rb_free(arec);
-			}
-		}
-		*store_next = NULL;
+		arec = ptr->data;
+		aconf = arec->aconf;
+
+		/* We keep the temporary K-lines and destroy the
+		 * permanent ones, just to be confusing :) -A1kmm */
+		if(aconf->flags & CONF_FLAGS_TEMPORARY ||
+		   ((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT ||
+		    (arec->type & ~CONF_SKIPUSER) == CONF_EXEMPTDLINE))
+			continue;
+
+		remove_arec(arec);
+		aconf->status |= CONF_ILLEGAL;
+		if(!aconf->clients)
+			free_conf(aconf);
 	}
 }
 
@@ -108,6 +108,11 @@ int server_state_foreground = 0;
 int printVersion = 0;
 int ircd_ssl_ok = 0;
 int zlib_ok = 1;
+#ifdef HAVE_ZSTD
+int zstd_ok = 1;
+#else
+int zstd_ok = 0;
+#endif
 
 int testing_conf = 0;
 int conf_parse_failure = 0;
@@ -371,7 +376,7 @@ initialize_global_set_options(void)
 static void
 initialize_server_capabs(void)
 {
-	default_server_capabs &= ~CAP_ZIP;
+	default_server_capabs &= ~(CAP_ZIP | CAP_ZSTD);
 }
 
 
@@ -783,6 +788,9 @@ ratbox_main(int argc, char *argv[])
 	if(splitmode)
 		rb_event_add("check_splitmode", check_splitmode, NULL, 5);
 
+	/* write out sendqs once per loop rather than once per line */
+	rb_lib_set_loop_cb(send_flush_queued);
+
 	rb_lib_loop(0);		/* we'll never return from here */
 	return 0;
 }
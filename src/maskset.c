@@ -0,0 +1,378 @@
+/*
+ *  ircd-ratbox: A slightly useful ircd.
+ *  maskset.c: A list of match_esc() masks matched all at once.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ *  $Id$
+ */
+
+#include "stdinc.h"
+#include "struct.h"
+#include "ratbox_lib.h"
+#include "client.h"
+#include "s_conf.h"
+#include "s_log.h"
+#include "send.h"
+#include "match.h"
+#include "maskset.h"
+
+/* longest run put into the automaton.  any part of a run the mask
+ * needs is needed just as much, so longer runs are cut short to keep
+ * the trie small.
+ */
+#define MASKSET_RUNLEN	16
+
+/* node 0 is the root.  children hang off first/next, the root's are
+ * also in mask_set.root[] so most characters never walk a list.
+ */
+struct maskset_node
+{
+	unsigned int first;	/* first child */
+	unsigned int next;	/* next sibling */
+	unsigned int fail;	/* longest proper suffix that is also a node */
+	unsigned int out;	/* next node down the fail chain that ends a run */
+	unsigned int pat;	/* masks whose run ends here, +1 into pats */
+	unsigned char c;
+};
+
+struct maskset_pat
+{
+	struct ConfItem *aconf;
+	unsigned int next;	/* next mask with the same run, +1 */
+	unsigned int stamp;	/* maskset_find() call that last saw it */
+};
+
+void
+maskset_init(struct mask_set *set, rb_dlink_list *list)
+{
+	memset(set, 0, sizeof(struct mask_set));
+	set->list = list;
+	set->dirty = 1;
+}
+
+void
+maskset_changed(struct mask_set *set)
+{
+	set->dirty = 1;
+}
+
+/* maskset_run()
+ *
+ * inputs	- match_esc() mask, buffer of MASKSET_RUNLEN
+ * outputs	- length of the longest run of characters that anything
+ *		  the mask matches must contain, folded with ToLower()
+ * side effects -
+ *
+ * '*', '?', '@' and '#' end a run.  a '\' quotes the next character,
+ * which then matches itself, except "\s" which matches a space.
+ */
+static unsigned int
+maskset_run(const char *mask, unsigned char *run)
+{
+	const char *p = mask;
+	const char *best = NULL, *start = NULL;
+	unsigned int bestlen = 0, len = 0;
+	unsigned int i;
+
+	for(;; p++)
+	{
+		if(*p == '\\' && p[1] != '\0')
+		{
+			if(start == NULL)
+				start = p;
+			len++;
+			p++;
+			continue;
+		}
+
+		if(*p == '\0' || *p == '\\' || *p == '*' || *p == '?' || *p == '@' || *p == '#')
+		{
+			if(len > bestlen)
+			{
+				best = start;
+				bestlen = len;
+			}
+			if(*p == '\0')
+				break;
+			start = NULL;
+			len = 0;
+			continue;
+		}
+
+		if(start == NULL)
+			start = p;
+		len++;
+	}
+
+	if(bestlen > MASKSET_RUNLEN)
+		bestlen = MASKSET_RUNLEN;
+
+	for(i = 0, p = best; i < bestlen; i++, p++)
+	{
+		if(*p == '\\')
+		{
+			p++;
+			run[i] = (*p == 's') ? ' ' : ToLower(*p);
+		}
+		else
+			run[i] = ToLower(*p);
+	}
+
+	return bestlen;
+}
+
+static inline unsigned int
+maskset_child(struct mask_set *set, unsigned int node, unsigned char c)
+{
+	unsigned int child;
+
+	if(node == 0)
+		return set->root[c];
+
+	for(child = set->nodes[node].first; child != 0; child = set->nodes[child].next)
+	{
+		if(set->nodes[child].c == c)
+			return child;
+	}
+	return 0;
+}
+
+static unsigned int
+maskset_add_node(struct mask_set *set, unsigned int parent, unsigned char c, unsigned int *size)
+{
+	struct maskset_node *node;
+	unsigned int id;
+
+	if(set->nodecount == *size)
+	{
+		*size *= 2;
+		set->nodes = rb_realloc(set->nodes, sizeof(struct maskset_node) * *size);
+	}
+
+	id = set->nodecount++;
+	node = &set->nodes[id];
+	memset(node, 0, sizeof(struct maskset_node));
+	node->c = c;
+
+	if(parent == 0)
+		set->root[c] = id;
+	else
+	{
+		node->next = set->nodes[parent].first;
+		set->nodes[parent].first = id;
+	}
+
+	return id;
+}
+
+static void
+maskset_free(struct mask_set *set)
+{
+	rb_free(set->nodes);
+	rb_free(set->pats);
+	rb_free(set->always);
+	rb_free(set->cand);
+	set->nodes = NULL;
+	set->pats = NULL;
+	set->always = NULL;
+	set->cand = NULL;
+	set->nodecount = set->patcount = set->alwayscount = 0;
+	memset(set->root, 0, sizeof(set->root));
+}
+
+static void
+maskset_build(struct mask_set *set)
+{
+	unsigned char run[MASKSET_RUNLEN];
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr;
+	unsigned int *queue;
+	unsigned int size = 64;
+	unsigned int count, len, node, child, fail, head, tail, i, j;
+
+	maskset_free(set);
+
+	count = rb_dlink_list_length(set->list);
+	set->pats = rb_malloc(sizeof(struct maskset_pat) * (count + 1));
+	set->always = rb_malloc(sizeof(unsigned int) * (count + 1));
+	set->cand = rb_malloc(sizeof(unsigned int) * (count + 1));
+	set->nodes = rb_malloc(sizeof(struct maskset_node) * size);
+	set->nodecount = 1;
+	set->stamp = 0;
+
+	/* the trie of runs */
+	RB_DLINK_FOREACH(ptr, set->list->head)
+	{
+		aconf = ptr->data;
+		i = set->patcount++;
+		set->pats[i].aconf = aconf;
+
+		if((len = maskset_run(aconf->host, run)) == 0)
+		{
+			set->always[set->alwayscount++] = i;
+			continue;
+		}
+
+		for(node = 0, j = 0; j < len; j++)
+		{
+			if((child = maskset_child(set, node, run[j])) == 0)
+				child = maskset_add_node(set, node, run[j], &size);
+			node = child;
+		}
+
+		set->pats[i].next = set->nodes[node].pat;
+		set->nodes[node].pat = i + 1;
+	}
+
+	/* fail and output links, breadth first so a node's fail is
+	 * always done before it is needed
+	 */
+	queue = rb_malloc(sizeof(unsigned int) * set->nodecount);
+	head = tail = 0;
+
+	for(i = 0; i < 256; i++)
+	{
+		if(set->root[i] != 0)
+			queue[tail++] = set->root[i];
+	}
+
+	while(head < tail)
+	{
+		node = queue[head++];
+
+		for(child = set->nodes[node].first; child != 0; child = set->nodes[child].next)
+		{
+			struct maskset_node *cnode = &set->nodes[child];
+
+			fail = set->nodes[node].fail;
+			while(fail != 0 && maskset_child(set, fail, cnode->c) == 0)
+				fail = set->nodes[fail].fail;
+			cnode->fail = maskset_child(set, fail, cnode->c);
+
+			if(set->nodes[cnode->fail].pat != 0)
+				cnode->out = cnode->fail;
+			else
+				cnode->out = set->nodes[cnode->fail].out;
+
+			queue[tail++] = child;
+		}
+	}
+
+	rb_free(queue);
+	set->dirty = 0;
+}
+
+static void
+maskset_mark(struct mask_set *set, unsigned int node, unsigned int *count)
+{
+	struct maskset_pat *pat;
+	unsigned int i;
+
+	for(i = set->nodes[node].pat; i != 0; i = pat->next)
+	{
+		pat = &set->pats[i - 1];
+		if(pat->stamp == set->stamp)
+			continue;
+		pat->stamp = set->stamp;
+		set->cand[(*count)++] = i - 1;
+	}
+}
+
+static int
+maskset_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* maskset_find()
+ *
+ * inputs	- set, name to match
+ * outputs	- the first ConfItem in list order whose mask matches, as
+ *		  walking the list with match_esc() would find
+ * side effects - the automaton is rebuilt if the list has changed
+ */
+struct ConfItem *
+maskset_find(struct mask_set *set, const char *name)
+{
+	const unsigned char *p;
+	struct ConfItem *aconf;
+	unsigned int node = 0, next, count = 0;
+	unsigned int i, j, pick;
+
+	/* a change to the list that missed maskset_changed() leaves pats
+	 * pointing at ConfItems that may have been freed.  it can only be
+	 * seen here when the length changed, so make some noise about it
+	 */
+	s_assert(set->dirty || set->patcount == rb_dlink_list_length(set->list));
+	if(set->dirty || set->patcount != rb_dlink_list_length(set->list))
+		maskset_build(set);
+
+	if(set->patcount == 0)
+		return NULL;
+
+	if(++set->stamp == 0)
+	{
+		for(i = 0; i < set->patcount; i++)
+			set->pats[i].stamp = 0;
+		set->stamp = 1;
+	}
+
+	for(p = (const unsigned char *)name; *p != '\0'; p++)
+	{
+		unsigned char c = ToLower(*p);
+
+		while(node != 0 && (next = maskset_child(set, node, c)) == 0)
+			node = set->nodes[node].fail;
+		node = maskset_child(set, node, c);
+
+		for(next = set->nodes[node].pat ? node : set->nodes[node].out; next != 0;
+		    next = set->nodes[next].out)
+			maskset_mark(set, next, &count);
+	}
+
+	if(count > 1)
+		qsort(set->cand, count, sizeof(unsigned int), maskset_cmp);
+
+	/* the candidates and the masks without a run, merged back into
+	 * list order
+	 */
+	for(i = 0, j = 0; i < count || j < set->alwayscount;)
+	{
+		if(j == set->alwayscount || (i < count && set->cand[i] < set->always[j]))
+			pick = set->cand[i++];
+		else
+			pick = set->always[j++];
+
+		aconf = set->pats[pick].aconf;
+		if(match_esc(aconf->host, name))
+			return aconf;
+	}
+
+	return NULL;
+}
+
+size_t
+maskset_memory(struct mask_set *set)
+{
+	return set->nodecount * sizeof(struct maskset_node) +
+		set->patcount * (sizeof(struct maskset_pat) + 2 * sizeof(unsigned int));
+}
@@ -194,6 +194,294 @@ mask_match(const char *mask, const char *name)
 	return 0;
 }
 
+/* compile_mask()
+ *
+ * inputs	- compiled_mask to fill in, mask as given to match()
+ * output	-
+ * side effects - mask is collapsed, folded with ToLower() and cut up
+ *		  at its '*'s, see struct compiled_mask.  free it again
+ *		  with free_compiled_mask().
+ */
+void
+compile_mask(struct compiled_mask *cm, const char *mask)
+{
+	const char *p;
+	char *text, *s;
+	unsigned int nseg = 0, len = 0, i;
+	int star = 1;
+
+	/* count the literal runs and what is left of the mask once
+	 * runs of '*' are collapsed
+	 */
+	for(p = mask; *p != '\0'; p++)
+	{
+		if(*p != '*')
+		{
+			if(star)
+				nseg++;
+			star = 0;
+			len++;
+		}
+		else if(!star || p == mask)
+		{
+			star = 1;
+			len++;
+		}
+	}
+
+	cm->seg = rb_malloc(sizeof(struct cmask_seg) * (nseg + 1) + len + 1);
+	cm->mask = text = (char *)(cm->seg + nseg + 1);
+	cm->nseg = 0;
+	cm->minlen = 0;
+	cm->flags = 0;
+
+	for(p = mask, s = text, star = 0; *p != '\0'; p++)
+	{
+		if(*p == '*')
+		{
+			if(!star)
+				*s++ = '*';
+			star = 1;
+			continue;
+		}
+		star = 0;
+		*s++ = ToLower(*p);
+	}
+	*s = '\0';
+
+	if(*text != '*')
+		cm->flags |= CMASK_START;
+	if(s == text || s[-1] != '*')
+		cm->flags |= CMASK_END;
+
+	for(s = text; *s != '\0';)
+	{
+		struct cmask_seg *seg;
+
+		if(*s == '*')
+		{
+			s++;
+			continue;
+		}
+
+		seg = &cm->seg[cm->nseg++];
+		seg->text = s;
+		seg->len = strcspn(s, "*");
+		seg->anchor = seg->len;
+		seg->wild = 0;
+
+		for(i = 0; i < seg->len; i++)
+		{
+			if(s[i] != '?')
+			{
+				if(seg->anchor == seg->len)
+					seg->anchor = i;
+			}
+			else
+				seg->wild = 1;
+		}
+
+		cm->minlen += seg->len;
+		s += seg->len;
+	}
+
+	/* "" is an exact match for "" */
+	if(cm->nseg == 0 && (cm->flags & CMASK_START))
+	{
+		cm->seg[0].text = text;
+		cm->seg[0].len = cm->seg[0].anchor = 0;
+		cm->seg[0].wild = 0;
+		cm->nseg = 1;
+	}
+
+	if(cm->nseg == 0)
+		cm->type = CMASK_ANY;
+	else if(cm->nseg == 1 && (cm->flags & CMASK_START) && (cm->flags & CMASK_END))
+		cm->type = CMASK_EXACT;
+	else if(cm->nseg == 1 && (cm->flags & CMASK_START))
+		cm->type = CMASK_PREFIX;
+	else if(cm->nseg == 1 && (cm->flags & CMASK_END))
+		cm->type = CMASK_SUFFIX;
+	else if(cm->nseg == 1)
+		cm->type = CMASK_INFIX;
+	else
+		cm->type = CMASK_GLOB;
+}
+
+void
+free_compiled_mask(struct compiled_mask *cm)
+{
+	rb_free(cm->seg);
+	cm->seg = NULL;
+	cm->mask = NULL;
+}
+
+/* does seg match the seg->len bytes at n */
+static inline int
+cmask_seg_equal(const struct cmask_seg *seg, const unsigned char *n)
+{
+	unsigned int i;
+
+	if(!seg->wild)
+		return memcmp(seg->text, n, seg->len) == 0;
+
+	for(i = 0; i < seg->len; i++)
+	{
+		if(seg->text[i] != '?' && (unsigned char)seg->text[i] != n[i])
+			return 0;
+	}
+	return 1;
+}
+
+/* does n start with seg.  n may be shorter than seg, and need not
+ * have been through ToLower() yet if fold is set.
+ */
+static inline int
+cmask_seg_prefix(const struct cmask_seg *seg, const unsigned char *n, int fold)
+{
+	unsigned int i;
+
+	for(i = 0; i < seg->len; i++)
+	{
+		if(n[i] == '\0')
+			return 0;
+		if(seg->text[i] != '?' &&
+		   (unsigned char)seg->text[i] != (fold ? ToLower(n[i]) : n[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/* leftmost place in n..end where seg matches.  candidates come from
+ * memchr() on the first literal character of the segment.
+ */
+static const unsigned char *
+cmask_seg_find(const struct cmask_seg *seg, const unsigned char *n, const unsigned char *end)
+{
+	const unsigned char *p, *last;
+	unsigned char c;
+
+	if((size_t)(end - n) < seg->len)
+		return NULL;
+
+	/* all '?' */
+	if(seg->anchor == seg->len)
+		return n;
+
+	c = seg->text[seg->anchor];
+	last = end - seg->len + seg->anchor;
+
+	for(p = n + seg->anchor; p <= last; p++)
+	{
+		if((p = memchr(p, c, last - p + 1)) == NULL)
+			return NULL;
+		if(cmask_seg_equal(seg, p - seg->anchor))
+			return p - seg->anchor;
+	}
+	return NULL;
+}
+
+/* match_compiled_lower()
+ *
+ * as match(), but on a compiled mask and a name that has already
+ * been through ToLower(), for matching one name against many masks.
+ *
+ * the anchored runs at either end are tried first, as that is where
+ * most bans fail.  the runs between them are placed leftmost first,
+ * which is all a mask of '*' and '?' ever needs, so there is no
+ * backtracking and no MATCH_MAX_CALLS to run out of.
+ */
+int
+match_compiled_lower(const struct compiled_mask *cm, const char *name)
+{
+	const unsigned char *n = (const unsigned char *)name;
+	const unsigned char *end;
+	const struct cmask_seg *seg = cm->seg;
+	unsigned int i = 0, last = cm->nseg;
+	size_t len;
+
+	if(cm->type == CMASK_ANY)
+		return 1;
+
+	if(cm->flags & CMASK_START)
+	{
+		if(!cmask_seg_prefix(&seg[0], n, 0))
+			return 0;
+		if(cm->type == CMASK_EXACT)
+			return n[seg[0].len] == '\0';
+		if(cm->type == CMASK_PREFIX)
+			return 1;
+		n += seg[0].len;
+		i++;
+	}
+
+	len = strlen(name);
+	if(len < cm->minlen)
+		return 0;
+	end = (const unsigned char *)name + len;
+
+	if(cm->flags & CMASK_END)
+	{
+		last--;
+		end -= seg[last].len;
+		if(!cmask_seg_equal(&seg[last], end))
+			return 0;
+	}
+
+	for(; i < last; i++)
+	{
+		if((n = cmask_seg_find(&seg[i], n, end)) == NULL)
+			return 0;
+		n += seg[i].len;
+	}
+	return 1;
+}
+
+/* match_compiled()
+ *
+ * as match(), but on a mask from compile_mask()
+ */
+int
+match_compiled(const struct compiled_mask *cm, const char *name)
+{
+	char buf[BUFSIZE];
+	char *lower = buf;
+	size_t len, i;
+	int result;
+
+	s_assert(name != NULL);
+
+	if(cm->type == CMASK_ANY)
+		return 1;
+
+	/* anchored masks mostly fail in the first few characters, don't
+	 * fold the whole name for them
+	 */
+	if(cm->flags & CMASK_START)
+	{
+		if(!cmask_seg_prefix(&cm->seg[0], (const unsigned char *)name, 1))
+			return 0;
+		if(cm->type == CMASK_EXACT)
+			return name[cm->seg[0].len] == '\0';
+		if(cm->type == CMASK_PREFIX)
+			return 1;
+	}
+
+	len = strlen(name);
+	if(len >= sizeof(buf))
+		lower = rb_malloc(len + 1);
+
+	for(i = 0; i < len; i++)
+		lower[i] = ToLower(name[i]);
+	lower[len] = '\0';
+
+	result = match_compiled_lower(cm, lower);
+
+	if(lower != buf)
+		rb_free(lower);
+	return result;
+}
+
 /* match_esc()
  *
  * The match() function with support for escaping characters such
@@ -52,7 +52,7 @@ init_monitor(void)
 static inline unsigned int
 hash_monitor_nick(const char *name)
 {
-	return fnv_hash_upper((const unsigned char *)name, MONITOR_HASH_BITS, 0);
+	return siphash_upper((const unsigned char *)name, MONITOR_HASH_BITS, 0);
 }
 
 struct monitor *
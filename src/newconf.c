@@ -1723,6 +1723,25 @@ conf_set_general_compression_level(confentry_t * entry, conf_t * conf, struct co
 
 }
 
+static void
+conf_set_general_zstd_level(confentry_t * entry, conf_t * conf, struct conf_items *item)
+{
+#ifdef HAVE_ZSTD
+	if(entry->number < 1 || entry->number > 19)
+	{
+		conf_report_warning_nl
+			("Invalid general::zstd_level %ld at %s:%d -- using default.",
+			 entry->number, entry->filename, entry->line);
+		return;
+	}
+	ConfigFileEntry.zstd_level = entry->number;
+#else
+	conf_report_warning_nl
+		("Ignoring general::zstd_level at %s:%d -- zstd not available.",
+		 entry->filename, entry->line);
+#endif
+}
+
 static void
 conf_set_general_havent_read_conf(confentry_t * entry, conf_t * conf, struct conf_items *item)
 {
@@ -1907,6 +1926,32 @@ conf_set_connect_port(confentry_t * entry, conf_t * conf, struct conf_items *ite
 	t_server->port = port;
 }
 
+static void
+conf_set_connect_zip_flush_size(confentry_t * entry, conf_t * conf, struct conf_items *item)
+{
+	if(entry->number < 0 || entry->number > 1024 * 1024)
+	{
+		conf_report_warning_nl
+			("Invalid connect::zip_flush_size %ld at %s:%d -- ignoring.",
+			 entry->number, entry->filename, entry->line);
+		return;
+	}
+	t_server->zip_flush_size = entry->number;
+}
+
+static void
+conf_set_connect_zip_flush_delay(confentry_t * entry, conf_t * conf, struct conf_items *item)
+{
+	if(entry->number < 0 || entry->number > 1000)
+	{
+		conf_report_warning_nl
+			("Invalid connect::zip_flush_delay %ld at %s:%d -- ignoring.",
+			 entry->number, entry->filename, entry->line);
+		return;
+	}
+	t_server->zip_flush_delay = entry->number;
+}
+
 static void
 conf_set_connect_aftype(confentry_t * entry, conf_t * conf, struct conf_items *item)
 {
@@ -2289,6 +2334,11 @@ load_conf_settings(void)
 	if(ServerInfo.ssld_count < 1)
 		ServerInfo.ssld_count = 1;
 
+	if(ServerInfo.ssld_threads < 1)
+		ServerInfo.ssld_threads = 1;
+	else if(ServerInfo.ssld_threads > 64)
+		ServerInfo.ssld_threads = 64;
+
 	if((ConfigFileEntry.client_flood < CLIENT_FLOOD_MIN)
 	   || (ConfigFileEntry.client_flood > CLIENT_FLOOD_MAX))
 		ConfigFileEntry.client_flood = CLIENT_FLOOD_MAX;
@@ -2296,6 +2346,8 @@ load_conf_settings(void)
 	if(ConfigChannel.topiclen > MAX_TOPICLEN || ConfigChannel.topiclen < 0)
 		ConfigChannel.topiclen = DEFAULT_TOPICLEN;
 
+	rb_set_epoll_persistent(ConfigFileEntry.epoll_persistent);
+
 	if(!rb_setup_ssl_server
 	   (ServerInfo.ssl_cert, ServerInfo.ssl_private_key, ServerInfo.ssl_dh_params))
 	{
@@ -2307,7 +2359,9 @@ load_conf_settings(void)
 		ircd_ssl_ok = 1;
 		send_new_ssl_certs(ServerInfo.ssl_cert, ServerInfo.ssl_private_key,
 				   ServerInfo.ssl_dh_params);
+		send_ssl_ktls(ServerInfo.ssl_ktls);
 	}
+	send_zstd_dictionary(ConfigFileEntry.zstd_dictionary);
 	if(ServerInfo.ssld_count > get_ssld_count())
 	{
 		int start = ServerInfo.ssld_count - get_ssld_count();
@@ -2351,7 +2405,9 @@ static struct conf_items conf_serverinfo_table[] =
         { "ssl_ca_cert",        CF_QSTRING, NULL, 0, &ServerInfo.ssl_ca_cert },
         { "ssl_cert",           CF_QSTRING, NULL, 0, &ServerInfo.ssl_cert },   
         { "ssl_dh_params",      CF_QSTRING, NULL, 0, &ServerInfo.ssl_dh_params },
+        { "ssl_ktls",		CF_YESNO,   NULL, 0, &ServerInfo.ssl_ktls },
         { "ssld_count",		CF_INT,	    NULL, 0, &ServerInfo.ssld_count },
+        { "ssld_threads",	CF_INT,	    NULL, 0, &ServerInfo.ssld_threads },
         { "vhost_dns",		CF_QSTRING, conf_set_serverinfo_vhost_dns, 0, NULL },
 #ifdef RB_IPV6
         { "vhost6_dns",		CF_QSTRING, conf_set_serverinfo_vhost6_dns, 0, NULL },
@@ -2442,6 +2498,8 @@ static struct conf_items conf_general_table[] =
 	{ "oper_only_umodes", 	CF_STRING | CF_FLIST, conf_set_general_oper_only_umodes, 0, NULL },
 	{ "oper_umodes", 	CF_STRING | CF_FLIST, conf_set_general_oper_umodes,	 0, NULL },
 	{ "compression_level", 	CF_INT,    conf_set_general_compression_level,	0, NULL },
+	{ "zstd_level", 	CF_INT,    conf_set_general_zstd_level,	0, NULL },
+	{ "zstd_dictionary",	CF_QSTRING, NULL, MAXPATHLEN, &ConfigFileEntry.zstd_dictionary },
 	{ "havent_read_conf", 	CF_YESNO,  conf_set_general_havent_read_conf,	0, NULL },
 	{ "stats_k_oper_only", 	CF_STRING, conf_set_general_stats_k_oper_only,	0, NULL },
 	{ "stats_i_oper_only", 	CF_STRING, conf_set_general_stats_i_oper_only,	0, NULL },
@@ -2468,6 +2526,7 @@ static struct conf_items conf_general_table[] =
 	{ "default_floodcount", CF_INT,   NULL, 0, &ConfigFileEntry.default_floodcount	},
 	{ "disable_auth",	CF_YESNO, NULL, 0, &ConfigFileEntry.disable_auth	},
 	{ "dots_in_ident",	CF_INT,   NULL, 0, &ConfigFileEntry.dots_in_ident	},
+	{ "epoll_persistent",	CF_YESNO, NULL, 0, &ConfigFileEntry.epoll_persistent	},
 	{ "failed_oper_notice",	CF_YESNO, NULL, 0, &ConfigFileEntry.failed_oper_notice	},
 	{ "hide_spoof_ips",     CF_YESNO, NULL, 0, &ConfigFileEntry.hide_spoof_ips      },
 	{ "glines",		CF_YESNO, NULL, 0, &ConfigFileEntry.glines		},
@@ -2493,6 +2552,7 @@ static struct conf_items conf_general_table[] =
 	{ "reject_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.reject_duration	},
 	{ "throttle_count",	CF_INT,   NULL, 0, &ConfigFileEntry.throttle_count	},
 	{ "throttle_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.throttle_duration	},
+	{ "server_flush_delay",	CF_INT,   NULL, 0, &ConfigFileEntry.server_flush_delay	},
 	{ "short_motd",		CF_YESNO, NULL, 0, &ConfigFileEntry.short_motd		},
 	{ "stats_c_oper_only",	CF_YESNO, NULL, 0, &ConfigFileEntry.stats_c_oper_only	},
 	{ "stats_e_disabled",	CF_YESNO, NULL, 0, &ConfigFileEntry.stats_e_disabled	},
@@ -2564,6 +2624,8 @@ static struct conf_items conf_connect_table[] =
 	{ "hub_mask",	CF_QSTRING, conf_set_connect_hub_mask,	0, NULL },
 	{ "leaf_mask",	CF_QSTRING, conf_set_connect_leaf_mask,	0, NULL },
 	{ "class",	CF_QSTRING, conf_set_connect_class,	0, NULL },
+	{ "zip_flush_size",	CF_TIME, conf_set_connect_zip_flush_size,	0, NULL },
+	{ "zip_flush_delay",	CF_INT,  conf_set_connect_zip_flush_delay,	0, NULL },
 	{ "\0",	0, NULL, 0, NULL }
 };
 
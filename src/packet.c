@@ -36,16 +36,181 @@
 #include "send.h"
 #include "s_log.h"
 
-static char readBuf[READBUF_SIZE];
 static void client_dopacket(struct Client *client_p, char *buffer, size_t length);
 
 
+/*
+ * recvq_reserve - make room for at least want bytes at the end of the
+ * receive buffer.
+ *
+ * The buffer is compacted rather than wrapped, so every line we hand to
+ * parse() is contiguous.  Whatever is left over after parsing is normally
+ * a partial line, so the memmove is cheap.
+ */
+static void
+recvq_reserve(struct LocalUser *lclient_p, unsigned int want)
+{
+	unsigned int used = lclient_p->recvq_tail - lclient_p->recvq_head;
+	unsigned int size;
+
+	if(lclient_p->recvq_size - lclient_p->recvq_tail >= want)
+		return;
+
+	if(lclient_p->recvq_head > 0)
+	{
+		memmove(lclient_p->recvq_buf, lclient_p->recvq_buf + lclient_p->recvq_head, used);
+		lclient_p->recvq_head = 0;
+		lclient_p->recvq_tail = used;
+	}
+
+	if(lclient_p->recvq_size - used >= want)
+		return;
+
+	size = lclient_p->recvq_size ? lclient_p->recvq_size : RECVQ_MIN_SIZE;
+	while(size - used < want)
+		size <<= 1;
+
+	lclient_p->recvq_buf = rb_realloc(lclient_p->recvq_buf, size);
+	lclient_p->recvq_size = size;
+}
+
+/*
+ * recvq_getline - frame the next complete line in the receive buffer
+ *
+ * inputs	- local client, pointer to store the line length in
+ * outputs	- NUL terminated line inside the receive buffer, or NULL
+ *		  if there is no complete line yet
+ * side effects	- the line and its CR/LF run are consumed.  lines longer
+ *		  than BUF_DATA_SIZE - 1 are truncated and the rest of them
+ *		  is discarded, as linebuf did.
+ */
+static char *
+recvq_getline(struct LocalUser *lclient_p, int *len)
+{
+	char *buf = lclient_p->recvq_buf;
+	char *line, *end, *ch, *scanend;
+
+	if(lclient_p->recvq_head == lclient_p->recvq_tail)
+	{
+		lclient_p->recvq_head = lclient_p->recvq_tail = 0;
+		return NULL;
+	}
+
+	line = buf + lclient_p->recvq_head;
+	end = buf + lclient_p->recvq_tail;
+
+	if(lclient_p->recvq_discard)
+	{
+		line = rb_linebuf_find_eol(line, end - line);
+
+		if(line == NULL)
+		{
+			lclient_p->recvq_head = lclient_p->recvq_tail = 0;
+			return NULL;
+		}
+		lclient_p->recvq_discard = 0;
+	}
+
+	/* empty lines are skipped */
+	while(line < end && (*line == '\r' || *line == '\n'))
+		line++;
+
+	if(line == end)
+	{
+		lclient_p->recvq_head = lclient_p->recvq_tail = 0;
+		return NULL;
+	}
+
+	lclient_p->recvq_head = line - buf;
+
+	scanend = line + BUF_DATA_SIZE;
+	if(scanend > end)
+		scanend = end;
+
+	ch = rb_linebuf_find_eol(line, scanend - line);
+
+	if(ch == NULL)
+	{
+		/* incomplete line, wait for the rest of it */
+		if(end - line < BUF_DATA_SIZE)
+			return NULL;
+
+		/* overlong, cut it and drop the remainder up to the CR/LF */
+		ch = line + BUF_DATA_SIZE - 1;
+		*ch++ = '\0';
+		*len = BUF_DATA_SIZE - 1;
+		lclient_p->recvq_discard = 1;
+	}
+	else
+	{
+		*len = ch - line;
+		*ch++ = '\0';
+
+		/* eat the whole CR/LF run with the line, so anything that
+		 * follows it (ziplinks data) stays untouched
+		 */
+		while(ch < end && (*ch == '\r' || *ch == '\n'))
+			ch++;
+	}
+
+	lclient_p->recvq_head = ch - buf;
+	lclient_p->actually_read++;
+	return line;
+}
+
+/*
+ * recvq_count_lines - count the lines waiting in the receive buffer
+ *
+ * The client_flood check is done in lines.  We give up counting once
+ * we pass limit, and a line takes at least two bytes so short buffers
+ * are not scanned at all.  Every BUF_DATA_SIZE bytes without a CR/LF
+ * count as a line of their own, so a client can't grow the buffer
+ * past client_flood lines worth by never ending one.
+ */
+static int
+recvq_count_lines(struct LocalUser *lclient_p, int limit)
+{
+	char *ch = lclient_p->recvq_buf + lclient_p->recvq_head;
+	char *end = lclient_p->recvq_buf + lclient_p->recvq_tail;
+	char *scanend, *eol;
+	int count = 0;
+
+	if((end - ch + 1) / 2 <= limit)
+		return 0;
+
+	while(count <= limit)
+	{
+		while(ch < end && (*ch == '\r' || *ch == '\n'))
+			ch++;
+
+		if(ch == end)
+			break;
+
+		count++;
+
+		scanend = ch + BUF_DATA_SIZE;
+		if(scanend > end)
+			scanend = end;
+
+		if((eol = rb_linebuf_find_eol(ch, scanend - ch)) != NULL)
+			ch = eol;
+		else if(scanend == end)
+			break;
+		else
+			ch = scanend;
+	}
+
+	return count;
+}
+
 /*
  * parse_client_queued - parse client queued messages
  */
 static void
 parse_client_queued(struct Client *client_p)
 {
+	struct LocalUser *lclient_p = client_p->localClient;
+	char *line;
 	int dolen = 0;
 	int checkflood = 1;
 
@@ -56,17 +221,16 @@ parse_client_queued(struct Client *client_p)
 	{
 		for(;;)
 		{
-			if(client_p->localClient->sent_parsed >= client_p->localClient->allow_read)
+			if(lclient_p->sent_parsed >= lclient_p->allow_read)
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->buf_recvq, readBuf,
-					       READBUF_SIZE, LINEBUF_COMPLETE, LINEBUF_PARSED);
+			line = recvq_getline(lclient_p, &dolen);
 
-			if(dolen <= 0 || IsDead(client_p))
+			if(line == NULL || IsDead(client_p))
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
-			client_p->localClient->sent_parsed++;
+			client_dopacket(client_p, line, dolen);
+			lclient_p->sent_parsed++;
 
 			/* He's dead cap'n */
 			if(IsAnyDead(client_p))
@@ -79,7 +243,7 @@ parse_client_queued(struct Client *client_p)
 				/* reset their flood limits, they're now
 				 * graced to flood
 				 */
-				client_p->localClient->sent_parsed = 0;
+				lclient_p->sent_parsed = 0;
 				break;
 			}
 		}
@@ -87,12 +251,9 @@ parse_client_queued(struct Client *client_p)
 
 	if(IsAnyServer(client_p) || IsExemptFlood(client_p))
 	{
-		while(!IsAnyDead(client_p)
-		      && (dolen =
-			  rb_linebuf_get(&client_p->localClient->buf_recvq, readBuf, READBUF_SIZE,
-					 LINEBUF_COMPLETE, LINEBUF_PARSED)) > 0)
+		while(!IsAnyDead(client_p) && (line = recvq_getline(lclient_p, &dolen)) != NULL)
 		{
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 		}
 	}
 	else if(IsClient(client_p))
@@ -122,28 +283,25 @@ parse_client_queued(struct Client *client_p)
 			 */
 			if(checkflood)
 			{
-				if(client_p->localClient->sent_parsed >=
-				   client_p->localClient->allow_read)
+				if(lclient_p->sent_parsed >= lclient_p->allow_read)
 					break;
 			}
 
 			/* allow opers 4 times the amount of messages as users. why 4?
 			 * why not. :) --fl_
 			 */
-			else if(client_p->localClient->sent_parsed >=
-				(4 * client_p->localClient->allow_read))
+			else if(lclient_p->sent_parsed >= (4 * lclient_p->allow_read))
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->buf_recvq, readBuf,
-					       READBUF_SIZE, LINEBUF_COMPLETE, LINEBUF_PARSED);
+			line = recvq_getline(lclient_p, &dolen);
 
-			if(!dolen)
+			if(line == NULL)
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 			if(IsAnyDead(client_p))
 				return;
-			client_p->localClient->sent_parsed++;
+			lclient_p->sent_parsed++;
 		}
 	}
 }
@@ -219,10 +377,10 @@ read_packet(rb_fde_t *F, void *data)
 {
 	struct Client *client_p = data;
 	struct LocalUser *lclient_p = client_p->localClient;
+	unsigned int want;
+	char *readbuf;
 	int length = 0;
-	int lbuf_len;
 
-	int binary = 0;
 #ifdef USE_IODEBUG_HOOKS
 	hook_data_int hdata;
 #endif
@@ -233,17 +391,26 @@ read_packet(rb_fde_t *F, void *data)
 		if(IsAnyDead(client_p))
 			return;
 
+		/*
+		 * Read straight into the receive buffer, the lines are framed
+		 * and parsed in place from there.
+		 */
+		want = IsAnyServer(client_p) ? READBUF_SIZE : BUF_DATA_SIZE + 1;
+		recvq_reserve(lclient_p, want);
+		readbuf = lclient_p->recvq_buf + lclient_p->recvq_tail;
+		want = lclient_p->recvq_size - lclient_p->recvq_tail;
+
 		/*
 		 * Read some data. We *used to* do anti-flood protection here, but
 		 * I personally think it makes the code too hairy to make sane.
 		 *     -- adrian
 		 */
-		length = rb_read(client_p->localClient->F, readBuf, READBUF_SIZE);
+		length = rb_read(lclient_p->F, readbuf, want);
 		if(length < 0)
 		{
 			if(rb_ignore_errno(errno))
 			{
-				rb_setselect(client_p->localClient->F,
+				rb_setselect(lclient_p->F,
 					     RB_SELECT_READ, read_packet, client_p);
 			}
 			else
@@ -258,31 +425,16 @@ read_packet(rb_fde_t *F, void *data)
 
 #ifdef USE_IODEBUG_HOOKS
 		hdata.client = client_p;
-		hdata.arg1 = readBuf;
+		hdata.arg1 = readbuf;
 		hdata.arg2 = length;
 		call_hook(h_iorecv_id, &hdata);
 #endif
 
-		if(client_p->localClient->lasttime < rb_current_time())
-			client_p->localClient->lasttime = rb_current_time();
+		if(lclient_p->lasttime < rb_current_time())
+			lclient_p->lasttime = rb_current_time();
 		client_p->flags &= ~FLAGS_PINGSENT;
 
-		/*
-		 * Before we even think of parsing what we just read, stick
-		 * it on the end of the receive queue and do it when its
-		 * turn comes around.
-		 */
-		if(IsHandshake(client_p) || IsUnknown(client_p))
-			binary = 1;
-
-		lbuf_len =
-			rb_linebuf_parse(&client_p->localClient->buf_recvq, readBuf, length,
-					 binary);
-
-		lclient_p->actually_read += lbuf_len;
-
-		if(IsAnyDead(client_p))
-			return;
+		lclient_p->recvq_tail += length;
 
 		/* Attempt to parse what we have */
 		parse_client_queued(client_p);
@@ -292,7 +444,7 @@ read_packet(rb_fde_t *F, void *data)
 
 		/* Check to make sure we're not flooding */
 		if(!IsAnyServer(client_p) &&
-		   (rb_linebuf_alloclen(&client_p->localClient->buf_recvq) >
+		   (recvq_count_lines(lclient_p, ConfigFileEntry.client_flood) >
 		    ConfigFileEntry.client_flood))
 		{
 			if(!(ConfigFileEntry.no_oper_flood && IsOper(client_p)))
@@ -303,10 +455,19 @@ read_packet(rb_fde_t *F, void *data)
 
 		}
 
+		/* give back what a burst of queued lines grew the buffer to */
+		if(lclient_p->recvq_head == lclient_p->recvq_tail
+		   && lclient_p->recvq_size > RECVQ_MIN_SIZE && !IsAnyServer(client_p))
+		{
+			rb_free(lclient_p->recvq_buf);
+			lclient_p->recvq_buf = NULL;
+			lclient_p->recvq_size = lclient_p->recvq_head = lclient_p->recvq_tail = 0;
+		}
+
 		/* bail if short read */
-		if(length < READBUF_SIZE)
+		if((unsigned int)length < want)
 		{
-			rb_setselect(client_p->localClient->F, RB_SELECT_READ, read_packet,
+			rb_setselect(lclient_p->F, RB_SELECT_READ, read_packet,
 				     client_p);
 			return;
 		}
@@ -729,6 +729,8 @@ set_default_conf(void)
 #endif
 	ServerInfo.default_max_clients = MAXCONNECTIONS;
 	ServerInfo.ssld_count = 1;
+	ServerInfo.ssld_threads = 1;
+	ServerInfo.ssl_ktls = NO;
 
 
 	/* Don't reset hub, as that will break lazylinks */
@@ -799,6 +801,11 @@ set_default_conf(void)
 #ifdef HAVE_ZLIB
 	ConfigFileEntry.compression_level = 4;
 #endif
+#ifdef HAVE_ZSTD
+	ConfigFileEntry.zstd_level = 3;
+#endif
+	rb_free(ConfigFileEntry.zstd_dictionary);
+	ConfigFileEntry.zstd_dictionary = NULL;
 
 	ConfigFileEntry.oper_umodes = UMODE_LOCOPS | UMODE_SERVNOTICE |
 		UMODE_OPERWALL | UMODE_WALLOP;
@@ -834,6 +841,8 @@ set_default_conf(void)
 	ConfigFileEntry.min_nonwildcard_simple = 3;
 	ConfigFileEntry.default_floodcount = 8;
 	ConfigFileEntry.client_flood = CLIENT_FLOOD_DEFAULT;
+	ConfigFileEntry.server_flush_delay = 0;
+	ConfigFileEntry.epoll_persistent = NO;
 	ConfigFileEntry.tkline_expire_notices = 0;
 
 	ConfigFileEntry.reject_after_count = 5;
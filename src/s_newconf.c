@@ -57,6 +57,8 @@ rb_dlink_list hubleaf_conf_list;
 rb_dlink_list server_conf_list;
 rb_dlink_list xline_conf_list;
 rb_dlink_list resv_conf_list;	/* nicks only! */
+struct mask_set xline_set;
+struct mask_set resv_set;
 rb_dlink_list pending_glines;
 rb_dlink_list glines;
 static rb_dlink_list nd_list;	/* nick delay */
@@ -74,6 +76,8 @@ void
 init_s_newconf(void)
 {
 	tgchange_tree = rb_new_patricia(PATRICIA_BITS);
+	maskset_init(&xline_set, &xline_conf_list);
+	maskset_init(&resv_set, &resv_conf_list);
 	nd_heap = rb_bh_create(sizeof(struct nd_entry), ND_HEAP_SIZE, "nd_heap");
 	rb_event_addish("expire_nd_entries", expire_nd_entries, NULL, 30);
 	rb_event_addish("expire_temp_rxlines", expire_temp_rxlines, NULL, 60);
@@ -156,6 +160,8 @@ clear_s_newconf_bans(void)
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
 
+	maskset_changed(&xline_set);
+	maskset_changed(&resv_set);
 	clear_resv_hash();
 }
 
@@ -555,21 +561,11 @@ struct ConfItem *
 find_xline(const char *gecos, int counter)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
-	{
-		aconf = ptr->data;
+	if((aconf = maskset_find(&xline_set, gecos)) != NULL && counter)
+		aconf->port++;
 
-		if(match_esc(aconf->host, gecos))
-		{
-			if(counter)
-				aconf->port++;
-			return aconf;
-		}
-	}
-
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -593,20 +589,11 @@ struct ConfItem *
 find_nick_resv(const char *name)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
-	{
-		aconf = ptr->data;
+	if((aconf = maskset_find(&resv_set, name)) != NULL)
+		aconf->port++;
 
-		if(match_esc(aconf->host, name))
-		{
-			aconf->port++;
-			return aconf;
-		}
-	}
-
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -722,30 +709,33 @@ valid_temp_time(const char *p)
 	return (result * 60);
 }
 
+static void
+expire_temp_resv(void *data, void *unused)
+{
+	struct ConfItem *aconf = data;
+
+	if((aconf->flags & CONF_FLAGS_TEMPORARY) && aconf->hold <= rb_current_time())
+	{
+		if(ConfigFileEntry.tkline_expire_notices)
+			sendto_realops_flags(UMODE_ALL, L_ALL,
+					     "Temporary RESV for [%s] expired",
+					     aconf->host);
+
+		del_from_hash(HASH_RESV, aconf->host, aconf);
+		free_conf(aconf);
+	}
+}
+
 static void
 expire_temp_rxlines(void *unused)
 {
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
-	int i;
 
-	HASH_WALK_SAFE(i, R_MAX, ptr, next_ptr, resvTable)
-	{
-		aconf = ptr->data;
+	hash_walk(HASH_RESV, expire_temp_resv, NULL);
 
-		if((aconf->flags & CONF_FLAGS_TEMPORARY) && aconf->hold <= rb_current_time())
-		{
-			if(ConfigFileEntry.tkline_expire_notices)
-				sendto_realops_flags(UMODE_ALL, L_ALL,
-						     "Temporary RESV for [%s] expired",
-						     aconf->host);
-
-			free_conf(aconf);
-			rb_dlinkDestroy(ptr, &resvTable[i]);
-		}
-	}
-	HASH_WALK_END RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
 	{
 		aconf = ptr->data;
 
@@ -757,6 +747,7 @@ expire_temp_rxlines(void *unused)
 						     aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &resv_conf_list);
+			maskset_changed(&resv_set);
 		}
 	}
 
@@ -772,6 +763,7 @@ expire_temp_rxlines(void *unused)
 						     aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
+			maskset_changed(&xline_set);
 		}
 	}
 }
@@ -805,7 +797,7 @@ void
 free_nd_entry(struct nd_entry *nd)
 {
 	rb_dlinkDelete(&nd->lnode, &nd_list);
-	rb_dlinkDelete(&nd->hnode, &ndTable[nd->hashv]);
+	del_from_nd_hash(nd);
 	rb_bh_free(nd_heap, nd);
 }
 
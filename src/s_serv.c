@@ -69,6 +69,7 @@ struct Capability captab[] = {
 	{"GLN", CAP_GLN},
 	{"KNOCK", CAP_KNOCK},
 	{"ZIP", CAP_ZIP},
+	{"ZSTD", CAP_ZSTD},
 	{"TB", CAP_TB},
 	{"ENCAP", CAP_ENCAP},
 #ifdef ENABLE_SERVICES
@@ -336,6 +337,13 @@ char *send_capabilities(struct Client *client_p, int cap_can_send)
 		}
 	}
 
+	/* lets the other end tell if we trained on the same traffic */
+	if((cap_can_send & CAP_ZSTD) && zstd_dictionary_id())
+	{
+		tl = rb_sprintf(t, "ZSTDDICT=%08x ", zstd_dictionary_id());
+		t += tl;
+	}
+
 	t--;
 	*t = '\0';
 
@@ -654,9 +662,15 @@ serv_connect_callback(rb_fde_t *F, int status, void *data)
 	if(!EmptyString(server_p->spasswd))
 	{
 #ifdef COMPAT_211
-		sendto_one(client_p, "PASS %s " IRCNET_FAKESTRING "%s%s",
+		int zstd = ServerConfCompressed(server_p) && zlib_ok && zstd_ok;
+		char dictbuf[20] = "";
+
+		if(zstd && zstd_dictionary_id())
+			rb_snprintf(dictbuf, sizeof(dictbuf), " ZSTDDICT=%08x", zstd_dictionary_id());
+
+		sendto_one(client_p, "PASS %s " IRCNET_FAKESTRING "%s%s%s%s",
 		   server_p->spasswd, ServerConfCompressed(server_p) && zlib_ok ? "Z" : "",
-					ServerConfTb(server_p) ? "T" : "");
+					ServerConfTb(server_p) ? "T" : "", zstd ? "z" : "", dictbuf);
 		if (ServerConfMask(server_p, me.name) != me.name && !ConfigServerHide.hidden) {
 			sendto_one(client_p, "SERVER %s 1 %s :[%s]%s", ServerConfMask(server_p, me.name), me.id, me.name,
 				(me.info[0]) ? (me.info) : "IRCers United");
@@ -673,6 +687,7 @@ serv_connect_callback(rb_fde_t *F, int status, void *data)
 #ifndef COMPAT_211
 	send_capabilities(client_p, default_server_capabs
 			  | (ServerConfCompressed(server_p) && zlib_ok ? CAP_ZIP : 0)
+			  | (ServerConfCompressed(server_p) && zlib_ok && zstd_ok ? CAP_ZSTD : 0)
 			  | (ServerConfTb(server_p) ? CAP_TB : 0));
 #endif
 
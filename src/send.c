@@ -43,9 +43,18 @@
 
 #define LOG_BUFSIZE 2048
 
+/* once a sendq holds this much, write it out now rather than waiting
+ * for the end of loop flush
+ */
+#define FLUSH_IMMEDIATE_LEN 16384
+
 uint32_t current_serial = 0L;
+static rb_dlink_list flush_list;
+static rb_dlink_list cursor_list;
 static void send_queued_write(rb_fde_t *F, void *data);
 static void send_queued(struct Client *to);
+static void send_schedule_flush(struct Client *to);
+static void fill_cursor(struct Client *to);
 static void sendto_ops_hook(int flags, const char *pattern, va_list args);
 
 
@@ -101,11 +110,95 @@ send_linebuf(struct Client *to, buf_head_t * linebuf)
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+	if(rb_linebuf_len(&to->localClient->buf_sendq) >= FLUSH_IMMEDIATE_LEN)
+	{
+		send_flush_cancel(to);
 		send_queued(to);
+	}
+	else if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+		send_schedule_flush(to);
 	return 0;
 }
 
+/* send_schedule_flush()
+ *
+ * inputs	- client with data in its sendq
+ * outputs	-
+ * side effects - client is put on the flush list, its sendq will be
+ *		  written out by send_flush_queued() at the end of this
+ *		  pass through the event loop
+ */
+static void
+send_schedule_flush(struct Client *to)
+{
+	if(IsFlushPending(to))
+		return;
+
+	SetFlushPending(to);
+	memcpy(&to->localClient->flush_time, rb_current_time_tv(), sizeof(struct timeval));
+	rb_dlinkAddTail(to, &to->localClient->flush_node, &flush_list);
+}
+
+/* send_flush_cancel()
+ *
+ * inputs	- client
+ * outputs	-
+ * side effects - client is taken off the flush list
+ */
+void
+send_flush_cancel(struct Client *to)
+{
+	if(!IsFlushPending(to))
+		return;
+
+	ClearFlushPending(to);
+	rb_dlinkDelete(&to->localClient->flush_node, &flush_list);
+}
+
+/* send_flush_queued()
+ *
+ * inputs	-
+ * outputs	- milliseconds until we want to be called again, or -1
+ * side effects - sendqs of every client on the flush list are written,
+ *		  so a client gets one write per loop rather than one per
+ *		  line.  server links may be held back for up to
+ *		  server_flush_delay microseconds to coalesce further.
+ */
+long
+send_flush_queued(void)
+{
+	struct Client *to;
+	rb_dlink_node *ptr, *next_ptr;
+	const struct timeval *now = rb_current_time_tv();
+	long wait = -1;
+	long left;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, flush_list.head)
+	{
+		to = ptr->data;
+
+		if(ConfigFileEntry.server_flush_delay > 0 && IsServer(to) && !IsIOError(to))
+		{
+			left = ConfigFileEntry.server_flush_delay -
+				((now->tv_sec - to->localClient->flush_time.tv_sec) * 1000000 +
+				 (now->tv_usec - to->localClient->flush_time.tv_usec));
+
+			if(left > 0)
+			{
+				left = (left + 999) / 1000;
+				if(wait < 0 || left < wait)
+					wait = left;
+				continue;
+			}
+		}
+
+		send_flush_cancel(to);
+		send_queued(to);
+	}
+
+	return wait;
+}
+
 void
 send_pop_queue(struct Client *to)
 {
@@ -113,6 +206,7 @@ send_pop_queue(struct Client *to)
 		to = to->from;
 	if(!MyConnect(to) || IsIOError(to))
 		return;
+	send_flush_cancel(to);
 	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
 		send_queued(to);
 }
@@ -183,34 +277,48 @@ send_queued(struct Client *to)
 			to->localClient->buf_sendq.writeofs;
 #endif
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq))
+	for(;;)
 	{
-		while((retlen =
-		       rb_linebuf_flush(to->localClient->F, &to->localClient->buf_sendq)) > 0)
+		if(rb_linebuf_len(&to->localClient->buf_sendq))
 		{
-			/* We have some data written .. update counters */
+			while((retlen =
+			       rb_linebuf_flush(to->localClient->F,
+						&to->localClient->buf_sendq)) > 0)
+			{
+				/* We have some data written .. update counters */
 #ifdef USE_IODEBUG_HOOKS
-			hd.arg2 = retlen;
-			call_hook(h_iosend_id, &hd);
+				hd.arg2 = retlen;
+				call_hook(h_iosend_id, &hd);
 
-			if(to->localClient->buf_sendq.list.head)
-				hd.arg1 =
-					((buf_line_t *) to->localClient->buf_sendq.list.
-					 head->data)->buf + to->localClient->buf_sendq.writeofs;
+				if(to->localClient->buf_sendq.list.head)
+					hd.arg1 =
+						((buf_line_t *) to->localClient->buf_sendq.list.
+						 head->data)->buf + to->localClient->buf_sendq.writeofs;
 #endif
 
-			ClearFlush(to);
+				ClearFlush(to);
 
-			to->localClient->sendB += retlen;
-			me.localClient->sendB += retlen;
-		}
+				to->localClient->sendB += retlen;
+				me.localClient->sendB += retlen;
+			}
 
-		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
-		{
-			dead_link(to, 0);
-			return;
+			if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
+			{
+				dead_link(to, 0);
+				return;
+			}
 		}
+
+		/* a long reply in progress gets topped up once the sendq
+		 * has drained below a quarter of what the class allows
+		 */
+		if(to->localClient->cursor == NULL || IsIOError(to) ||
+		   rb_linebuf_len(&to->localClient->buf_sendq) >= get_sendq(to) / 4)
+			break;
+
+		fill_cursor(to);
 	}
+
 	if(rb_linebuf_len(&to->localClient->buf_sendq))
 	{
 		SetFlush(to);
@@ -221,6 +329,128 @@ send_queued(struct Client *to)
 
 }
 
+/* send_cursor()
+ *
+ * inputs	- client to send to, list node to start from, callbacks, state
+ * outputs	-
+ * side effects - the reply is sent as the client's sendq drains, a
+ *		  remote client gets it all at once.  a reply already in
+ *		  progress for the client is ended first.
+ */
+void
+send_cursor(struct Client *to, rb_dlink_node *start, CURSORFILL *fill, CURSORDONE *done,
+	    void *data)
+{
+	struct Cursor *cursor;
+	rb_dlink_node *ptr, *next_ptr;
+
+	if(!MyConnect(to))
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, start)
+		{
+			if(!fill(to, ptr->data, data))
+				break;
+		}
+		done(to, data);
+		rb_free(data);
+		return;
+	}
+
+	if((cursor = to->localClient->cursor) != NULL)
+	{
+		cursor->pos = NULL;
+		fill_cursor(to);
+	}
+
+	cursor = rb_malloc(sizeof(struct Cursor));
+	cursor->pos = start;
+	cursor->fill = fill;
+	cursor->done = done;
+	cursor->data = data;
+	rb_dlinkAdd(cursor, &cursor->node, &cursor_list);
+	to->localClient->cursor = cursor;
+
+	/* the first lines go out with the rest of this loop's writes */
+	send_schedule_flush(to);
+}
+
+/* fill_cursor()
+ *
+ * inputs	- client with a reply in progress
+ * outputs	-
+ * side effects - entries are sent until the sendq reaches a quarter of
+ *		  the class sendq, the cursor is finished at the end of
+ *		  the list
+ */
+static void
+fill_cursor(struct Client *to)
+{
+	struct Cursor *cursor = to->localClient->cursor;
+	rb_dlink_node *ptr;
+	unsigned long limit = get_sendq(to) / 4;
+
+	/* no flushing from in here, send_queued() is what called us */
+	SetCork(to);
+	while((ptr = cursor->pos) != NULL &&
+	      rb_linebuf_len(&to->localClient->buf_sendq) < limit && !IsIOError(to))
+	{
+		cursor->pos = ptr->next;
+		if(!cursor->fill(to, ptr->data, cursor->data))
+			cursor->pos = NULL;
+	}
+	ClearCork(to);
+
+	/* taken off first, so the ending cant get us called again */
+	if(cursor->pos == NULL)
+	{
+		to->localClient->cursor = NULL;
+		rb_dlinkDelete(&cursor->node, &cursor_list);
+		cursor->done(to, cursor->data);
+		rb_free(cursor->data);
+		rb_free(cursor);
+	}
+}
+
+/* cursor_drop_node()
+ *
+ * inputs	- list node about to be unlinked
+ * outputs	-
+ * side effects - cursors about to visit it move on to the next one
+ */
+void
+cursor_drop_node(rb_dlink_node *ptr)
+{
+	struct Cursor *cursor;
+	rb_dlink_node *cptr;
+
+	RB_DLINK_FOREACH(cptr, cursor_list.head)
+	{
+		cursor = cptr->data;
+		if(cursor->pos == ptr)
+			cursor->pos = ptr->next;
+	}
+}
+
+/* free_cursor()
+ *
+ * inputs	- client
+ * outputs	-
+ * side effects - any reply in progress is dropped without its ending
+ */
+void
+free_cursor(struct Client *client_p)
+{
+	struct Cursor *cursor = client_p->localClient->cursor;
+
+	if(cursor == NULL)
+		return;
+
+	rb_dlinkDelete(&cursor->node, &cursor_list);
+	rb_free(cursor->data);
+	rb_free(cursor);
+	client_p->localClient->cursor = NULL;
+}
+
 /* send_queued_write()
  *
  * inputs	- fd to have queue sent, client we're sending to
@@ -528,14 +758,14 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	buf_head_t rb_linebuf_id;
 	struct Client *target_p;
 	struct membership *msptr;
+	struct chan_uplink *uplink;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
+	unsigned int i;
 
 	rb_linebuf_newbuf(&rb_linebuf_local);
 	rb_linebuf_newbuf(&rb_linebuf_id);
 
-	current_serial++;
-
 	va_start(args, pattern);
 	rb_vsnprintf(buf, sizeof(buf), pattern, args);
 	va_end(args);
@@ -549,26 +779,60 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 
 	rb_linebuf_putmsg(&rb_linebuf_id, NULL, NULL, ":%s %s", source_p->id, buf);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->members.head)
+	for(i = 0; i < chptr->loccount; i++)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
-
-		if(IsIOError(target_p->from) || target_p->from == one)
+		if(type && ((chptr->locflags[i] & type) == 0))
 			continue;
 
-		if(type && ((msptr->flags & type) == 0))
+		target_p = chptr->locclient[i];
+
+		if(IsIOError(target_p) || target_p == one)
 			continue;
 
 		if(IsDeaf(target_p))
 			continue;
 
-		if(!MyClient(target_p))
+		send_linebuf(target_p, &rb_linebuf_local);
+	}
+
+	/* everyone gets it, so it goes down every link with a member behind
+	 * it.  deaf remote members are left for their own server to skip.
+	 */
+	if(!type)
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->uplinks.head)
+		{
+			uplink = ptr->data;
+			target_p = uplink->client_p;
+
+			if(IsIOError(target_p) || target_p == one)
+				continue;
+
+			send_rb_linebuf_remote(target_p, source_p, &rb_linebuf_id);
+		}
+	}
+	else
+	{
+		current_serial++;
+
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->members.head)
 		{
+			msptr = ptr->data;
+			target_p = msptr->client_p;
+
+			if(MyClient(target_p) || (msptr->flags & type) == 0)
+				continue;
+
+			if(IsIOError(target_p->from) || target_p->from == one)
+				continue;
+
+			if(IsDeaf(target_p))
+				continue;
+
 			/* if we've got a specific type, target must support
 			 * CHW.. --fl
 			 */
-			if(type && NotCapable(target_p->from, CAP_CHW))
+			if(NotCapable(target_p->from, CAP_CHW))
 				continue;
 
 			if(target_p->from->localClient->serial != current_serial)
@@ -577,8 +841,6 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 				target_p->from->localClient->serial = current_serial;
 			}
 		}
-		else
-			send_linebuf(target_p, &rb_linebuf_local);
 	}
 
 	rb_linebuf_donebuf(&rb_linebuf_local);
@@ -597,10 +859,8 @@ sendto_channel_local(int type, struct Channel *chptr, const char *pattern, ...)
 {
 	va_list args;
 	buf_head_t linebuf;
-	struct membership *msptr;
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	unsigned int i;
 
 	rb_linebuf_newbuf(&linebuf);
 
@@ -608,15 +868,14 @@ sendto_channel_local(int type, struct Channel *chptr, const char *pattern, ...)
 	rb_linebuf_putmsg(&linebuf, pattern, &args, NULL);
 	va_end(args);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
+	for(i = 0; i < chptr->loccount; i++)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
-
-		if(IsIOError(target_p))
+		if(type && ((chptr->locflags[i] & type) == 0))
 			continue;
 
-		if(type && ((msptr->flags & type) == 0))
+		target_p = chptr->locclient[i];
+
+		if(IsIOError(target_p))
 			continue;
 
 		send_linebuf(target_p, &linebuf);
@@ -636,10 +895,8 @@ sendto_channel_anon(struct Client *anon, struct Channel *chptr, const char *patt
 {
 	va_list args;
 	buf_head_t linebuf;
-	struct membership *msptr;
 	struct Client *target_p;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
+	unsigned int i;
 
 	rb_linebuf_newbuf(&linebuf);
 
@@ -653,10 +910,9 @@ sendto_channel_anon(struct Client *anon, struct Channel *chptr, const char *patt
 		return;
 	}
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
+	for(i = 0; i < chptr->loccount; i++)
 	{
-		msptr = ptr->data;
-		target_p = msptr->client_p;
+		target_p = chptr->locclient[i];
 
 		if(IsIOError(target_p))
 			continue;
@@ -742,6 +998,7 @@ sendto_match_butone(struct Client *one, struct Client *source_p,
 	static char buf[BUFSIZE];
 	va_list args;
 	struct Client *target_p;
+	struct compiled_mask cmask;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	buf_head_t rb_linebuf_local;
@@ -765,13 +1022,15 @@ sendto_match_butone(struct Client *one, struct Client *source_p,
 
 	if(what == MATCH_HOST)
 	{
+		compile_mask(&cmask, mask);
 		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 		{
 			target_p = ptr->data;
 
-			if(match(mask, target_p->host))
+			if(match_compiled(&cmask, target_p->host))
 				send_linebuf(target_p, &rb_linebuf_local);
 		}
+		free_compiled_mask(&cmask);
 	}
 	/* what = MATCH_SERVER, if it doesnt match us, just send remote */
 	else if(match(mask, me.name))
@@ -811,6 +1070,7 @@ sendto_match_servs(struct Client *source_p, const char *mask, int cap,
 	va_list args;
 	rb_dlink_node *ptr;
 	struct Client *target_p;
+	struct compiled_mask cmask;
 	buf_head_t rb_linebuf_id;
 
 	if(EmptyString(mask))
@@ -839,6 +1099,7 @@ sendto_match_servs(struct Client *source_p, const char *mask, int cap,
 		rb_linebuf_putmsg(&rb_linebuf_id, NULL, NULL, ":%s %s", source_p->id, buf);
 
 	current_serial++;
+	compile_mask(&cmask, mask);
 
 	RB_DLINK_FOREACH(ptr, global_serv_list.head)
 	{
@@ -851,7 +1112,7 @@ sendto_match_servs(struct Client *source_p, const char *mask, int cap,
 		if(target_p->from->localClient->serial == current_serial)
 			continue;
 
-		if(match(mask, target_p->name))
+		if(match_compiled(&cmask, target_p->name))
 		{
 			/* if we set the serial here, then we'll never do
 			 * a match() again if !IsCapable()
@@ -872,6 +1133,7 @@ sendto_match_servs(struct Client *source_p, const char *mask, int cap,
 		}
 	}
 
+	free_compiled_mask(&cmask);
 	rb_linebuf_donebuf(&rb_linebuf_id);
 }
 
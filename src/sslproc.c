@@ -26,6 +26,7 @@
 
 
 #include "s_conf.h"
+#include "s_newconf.h"
 #include "s_log.h"
 #include "listener.h"
 #include "struct.h"
@@ -36,10 +37,16 @@
 #include "client.h"
 #include "send.h"
 #include "packet.h"
+#include "numeric.h"
+#include "match.h"
 
 #define ZIPSTATS_TIME           60
+#define SSLSTATS_TIME		10
+#define TICKET_ROTATE_TIME	3600	/* tickets stay valid for two of these */
 
 static void collect_zipstats(void *unused);
+static void collect_sslstats(void *unused);
+static void rotate_ticket_keys(void *unused);
 static void ssl_read_ctl(rb_fde_t *F, void *data);
 static int ssld_count;
 
@@ -68,11 +75,26 @@ struct _ssl_ctl
 	rb_dlink_list readq;
 	rb_dlink_list writeq;
 	uint8_t dead;
+	unsigned long handshakes;	/* full and resumed, as of the last 's' */
+	unsigned long resumed;
+	unsigned long cpu_ms;		/* cpu time used, as of the last 's' */
+	unsigned long load;		/* cpu microseconds per second since the one before */
+	int poll_count;			/* cli_count when load was measured */
+	time_t polled;
 };
 
+/* id of the zstd dictionary the sslds have loaded, 0 for none */
+static unsigned int zstd_dict_id;
+
+/* session ticket keys every ssld shares, [0] issues new tickets */
+static uint8_t ticket_keys[RB_SSL_TICKET_KEYS][RB_SSL_TICKET_KEYLEN];
+
 static void send_new_ssl_certs_one(ssl_ctl_t * ctl, const char *ssl_cert,
 				   const char *ssl_private_key, const char *ssl_dh_params);
 static void send_init_prng(ssl_ctl_t * ctl, prng_seed_t seedtype, const char *path);
+static void send_ssl_ktls_one(ssl_ctl_t * ctl, int enable);
+static void send_ticket_keys_one(ssl_ctl_t * ctl);
+static void send_zstd_dictionary_one(ssl_ctl_t * ctl, const char *path);
 
 
 static rb_dlink_list ssl_daemons;
@@ -306,6 +328,8 @@ start_ssldaemon(int count, const char *ssl_cert, const char *ssl_private_key,
 		rb_setenv("CTL_PIPE", fdarg, 1);
 		rb_snprintf(s_pid, sizeof(s_pid), "%d", (int)getpid());
 		rb_setenv("CTL_PPID", s_pid, 1);
+		rb_snprintf(fdarg, sizeof(fdarg), "%d", ServerInfo.ssld_threads);
+		rb_setenv("SSLD_THREADS", fdarg, 1);
 #ifdef _WIN32
 		SetHandleInformation((HANDLE) rb_get_fd(F2), HANDLE_FLAG_INHERIT, 1);
 		SetHandleInformation((HANDLE) rb_get_fd(P1), HANDLE_FLAG_INHERIT, 1);
@@ -333,8 +357,13 @@ start_ssldaemon(int count, const char *ssl_cert, const char *ssl_private_key,
 				send_init_prng(ctl, RB_PRNG_DEFAULT, NULL);
 		}
 		if(ircd_ssl_ok && ssl_cert != NULL && ssl_private_key != NULL)
+		{
 			send_new_ssl_certs_one(ctl, ssl_cert, ssl_private_key,
 					       ssl_dh_params != NULL ? ssl_dh_params : "");
+			send_ssl_ktls_one(ctl, ServerInfo.ssl_ktls);
+		}
+		if(zstd_dict_id)
+			send_zstd_dictionary_one(ctl, ConfigFileEntry.zstd_dictionary);
 		ssl_read_ctl(ctl->F, ctl);
 		ssl_do_pipe(P2, ctl);
 
@@ -342,14 +371,39 @@ start_ssldaemon(int count, const char *ssl_cert, const char *ssl_private_key,
 	return started;
 }
 
+static void
+ssl_process_sslstats(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	int parc;
+	char *parv[5];
+	unsigned long cpu_ms;
+
+	parc = rb_string_to_array(ctl_buf->buf, parv, 4);
+	if(parc < 3)
+		return;
+
+	ctl->handshakes = strtoul(parv[1], NULL, 10);
+	ctl->resumed = strtoul(parv[2], NULL, 10);
+
+	if(parc < 4)
+		return;
+
+	cpu_ms = strtoul(parv[3], NULL, 10);
+	if(ctl->polled && rb_current_time() > ctl->polled && cpu_ms >= ctl->cpu_ms)
+		ctl->load = (cpu_ms - ctl->cpu_ms) * 1000 / (rb_current_time() - ctl->polled);
+	ctl->cpu_ms = cpu_ms;
+	ctl->poll_count = ctl->cli_count;
+	ctl->polled = rb_current_time();
+}
+
 static void
 ssl_process_zipstats(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 {
 	struct Client *server;
 	struct ZipStats *zips;
 	int parc;
-	char *parv[7];
-	parc = rb_string_to_array(ctl_buf->buf, parv, 6);
+	char *parv[8];
+	parc = rb_string_to_array(ctl_buf->buf, parv, 7);
 	server = find_server(NULL, parv[1]);
 	if(server == NULL || server->localClient == NULL || !IsCapable(server, CAP_ZIP))
 		return;
@@ -362,6 +416,8 @@ ssl_process_zipstats(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 	zips->in_wire += strtoull(parv[3], NULL, 10);
 	zips->out += strtoull(parv[4], NULL, 10);
 	zips->out_wire += strtoull(parv[5], NULL, 10);
+	if(parc > 6)
+		zips->out_blocks += strtoull(parv[6], NULL, 10);
 
 	if(zips->in > 0)
 		zips->in_ratio = ((double)(zips->in - zips->in_wire) / (double)zips->in) * 100.00;
@@ -432,6 +488,9 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 		case 'S':
 			ssl_process_zipstats(ctl, ctl_buf);
 			break;
+		case 's':
+			ssl_process_sslstats(ctl, ctl_buf);
+			break;
 		case 'I':
 			ircd_ssl_ok = 0;
 			ilog(L_MAIN, cannot_setup_ssl);
@@ -494,24 +553,50 @@ ssl_read_ctl(rb_fde_t *F, void *data)
 	rb_setselect(ctl->F, RB_SELECT_READ, ssl_read_ctl, ctl);
 }
 
+/*
+ * which_ssld - pick the ssld to hand a new connection to
+ *
+ * Connections differ a lot in what they cost (a busy server link versus
+ * an idle client), so go by the cpu time each ssld reported over the
+ * last stats interval.  Connections given out since then are added at
+ * the average cost per connection, otherwise a burst of accepts would
+ * all land on whichever ssld looked idle at the last poll.  Until there
+ * is any load to go by this is simply the lowest client count.
+ *
+ * An ssld started with ssld_threads above one balances between its own
+ * worker threads the same way, its load here is all of them together.
+ */
 static ssl_ctl_t *
 which_ssld(void)
 {
 	ssl_ctl_t *ctl, *lowest = NULL;
 	rb_dlink_node *ptr;
+	unsigned long total_load = 0, cost;
+	long load, lowest_load = 0;
+	int total_count = 0;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		total_load += ctl->load;
+		total_count += ctl->poll_count;
+	}
+	cost = total_count ? total_load / total_count : 0;
 
 	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
 	{
 		ctl = ptr->data;
 		if(ctl->dead)
 			continue;
-		if(lowest == NULL)
+		load = (long)ctl->load + (long)(ctl->cli_count - ctl->poll_count) * (long)cost;
+		if(lowest == NULL || load < lowest_load
+		   || (load == lowest_load && ctl->cli_count < lowest->cli_count))
 		{
 			lowest = ctl;
-			continue;
+			lowest_load = load;
 		}
-		if(ctl->cli_count < lowest->cli_count)
-			lowest = ctl;
 	}
 	return (lowest);
 }
@@ -599,6 +684,44 @@ send_new_ssl_certs_one(ssl_ctl_t * ctl, const char *ssl_cert, const char *ssl_pr
 	len = rb_snprintf(tmpbuf, sizeof(tmpbuf), "K%c%s%c%s%c%s%c", nul, ssl_cert, nul,
 			  ssl_private_key, nul, ssl_dh_params, nul);
 	ssl_cmd_write_queue(ctl, NULL, 0, tmpbuf, len);
+	send_ticket_keys_one(ctl);
+}
+
+/*
+ * k[keys]
+ * keys = RB_SSL_TICKET_KEYS session ticket keys, the current one first
+ */
+static void
+send_ticket_keys_one(ssl_ctl_t * ctl)
+{
+	char buf[1 + sizeof(ticket_keys)];
+
+	buf[0] = 'k';
+	memcpy(&buf[1], ticket_keys, sizeof(ticket_keys));
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+/*
+ * rotate_ticket_keys - start issuing tickets under a new key, the old
+ * one is still accepted until the next rotation
+ */
+static void
+rotate_ticket_keys(void *unused)
+{
+	rb_dlink_node *ptr;
+	int i;
+
+	for(i = RB_SSL_TICKET_KEYS - 1; i > 0; i--)
+		memcpy(ticket_keys[i], ticket_keys[i - 1], RB_SSL_TICKET_KEYLEN);
+	rb_get_random(ticket_keys[0], RB_SSL_TICKET_KEYLEN);
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		send_ticket_keys_one(ctl);
+	}
 }
 
 static void
@@ -629,6 +752,31 @@ send_init_prng(ssl_ctl_t * ctl, prng_seed_t seedtype, const char *path)
 	ssl_cmd_write_queue(ctl, NULL, 0, tmpbuf, len);
 }
 
+/* 
+ * T[enable]
+ * enable = '1' to let the kernel take over sessions after the handshake
+ */
+static void
+send_ssl_ktls_one(ssl_ctl_t * ctl, int enable)
+{
+	char buf[2];
+
+	buf[0] = 'T';
+	buf[1] = enable ? '1' : '0';
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+
+void
+send_ssl_ktls(int enable)
+{
+	rb_dlink_node *ptr;
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		send_ssl_ktls_one(ctl, enable);
+	}
+}
+
 void
 send_new_ssl_certs(const char *ssl_cert, const char *ssl_private_key, const char *ssl_dh_params)
 {
@@ -694,6 +842,69 @@ ssld_decrement_clicount(ssl_ctl_t * ctl)
 	}
 }
 
+/*
+ * zstd dictionaries start with a magic number and an id, the id goes in
+ * CAPAB so both ends can tell whether they were given the same one
+ */
+static unsigned int
+read_zstd_dictionary_id(const char *path)
+{
+	unsigned char hdr[8];
+	FILE *f;
+	size_t n;
+
+	if((f = fopen(path, "r")) == NULL)
+		return 0;
+	n = fread(hdr, 1, sizeof(hdr), f);
+	fclose(f);
+
+	if(n != sizeof(hdr) || hdr[0] != 0x37 || hdr[1] != 0xa4 || hdr[2] != 0x30 || hdr[3] != 0xec)
+		return 0;
+	return hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | ((unsigned int)hdr[7] << 24);
+}
+
+static void
+send_zstd_dictionary_one(ssl_ctl_t * ctl, const char *path)
+{
+	char buf[MAXPATHLEN + 2];
+
+	buf[0] = 'x';
+	rb_strlcpy(&buf[1], path != NULL ? path : "", sizeof(buf) - 1);
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, strlen(buf) + 1);
+}
+
+void
+send_zstd_dictionary(const char *path)
+{
+	rb_dlink_node *ptr;
+
+	if(!zstd_ok)
+		return;
+
+	zstd_dict_id = 0;
+	if(!EmptyString(path) && (zstd_dict_id = read_zstd_dictionary_id(path)) == 0)
+	{
+		ilog(L_MAIN, "Ignoring zstd_dictionary %s: not a zstd dictionary", path);
+		sendto_realops_flags(UMODE_ALL, L_ALL,
+				     "Ignoring zstd_dictionary %s: not a zstd dictionary", path);
+		path = NULL;
+	}
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		send_zstd_dictionary_one(ctl, zstd_dict_id ? path : NULL);
+	}
+}
+
+unsigned int
+zstd_dictionary_id(void)
+{
+	return zstd_dict_id;
+}
+
 /* 
  * what we end up sending to the ssld process for ziplinks is the following
  * Z[ourfd][level][RECVQ]  
@@ -702,6 +913,9 @@ ssld_decrement_clicount(ssl_ctl_t * ctl)
  * level = zip level buf[5]
  * recvqlen = our recvq len = buf[6-7]
  * recvq = any data we read prior to starting ziplinks
+ *
+ * a zstd link (both sides sent ZSTD) is X[ourfd][level][dict][RECVQ],
+ * where dict says to use the dictionary because both of us have it
  */
 void
 start_zlib_session(void *data)
@@ -709,23 +923,23 @@ start_zlib_session(void *data)
 	struct Client *server = (struct Client *)data;
 	uint16_t recvqlen;
 	uint8_t level;
-	void *xbuf;
 
 	rb_fde_t *F[2];
 	rb_fde_t *xF1, *xF2;
 	char *buf;
 	char buf2[9];
+	char fbuf[11];
 	void *recvq_start;
+	struct server_conf *server_p;
 
-	size_t hdr = (sizeof(uint8_t) * 2) + sizeof(int32_t);
+	int zstd = IsCapable(server, CAP_ZSTD);
+	int use_dict = zstd && zstd_dict_id && server->localClient->zstd_dict == zstd_dict_id;
+	size_t hdr = (sizeof(uint8_t) * (zstd ? 3 : 2)) + sizeof(int32_t);
 	size_t len;
-	int cpylen, left;
 
 	server->localClient->event = NULL;
 
-	recvqlen = rb_linebuf_len(&server->localClient->buf_recvq);
-
-	len = recvqlen + hdr;
+	len = server->localClient->recvq_tail - server->localClient->recvq_head + hdr;
 
 	if(len > READBUF_SIZE)
 	{
@@ -738,31 +952,28 @@ start_zlib_session(void *data)
 		return;
 	}
 
+	recvqlen = len - hdr;
 	buf = rb_malloc(len);
-	level = ConfigFileEntry.compression_level;
+	level = zstd ? ConfigFileEntry.zstd_level : ConfigFileEntry.compression_level;
 
 	int32_to_buf(&buf[1], rb_get_fd(server->localClient->F));
 
 	
 	buf[5] = (char)level;
+	if(zstd)
+		buf[6] = use_dict;
 
-	recvq_start = &buf[6];
+	recvq_start = &buf[hdr];
 	server->localClient->zipstats = rb_malloc(sizeof(struct ZipStats));
+	server->localClient->zipstats->method = zstd ? (use_dict ? "zstd+dict" : "zstd") : "zlib";
 
-	xbuf = recvq_start;
-	left = recvqlen;
-
-	do
-	{
-		cpylen = rb_linebuf_get(&server->localClient->buf_recvq, xbuf, left,
-					LINEBUF_PARTIAL, LINEBUF_RAW);
-		left -= cpylen;
-		xbuf = (void *) (((uintptr_t) xbuf) + cpylen);
-	}
-	while(cpylen > 0);
+	/* hand over everything we read past the SERVER line */
+	memcpy(recvq_start, server->localClient->recvq_buf + server->localClient->recvq_head,
+	       recvqlen);
+	server->localClient->recvq_head = server->localClient->recvq_tail = 0;
 
 	/* Pass the socket to ssld. */
-	*buf = 'Z';
+	*buf = zstd ? 'X' : 'Z';
 	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &xF1, &xF2, "Initial zlib socketpairs") == -1)
 	{
 		sendto_realops_flags(UMODE_ALL, L_ALL, "Error creating zlib socketpair - %m");
@@ -795,6 +1006,17 @@ start_zlib_session(void *data)
 	server->localClient->z_ctl->cli_count++;
 	ssl_cmd_write_queue(server->localClient->z_ctl, F, 2, buf, len);
 	rb_free(buf);
+
+	/* hold output back in ssld to send fewer, bigger blocks */
+	server_p = server->localClient->att_sconf;
+	if(server_p != NULL && server_p->zip_flush_delay > 0)
+	{
+		fbuf[0] = 'F';
+		int32_to_buf(&fbuf[1], rb_get_fd(server->localClient->F));
+		int32_to_buf(&fbuf[5], server_p->zip_flush_size);
+		uint16_to_buf(&fbuf[9], server_p->zip_flush_delay);
+		ssl_cmd_write_queue(server->localClient->z_ctl, NULL, 0, fbuf, sizeof(fbuf));
+	}
 }
 
 static void
@@ -826,6 +1048,59 @@ collect_zipstats(void *unused)
 	}
 }
 
+static void
+collect_sslstats(void *unused)
+{
+	static const char cmd = 's';
+	rb_dlink_node *ptr;
+
+	if(!ircd_ssl_ok)
+		return;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		ssl_cmd_write_queue(ctl, NULL, 0, &cmd, sizeof(cmd));
+	}
+}
+
+/*
+ * ssld_session_stats - TLS handshakes done by the running sslds, and
+ * how many of those resumed a session
+ */
+void
+ssld_session_stats(unsigned long *handshakes, unsigned long *resumed)
+{
+	rb_dlink_node *ptr;
+
+	*handshakes = *resumed = 0;
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		*handshakes += ctl->handshakes;
+		*resumed += ctl->resumed;
+	}
+}
+
+void
+report_ssld(struct Client *source_p)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "T :ssld %ld%s connections %d cpu %lu.%lu%%",
+				   (long)ctl->pid, ctl->dead ? " (dead)" : "", ctl->cli_count,
+				   ctl->load / 10000, ctl->load / 1000 % 10);
+	}
+}
+
 static void
 cleanup_dead_ssl(void *unused)
 {
@@ -851,5 +1126,11 @@ void
 init_ssld(void)
 {
 	rb_event_addish("collect_zipstats", collect_zipstats, NULL, ZIPSTATS_TIME);
+	rb_event_addish("collect_sslstats", collect_sslstats, NULL, SSLSTATS_TIME);
+
+	/* fill both slots so there is never an all zero key */
+	rotate_ticket_keys(NULL);
+	rotate_ticket_keys(NULL);
+	rb_event_addish("rotate_ticket_keys", rotate_ticket_keys, NULL, TICKET_ROTATE_TIME);
 	rb_event_addish("cleanup_dead_ssld", cleanup_dead_ssl, NULL, 1200);
 }
@@ -27,12 +27,34 @@
 #ifdef HAVE_ZLIB
 #include <zlib.h>
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #define MAXPASSFD 4
 #ifndef READBUF_SIZE
 #define READBUF_SIZE 16384
 #endif
 
+/* with kernel TLS, data can be spliced between the client socket and the
+ * ircd socketpair without coming up into ssld at all
+ */
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+#define USE_SPLICE 1
+#endif
+
+/* with ssld_threads the connections are spread over worker threads that
+ * each run their own event loop, libratbox keeps its state per thread
+ */
+#if defined(HAVE_PTHREAD) && defined(RB_HAVE_THREAD_LOCAL)
+#define USE_THREADS 1
+#include <pthread.h>
+#include <time.h>
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+#define USE_THREAD_CPUTIME 1
+#endif
+#endif
+
 static void setup_signals(void);
 static pid_t ppid;
 
@@ -67,9 +89,9 @@ uint16_to_buf(char *buf, uint16_t x)
 }
 
 
-static char inbuf[READBUF_SIZE];
+static RB_THREAD_LOCAL char inbuf[READBUF_SIZE];
 #ifdef HAVE_ZLIB
-static char outbuf[READBUF_SIZE];
+static RB_THREAD_LOCAL char outbuf[READBUF_SIZE];
 #endif
 
 typedef struct _mod_ctl_buf
@@ -89,9 +111,48 @@ typedef struct _mod_ctl
 	rb_fde_t *F_pipe;
 	rb_dlink_list readq;
 	rb_dlink_list writeq;
+	struct _worker *worker;	/* set on the main thread's end of a worker's socket */
 } mod_ctl_t;
 
-static mod_ctl_t *mod_ctl;
+static RB_THREAD_LOCAL mod_ctl_t *mod_ctl;
+
+#ifdef USE_THREADS
+/*
+ * a worker thread runs everything below on its own event loop with its
+ * own connections, and hears from the main thread over a socketpair in
+ * the same protocol the ircd uses.  the main thread only passes the
+ * ircd's messages on, see main_cmd_recv().
+ */
+typedef struct _worker
+{
+	mod_ctl_t ctl;		/* the main thread's end */
+	int fd;			/* the worker's end */
+	pthread_t thread;
+#ifdef USE_THREAD_CPUTIME
+	clockid_t clock;
+	int has_clock;
+	unsigned long long cpu_us;	/* thread cpu time at the last sample */
+#endif
+	unsigned long load;	/* cpu microseconds since the last sample */
+	int poll_conns;		/* conns at the last sample */
+	int handed;		/* new connections given it since */
+
+	/* the worker fills these in once a second */
+	pthread_mutex_t lock;
+	int conns;
+	unsigned long handshakes;
+	unsigned long resumed;
+} worker_t;
+
+/* only the main thread has workers, in a worker these stay empty */
+static RB_THREAD_LOCAL worker_t *workers;
+static RB_THREAD_LOCAL int worker_count;
+static RB_THREAD_LOCAL worker_t *self;	/* and this is set instead */
+
+static void main_cmd_recv(mod_ctl_t * ctl);
+static void main_worker_recv(worker_t * w);
+static void worker_session_stats(unsigned long *handshakes, unsigned long *resumed);
+#endif
 
 
 #ifdef HAVE_ZLIB
@@ -102,6 +163,22 @@ typedef struct _zlib_stream
 } zlib_stream_t;
 #endif
 
+#ifdef HAVE_ZSTD
+/* both ends of a zstd link keep a window this big per direction, a hub
+ * has a few of these so don't let the higher levels pick 8MB
+ */
+#define ZSTD_LINK_WINDOWLOG	18
+
+typedef struct _zstd_stream
+{
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+} zstd_stream_t;
+
+static RB_THREAD_LOCAL void *zstd_dict;
+static RB_THREAD_LOCAL size_t zstd_dict_len;
+#endif
+
 typedef struct _conn
 {
 	rb_dlink_node node;
@@ -117,8 +194,16 @@ typedef struct _conn
 	unsigned long long mod_in;
 	unsigned long long plain_in;
 	unsigned long long plain_out;
-	uint8_t flags;
+	unsigned long long mod_blocks;	/* compressed blocks flushed out */
+	uint16_t flags;
 	void *stream;
+
+	/* flush policy for compressed links, see zip_compress() */
+	rb_dlink_node flush_node;
+	uint32_t flush_size;
+	uint16_t flush_delay;
+	uint32_t unflushed;
+	struct timeval flush_time;	/* when the oldest unflushed data went in */
 } conn_t;
 
 #define FLAG_SSL	0x01
@@ -128,6 +213,10 @@ typedef struct _conn
 #define FLAG_SSL_W_WANTS_R 0x10	/* output needs to wait until input possible */
 #define FLAG_SSL_R_WANTS_W 0x20	/* input needs to wait until output possible */
 #define FLAG_ZIPSSL	0x40
+#define FLAG_KTLS_TX	0x80	/* kernel encrypts, plain data can be spliced out */
+#define FLAG_KTLS_RX	0x100	/* kernel decrypts, data records can be spliced in */
+#define FLAG_ZSTD	0x200
+#define FLAG_FLUSH_PENDING 0x400	/* compressor holds data, on zip_flush_list */
 
 #define IsSSL(x) ((x)->flags & FLAG_SSL)
 #define IsZip(x) ((x)->flags & FLAG_ZIP)
@@ -136,6 +225,10 @@ typedef struct _conn
 #define IsSSLWWantsR(x) ((x)->flags & FLAG_SSL_W_WANTS_R)
 #define IsSSLRWantsW(x) ((x)->flags & FLAG_SSL_R_WANTS_W)
 #define IsZipSSL(x)	((x)->flags & FLAG_ZIPSSL)
+#define IsKTLSTX(x)	((x)->flags & FLAG_KTLS_TX)
+#define IsKTLSRX(x)	((x)->flags & FLAG_KTLS_RX)
+#define IsZstd(x)	((x)->flags & FLAG_ZSTD)
+#define IsFlushPending(x)	((x)->flags & FLAG_FLUSH_PENDING)
 
 #define SetSSL(x) ((x)->flags |= FLAG_SSL)
 #define SetZip(x) ((x)->flags |= FLAG_ZIP)
@@ -144,6 +237,10 @@ typedef struct _conn
 #define SetSSLWWantsR(x) ((x)->flags |= FLAG_SSL_W_WANTS_R)
 #define SetSSLRWantsW(x) ((x)->flags |= FLAG_SSL_R_WANTS_W)
 #define SetZipSSL(x)	((x)->flags |= FLAG_ZIPSSL)
+#define SetKTLSTX(x)	((x)->flags |= FLAG_KTLS_TX)
+#define SetKTLSRX(x)	((x)->flags |= FLAG_KTLS_RX)
+#define SetZstd(x)	((x)->flags |= FLAG_ZSTD)
+#define SetFlushPending(x)	((x)->flags |= FLAG_FLUSH_PENDING)
 
 #define ClearSSL(x) ((x)->flags &= ~FLAG_SSL)
 #define ClearZip(x) ((x)->flags &= ~FLAG_ZIP)
@@ -152,6 +249,8 @@ typedef struct _conn
 #define ClearSSLWWantsR(x) ((x)->flags &= ~FLAG_SSL_W_WANTS_R)
 #define ClearSSLRWantsW(x) ((x)->flags &= ~FLAG_SSL_R_WANTS_W)
 #define ClearZipSSL(x)	((x)->flags &= ~FLAG_ZIPSSL)
+#define ClearKTLSTX(x)	((x)->flags &= ~FLAG_KTLS_TX)
+#define ClearFlushPending(x)	((x)->flags &= ~FLAG_FLUSH_PENDING)
 
 #define NO_WAIT 0x0
 #define WAIT_PLAIN 0x1
@@ -163,8 +262,10 @@ typedef struct _conn
 
 
 
-static rb_dlink_list connid_hash_table[CONN_HASH_SIZE];
-static rb_dlink_list dead_list;
+static RB_THREAD_LOCAL rb_dlink_list connid_hash_table[CONN_HASH_SIZE];
+static RB_THREAD_LOCAL rb_dlink_list dead_list;
+static RB_THREAD_LOCAL rb_dlink_list zip_flush_list;
+static RB_THREAD_LOCAL int conn_count;	/* not yet closed, for the main thread's balancing */
 
 static void conn_mod_read_cb(rb_fde_t *fd, void *data);
 static void conn_mod_write_sendq(rb_fde_t *, void *data);
@@ -173,8 +274,12 @@ static void mod_write_ctl(rb_fde_t *, void *data);
 static void conn_plain_read_cb(rb_fde_t *fd, void *data);
 static void conn_plain_read_shutdown_cb(rb_fde_t *fd, void *data);
 static void mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len);
+static void zip_flush(conn_t * conn);
 static const char *remote_closed = "Remote host closed the connection";
 static int ssl_ok;
+#ifdef USE_SPLICE
+static RB_THREAD_LOCAL int splice_pipe[2] = { -1, -1 };
+#endif
 #ifdef HAVE_ZLIB
 static int zlib_ok = 1;
 #else
@@ -231,6 +336,15 @@ free_conn(conn_t * conn)
 		deflateEnd(&stream->outstream);
 	}
 #endif
+#ifdef HAVE_ZSTD
+	if(IsZstd(conn))
+	{
+		zstd_stream_t *stream = conn->stream;
+		ZSTD_freeCCtx(stream->cctx);
+		ZSTD_freeDCtx(stream->dctx);
+	}
+#endif
+	rb_free(conn->stream);
 	rb_free(conn);
 }
 
@@ -258,10 +372,20 @@ close_conn(conn_t * conn, int wait_plain, const char *fmt, ...)
 	if(IsDead(conn))
 		return;
 
+	/* a link going away has usually just sent its ERROR or SQUIT, don't
+	 * leave that sitting in the compressor */
+	if(IsFlushPending(conn))
+	{
+		zip_flush(conn);
+		if(IsDead(conn))
+			return;
+	}
+
 	rb_rawbuf_flush(conn->modbuf_out, conn->mod_fd);
 	rb_rawbuf_flush(conn->plainbuf_out, conn->plain_fd);
 	rb_close(conn->mod_fd);
 	SetDead(conn);
+	conn_count--;
 
 	if(conn->id >= 0 && !IsZipSSL(conn))
 		rb_dlinkDelete(&conn->node, connid_hash(conn->id));
@@ -298,6 +422,7 @@ make_conn(mod_ctl_t * ctl, rb_fde_t *mod_fd, rb_fde_t *plain_fd)
 	conn->stream = NULL;
 	rb_set_nb(mod_fd);
 	rb_set_nb(plain_fd);
+	conn_count++;
 	return conn;
 }
 
@@ -406,37 +531,34 @@ mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len)
 }
 
 #ifdef HAVE_ZLIB
+/* flush is Z_SYNC_FLUSH to end a block, Z_NO_FLUSH to let deflate hold on
+ * to the data until the next one
+ */
 static void
-common_zlib_deflate(conn_t * conn, void *buf, size_t len)
+common_zlib_deflate(conn_t * conn, void *buf, size_t len, int flush)
 {
 	int ret, have;
 	z_stream *outstream = &((zlib_stream_t *) conn->stream)->outstream;
 	outstream->next_in = buf;
 	outstream->avail_in = len;
-	outstream->next_out = (Bytef *) outbuf;
-	outstream->avail_out = sizeof(outbuf);
 
-	ret = deflate(outstream, Z_SYNC_FLUSH);
-	if(ret != Z_OK)
-	{
-		/* deflate error */
-		close_conn(conn, WAIT_PLAIN, "Deflate failed: %s", zError(ret));
-		return;
-	}
-	if(outstream->avail_out == 0)
-	{
-		/* avail_out empty */
-		close_conn(conn, WAIT_PLAIN, "error compressing data, avail_out == 0");
-		return;
-	}
-	if(outstream->avail_in != 0)
+	do
 	{
-		/* avail_in isn't empty... */
-		close_conn(conn, WAIT_PLAIN, "error compressing data, avail_in != 0");
-		return;
+		outstream->next_out = (Bytef *) outbuf;
+		outstream->avail_out = sizeof(outbuf);
+
+		ret = deflate(outstream, flush);
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			/* deflate error */
+			close_conn(conn, WAIT_PLAIN, "Deflate failed: %s", zError(ret));
+			return;
+		}
+		have = sizeof(outbuf) - outstream->avail_out;
+		if(have > 0)
+			conn_mod_write(conn, outbuf, have);
 	}
-	have = sizeof(outbuf) - outstream->avail_out;
-	conn_mod_write(conn, outbuf, have);
+	while(outstream->avail_in != 0 || outstream->avail_out == 0);
 }
 
 static void
@@ -478,6 +600,241 @@ common_zlib_inflate(conn_t * conn, void *buf, size_t len)
 }
 #endif
 
+#ifdef HAVE_ZSTD
+/* mode is ZSTD_e_flush to end a block, ZSTD_e_continue to let zstd hold
+ * on to the data until the next one
+ */
+static void
+common_zstd_compress(conn_t * conn, void *buf, size_t len, ZSTD_EndDirective mode)
+{
+	zstd_stream_t *stream = conn->stream;
+	ZSTD_inBuffer in = { buf, len, 0 };
+	ZSTD_outBuffer out;
+	size_t ret;
+
+	do
+	{
+		out.dst = outbuf;
+		out.size = sizeof(outbuf);
+		out.pos = 0;
+
+		ret = ZSTD_compressStream2(stream->cctx, &out, &in, mode);
+		if(ZSTD_isError(ret))
+		{
+			close_conn(conn, WAIT_PLAIN, "zstd compression failed: %s",
+				   ZSTD_getErrorName(ret));
+			return;
+		}
+		if(out.pos > 0)
+			conn_mod_write(conn, outbuf, out.pos);
+	}
+	while(in.pos < in.size || (mode == ZSTD_e_flush && ret != 0));
+}
+
+static void
+common_zstd_decompress(conn_t * conn, void *buf, size_t len)
+{
+	zstd_stream_t *stream = conn->stream;
+	ZSTD_inBuffer in = { buf, len, 0 };
+	ZSTD_outBuffer out;
+	size_t ret;
+
+	do
+	{
+		out.dst = outbuf;
+		out.size = sizeof(outbuf);
+		out.pos = 0;
+
+		ret = ZSTD_decompressStream(stream->dctx, &out, &in);
+		if(ZSTD_isError(ret))
+		{
+			if(!strncmp("ERROR ", buf, 6))
+			{
+				close_conn(conn, WAIT_PLAIN, "Received uncompressed ERROR");
+				return;
+			}
+			close_conn(conn, WAIT_PLAIN, "zstd decompression failed: %s",
+				   ZSTD_getErrorName(ret));
+			return;
+		}
+		if(out.pos > 0)
+			conn_plain_write(conn, outbuf, out.pos);
+	}
+	while(in.pos < in.size || out.pos == out.size);
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/*
+ * zip_compress - compress data read from the ircd for the link
+ *
+ * without a flush policy every read goes out as its own block.  with one
+ * the compressor holds on to it until flush_size bytes are waiting or the
+ * oldest has waited flush_delay milliseconds, so a busy link sends fewer
+ * and bigger blocks that compress better.
+ */
+static void
+zip_compress(conn_t * conn, void *buf, size_t len)
+{
+	int flush = 1;
+
+	if(conn->flush_delay > 0)
+	{
+		conn->unflushed += len;
+		if(conn->flush_size == 0 || conn->unflushed < conn->flush_size)
+			flush = 0;
+	}
+
+#ifdef HAVE_ZSTD
+	if(IsZstd(conn))
+		common_zstd_compress(conn, buf, len, flush ? ZSTD_e_flush : ZSTD_e_continue);
+	else
+#endif
+		common_zlib_deflate(conn, buf, len, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+	if(IsDead(conn))
+		return;
+
+	if(flush)
+	{
+		conn->mod_blocks++;
+		conn->unflushed = 0;
+		if(IsFlushPending(conn))
+		{
+			ClearFlushPending(conn);
+			rb_dlinkDelete(&conn->flush_node, &zip_flush_list);
+		}
+	}
+	else if(!IsFlushPending(conn))
+	{
+		SetFlushPending(conn);
+		memcpy(&conn->flush_time, rb_current_time_tv(), sizeof(struct timeval));
+		rb_dlinkAddTail(conn, &conn->flush_node, &zip_flush_list);
+	}
+}
+
+/* zip_flush - end the block the compressor is holding */
+static void
+zip_flush(conn_t * conn)
+{
+	ClearFlushPending(conn);
+	rb_dlinkDelete(&conn->flush_node, &zip_flush_list);
+	conn->unflushed = 0;
+	conn->mod_blocks++;
+
+#ifdef HAVE_ZSTD
+	if(IsZstd(conn))
+		common_zstd_compress(conn, NULL, 0, ZSTD_e_flush);
+	else
+#endif
+		common_zlib_deflate(conn, NULL, 0, Z_SYNC_FLUSH);
+}
+#else
+static void
+zip_flush(conn_t * conn)
+{
+}
+#endif
+
+/*
+ * zip_flush_expired - run once per pass through the event loop, the
+ * libratbox events only go down to a second.  returns milliseconds
+ * until the next held block is due, or -1 if nothing is held.
+ */
+static long
+zip_flush_expired(void)
+{
+	conn_t *conn;
+	rb_dlink_node *ptr, *next;
+	const struct timeval *now = rb_current_time_tv();
+	long wait = -1;
+	long left;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, zip_flush_list.head)
+	{
+		conn = ptr->data;
+		left = conn->flush_delay -
+			((now->tv_sec - conn->flush_time.tv_sec) * 1000 +
+			 (now->tv_usec - conn->flush_time.tv_usec) / 1000);
+		if(left > 0)
+		{
+			if(wait < 0 || left < wait)
+				wait = left;
+			continue;
+		}
+
+		zip_flush(conn);
+		conn_mod_write_sendq(conn->mod_fd, conn);
+	}
+	return wait;
+}
+
+#ifdef USE_SPLICE
+/*
+ * conn_splice - move up to a buffer's worth of data from one socket to
+ * another through splice_pipe.
+ *
+ * returns what was taken from the source, or the splice() error.  if
+ * the destination would not take all of it, the rest is read back into
+ * inbuf and *left says how much of it there is, the caller queues it.
+ */
+static ssize_t
+conn_splice(rb_fde_t *from, rb_fde_t *to, size_t *left)
+{
+	ssize_t len, ret;
+	size_t out = 0;
+
+	*left = 0;
+	len = splice(rb_get_fd(from), NULL, splice_pipe[1], NULL, sizeof(inbuf),
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if(len <= 0)
+		return len;
+
+	while(out < (size_t)len)
+	{
+		ret = splice(splice_pipe[0], NULL, rb_get_fd(to), NULL, len - out,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(ret <= 0)
+			break;
+		out += ret;
+	}
+
+	while(out + *left < (size_t)len)
+	{
+		ret = read(splice_pipe[0], inbuf + *left, len - out - *left);
+		if(ret <= 0)
+			break;
+		*left += ret;
+	}
+	return len;
+}
+#endif
+
+/*
+ * conn_setup_ktls - see whether the kernel took the session over after
+ * the handshake, and if so start splicing whatever it handles
+ */
+static void
+conn_setup_ktls(conn_t * conn)
+{
+#ifdef USE_SPLICE
+	int ktls = rb_ssl_ktls(conn->mod_fd);
+
+	if(ktls == 0)
+		return;
+
+	if(splice_pipe[0] == -1 && pipe2(splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		splice_pipe[0] = splice_pipe[1] = -1;
+		return;
+	}
+
+	if(ktls & RB_SSL_KTLS_SEND)
+		SetKTLSTX(conn);
+	if(ktls & RB_SSL_KTLS_RECV)
+		SetKTLSRX(conn);
+#endif
+}
+
 static int
 plain_check_cork(conn_t * conn)
 {
@@ -514,7 +871,33 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 		if(IsDead(conn))
 			return;
 
-		length = rb_read(conn->plain_fd, inbuf, sizeof(inbuf));
+#ifdef USE_SPLICE
+		if(IsKTLSTX(conn) && rb_rawbuf_length(conn->modbuf_out) == 0
+		   && !IsSSLWWantsR(conn))
+		{
+			size_t left;
+
+			length = conn_splice(conn->plain_fd, conn->mod_fd, &left);
+			if(length > 0)
+			{
+				conn->plain_in += length;
+				conn->mod_out += length - left;
+				if(left > 0)
+					conn_mod_write(conn, inbuf, left);
+				if(plain_check_cork(conn))
+					return;
+				continue;
+			}
+			/* the kernel won't splice this one, go back to copying */
+			if(length < 0 && !rb_ignore_errno(errno))
+			{
+				ClearKTLSTX(conn);
+				continue;
+			}
+		}
+		else
+#endif
+			length = rb_read(conn->plain_fd, inbuf, sizeof(inbuf));
 
 		if(length == 0 || (length < 0 && !rb_ignore_errno(errno)))
 		{
@@ -531,8 +914,9 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 		conn->plain_in += length;
 
 #ifdef HAVE_ZLIB
-		if(IsZip(conn))
-			common_zlib_deflate(conn, inbuf, length);
+		/* zstd links are only built with zlib */
+		if(IsZip(conn) || IsZstd(conn))
+			zip_compress(conn, inbuf, length);
 		else
 #endif
 			conn_mod_write(conn, inbuf, length);
@@ -595,6 +979,37 @@ conn_mod_read_cb(rb_fde_t *fd, void *data)
 		if(IsDead(conn))
 			return;
 
+#ifdef USE_SPLICE
+		/* a record that isn't application data makes splice() fail,
+		 * SSL_read() below deals with those
+		 */
+		if(IsKTLSRX(conn) && rb_rawbuf_length(conn->plainbuf_out) == 0)
+		{
+			size_t left;
+
+			length = conn_splice(conn->mod_fd, conn->plain_fd, &left);
+			if(length > 0)
+			{
+				conn->mod_in += length;
+				conn->plain_out += length - left;
+				if(left > 0)
+					conn_plain_write(conn, inbuf, left);
+				continue;
+			}
+			if(length == 0)
+			{
+				close_conn(conn, WAIT_PLAIN, "%s", remote_closed);
+				return;
+			}
+			if(rb_ignore_errno(errno))
+			{
+				rb_setselect(conn->mod_fd, RB_SELECT_READ, conn_mod_read_cb, conn);
+				conn_plain_write_sendq(conn->plain_fd, conn);
+				return;
+			}
+		}
+#endif
+
 		length = rb_read(conn->mod_fd, inbuf, sizeof(inbuf));
 
 		if(length == 0 || (length < 0 && !rb_ignore_errno(errno)))
@@ -626,6 +1041,11 @@ conn_mod_read_cb(rb_fde_t *fd, void *data)
 			return;
 		}
 		conn->mod_in += length;
+#ifdef HAVE_ZSTD
+		if(IsZstd(conn))
+			common_zstd_decompress(conn, inbuf, length);
+		else
+#endif
 #ifdef HAVE_ZLIB
 		if(IsZip(conn))
 			common_zlib_inflate(conn, inbuf, length);
@@ -681,6 +1101,7 @@ ssl_process_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen
 	conn_t *conn = data;
 	if(status == RB_OK)
 	{
+		conn_setup_ktls(conn);
 		conn_mod_read_cb(conn->mod_fd, conn);
 		conn_plain_read_cb(conn->plain_fd, conn);
 		return;
@@ -696,6 +1117,7 @@ ssl_process_connect_cb(rb_fde_t *F, int status, void *data)
 	conn_t *conn = data;
 	if(status == RB_OK)
 	{
+		conn_setup_ktls(conn);
 		conn_mod_read_cb(conn->mod_fd, conn);
 		conn_plain_read_cb(conn->plain_fd, conn);
 	}
@@ -785,15 +1207,43 @@ process_stats(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 	if(conn == NULL)
 		return;
 
-	rb_snprintf(outstat, sizeof(outstat), "S %s %llu %llu %llu %llu", odata,
-		    conn->plain_out, conn->mod_in, conn->plain_in, conn->mod_out);
+	rb_snprintf(outstat, sizeof(outstat), "S %s %llu %llu %llu %llu %llu", odata,
+		    conn->plain_out, conn->mod_in, conn->plain_in, conn->mod_out,
+		    conn->mod_blocks);
 	conn->plain_out = 0;
 	conn->plain_in = 0;
 	conn->mod_in = 0;
 	conn->mod_out = 0;
+	conn->mod_blocks = 0;
 	mod_cmd_write_queue(ctl, outstat, strlen(outstat) + 1);	/* +1 is so we send the \0 as well */
 }
 
+/* 
+ * report our handshake totals, ircd works out the resumption rate
+ */
+static void
+process_ssl_stats(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	char outstat[96];
+	unsigned long handshakes, resumed, cpu_ms = 0;
+	struct rusage ru;
+
+#ifdef USE_THREADS
+	if(workers != NULL)
+		worker_session_stats(&handshakes, &resumed);
+	else
+#endif
+		rb_ssl_session_stats(&handshakes, &resumed);
+
+	/* cpu time used so far, the ircd balances new connections on it */
+	if(getrusage(RUSAGE_SELF, &ru) == 0)
+		cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+			(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+
+	rb_snprintf(outstat, sizeof(outstat), "s %lu %lu %lu", handshakes, resumed, cpu_ms);
+	mod_cmd_write_queue(ctl, outstat, strlen(outstat) + 1);
+}
+
 static void
 change_connid(mod_ctl_t *ctl, mod_ctl_buf_t *ctlb)
 {
@@ -806,6 +1256,23 @@ change_connid(mod_ctl_t *ctl, mod_ctl_buf_t *ctlb)
 	conn->id = newid;
 }
 
+/*
+ * flush policy for a compressed link, sent after the Z or X for it:
+ * F[id int32][bytes int32][milliseconds uint16]
+ */
+static void
+set_flush_policy(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	conn_t *conn = conn_find_by_id(buf_to_int32(&ctlb->buf[1]));
+	int32_t size = buf_to_int32(&ctlb->buf[5]);
+
+	if(conn == NULL || size < 0)
+		return;
+
+	conn->flush_size = size;
+	conn->flush_delay = buf_to_uint16(&ctlb->buf[9]);
+}
+
 #ifdef HAVE_ZLIB
 
 static void
@@ -866,6 +1333,100 @@ zlib_process(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 }
 #endif
 
+#ifdef HAVE_ZSTD
+/*
+ * X - start a zstd link, same layout as Z with one more byte saying
+ * whether to use the dictionary
+ */
+static void
+zstd_process(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	size_t hdr = (sizeof(uint8_t) * 3) + sizeof(int32_t);
+	zstd_stream_t *stream;
+	conn_t *conn;
+	int level, use_dict;
+
+	conn = make_conn(ctl, ctlb->F[0], ctlb->F[1]);
+	if(rb_get_type(conn->mod_fd) == RB_FD_UNKNOWN)
+		rb_set_type(conn->mod_fd, RB_FD_SOCKET);
+
+	if(rb_get_type(conn->plain_fd) == RB_FD_UNKNOWN)
+		rb_set_type(conn->plain_fd, RB_FD_SOCKET);
+
+	conn_add_id_hash(conn, buf_to_int32(&ctlb->buf[1]));
+
+	level = (uint8_t)ctlb->buf[5];
+	use_dict = ctlb->buf[6];
+
+	SetZstd(conn);
+	conn->stream = stream = rb_malloc(sizeof(zstd_stream_t));
+	stream->cctx = ZSTD_createCCtx();
+	stream->dctx = ZSTD_createDCtx();
+	if(stream->cctx == NULL || stream->dctx == NULL)
+	{
+		close_conn(conn, WAIT_PLAIN, "Unable to set up zstd contexts");
+		return;
+	}
+
+	if(level < 1 || level > ZSTD_maxCLevel())
+		level = 3;
+	ZSTD_CCtx_setParameter(stream->cctx, ZSTD_c_compressionLevel, level);
+	ZSTD_CCtx_setParameter(stream->cctx, ZSTD_c_windowLog, ZSTD_LINK_WINDOWLOG);
+
+	if(use_dict)
+	{
+		if(zstd_dict == NULL)
+		{
+			close_conn(conn, WAIT_PLAIN, "zstd dictionary not loaded");
+			return;
+		}
+		ZSTD_CCtx_loadDictionary(stream->cctx, zstd_dict, zstd_dict_len);
+		ZSTD_DCtx_loadDictionary(stream->dctx, zstd_dict, zstd_dict_len);
+	}
+
+	if(ctlb->buflen > hdr)
+		common_zstd_decompress(conn, &ctlb->buf[hdr], ctlb->buflen - hdr);
+
+	conn_mod_read_cb(conn->mod_fd, conn);
+	conn_plain_read_cb(conn->plain_fd, conn);
+}
+
+/*
+ * x - (re)load the dictionary for zstd links started from now on, links
+ * that are up keep their own copy
+ */
+static void
+zstd_load_dict(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	const char *path = &ctlb->buf[1];
+	struct stat st;
+	int fd;
+
+	rb_free(zstd_dict);
+	zstd_dict = NULL;
+	zstd_dict_len = 0;
+
+	if(ctlb->buflen < 2 || ctlb->buf[ctlb->buflen - 1] != '\0' || *path == '\0')
+		return;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return;
+
+	if(fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= 1024 * 1024)
+	{
+		zstd_dict = rb_malloc(st.st_size);
+		if(read(fd, zstd_dict, st.st_size) == st.st_size)
+			zstd_dict_len = st.st_size;
+		else
+		{
+			rb_free(zstd_dict);
+			zstd_dict = NULL;
+		}
+	}
+	close(fd);
+}
+#endif
+
 static void
 init_prng(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 {
@@ -901,6 +1462,18 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 	}
 }
 
+static void
+ssl_new_ticket_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
+{
+	rb_ssl_set_ticket_keys((uint8_t *)&ctl_buf->buf[1], RB_SSL_TICKET_KEYS);
+}
+
+static void
+ssl_set_ktls(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
+{
+	rb_ssl_set_ktls(ctl_buf->buf[1] == '1');
+}
+
 static void
 send_nossl_support(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 {
@@ -1003,6 +1576,34 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 		case 'I':
 			init_prng(ctl, ctl_buf);
 			break;
+		case 'T':
+			{
+				if(ctl_buf->buflen < 2)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				if(ssl_ok)
+					ssl_set_ktls(ctl, ctl_buf);
+				break;
+			}
+		case 'k':
+			{
+				if(ctl_buf->buflen != 1 + RB_SSL_TICKET_KEYS * RB_SSL_TICKET_KEYLEN)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				if(ssl_ok)
+					ssl_new_ticket_keys(ctl, ctl_buf);
+				break;
+			}
+		case 's':
+			{
+				if(ssl_ok)
+					process_ssl_stats(ctl, ctl_buf);
+				break;
+			}
 		case 'S':
 			{
 				process_stats(ctl, ctl_buf);
@@ -1013,6 +1614,16 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				change_connid(ctl, ctl_buf);
 				break;
 			}
+		case 'F':
+			{
+				if(ctl_buf->buflen != 11)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				set_flush_policy(ctl, ctl_buf);
+				break;
+			}
 
 #ifdef HAVE_ZLIB
 		case 'Z':
@@ -1033,6 +1644,25 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 			send_nozlib_support(ctl, ctl_buf);
 			break;
 
+#endif
+#ifdef HAVE_ZSTD
+		case 'X':
+			{
+				if (ctl_buf->nfds != 2 || ctl_buf->buflen < 7)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				zstd_process(ctl, ctl_buf);
+				break;
+			}
+		case 'x':
+			zstd_load_dict(ctl, ctl_buf);
+			break;
+#else
+		case 'X':
+			send_nozlib_support(ctl, ctl_buf);
+			break;
 #endif
 		default:
 			break;
@@ -1081,7 +1711,14 @@ mod_read_ctl(rb_fde_t *F, void *data)
 	if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
 		exit(0);
 
-	mod_process_cmd_recv(ctl);
+#ifdef USE_THREADS
+	if(ctl->worker != NULL)
+		main_worker_recv(ctl->worker);
+	else if(workers != NULL)
+		main_cmd_recv(ctl);
+	else
+#endif
+		mod_process_cmd_recv(ctl);
 	rb_setselect(ctl->F, RB_SELECT_READ, mod_read_ctl, ctl);
 }
 
@@ -1130,10 +1767,361 @@ read_pipe_ctl(rb_fde_t *F, void *data)
 
 }
 
+#ifdef USE_THREADS
+#define route_hash(x)	(&route_hash_table[(x % CONN_HASH_SIZE)])
+
+/* which worker a connection id went to, kept by the main thread */
+typedef struct _route
+{
+	rb_dlink_node node;
+	int32_t id;
+	worker_t *worker;
+} route_t;
+
+static rb_dlink_list route_hash_table[CONN_HASH_SIZE];
+static int keys_invalid;	/* a worker turned down the keys since the last K */
+
+static route_t *
+route_find(int32_t id)
+{
+	rb_dlink_node *ptr;
+	route_t *route;
+
+	if(id < 0)
+		return NULL;
+
+	RB_DLINK_FOREACH(ptr, (route_hash(id))->head)
+	{
+		route = ptr->data;
+		if(route->id == id)
+			return route;
+	}
+	return NULL;
+}
+
+/* 
+ * ids are the ircd's fds, a connection closed without a D keeps its
+ * entry until the id is given to a new one, which takes it over
+ */
+static void
+route_add(int32_t id, worker_t * w)
+{
+	route_t *route;
+
+	if(id < 0)
+		return;
+
+	if((route = route_find(id)) == NULL)
+	{
+		route = rb_malloc(sizeof(route_t));
+		route->id = id;
+		rb_dlinkAdd(route, &route->node, route_hash(id));
+	}
+	route->worker = w;
+}
+
+static void
+route_del(route_t * route)
+{
+	rb_dlinkDelete(&route->node, route_hash(route->id));
+	rb_free(route);
+}
+
+/*
+ * which_worker - pick the worker for a new connection, the same way the
+ * ircd picks an ssld: by the cpu time each used over the last second,
+ * with connections given out since then added at the average cost of
+ * one, and the fewest connections when there is no load to go by
+ */
+static worker_t *
+which_worker(void)
+{
+	worker_t *w, *lowest = NULL;
+	unsigned long total_load = 0, cost;
+	long load, lowest_load = 0;
+	int total_conns = 0, i;
+
+	for(i = 0; i < worker_count; i++)
+	{
+		total_load += workers[i].load;
+		total_conns += workers[i].poll_conns;
+	}
+	cost = total_conns ? total_load / total_conns : 0;
+
+	for(i = 0; i < worker_count; i++)
+	{
+		w = &workers[i];
+		load = (long)w->load + (long)w->handed * (long)cost;
+		if(lowest == NULL || load < lowest_load
+		   || (load == lowest_load
+		       && w->poll_conns + w->handed < lowest->poll_conns + lowest->handed))
+		{
+			lowest = w;
+			lowest_load = load;
+		}
+	}
+	lowest->handed++;
+	return lowest;
+}
+
+static void
+sample_workers(void *unused)
+{
+#ifdef USE_THREAD_CPUTIME
+	struct timespec ts;
+	unsigned long long cpu_us;
+#endif
+	worker_t *w;
+	int i;
+
+	for(i = 0; i < worker_count; i++)
+	{
+		w = &workers[i];
+#ifdef USE_THREAD_CPUTIME
+		if(w->has_clock && clock_gettime(w->clock, &ts) == 0)
+		{
+			cpu_us = (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+			w->load = cpu_us - w->cpu_us;
+			w->cpu_us = cpu_us;
+		}
+#endif
+		pthread_mutex_lock(&w->lock);
+		w->poll_conns = w->conns;
+		pthread_mutex_unlock(&w->lock);
+		w->handed = 0;
+	}
+}
+
+/* the workers' totals are up to a second old, near enough for STATS T */
+static void
+worker_session_stats(unsigned long *handshakes, unsigned long *resumed)
+{
+	worker_t *w;
+	int i;
+
+	*handshakes = *resumed = 0;
+	for(i = 0; i < worker_count; i++)
+	{
+		w = &workers[i];
+		pthread_mutex_lock(&w->lock);
+		*handshakes += w->handshakes;
+		*resumed += w->resumed;
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+/* hand a new connection, fds and all, to a worker */
+static void
+main_new_conn(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
+{
+	worker_t *w = which_worker();
+
+	route_add(buf_to_int32(&ctl_buf->buf[1]), w);
+	rb_dlinkDelete(&ctl_buf->node, &ctl->readq);
+	rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &w->ctl.writeq);
+	mod_write_ctl(w->ctl.F, &w->ctl);
+}
+
+/*
+ * main_cmd_recv - the main thread's side of the ircd's messages.  new
+ * connections go to a worker, messages about one follow it there and
+ * settings go to every worker.  the rest, the prng, ssl stats, and
+ * whatever a worker would only turn down, is left on the queue for
+ * mod_process_cmd_recv() as without workers.
+ */
+static void
+main_cmd_recv(mod_ctl_t * ctl)
+{
+	rb_dlink_node *ptr, *next;
+	mod_ctl_buf_t *ctl_buf;
+	route_t *route;
+	int i;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->readq.head)
+	{
+		ctl_buf = ptr->data;
+
+		switch (*ctl_buf->buf)
+		{
+		case 'A':
+		case 'C':
+			if(!ssl_ok || ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
+				continue;
+			main_new_conn(ctl, ctl_buf);
+			continue;
+#ifdef HAVE_ZLIB
+		case 'Z':
+#ifdef HAVE_ZSTD
+		case 'X':
+#endif
+			if(ctl_buf->nfds != 2 || ctl_buf->buflen < 6)
+				continue;
+			main_new_conn(ctl, ctl_buf);
+			continue;
+#endif
+		case 'K':
+			if(!ssl_ok)
+				continue;
+			keys_invalid = 0;
+			/* FALLTHROUGH */
+		case 'T':
+		case 'k':
+		case 'x':
+			for(i = 0; i < worker_count; i++)
+				mod_cmd_write_queue(&workers[i].ctl, ctl_buf->buf, ctl_buf->buflen);
+			break;
+		case 'S':
+		case 'F':
+		case 'Y':
+			if(ctl_buf->buflen < 5)
+				break;
+			if((route = route_find(buf_to_int32(&ctl_buf->buf[1]))) == NULL)
+				break;
+			mod_cmd_write_queue(&route->worker->ctl, ctl_buf->buf, ctl_buf->buflen);
+			/* after a Y the worker can't find it by id any more either */
+			if(*ctl_buf->buf == 'Y')
+				route_del(route);
+			break;
+		default:
+			continue;
+		}
+		rb_dlinkDelete(ptr, &ctl->readq);
+		rb_free(ctl_buf->buf);
+		rb_free(ctl_buf);
+	}
+	mod_process_cmd_recv(ctl);
+}
+
+/* main_worker_recv - pass what a worker says on to the ircd */
+static void
+main_worker_recv(worker_t * w)
+{
+	rb_dlink_node *ptr, *next;
+	mod_ctl_buf_t *ctl_buf;
+	route_t *route;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, w->ctl.readq.head)
+	{
+		ctl_buf = ptr->data;
+
+		/* unless the id has been given to a new connection meanwhile */
+		if(*ctl_buf->buf == 'D' && ctl_buf->buflen >= 5
+		   && (route = route_find(buf_to_int32(&ctl_buf->buf[1]))) != NULL
+		   && route->worker == w)
+			route_del(route);
+
+		/* every worker turns the same keys down, once is enough */
+		if(*ctl_buf->buf != 'I' || !keys_invalid)
+			mod_cmd_write_queue(mod_ctl, ctl_buf->buf, ctl_buf->buflen);
+		if(*ctl_buf->buf == 'I')
+			keys_invalid = 1;
+
+		rb_dlinkDelete(ptr, &w->ctl.readq);
+		rb_free(ctl_buf->buf);
+		rb_free(ctl_buf);
+	}
+}
+
+static void
+worker_report(void *unused)
+{
+	unsigned long handshakes = 0, resumed = 0;
+
+	if(ssl_ok)
+		rb_ssl_session_stats(&handshakes, &resumed);
+
+	pthread_mutex_lock(&self->lock);
+	self->conns = conn_count;
+	self->handshakes = handshakes;
+	self->resumed = resumed;
+	pthread_mutex_unlock(&self->lock);
+}
+
+static void *
+worker_main(void *data)
+{
+	sigset_t sigs;
+
+	/* signals are the main thread's business */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	self = data;
+	rb_lib_init(NULL, NULL, NULL, 0, maxconn(), 1024, 4096);
+	rb_init_rawbuffers(1024);
+	mod_ctl = rb_malloc(sizeof(mod_ctl_t));
+	mod_ctl->F = rb_open(self->fd, RB_FD_SOCKET, "ssld main thread socket");
+	rb_set_buffers(mod_ctl->F, READBUF_SIZE);
+	rb_set_nb(mod_ctl->F);
+	rb_event_addish("clean_dead_conns", clean_dead_conns, NULL, 10);
+	rb_event_add("check_handshake_flood", check_handshake_flood, NULL, 10);
+	rb_event_add("worker_report", worker_report, NULL, 1);
+	mod_read_ctl(mod_ctl->F, mod_ctl);
+	rb_lib_set_loop_cb(zip_flush_expired);
+	rb_lib_loop(0);
+	return NULL;
+}
+
+/*
+ * start_workers - start up to count worker threads.  if none start, the
+ * main thread keeps its connections itself as if none were asked for.
+ */
+static void
+start_workers(int count)
+{
+	worker_t *w;
+	int fds[2], i;
+
+	/* sigio's signals go to the process, not to a thread's loop */
+	if(!strcmp(rb_get_iotype(), "sigio"))
+		return;
+
+	workers = rb_malloc(sizeof(worker_t) * count);
+	for(i = 0; i < count; i++)
+	{
+		w = &workers[i];
+		if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1)
+			break;
+
+		w->fd = fds[1];
+		pthread_mutex_init(&w->lock, NULL);
+		if(pthread_create(&w->thread, NULL, worker_main, w) != 0)
+		{
+			pthread_mutex_destroy(&w->lock);
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+#ifdef USE_THREAD_CPUTIME
+		w->has_clock = pthread_getcpuclockid(w->thread, &w->clock) == 0;
+#endif
+		w->ctl.worker = w;
+		w->ctl.F = rb_open(fds[0], RB_FD_SOCKET, "ssld worker socket");
+		rb_set_buffers(w->ctl.F, READBUF_SIZE);
+		rb_set_nb(w->ctl.F);
+		worker_count++;
+	}
+
+	if(worker_count == 0)
+	{
+		rb_free(workers);
+		workers = NULL;
+		return;
+	}
+
+	for(i = 0; i < worker_count; i++)
+		mod_read_ctl(workers[i].ctl.F, &workers[i].ctl);
+	rb_event_add("sample_workers", sample_workers, NULL, 1);
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
 	const char *s_ctlfd, *s_pipe, *s_pid;
+#ifdef USE_THREADS
+	const char *s_threads;
+#endif
 	int ctlfd, pipefd, x, maxfd;
 	maxfd = maxconn();
 
@@ -1186,6 +2174,11 @@ main(int argc, char **argv)
 	rb_set_nb(mod_ctl->F_pipe);
 	rb_event_addish("clean_dead_conns", clean_dead_conns, NULL, 10);
 	rb_event_add("check_handshake_flood", check_handshake_flood, NULL, 10);
+#ifdef USE_THREADS
+	s_threads = getenv("SSLD_THREADS");
+	if(s_threads != NULL && atoi(s_threads) > 1 && (ssl_ok || zlib_ok))
+		start_workers(atoi(s_threads));
+#endif
 	read_pipe_ctl(mod_ctl->F_pipe, NULL);
 	mod_read_ctl(mod_ctl->F, mod_ctl);
 	if(!zlib_ok && !ssl_ok)
@@ -1201,6 +2194,7 @@ main(int argc, char **argv)
 		send_nozlib_support(mod_ctl, NULL);
 	if(!ssl_ok)
 		send_nossl_support(mod_ctl, NULL);
+	rb_lib_set_loop_cb(zip_flush_expired);
 	rb_lib_loop(0);
 	return 0;
 }
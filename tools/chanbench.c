@@ -0,0 +1,425 @@
+/*
+ *  chanbench: cost of a channel message against the size of the channel.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  chanbench links to a running ircd as a server and bursts a channel
+ *  of each size given, all its members behind the link.  A local client
+ *  joins each channel, then messages from one of the remote members go
+ *  to it.  The ircd only has the one local member to deliver to and
+ *  none of its links to send to, so what is left is the cost of working
+ *  that out, which sendto_channel_flags() keeps from growing with the
+ *  channel.  It prints the cpu time the ircd used per message, read
+ *  from /proc, so it has to run on the same host.
+ *
+ *  The ircd needs a connect block for the link and an auth block that
+ *  lets the client in without ident or flood limits, such as:
+ *
+ *	connect "bench.server" { host = "127.0.0.1"; send_password = "pw";
+ *		accept_password = "pw"; class = "server"; };
+ *	auth { user = "*@127.0.0.1"; class = "users";
+ *		flags = exceed_limit, flood_exempt; };
+ *
+ *  Each run needs a fresh ircd, the users it bursts stay behind.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_MESSAGES	20000
+#define BATCH			100
+#define MAXSIZES		32
+
+struct conn
+{
+	int fd;
+	int link;			/* answer PINGs as a server */
+	unsigned long counted;		/* lines with "benchmark" in them */
+	size_t len;
+	char buf[65536];
+};
+
+extern char *optarg;
+extern int optind;
+
+static const char *sid = "009Z";
+static pid_t ircd_pid;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "chanbench [-h host] [-p port] [-w password] [-s name] [-S sid]\n");
+	fprintf(stderr, "          [-m messages] -P pidfile [size ...]\n");
+	fprintf(stderr, "-h, -p Where the ircd listens [127.0.0.1 6667]\n");
+	fprintf(stderr, "-w, -s, -S The link's password, server name and SID [pw bench.server 009Z]\n");
+	fprintf(stderr, "-m Messages to each channel [%d]\n", DEFAULT_MESSAGES);
+	fprintf(stderr, "-P The ircd's pid file, its cpu time is measured\n");
+	fprintf(stderr, "size Members of each channel [100 1000 5000 20000]\n");
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* time on cpu in seconds, schedstat is in ns where there is one, stat
+ * only in clock ticks
+ */
+static double
+ircd_cpu(void)
+{
+	char path[64], buf[1024], *p;
+	unsigned long long ns, utime, stime;
+	FILE *in;
+	int ok;
+
+	snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)ircd_pid);
+	if((in = fopen(path, "r")) != NULL)
+	{
+		ok = fscanf(in, "%llu", &ns);
+		fclose(in);
+		if(ok == 1)
+			return ns / 1e9;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)ircd_pid);
+	if((in = fopen(path, "r")) == NULL || fgets(buf, sizeof(buf), in) == NULL ||
+	   (p = strrchr(buf, ')')) == NULL ||
+	   sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		  &utime, &stime) != 2)
+	{
+		fprintf(stderr, "Can't read the cpu time of %d\n", (int)ircd_pid);
+		exit(1);
+	}
+	fclose(in);
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void
+conn_send(struct conn *conn, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		if((n = send(conn->fd, data, len, 0)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "send: %s\n", strerror(errno));
+			exit(1);
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void
+conn_line(struct conn *conn, char *line)
+{
+	char pong[512];
+	char *p = line;
+
+	if(strstr(line, "benchmark") != NULL)
+	{
+		conn->counted++;
+		return;
+	}
+
+	/* skip a prefix */
+	if(*p == ':' && (p = strchr(p, ' ')) != NULL)
+		p++;
+	if(p == NULL || strncmp(p, "PING ", 5))
+		return;
+
+	if(conn->link)
+		snprintf(pong, sizeof(pong), ":%s PONG %s\r\n", sid, p + 5);
+	else
+		snprintf(pong, sizeof(pong), "PONG %s\r\n", p + 5);
+	conn_send(conn, pong, strlen(pong));
+}
+
+/* read and handle what the connections have for secs seconds */
+static void
+drain(struct conn **conns, int count, double secs)
+{
+	struct pollfd pfd[2];
+	double end = now() + secs;
+	char *line, *eol;
+	ssize_t n;
+	int i, left;
+
+	for(;;)
+	{
+		left = (int)((end - now()) * 1000);
+		if(left < 0)
+			left = 0;
+
+		for(i = 0; i < count; i++)
+		{
+			pfd[i].fd = conns[i]->fd;
+			pfd[i].events = POLLIN;
+		}
+		if(poll(pfd, count, left) <= 0)
+			return;
+
+		for(i = 0; i < count; i++)
+		{
+			if(!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			n = recv(conns[i]->fd, conns[i]->buf + conns[i]->len,
+				 sizeof(conns[i]->buf) - conns[i]->len - 1, 0);
+			if(n <= 0)
+			{
+				fprintf(stderr, "The ircd closed a connection\n");
+				exit(1);
+			}
+			conns[i]->len += n;
+			conns[i]->buf[conns[i]->len] = '\0';
+
+			for(line = conns[i]->buf; (eol = strpbrk(line, "\r\n")) != NULL;
+			    line = eol + 1)
+			{
+				*eol = '\0';
+				if(*line != '\0')
+					conn_line(conns[i], line);
+			}
+			conns[i]->len -= line - conns[i]->buf;
+			memmove(conns[i]->buf, line, conns[i]->len);
+		}
+	}
+}
+
+static struct conn *
+conn_open(const char *host, int port, int link)
+{
+	struct sockaddr_in addr;
+	struct conn *conn;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+	{
+		fprintf(stderr, "%s is not an IPv4 address\n", host);
+		exit(1);
+	}
+
+	conn = calloc(1, sizeof(struct conn));
+	conn->link = link;
+	if((conn->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	   connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		fprintf(stderr, "Can't connect to %s/%d: %s\n", host, port, strerror(errno));
+		exit(1);
+	}
+	return conn;
+}
+
+/* "<sid>" and 5 more letters and digits */
+static void
+make_uid(char *buf, size_t size, unsigned int n)
+{
+	static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+	snprintf(buf, size, "%s%c%c%c%c%c", sid, chars[n / (36 * 36 * 36 * 36) % 26],
+		 chars[n / (36 * 36 * 36) % 36], chars[n / (36 * 36) % 36],
+		 chars[n / 36 % 36], chars[n % 36]);
+}
+
+/* the members of a channel, the first of them sends the messages */
+static void
+burst_channel(struct conn *link, const char *chname, unsigned int size, unsigned int *next,
+	      char *sender, size_t senderlen)
+{
+	char line[512], uid[16];
+	size_t len = 0;
+	unsigned int i, n;
+
+	for(i = 0; i < size; i++)
+	{
+		n = (*next)++;
+		make_uid(uid, sizeof(uid), n);
+		if(i == 0)
+			snprintf(sender, senderlen, "%s", uid);
+
+		snprintf(line, sizeof(line),
+			 ":%s UID b%u 1 1700000000 +i u h%u.example 10.%u.%u.%u %s :bench\r\n",
+			 sid, n, n, (n >> 16) & 255, (n >> 8) & 255, n & 255, uid);
+		conn_send(link, line, strlen(line));
+	}
+
+	/* SJOIN the lot, a few to a line */
+	n = *next - size;
+	for(i = 0; i < size; i++)
+	{
+		if(len == 0)
+			len = snprintf(line, sizeof(line), ":%s SJOIN 1700000000 %s +nt :", sid,
+				       chname);
+		make_uid(uid, sizeof(uid), n + i);
+		len += snprintf(line + len, sizeof(line) - len, "%s ", uid);
+		if(len > 400 || i == size - 1)
+		{
+			line[len - 1] = '\0';
+			strcat(line, "\r\n");
+			conn_send(link, line, strlen(line));
+			len = 0;
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *host = "127.0.0.1", *password = "pw", *name = "bench.server";
+	const char *pidfile = NULL;
+	unsigned int sizes[MAXSIZES] = { 100, 1000, 5000, 20000 };
+	char senders[MAXSIZES][16], chname[32], line[512], batch[BATCH * 128];
+	struct conn *link, *client, *both[2];
+	unsigned int nsizes = 4, next = 0, messages = DEFAULT_MESSAGES, i, b;
+	unsigned long want;
+	size_t batchlen;
+	double start, cpu;
+	int port = 6667, c;
+	FILE *in;
+
+	while((c = getopt(argc, argv, "h:p:w:s:S:m:P:")) != -1)
+	{
+		switch (c)
+		{
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'w':
+			password = optarg;
+			break;
+		case 's':
+			name = optarg;
+			break;
+		case 'S':
+			sid = optarg;
+			break;
+		case 'm':
+			messages = atoi(optarg);
+			break;
+		case 'P':
+			pidfile = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(pidfile == NULL || messages < BATCH || strlen(sid) != 4)
+		usage();
+
+	if(optind < argc)
+	{
+		for(nsizes = 0; optind < argc && nsizes < MAXSIZES; optind++)
+		{
+			if((sizes[nsizes++] = atoi(argv[optind])) == 0)
+				usage();
+		}
+	}
+
+	if((in = fopen(pidfile, "r")) == NULL || fscanf(in, "%d", &c) != 1)
+	{
+		fprintf(stderr, "Can't read a pid from %s\n", pidfile);
+		exit(1);
+	}
+	fclose(in);
+	ircd_pid = c;
+
+	link = conn_open(host, port, 1);
+	snprintf(line, sizeof(line), "PASS %s TS 6 :%s\r\n"
+		 "CAPAB :QS EX CHW IE KNOCK TB ENCAP SAVE IRCNET\r\n"
+		 "SERVER %s 1 :chanbench\r\nSVINFO 6 6 0 :%ld\r\n",
+		 password, sid, name, (long)time(NULL));
+	conn_send(link, line, strlen(line));
+	drain(&link, 1, 1);
+
+	for(i = 0; i < nsizes; i++)
+	{
+		snprintf(chname, sizeof(chname), "#bench%u", sizes[i]);
+		burst_channel(link, chname, sizes[i], &next, senders[i], sizeof(senders[i]));
+	}
+	snprintf(line, sizeof(line), ":%s EOB\r\n", sid);
+	conn_send(link, line, strlen(line));
+	drain(&link, 1, 2);
+
+	client = conn_open(host, port, 0);
+	snprintf(line, sizeof(line), "NICK chanbench\r\nUSER u 0 * :chanbench\r\n");
+	conn_send(client, line, strlen(line));
+	both[0] = link;
+	both[1] = client;
+	drain(both, 2, 1);
+	for(i = 0; i < nsizes; i++)
+	{
+		snprintf(line, sizeof(line), "JOIN #bench%u\r\n", sizes[i]);
+		conn_send(client, line, strlen(line));
+	}
+	drain(both, 2, 2);
+
+	printf("%-10s %10s %10s %10s\n", "members", "messages", "delivered", "us/msg");
+	for(i = 0; i < nsizes; i++)
+	{
+		batchlen = 0;
+		for(b = 0; b < BATCH; b++)
+			batchlen += snprintf(batch + batchlen, sizeof(batch) - batchlen,
+					     ":%s PRIVMSG #bench%u :benchmark line with some text in it\r\n",
+					     senders[i], sizes[i]);
+
+		client->counted = 0;
+		want = messages / BATCH * BATCH;
+		cpu = ircd_cpu();
+		for(b = 0; b < messages / BATCH; b++)
+		{
+			conn_send(link, batch, batchlen);
+			drain(both, 2, 0.005);
+		}
+		start = now();
+		while(client->counted < want && now() - start < 5)
+			drain(both, 2, 0.1);
+		cpu = ircd_cpu() - cpu;
+
+		printf("%-10u %10lu %10lu %10.2f\n", sizes[i], want, client->counted,
+		       cpu * 1e6 / want);
+	}
+
+	close(client->fd);
+	close(link->fd);
+	free(client);
+	free(link);
+	return 0;
+}
@@ -0,0 +1,462 @@
+/*
+ *  hashbench: SipHash-1-3 against FNV on nick, channel and host names.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  Each corpus is hashed with the function the tables in hash.c use for
+ *  it and with the FNV hash they used before.  For each we print the
+ *  time per name over the whole corpus and over 1000 names that stay in
+ *  cache, how many distinct names share a full 32 bit hash, and how the
+ *  names spread over tables sized the way hash.c sizes them: chi^2 per
+ *  degree of freedom (about 1.0 for a uniform spread) and the fullest
+ *  home slot.
+ *
+ *  The corpora are made up unless files with one name per line are
+ *  given.  Names that are equal under irccmp() have to hash the same, a
+ *  mismatch makes the exit status 1.
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "match.h"
+#include "hash.h"
+
+#define DEFAULT_COUNT	100000
+#define HOT_NAMES	1000
+
+/* as in hash.c */
+#define HASH_HOME(hashv, bits) (((uint32_t)(hashv) * 0x9E3779B9U) >> (32 - (bits)))
+
+typedef uint32_t hashfunc(const unsigned char *, unsigned int, unsigned int);
+
+struct corpus
+{
+	const char *name;
+	char **names;
+	unsigned int count;
+	unsigned int hashlen;
+	hashfunc *func;
+	const char *funcname;
+	hashfunc *fnv;			/* what the table used before */
+};
+
+extern char *optarg;
+
+static const char *syllables[] = {
+	"ka", "ri", "to", "mon", "ze", "lu", "dar", "in", "ex", "bot", "ne", "o",
+	"the", "sh", "ad", "ow", "ma", "rk", "ji", "pe", "ter", "ch", "ris", "an"
+};
+#define NSYLLABLES (sizeof(syllables) / sizeof(syllables[0]))
+
+static void
+usage(void)
+{
+	fprintf(stderr, "hashbench [-c count] [-n nickfile] [-C chanfile] [-H hostfile]\n");
+	fprintf(stderr, "-c Names in each made up corpus [%d]\n", DEFAULT_COUNT);
+	fprintf(stderr, "-n, -C, -H Read a corpus from a file, one name per line\n");
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+make_word(char *buf, int syl)
+{
+	char *p = buf;
+	int i;
+
+	for(i = 0; i < syl; i++)
+		p += sprintf(p, "%s", syllables[rand() % NSYLLABLES]);
+	return p;
+}
+
+/* nicks: words with digits and the usual decorations, plus a run of
+ * Guest nicks that only differ in their number
+ */
+static void
+make_nicks(struct corpus *c, unsigned int count)
+{
+	static const char *deco[] = { "", "_", "^", "|away", "`", "[m]", "-" };
+	char buf[64], *p;
+	unsigned int i;
+
+	c->names = rb_malloc(sizeof(char *) * count);
+	for(i = 0; i < count; i++)
+	{
+		if(i % 5 == 0)
+			rb_snprintf(buf, sizeof(buf), "Guest%u", 10000 + i);
+		else
+		{
+			p = make_word(buf, 1 + rand() % 3);
+			if(rand() % 2)
+				p += sprintf(p, "%d", rand() % 10000);
+			strcpy(p, deco[rand() % 7]);
+			if(rand() % 3 == 0)
+				buf[0] = ToUpper(buf[0]);
+		}
+		buf[NICKLEN - 1] = '\0';
+		c->names[i] = rb_strdup(buf);
+	}
+	c->count = count;
+}
+
+static void
+make_channels(struct corpus *c, unsigned int count)
+{
+	char buf[64], *p;
+	unsigned int i;
+
+	c->names = rb_malloc(sizeof(char *) * count);
+	for(i = 0; i < count; i++)
+	{
+		switch (i % 4)
+		{
+		case 0:
+			rb_snprintf(buf, sizeof(buf), "#chan%u", i);
+			break;
+		case 1:
+			/* '!' channels hash past their id */
+			p = buf + rb_snprintf(buf, sizeof(buf), "!%05X", rand() & 0xfffff);
+			make_word(p, 1 + rand() % 3);
+			break;
+		default:
+			buf[0] = (i % 8 == 2) ? '&' : '#';
+			p = make_word(buf + 1, 1 + rand() % 4);
+			if(rand() % 2)
+				sprintf(p, "-%s", syllables[rand() % NSYLLABLES]);
+			break;
+		}
+		c->names[i] = rb_strdup(buf);
+	}
+	c->count = count;
+}
+
+static void
+make_hosts(struct corpus *c, unsigned int count)
+{
+	char buf[128], word[64];
+	unsigned int i, a, b, d, e;
+
+	c->names = rb_malloc(sizeof(char *) * count);
+	for(i = 0; i < count; i++)
+	{
+		a = 1 + rand() % 223;
+		b = rand() % 256;
+		d = rand() % 256;
+		e = 1 + rand() % 254;
+		make_word(word, 1 + rand() % 2);
+		switch (i % 4)
+		{
+		case 0:
+			rb_snprintf(buf, sizeof(buf), "%u.%u.%u.%u", a, b, d, e);
+			break;
+		case 1:
+			rb_snprintf(buf, sizeof(buf), "ip-%u-%u-%u-%u.%s.example.net", a, b, d,
+				    e, word);
+			break;
+		case 2:
+			rb_snprintf(buf, sizeof(buf), "%s%u.dyn.%s.org", word, i, syllables[i % NSYLLABLES]);
+			break;
+		default:
+			rb_snprintf(buf, sizeof(buf), "2001:db8:%x:%x::%x", b, d, e);
+			break;
+		}
+		c->names[i] = rb_strdup(buf);
+	}
+	c->count = count;
+}
+
+static void
+load_corpus(struct corpus *c, const char *file)
+{
+	char buf[BUFSIZE], *p;
+	unsigned int alloc = 1024;
+	FILE *in;
+
+	if((in = fopen(file, "r")) == NULL)
+	{
+		fprintf(stderr, "Can't open %s: %s\n", file, strerror(errno));
+		exit(1);
+	}
+
+	c->names = rb_malloc(sizeof(char *) * alloc);
+	c->count = 0;
+	while(fgets(buf, sizeof(buf), in) != NULL)
+	{
+		if((p = strpbrk(buf, "\r\n")) != NULL)
+			*p = '\0';
+		if(buf[0] == '\0')
+			continue;
+		if(c->count == alloc)
+		{
+			alloc *= 2;
+			c->names = rb_realloc(c->names, sizeof(char *) * alloc);
+		}
+		c->names[c->count++] = rb_strdup(buf);
+	}
+	fclose(in);
+
+	if(c->count == 0)
+	{
+		fprintf(stderr, "%s has no names in it\n", file);
+		exit(1);
+	}
+}
+
+/* what the old fnv_hash_channel() did */
+static uint32_t
+fnv_channel(const unsigned char *s, unsigned int bits, unsigned int len)
+{
+	if(s[0] == '!' && strlen((const char *)s) > CHIDLEN + 1)
+		s += CHIDLEN + 1;
+	return fnv_hash_upper_len(s, bits, len);
+}
+
+static int
+cmp_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static struct corpus *sorting;
+
+/* the part of a name the hash looks at: past the id of a '!' channel,
+ * and no further than hashlen
+ */
+static int
+cmp_hashed(const void *a, const void *b)
+{
+	const char *x = *(const char *const *)a, *y = *(const char *const *)b;
+
+	if(sorting->func == siphash_channel)
+	{
+		if(x[0] == '!' && strlen(x) > CHIDLEN + 1)
+			x += CHIDLEN + 1;
+		if(y[0] == '!' && strlen(y) > CHIDLEN + 1)
+			y += CHIDLEN + 1;
+	}
+	if(sorting->hashlen != 0)
+		return ircncmp(x, y, sorting->hashlen);
+	return irccmp(x, y);
+}
+
+/* names the hash can't tell apart by design would count as collisions,
+ * keep one of each
+ */
+static void
+unique(struct corpus *c)
+{
+	unsigned int i, n = 0;
+
+	sorting = c;
+	qsort(c->names, c->count, sizeof(char *), cmp_hashed);
+	for(i = 0; i < c->count; i++)
+	{
+		if(n > 0 && cmp_hashed(&c->names[i], &c->names[n - 1]) == 0)
+		{
+			rb_free(c->names[i]);
+			continue;
+		}
+		c->names[n++] = c->names[i];
+	}
+	c->count = n;
+}
+
+static unsigned int
+full_collisions(struct corpus *c, hashfunc *func)
+{
+	uint32_t *hv = rb_malloc(sizeof(uint32_t) * c->count);
+	unsigned int i, dup = 0;
+
+	for(i = 0; i < c->count; i++)
+		hv[i] = func((const unsigned char *)c->names[i], 32, c->hashlen);
+
+	qsort(hv, c->count, sizeof(uint32_t), cmp_uint32);
+	for(i = 1; i < c->count; i++)
+	{
+		if(hv[i] == hv[i - 1])
+			dup++;
+	}
+	rb_free(hv);
+	return dup;
+}
+
+/* how the names land on their home slots, as HASH_HOME() puts them */
+static void
+spread(struct corpus *c, hashfunc *func, unsigned int bits, double *chi, unsigned int *most)
+{
+	unsigned int size = 1U << bits;
+	unsigned int *load = rb_malloc(sizeof(unsigned int) * size);
+	double expect = (double)c->count / size;
+	unsigned int i;
+
+	for(i = 0; i < c->count; i++)
+		load[HASH_HOME(func((const unsigned char *)c->names[i], 32, c->hashlen), bits)]++;
+
+	*chi = 0;
+	*most = 0;
+	for(i = 0; i < size; i++)
+	{
+		*chi += (load[i] - expect) * (load[i] - expect) / expect;
+		if(load[i] > *most)
+			*most = load[i];
+	}
+	*chi /= size - 1;
+	rb_free(load);
+}
+
+static double
+time_hash(struct corpus *c, hashfunc *func, unsigned int count, unsigned int rounds)
+{
+	volatile uint32_t sink = 0;
+	double start;
+	unsigned int r, i;
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+	{
+		for(i = 0; i < count; i++)
+			sink += func((const unsigned char *)c->names[i], 32, c->hashlen);
+	}
+	(void)sink;
+	return (now() - start) * 1e9 / ((double)rounds * count);
+}
+
+static void
+run_corpus(struct corpus *c)
+{
+	hashfunc *funcs[2] = { c->func, c->fnv };
+	const char *names[2] = { c->funcname, "fnv" };
+	unsigned int bits, most, hot, f;
+	double chi;
+
+	unique(c);
+	hot = c->count < HOT_NAMES ? c->count : HOT_NAMES;
+
+	/* the size hash.c would have grown the table to, it doubles when
+	 * 3/4 full
+	 */
+	for(bits = 4; (1U << bits) * 3 / 4 < c->count; bits++)
+		;
+
+	printf("%s: %u distinct names in %u slots\n", c->name, c->count, 1U << bits);
+	for(f = 0; f < 2; f++)
+	{
+		spread(c, funcs[f], bits, &chi, &most);
+		printf("  %-16s %6.1f ns/name %6.1f hot  32 bit collisions %-4u"
+		       "  chi2/df %.3f  fullest home %u\n", names[f],
+		       time_hash(c, funcs[f], c->count, 10),
+		       time_hash(c, funcs[f], hot, 4000000 / hot),
+		       full_collisions(c, funcs[f]), chi, most);
+	}
+}
+
+/* every name has to hash the same with its letters in any case, the
+ * way irccmp() folds them with ToUpper()
+ */
+static unsigned int
+check_case(struct corpus *c)
+{
+	char buf[BUFSIZE];
+	unsigned int i, j, bad = 0;
+	uint32_t want;
+
+	for(i = 0; i < c->count; i++)
+	{
+		rb_strlcpy(buf, c->names[i], sizeof(buf));
+		want = c->func((const unsigned char *)buf, 32, c->hashlen);
+		for(j = 0; buf[j] != '\0'; j++)
+			buf[j] = (j + i) % 2 ? ToLower(buf[j]) : ToUpper(buf[j]);
+		if(c->func((const unsigned char *)buf, 32, c->hashlen) != want)
+		{
+			if(bad++ < 10)
+				fprintf(stderr, "%s: %s and %s hash differently\n", c->name,
+					c->names[i], buf);
+		}
+	}
+	return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct corpus corpora[3] = {
+		{ "nicks", NULL, 0, 0, siphash_upper, "siphash_upper", fnv_hash_upper },
+		{ "channels", NULL, 0, 30, siphash_channel, "siphash_channel", fnv_channel },
+		{ "hosts", NULL, 0, 30, siphash_upper, "siphash_upper", fnv_hash_upper_len }
+	};
+	const char *files[3] = { NULL, NULL, NULL };
+	unsigned int count = DEFAULT_COUNT, bad = 0;
+	int c, i;
+
+	while((c = getopt(argc, argv, "c:n:C:H:")) != -1)
+	{
+		switch (c)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'n':
+			files[0] = optarg;
+			break;
+		case 'C':
+			files[1] = optarg;
+			break;
+		case 'H':
+			files[2] = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(count == 0)
+		usage();
+
+	srand(1);
+	init_hash();
+
+	for(i = 0; i < 3; i++)
+	{
+		if(files[i] != NULL)
+			load_corpus(&corpora[i], files[i]);
+	}
+	if(files[0] == NULL)
+		make_nicks(&corpora[0], count);
+	if(files[1] == NULL)
+		make_channels(&corpora[1], count);
+	if(files[2] == NULL)
+		make_hosts(&corpora[2], count);
+
+	for(i = 0; i < 3; i++)
+	{
+		bad += check_case(&corpora[i]);
+		run_corpus(&corpora[i]);
+	}
+
+	if(bad)
+		printf("%u names hash differently in another case\n", bad);
+	return bad ? 1 : 0;
+}
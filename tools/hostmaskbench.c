@@ -0,0 +1,181 @@
+/*
+ *  hostmaskbench: time auth {} and K-line lookups with a lot of K-lines.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  A few auth blocks and 100000 K-lines by default, of the kinds a
+ *  busy server collects: single IPv4 addresses, IPv4 and IPv6 ranges,
+ *  *.dynamic.isp masks and exact hosts with a username.  Then the time
+ *  to look up a connecting client the way check_client() does, with
+ *  find_auth() and find_conf_by_address(), for a mix of IPv4 and IPv6
+ *  clients with and without a resolved name.  The time to add the
+ *  K-lines and to clear them out again is printed too.
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "struct.h"
+#include "client.h"
+#include "s_conf.h"
+#include "hostmask.h"
+#include "match.h"
+
+#define DEFAULT_KLINES	100000
+#define CLIENTS		20000
+
+extern char *optarg;
+
+static const char *auths[] = {
+	"*", "*.example.net", "192.168.0.0/16", "2001:db8::/32", "*.trusted.org"
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "hostmaskbench [-k klines] [-n rounds]\n");
+	fprintf(stderr, "-k K-lines to add [%d]\n", DEFAULT_KLINES);
+	fprintf(stderr, "-n Rounds over %d clients [10]\n", CLIENTS);
+	exit(1);
+}
+
+static struct ConfItem *
+make_kline(int type, const char *host, const char *user)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = type;
+	aconf->host = rb_strdup(host);
+	aconf->user = rb_strdup(user);
+	add_conf_by_address(aconf->host, type, aconf->user, aconf);
+	return aconf;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static char names[CLIENTS][64], socks[CLIENTS][48];
+	static struct rb_sockaddr_storage addrs[CLIENTS];
+	struct sockaddr *sa;
+	char host[80];
+	const char *user;
+	double start;
+	long hits = 0;
+	int klines = DEFAULT_KLINES, rounds = 10, c, i, r;
+
+	while((c = getopt(argc, argv, "k:n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'k':
+			klines = atoi(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(klines < 0 || rounds <= 0)
+		usage();
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+	init_s_conf();
+	init_host_hash();
+	srand(1);
+
+	for(i = 0; i < (int)(sizeof(auths) / sizeof(auths[0])); i++)
+		make_kline(CONF_CLIENT, auths[i], "*");
+
+	start = now();
+	for(i = 0; i < klines; i++)
+	{
+		user = "*";
+		switch (rand() % 10)
+		{
+		case 0: case 1: case 2: case 3:
+			rb_snprintf(host, sizeof(host), "%d.%d.%d.%d", 11 + rand() % 200,
+				    rand() % 256, rand() % 256, rand() % 256);
+			break;
+		case 4: case 5:
+			rb_snprintf(host, sizeof(host), "%d.%d.%d.0/%d", 11 + rand() % 200,
+				    rand() % 256, rand() % 256, 20 + rand() % 5);
+			break;
+		case 6:
+			rb_snprintf(host, sizeof(host), "2a%02x:%x:%x::/%d", rand() % 256,
+				    rand() % 65536, rand() % 65536, 48 + rand() % 17);
+			break;
+		case 7: case 8:
+			rb_snprintf(host, sizeof(host), "*.dyn%d.isp%d.com", rand() % 1000,
+				    rand() % 100);
+			break;
+		default:
+			rb_snprintf(host, sizeof(host), "host%d.isp%d.net", rand() % 100000,
+				    rand() % 100);
+			user = "*bot*";
+			break;
+		}
+		make_kline(CONF_KILL, host, user);
+	}
+	printf("added %d K-lines in %.1f ms\n", klines, (now() - start) * 1e3);
+
+	for(i = 0; i < CLIENTS; i++)
+	{
+		if(i % 4 == 3)
+			rb_snprintf(socks[i], sizeof(socks[i]), "2a%02x:%x:%x::%x", rand() % 256,
+				    rand() % 65536, rand() % 65536, rand() % 65536);
+		else
+			rb_snprintf(socks[i], sizeof(socks[i]), "%d.%d.%d.%d", 11 + rand() % 200,
+				    rand() % 256, rand() % 256, rand() % 256);
+		rb_inet_pton_sock(socks[i], (struct sockaddr *)&addrs[i]);
+
+		/* half of them resolve */
+		if(i % 2)
+			rb_snprintf(names[i], sizeof(names[i]), "c-%d.dyn%d.isp%d.com", rand(),
+				    rand() % 2000, rand() % 100);
+		else
+			rb_strlcpy(names[i], socks[i], sizeof(names[i]));
+	}
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+	{
+		for(i = 0; i < CLIENTS; i++)
+		{
+			sa = (struct sockaddr *)&addrs[i];
+			hits += find_auth(names[i], socks[i], sa, GET_SS_FAMILY(sa), "user") != NULL;
+			hits += find_conf_by_address(names[i], socks[i], sa, CONF_KILL,
+						     GET_SS_FAMILY(sa), "user") != NULL;
+		}
+	}
+	printf("%.2f us per client, %ld hits\n",
+	       (now() - start) * 1e6 / ((double)rounds * CLIENTS), hits / rounds);
+
+	start = now();
+	clear_out_address_conf_bans();
+	printf("cleared them out in %.1f ms\n", (now() - start) * 1e3);
+	return 0;
+}
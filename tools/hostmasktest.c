@@ -0,0 +1,324 @@
+/*
+ *  hostmasktest: check the auth {} and K-line lookups against a search
+ *  of every mask.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  Masks are added, deleted and cleared out at random, from a small set
+ *  of labels, addresses and prefix lengths so that they overlap a lot:
+ *  IPv4 and IPv6 with and without a cidr, negative cidrs, host masks
+ *  with wildcards in any label, masks with no labels right of their
+ *  last wildcard, and usernames.  In between, clients are looked up by
+ *  any of their name, sockhost and address.  find_auth() has to return
+ *  the auth {} with the highest precedence that matches, and
+ *  find_conf_by_address() one of the K-lines or G-lines that match, or
+ *  none if none do.
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "struct.h"
+#include "client.h"
+#include "s_conf.h"
+#include "hostmask.h"
+#include "match.h"
+
+#define ITERATIONS	100000
+#define MAXENTS		500
+
+struct ent
+{
+	char host[64];
+	char user[16];
+	int type;
+	int masktype;
+	int bits;
+	int keyed;			/* has labels right of its last wildcard */
+	struct rb_sockaddr_storage addr;
+	struct ConfItem *aconf;
+	uint32_t prec;
+	int live;
+};
+
+static struct ent ents[MAXENTS];
+static int nents;
+static uint32_t prec = 0xFFFFFFFF;
+static int failures;
+
+static const char *labels[] = { "a", "b", "c", "ab", "x", "" };
+static const char *wildlabels[] = { "*", "?", "*a", "a*", "?b" };
+static const char *users[] = { "*", "", "u*", "?x", "ux", "*x" };
+static const char *qusers[] = { "ux", "uu", "ax", "bx", "" };
+
+static void
+random_host(char *buf, size_t size, int wild)
+{
+	char tmp[64];
+	const char *label;
+	int n = 1 + rand() % 4, i;
+
+	buf[0] = '\0';
+	for(i = 0; i < n; i++)
+	{
+		label = labels[rand() % (wild ? 5 : 6)];
+		if(wild && rand() % 4 == 0)
+			label = wildlabels[rand() % 5];
+		rb_snprintf(tmp, sizeof(tmp), "%s%s", i ? "." : "", label);
+		rb_strlcat(buf, tmp, size);
+	}
+
+	if(wild && rand() % 10 == 0)
+		rb_strlcpy(buf, rand() % 2 ? "*" : "a.*", size);
+	if(wild && rand() % 8 == 0)
+	{
+		rb_snprintf(tmp, sizeof(tmp), "*%s", buf);
+		rb_strlcpy(buf, tmp, size);
+	}
+}
+
+static void
+random_ip(char *buf, size_t size, int fam)
+{
+	if(fam == AF_INET)
+		rb_snprintf(buf, size, "10.%d.%d.%d", rand() % 3, rand() % 3, rand() % 4);
+	else
+		rb_snprintf(buf, size, "2001:db8:%x::%x", rand() % 3, rand() % 4);
+}
+
+static void
+random_mask(char *buf, size_t size)
+{
+	char ip[48];
+	int r = rand() % 10;
+
+	if(r < 4)
+	{
+		random_ip(ip, sizeof(ip), AF_INET);
+		if(rand() % 3)
+			rb_snprintf(buf, size, "%s/%d", ip, rand() % 33);
+		else
+			rb_strlcpy(buf, ip, size);
+	}
+	else if(r < 6)
+	{
+		random_ip(ip, sizeof(ip), AF_INET6);
+		if(rand() % 3)
+			rb_snprintf(buf, size, "%s/%d", ip, rand() % 129);
+		else
+			rb_strlcpy(buf, ip, size);
+	}
+	else if(r < 7)
+	{
+		/* never matches anything as an address */
+		random_ip(ip, sizeof(ip), AF_INET);
+		rb_snprintf(buf, size, "%s/-%d", ip, rand() % 3);
+	}
+	else
+		random_host(buf, size, 1);
+}
+
+static void
+add_ent(struct ent *e)
+{
+	static const int types[] = { CONF_CLIENT, CONF_KILL, CONF_GLINE, CONF_EXEMPTDLINE };
+	const char *p, *label = "";
+
+	random_mask(e->host, sizeof(e->host));
+	rb_strlcpy(e->user, users[rand() % 6], sizeof(e->user));
+	e->type = types[rand() % 4];
+
+	e->masktype = parse_netmask(e->host, (struct sockaddr *)&e->addr, &e->bits);
+	if(e->masktype != HM_HOST && e->bits < 0)
+		e->masktype = HM_HOST;
+
+	/* whether anything is left right of the last wildcard */
+	e->keyed = 1;
+	for(p = e->host + strlen(e->host) - 1; p >= e->host; p--)
+	{
+		if(*p == '*' || *p == '?')
+		{
+			e->keyed = *label != '\0';
+			break;
+		}
+		if(*p == '.')
+			label = p + 1;
+	}
+
+	/* as the conf code does it, the records point into the ConfItem */
+	e->aconf = make_conf();
+	e->aconf->status = e->type;
+	e->aconf->flags = rand() % 2 ? CONF_FLAGS_TEMPORARY : 0;
+	e->aconf->host = rb_strdup(e->host);
+	e->aconf->user = rb_strdup(e->user);
+	if(e->type == CONF_CLIENT)
+		e->prec = prec--;
+	e->live = 1;
+
+	add_conf_by_address(e->aconf->host, e->type, e->aconf->user, e->aconf);
+}
+
+static int
+ent_matches(struct ent *e, const char *name, const char *sockhost, struct sockaddr *addr,
+	    int fam, const char *user)
+{
+	if(e->user[0] != '\0' && strcmp(e->user, "*") && !match(e->user, user))
+		return 0;
+
+	if(e->masktype == HM_HOST)
+	{
+		if(name == NULL)
+			return 0;
+		/* masks with nothing to key them by are tried on the
+		 * sockhost as well
+		 */
+		return match(e->host, name) || (!e->keyed && sockhost && match(e->host, sockhost));
+	}
+
+	if(addr == NULL || (e->masktype == HM_IPV4 && fam != AF_INET) ||
+	   (e->masktype == HM_IPV6 && fam != AF_INET6))
+		return 0;
+	return comp_with_mask_sock(addr, (struct sockaddr *)&e->addr, e->bits);
+}
+
+static void
+clear_ents(void)
+{
+	struct ent *e;
+	int i, bans = rand() % 2, keep;
+
+	for(i = 0; i < nents; i++)
+	{
+		e = &ents[i];
+		if(!e->live)
+			continue;
+		keep = (e->aconf->flags & CONF_FLAGS_TEMPORARY) ||
+			(bans ? (e->type == CONF_CLIENT || e->type == CONF_EXEMPTDLINE) :
+			 (e->type != CONF_CLIENT && e->type != CONF_EXEMPTDLINE));
+		if(!keep)
+			e->live = 0;
+	}
+
+	if(bans)
+		clear_out_address_conf_bans();
+	else
+		clear_out_address_conf();
+}
+
+static void
+lookup(void)
+{
+	struct rb_sockaddr_storage addr;
+	struct ConfItem *got, *best = NULL;
+	struct sockaddr *sa;
+	const char *user = qusers[rand() % 5], *name, *sockhost;
+	char namebuf[64], sock[48];
+	uint32_t bestprec = 0;
+	int fam, i, t, type, any, found;
+
+	random_host(namebuf, sizeof(namebuf), 0);
+	fam = rand() % 3 ? AF_INET : AF_INET6;
+	random_ip(sock, sizeof(sock), fam);
+	rb_inet_pton_sock(sock, (struct sockaddr *)&addr);
+	if(rand() % 4 == 0)
+		rb_strlcpy(namebuf, sock, sizeof(namebuf));
+
+	/* any of them can be missing */
+	name = rand() % 8 ? namebuf : NULL;
+	sockhost = rand() % 4 ? sock : NULL;
+	sa = rand() % 8 ? (struct sockaddr *)&addr : NULL;
+
+	got = find_auth(name, sockhost, sa, fam, user);
+	for(i = 0; i < nents; i++)
+	{
+		if(ents[i].live && ents[i].type == CONF_CLIENT && ents[i].prec > bestprec &&
+		   ent_matches(&ents[i], name, sockhost, sa, fam, user))
+		{
+			bestprec = ents[i].prec;
+			best = ents[i].aconf;
+		}
+	}
+	if(got != best && failures++ < 20)
+		fprintf(stderr, "find_auth: %s for %s[%s] %s, not %s\n",
+			got ? got->host : "nothing", name ? name : "-", sockhost ? sockhost : "-",
+			user, best ? best->host : "nothing");
+
+	for(t = 0; t < 2; t++)
+	{
+		type = t ? CONF_GLINE : CONF_KILL;
+		got = find_conf_by_address(name, sockhost, sa, type, fam, user);
+		any = found = 0;
+		for(i = 0; i < nents; i++)
+		{
+			if(ents[i].live && ents[i].type == type &&
+			   ent_matches(&ents[i], name, sockhost, sa, fam, user))
+			{
+				any = 1;
+				if(ents[i].aconf == got)
+					found = 1;
+			}
+		}
+		if(((got != NULL) != any || (got != NULL && !found)) && failures++ < 20)
+			fprintf(stderr, "find_conf_by_address: %s for %s[%s] %s, %s match\n",
+				got ? got->host : "nothing", name ? name : "-",
+				sockhost ? sockhost : "-", user, any ? "some" : "none");
+	}
+}
+
+int
+main(void)
+{
+	struct ent *e;
+	long i, lookups = 0;
+	int r, slot;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+	init_s_conf();
+	init_host_hash();
+	srand(1);
+
+	for(i = 0; i < ITERATIONS; i++)
+	{
+		r = rand() % 100;
+		if(r < 30)
+		{
+			slot = rand() % MAXENTS;
+			if(slot < nents && ents[slot].live)
+				continue;
+			if(slot >= nents)
+				slot = nents++;
+			add_ent(&ents[slot]);
+		}
+		else if(r < 40 && nents > 0)
+		{
+			e = &ents[rand() % nents];
+			if(!e->live)
+				continue;
+			delete_one_address_conf(e->aconf->host, e->aconf);
+			e->live = 0;
+		}
+		else if(r == 40 && rand() % 50 == 0)
+			clear_ents();
+		else
+		{
+			lookup();
+			lookups++;
+		}
+	}
+
+	printf("%ld lookups over %d masks, %d failures\n", lookups, nents, failures);
+	return failures ? 1 : 0;
+}
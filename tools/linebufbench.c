@@ -0,0 +1,195 @@
+/*
+ *  linebufbench: time the end of line kernels on their own and under
+ *  rb_linebuf_parse().
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  The first table is rb_linebuf_find_eol() on a line of each length
+ *  with its EOL at the end, the second is a burst of server lines of
+ *  about the sizes a netjoin sends pushed through rb_linebuf_parse() and
+ *  rb_linebuf_get() in READBUF_SIZE reads.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "ratbox_lib.h"
+
+#define BURST_SIZE	(4 * 1024 * 1024)
+#define READ_SIZE	16384
+
+extern char *optarg;
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+static const size_t lengths[] = { 8, 16, 31, 32, 33, 64, 100, 200, 510, 4096 };
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "linebufbench [-n rounds]\n");
+	fprintf(stderr, "-n Rounds over the burst per kernel [20]\n");
+	exit(1);
+}
+
+static double
+bench_find_eol(size_t len, long iterations)
+{
+	static char buf[4096 + 64];
+	volatile char *sink;
+	double start;
+	long i;
+
+	memset(buf, 'x', len);
+	buf[len - 1] = '\n';
+
+	start = now();
+	for(i = 0; i < iterations; i++)
+	{
+		/* start one byte on now and then so it isn't always aligned */
+		sink = rb_linebuf_find_eol(buf + (i & 1), len - (i & 1));
+	}
+	(void)sink;
+	return (now() - start) * 1e9 / iterations;
+}
+
+static size_t
+make_burst(char *buf, size_t size)
+{
+	size_t len = 0, linelen, i;
+
+	srand(1);
+	while(len + BUF_DATA_SIZE + 2 < size)
+	{
+		/* mostly UID/SJOIN sized, some short, a few at the limit */
+		switch (rand() % 8)
+		{
+		case 0:
+			linelen = 10 + rand() % 30;
+			break;
+		case 1:
+			linelen = 400 + rand() % 110;
+			break;
+		default:
+			linelen = 60 + rand() % 120;
+			break;
+		}
+		for(i = 0; i < linelen; i++)
+			buf[len + i] = 'A' + (len + i) % 58;
+		len += linelen;
+		buf[len++] = '\r';
+		buf[len++] = '\n';
+	}
+	return len;
+}
+
+static double
+bench_parse(const char *burst, size_t len, int rounds, unsigned long *lines)
+{
+	static char data[READ_SIZE];
+	char line[BUF_DATA_SIZE + 2];
+	buf_head_t head;
+	size_t pos, chunk;
+	double start;
+	int r;
+
+	*lines = 0;
+	rb_linebuf_newbuf(&head);
+	start = now();
+	for(r = 0; r < rounds; r++)
+	{
+		for(pos = 0; pos < len; pos += chunk)
+		{
+			chunk = len - pos < READ_SIZE ? len - pos : READ_SIZE;
+			memcpy(data, burst + pos, chunk);
+			rb_linebuf_parse(&head, data, chunk, 0);
+			while(rb_linebuf_get(&head, line, sizeof(line), 0, 0) > 0)
+				(*lines)++;
+		}
+	}
+	rb_linebuf_donebuf(&head);
+	return now() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static char burst[BURST_SIZE];
+	unsigned long lines;
+	size_t burstlen, l;
+	double secs;
+	int rounds = 20, c, k;
+
+	while((c = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(rounds <= 0)
+		usage();
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+	rb_linebuf_init(1024);
+	burstlen = make_burst(burst, sizeof(burst));
+
+	printf("%-8s", "length");
+	for(k = 0; k < 3; k++)
+		printf("%12s", kernels[k]);
+	printf("    (ns per rb_linebuf_find_eol)\n");
+
+	for(l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+	{
+		printf("%-8zu", lengths[l]);
+		for(k = 0; k < 3; k++)
+		{
+			if(rb_linebuf_set_eol_kernel(kernels[k]) != 0)
+			{
+				printf("%12s", "-");
+				continue;
+			}
+			printf("%12.2f", bench_find_eol(lengths[l], 200000000 / (lengths[l] + 16)));
+		}
+		printf("\n");
+	}
+
+	printf("\nparse/get, %zu byte burst x %d\n", burstlen, rounds);
+	for(k = 0; k < 3; k++)
+	{
+		if(rb_linebuf_set_eol_kernel(kernels[k]) != 0)
+			continue;
+		secs = bench_parse(burst, burstlen, rounds, &lines);
+		printf("%-8s %8.1f MB/s %8.1f ns/line\n", kernels[k],
+		       burstlen * (double)rounds / secs / 1e6, secs * 1e9 / lines);
+	}
+	return 0;
+}
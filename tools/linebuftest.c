@@ -0,0 +1,317 @@
+/*
+ *  linebuftest: check the SIMD end of line kernels against the scalar one.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  rb_linebuf_find_eol() is run with every kernel this cpu has over all
+ *  lengths up to a few 32 byte blocks, at every alignment, with a CR or
+ *  LF at every offset.  Then random streams go through rb_linebuf_parse()
+ *  and rb_linebuf_get(), raw and not, and every kernel has to split them
+ *  into the same lines the scalar one does.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "ratbox_lib.h"
+
+#define MAXLEN		(4 * 32 + 3)
+#define ALIGNS		32
+#define STREAMS		2000
+#define STREAM_SIZE	(8 * BUF_DATA_SIZE)
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+
+static int failures;
+
+static void
+fail(const char *kernel, const char *what, size_t len, size_t align, size_t pos)
+{
+	if(failures++ < 20)
+		fprintf(stderr, "%s: %s, len %zu align %zu pos %zu\n", kernel, what, len,
+			align, pos);
+}
+
+static const char *
+find_eol_ref(const char *ch, size_t len)
+{
+	for(; len; len--, ch++)
+	{
+		if(*ch == '\r' || *ch == '\n')
+			return ch;
+	}
+	return NULL;
+}
+
+/* fill the buffer with bytes that look like CR/LF to a sloppy compare:
+ * same low nibble, the top bit set, one off either side
+ */
+static void
+fill_noise(char *buf, size_t len)
+{
+	static const unsigned char noise[] =
+		{ 0x8a, 0x8d, 0x0b, 0x0c, 0x09, 0x0e, 0x1a, 0x1d, 0xff, 'x', ' ', 0x00 };
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = noise[(i * 7 + len) % sizeof(noise)];
+}
+
+static void
+check_find_eol(const char *kernel)
+{
+	static char area[ALIGNS + MAXLEN + 64];
+	const char *want;
+	char *buf, *got;
+	size_t len, align, pos;
+	int c;
+
+	for(align = 0; align < ALIGNS; align++)
+	{
+		buf = area + align;
+		for(len = 0; len <= MAXLEN; len++)
+		{
+			/* nothing to find, with an EOL just past the end */
+			fill_noise(area, sizeof(area));
+			buf[len] = '\n';
+			if(rb_linebuf_find_eol(buf, len) != NULL)
+				fail(kernel, "found an EOL past the end", len, align, len);
+
+			for(c = 0; c < 2; c++)
+			{
+				for(pos = 0; pos < len; pos++)
+				{
+					fill_noise(area, sizeof(area));
+					buf[pos] = c ? '\n' : '\r';
+					/* and another one later, the first has to win */
+					if(pos + 5 < len)
+						buf[pos + 5] = c ? '\r' : '\n';
+
+					want = find_eol_ref(buf, len);
+					got = rb_linebuf_find_eol(buf, len);
+					if(got != want)
+						fail(kernel, c ? "wrong LF" : "wrong CR", len, align, pos);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * a stream of lines from 0 to a few BUF_DATA_SIZEs long, ending in runs
+ * of CR and LF, sometimes with no EOL at all at the end
+ */
+static size_t
+make_stream(char *buf, size_t size)
+{
+	static const char *eols[] = { "\r\n", "\n", "\r", "\n\r", "\r\n\r\n", "\r\r\r\n" };
+	size_t len = 0, linelen, i;
+	const char *eol;
+
+	while(len + 3 * BUF_DATA_SIZE < size)
+	{
+		switch (rand() % 4)
+		{
+		case 0:
+			linelen = rand() % 40;
+			break;
+		case 1:
+			linelen = BUF_DATA_SIZE - 4 + rand() % 8;
+			break;
+		case 2:
+			linelen = rand() % (3 * BUF_DATA_SIZE);
+			break;
+		default:
+			linelen = rand() % BUF_DATA_SIZE;
+			break;
+		}
+
+		for(i = 0; i < linelen; i++)
+			buf[len + i] = 'a' + (len + i) % 26;
+		len += linelen;
+
+		/* now and then the stream ends halfway through a line */
+		if(rand() % 50 == 0)
+			break;
+		eol = eols[rand() % 6];
+		memcpy(buf + len, eol, strlen(eol));
+		len += strlen(eol);
+	}
+	return len;
+}
+
+static size_t
+get_lines(buf_head_t *head, int partial, int raw, char *out, size_t outlen)
+{
+	char line[BUF_DATA_SIZE + 2];
+	int numlines, n;
+
+	/* an empty line and one still waiting for its EOL both come back
+	 * as 0, only the first takes the line off the list
+	 */
+	while((numlines = rb_linebuf_numlines(head)) > 0)
+	{
+		n = rb_linebuf_get(head, line, sizeof(line), partial, raw);
+		if(n == 0 && rb_linebuf_numlines(head) == numlines)
+			break;
+		memcpy(out + outlen, &n, sizeof(n));
+		memcpy(out + outlen + sizeof(n), line, n);
+		outlen += sizeof(n) + n;
+	}
+	return outlen;
+}
+
+/*
+ * feed the stream in random sized chunks and collect what comes out,
+ * each line prefixed with its length
+ */
+static size_t
+run_stream(const char *stream, size_t len, const unsigned int *chunks, int raw, char *out)
+{
+	static char data[STREAM_SIZE];
+	buf_head_t head;
+	size_t pos = 0, outlen = 0;
+	unsigned int chunk, i = 0;
+
+	rb_linebuf_newbuf(&head);
+	while(pos < len)
+	{
+		chunk = chunks[i++];
+		if(chunk > len - pos)
+			chunk = len - pos;
+		/* parse() writes into the data, give it a copy */
+		memcpy(data, stream + pos, chunk);
+		rb_linebuf_parse(&head, data, chunk, raw);
+		pos += chunk;
+		outlen = get_lines(&head, 0, raw, out, outlen);
+	}
+
+	/* and whatever is left partial */
+	outlen = get_lines(&head, 1, raw, out, outlen);
+	rb_linebuf_donebuf(&head);
+	return outlen;
+}
+
+/* every line has to fit in 510 bytes with no CR/LF left in it */
+static void
+check_lines(const char *kernel, const char *out, size_t outlen)
+{
+	size_t pos = 0;
+	int n;
+
+	while(pos < outlen)
+	{
+		memcpy(&n, out + pos, sizeof(n));
+		pos += sizeof(n);
+		if(n > BUF_DATA_SIZE - 1)
+			fail(kernel, "line longer than 510 bytes", n, 0, pos);
+		if(find_eol_ref(out + pos, n) != NULL)
+			fail(kernel, "CR/LF left in a line", n, 0, pos);
+		pos += n;
+	}
+}
+
+static void
+check_truncation(const char *kernel)
+{
+	static char data[3 * BUF_DATA_SIZE];
+	char line[BUF_DATA_SIZE + 2];
+	buf_head_t head;
+	size_t len;
+	int n;
+
+	for(len = BUF_DATA_SIZE - 3; len < BUF_DATA_SIZE + 40; len++)
+	{
+		memset(data, 'x', len);
+		data[0] = 'a';
+		memcpy(data + len, "\r\nnext\r\n", 8);
+
+		rb_linebuf_newbuf(&head);
+		rb_linebuf_parse(&head, data, len + 8, 0);
+		/* a line that only overflows by its EOL comes back with the
+		 * EOL turned into a '\0' inside the length, hence strlen()
+		 */
+		rb_linebuf_get(&head, line, sizeof(line), 0, 0);
+		n = strlen(line);
+		if((size_t)n != (len < BUF_DATA_SIZE - 1 ? len : BUF_DATA_SIZE - 1) || line[0] != 'a')
+			fail(kernel, "long line cut at the wrong place", len, 0, n);
+		n = rb_linebuf_get(&head, line, sizeof(line), 0, 0);
+		if(n != 4 || memcmp(line, "next", 4))
+			fail(kernel, "line after a long one lost", len, 0, n);
+		rb_linebuf_donebuf(&head);
+	}
+}
+
+int
+main(void)
+{
+	static char stream[STREAM_SIZE];
+	static char want[2][4 * STREAM_SIZE], got[4 * STREAM_SIZE];
+	static unsigned int chunks[STREAM_SIZE];
+	size_t len, wantlen[2], gotlen;
+	unsigned int i, s;
+	int k, raw, tested = 0;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+	rb_linebuf_init(1024);
+
+	for(k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++)
+	{
+		if(rb_linebuf_set_eol_kernel(kernels[k]) != 0)
+		{
+			printf("%s: not available, skipped\n", kernels[k]);
+			continue;
+		}
+		check_find_eol(kernels[k]);
+		check_truncation(kernels[k]);
+		tested++;
+	}
+
+	srand(1);
+	for(s = 0; s < STREAMS; s++)
+	{
+		len = make_stream(stream, sizeof(stream));
+		for(i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+		{
+			if(rand() % 4 == 0)
+				chunks[i] = 1 + rand() % 40;
+			else
+				chunks[i] = 1 + rand() % (2 * BUF_DATA_SIZE);
+		}
+
+		rb_linebuf_set_eol_kernel("scalar");
+		for(raw = 0; raw < 2; raw++)
+			wantlen[raw] = run_stream(stream, len, chunks, raw, want[raw]);
+		check_lines("scalar", want[0], wantlen[0]);
+
+		for(k = 1; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++)
+		{
+			if(rb_linebuf_set_eol_kernel(kernels[k]) != 0)
+				continue;
+			for(raw = 0; raw < 2; raw++)
+			{
+				gotlen = run_stream(stream, len, chunks, raw, got);
+				if(gotlen != wantlen[raw] || memcmp(got, want[raw], gotlen))
+					fail(kernels[k], raw ? "raw lines differ from scalar" :
+					     "lines differ from scalar", len, 0, s);
+			}
+		}
+	}
+
+	printf("%d kernels checked, %d failures\n", tested, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/*
+ *  masksettest: check maskset_find() against walking the list with
+ *  match_esc().
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  Masks are added at either end of the list and deleted at random,
+ *  the way X-lines and RESVs come and go, with maskset_changed() after
+ *  each change.  They are made of a few letters in either case, spaces,
+ *  '*', '?', '@', '#' and '\' quoting any of those, "\s" included, so
+ *  every rule maskset_run() follows to pick a run gets used.  Names
+ *  are mostly built from a mask in the list, filling in its wildcards
+ *  and sometimes changing a character, and otherwise random.
+ *  maskset_find() has to return the same ConfItem as the first mask in
+ *  the list that match_esc() matches.
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "struct.h"
+#include "s_conf.h"
+#include "match.h"
+#include "maskset.h"
+
+#define ITERATIONS	200000
+#define MAXMASKS	300
+#define MAXMASK		24
+
+static rb_dlink_list list;
+static struct mask_set set;
+static int failures;
+
+/* plain characters, some of them the same but for case */
+static const char plain[] = "aAbBsS1 .";
+/* what can follow a '\' */
+static const char quoted[] = "*?@#\\sSa ";
+
+static char
+random_char(void)
+{
+	static const char any[] = "aAbBsS1 .*?@#\\xyz9";
+
+	return any[rand() % (sizeof(any) - 1)];
+}
+
+static void
+random_mask(char *buf)
+{
+	int len = 1 + rand() % (MAXMASK / 2), i = 0;
+
+	if(rand() % 3 == 0)
+		buf[i++] = '*';
+	while(i < len)
+	{
+		switch (rand() % 10)
+		{
+		case 0:
+			buf[i++] = '*';
+			break;
+		case 1:
+			buf[i++] = "?@#"[rand() % 3];
+			break;
+		case 2:
+			buf[i++] = '\\';
+			buf[i++] = quoted[rand() % (sizeof(quoted) - 1)];
+			break;
+		default:
+			buf[i++] = plain[rand() % (sizeof(plain) - 1)];
+			break;
+		}
+	}
+	/* now and then a '\' with nothing after it */
+	if(rand() % 20 == 0)
+		buf[i++] = '\\';
+	else if(rand() % 4 == 0)
+		buf[i++] = '*';
+	buf[i] = '\0';
+}
+
+/* a name the mask would match, give or take a changed character */
+static void
+name_from_mask(char *buf, size_t size, const char *mask)
+{
+	size_t i = 0;
+	int n;
+
+	for(; *mask != '\0' && i < size - 4; mask++)
+	{
+		switch (*mask)
+		{
+		case '*':
+			for(n = rand() % 4; n > 0; n--)
+				buf[i++] = random_char();
+			break;
+		case '?':
+			buf[i++] = random_char();
+			break;
+		case '@':
+			buf[i++] = "aBz"[rand() % 3];
+			break;
+		case '#':
+			buf[i++] = "019"[rand() % 3];
+			break;
+		case '\\':
+			if(mask[1] == '\0')
+				break;
+			mask++;
+			buf[i++] = *mask == 's' ? ' ' : *mask;
+			break;
+		default:
+			buf[i++] = rand() % 2 ? ToUpper(*mask) : *mask;
+			break;
+		}
+	}
+	buf[i] = '\0';
+
+	if(i > 0 && rand() % 4 == 0)
+		buf[rand() % i] = random_char();
+}
+
+static void
+random_name(char *buf, size_t size)
+{
+	size_t len = rand() % (size - 1), i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = random_char();
+	buf[len] = '\0';
+}
+
+static void
+add_mask(void)
+{
+	struct ConfItem *aconf;
+	char mask[MAXMASK + 4];
+
+	random_mask(mask);
+	aconf = make_conf();
+	aconf->host = rb_strdup(mask);
+
+	if(rand() % 2)
+		rb_dlinkAddAlloc(aconf, &list);
+	else
+		rb_dlinkAddTailAlloc(aconf, &list);
+	maskset_changed(&set);
+}
+
+static void
+del_mask(void)
+{
+	rb_dlink_node *ptr;
+	int n = rand() % rb_dlink_list_length(&list);
+
+	RB_DLINK_FOREACH(ptr, list.head)
+	{
+		if(n-- == 0)
+			break;
+	}
+	free_conf(ptr->data);
+	rb_dlinkDestroy(ptr, &list);
+	maskset_changed(&set);
+}
+
+static void
+lookup(void)
+{
+	struct ConfItem *aconf, *want = NULL, *got;
+	rb_dlink_node *ptr;
+	char name[64];
+	int n;
+
+	if(rb_dlink_list_length(&list) > 0 && rand() % 4 != 0)
+	{
+		n = rand() % rb_dlink_list_length(&list);
+		RB_DLINK_FOREACH(ptr, list.head)
+		{
+			if(n-- == 0)
+				break;
+		}
+		aconf = ptr->data;
+		name_from_mask(name, sizeof(name), aconf->host);
+	}
+	else
+		random_name(name, sizeof(name));
+
+	RB_DLINK_FOREACH(ptr, list.head)
+	{
+		aconf = ptr->data;
+		if(match_esc(aconf->host, name))
+		{
+			want = aconf;
+			break;
+		}
+	}
+
+	got = maskset_find(&set, name);
+	if(got != want && failures++ < 20)
+		fprintf(stderr, "maskset_find: \"%s\" for \"%s\", not \"%s\"\n",
+			got ? got->host : "nothing", name, want ? want->host : "nothing");
+}
+
+int
+main(void)
+{
+	long i, lookups = 0;
+	int r;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+	init_s_conf();
+	maskset_init(&set, &list);
+	srand(1);
+
+	for(i = 0; i < ITERATIONS; i++)
+	{
+		r = rand() % 100;
+		if(r < 10 && rb_dlink_list_length(&list) < MAXMASKS)
+			add_mask();
+		else if(r < 16 && rb_dlink_list_length(&list) > 0)
+			del_mask();
+		else
+		{
+			lookup();
+			lookups++;
+		}
+	}
+
+	printf("%ld lookups, %lu masks at the end, %d failures\n", lookups,
+	       rb_dlink_list_length(&list), failures);
+	return failures ? 1 : 0;
+}
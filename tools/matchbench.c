@@ -0,0 +1,151 @@
+/*
+ *  matchbench: time match() against compiled masks on ban sized input.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  A list of ban masks of each kind compile_mask() sorts them into is
+ *  tried against a list of nick!user@host names.  The first line is
+ *  the time per mask and name over all of them for match(),
+ *  match_compiled() and match_compiled_lower() on names folded once
+ *  up front, the way a channel's ban list is checked.  Then the same
+ *  per mask for match() and match_compiled_lower().
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "match.h"
+
+#define NMASKS	(sizeof(masks) / sizeof(masks[0]))
+#define NNAMES	(sizeof(names) / sizeof(names[0]))
+
+extern char *optarg;
+
+static const char *masks[] = {
+	"*!*@*.dsl.example.net", "baduser!*@*", "*!*@192.168.1.*", "*!~spam*@*",
+	"*!*@host-10-1-2-3.isp.example.com", "*troll*!*@*", "n?ck!*@*.example.org",
+	"*!*bot*@*.cloud.example.*", "*!*@*", "foo!bar@baz.example.com"
+};
+
+static const char *names[] = {
+	"alice!~alice@host-10-1-2-3.isp.example.com", "bob!bob@192.168.1.20",
+	"carol!~c@pool-44-12.dsl.example.net", "dave!dave@static.someplace.org",
+	"spammer!~spambot@vps123.cloud.example.io", "TrollFace!~tf@irc.example.org",
+	"eve!eve@2001:db8::1", "mallory!~m@very.long.host.name.that.goes.on.example.net"
+};
+
+static const char *typenames[] = { "any", "exact", "prefix", "suffix", "infix", "glob" };
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "matchbench [-n rounds]\n");
+	fprintf(stderr, "-n Rounds over every mask and name [1000000]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct compiled_mask cms[NMASKS];
+	static char lower[NNAMES][BUFSIZE];
+	volatile long hits = 0;
+	double start, t[3], n;
+	long rounds = 1000000, r;
+	size_t m, x, i;
+	int c;
+
+	while((c = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n':
+			rounds = atol(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(rounds <= 0)
+		usage();
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+
+	for(m = 0; m < NMASKS; m++)
+		compile_mask(&cms[m], masks[m]);
+	for(x = 0; x < NNAMES; x++)
+	{
+		for(i = 0; names[x][i] != '\0'; i++)
+			lower[x][i] = ToLower(names[x][i]);
+		lower[x][i] = '\0';
+	}
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(m = 0; m < NMASKS; m++)
+			for(x = 0; x < NNAMES; x++)
+				hits += match(masks[m], names[x]);
+	t[0] = now() - start;
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(m = 0; m < NMASKS; m++)
+			for(x = 0; x < NNAMES; x++)
+				hits += match_compiled(&cms[m], names[x]);
+	t[1] = now() - start;
+
+	start = now();
+	for(r = 0; r < rounds; r++)
+		for(m = 0; m < NMASKS; m++)
+			for(x = 0; x < NNAMES; x++)
+				hits += match_compiled_lower(&cms[m], lower[x]);
+	t[2] = now() - start;
+
+	n = (double)rounds * NMASKS * NNAMES / 1e9;
+	printf("match %.1f ns  match_compiled %.1f ns  match_compiled_lower %.1f ns\n\n",
+	       t[0] / n, t[1] / n, t[2] / n);
+
+	n = (double)rounds * NNAMES / 1e9;
+	printf("%-36s %-7s %8s %8s\n", "mask", "type", "match", "lower");
+	for(m = 0; m < NMASKS; m++)
+	{
+		start = now();
+		for(r = 0; r < rounds; r++)
+			for(x = 0; x < NNAMES; x++)
+				hits += match(masks[m], names[x]);
+		t[0] = now() - start;
+
+		start = now();
+		for(r = 0; r < rounds; r++)
+			for(x = 0; x < NNAMES; x++)
+				hits += match_compiled_lower(&cms[m], lower[x]);
+		t[1] = now() - start;
+
+		printf("%-36s %-7s %8.1f %8.1f\n", masks[m], typenames[cms[m].type],
+		       t[0] / n, t[1] / n);
+	}
+	(void)hits;
+	return 0;
+}
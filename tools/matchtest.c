@@ -0,0 +1,281 @@
+/*
+ *  matchtest: check match_compiled() against match().
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  Every mask goes through match(), match_compiled(),
+ *  match_compiled_lower() and a plain glob matcher that has no call
+ *  limit.  First a list of masks picked for the edges: runs of '?',
+ *  runs of '*' that get collapsed, runs anchored at either end, and
+ *  names one short of and exactly at the shortest a mask can match.
+ *  Then every mask up to 5 characters against every name up to 6, and
+ *  random masks against names up to 800 bytes, past the buffer
+ *  match_compiled() folds into on the stack.
+ *
+ *  match() gives up after MATCH_MAX_CALLS steps and says no, so on long
+ *  names it is only held to never matching where the others don't.
+ */
+#include "stdinc.h"
+#include "ratbox_lib.h"
+#include "match.h"
+
+#define MAXNAME		800
+#define RANDOM_TESTS	200000
+
+struct match_case
+{
+	const char *mask;
+	const char *name;
+	int result;
+};
+
+static const struct match_case cases[] = {
+	{ "", "", 1 },
+	{ "", "a", 0 },
+	{ "*", "", 1 },
+	{ "***", "anything", 1 },
+	{ "?", "", 0 },
+	{ "?", "a", 1 },
+	{ "???", "ab", 0 },
+	{ "???", "abc", 1 },
+	{ "???", "abcd", 0 },
+	{ "a???b", "aXYZb", 1 },
+	{ "a???b", "aXYb", 0 },
+	{ "*???", "ab", 0 },
+	{ "*???", "abc", 1 },
+	{ "???*", "abcdef", 1 },
+	{ "*?*?*", "a", 0 },
+	{ "*?*?*", "ab", 1 },
+	{ "a**b", "ab", 1 },
+	{ "a**b", "aXb", 1 },
+	{ "a***b***c", "abc", 1 },
+	{ "a***b***c", "acb", 0 },
+	{ "**a**", "xax", 1 },
+	{ "abc*", "abc", 1 },
+	{ "abc*", "ABCdef", 1 },
+	{ "abc*", "ab", 0 },
+	{ "*abc", "xxABC", 1 },
+	{ "*abc", "abcx", 0 },
+	{ "a*c", "ac", 1 },
+	{ "a*c", "abcbc", 1 },
+	{ "a*c", "abcb", 0 },
+	{ "*a*a*", "aa", 1 },
+	{ "*a*a*", "a", 0 },
+	{ "ab*ab", "ab", 0 },
+	{ "ab*ab", "abab", 1 },
+	{ "ab*ab", "aba", 0 },
+	{ "a?*?b", "a12b", 1 },
+	{ "a?*?b", "a1b", 0 },
+	{ "*a?c*d?f*", "abcdef", 1 },
+	{ "*a?c*d?f*", "abcdf", 0 },
+	{ "*!*@*.example.net", "nick!user@host.example.net", 1 },
+	{ "*!*@*.example.net", "nick!user@example.net", 0 },
+	{ "n?ck!*@*", "NICK!u@h", 1 },
+	{ "*[]*", "a{}b", 0 },
+	{ "*[]*", "a[]b", 1 }
+};
+
+static int failures;
+
+/* plain glob, a step per mask character over every place in the name */
+static int
+match_ref(const char *mask, const char *name)
+{
+	static unsigned char cur[MAXNAME + 2], next[MAXNAME + 2];
+	size_t len = strlen(name), i, j;
+
+	memset(cur, 0, len + 1);
+	cur[0] = 1;
+	for(; *mask != '\0'; mask++)
+	{
+		memset(next, 0, len + 1);
+		for(i = 0; i <= len; i++)
+		{
+			if(!cur[i])
+				continue;
+			if(*mask == '*')
+			{
+				for(j = i; j <= len; j++)
+					next[j] = 1;
+				break;
+			}
+			if(i < len && (*mask == '?' || ToLower(*mask) == ToLower(name[i])))
+				next[i + 1] = 1;
+		}
+		memcpy(cur, next, len + 1);
+	}
+	return cur[len];
+}
+
+static void
+fail(const char *what, const char *mask, const char *name, int want, int got)
+{
+	if(failures++ < 20)
+		fprintf(stderr, "%s: mask \"%s\" name \"%.60s%s\" (%zu) gave %d, not %d\n",
+			what, mask, name, strlen(name) > 60 ? "..." : "", strlen(name), got, want);
+}
+
+/* strict: match() has to agree as well, it does on anything short
+ * enough not to run out of calls
+ */
+static void
+check(const char *mask, const char *name, int want, int strict)
+{
+	static char lower[MAXNAME + 1];
+	struct compiled_mask cm;
+	size_t i;
+	int got;
+
+	compile_mask(&cm, mask);
+
+	got = match_compiled(&cm, name);
+	if(got != want)
+		fail("match_compiled", mask, name, want, got);
+
+	for(i = 0; name[i] != '\0'; i++)
+		lower[i] = ToLower(name[i]);
+	lower[i] = '\0';
+	got = match_compiled_lower(&cm, lower);
+	if(got != want)
+		fail("match_compiled_lower", mask, name, want, got);
+
+	/* match() wants collapsed masks */
+	got = match(cm.mask, name);
+	if(strict ? got != want : got > want)
+		fail("match", mask, name, want, got);
+
+	free_compiled_mask(&cm);
+}
+
+static void
+check_cases(void)
+{
+	size_t i;
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		if(match_ref(cases[i].mask, cases[i].name) != cases[i].result)
+			fail("reference", cases[i].mask, cases[i].name, cases[i].result,
+			     !cases[i].result);
+		check(cases[i].mask, cases[i].name, cases[i].result, 1);
+	}
+}
+
+/* the n'th string of length len over alpha */
+static void
+nth_string(char *buf, const char *alpha, size_t len, unsigned long n)
+{
+	size_t i, base = strlen(alpha);
+
+	for(i = 0; i < len; i++, n /= base)
+		buf[i] = alpha[n % base];
+	buf[len] = '\0';
+}
+
+static void
+check_all_short(void)
+{
+	static const char mask_alpha[] = "aB?*";
+	static const char name_alpha[] = "AbB";
+	char mask[8], name[8];
+	unsigned long mn, nn, mcount, ncount;
+	size_t ml, nl;
+
+	for(ml = 0, mcount = 1; ml <= 5; ml++, mcount *= 4)
+	{
+		for(mn = 0; mn < mcount; mn++)
+		{
+			nth_string(mask, mask_alpha, ml, mn);
+			for(nl = 0, ncount = 1; nl <= 6; nl++, ncount *= 3)
+			{
+				for(nn = 0; nn < ncount; nn++)
+				{
+					nth_string(name, name_alpha, nl, nn);
+					check(mask, name, match_ref(mask, name), 1);
+				}
+			}
+		}
+	}
+}
+
+/* a long name, and a mask that is mostly cut out of it so it matches
+ * about half the time
+ */
+static void
+check_random(void)
+{
+	static const char name_alpha[] = "abAB.x-";
+	static const char mask_alpha[] = "ab*?.x";
+	char name[MAXNAME + 1], mask[64];
+	size_t len, ml, i, pos;
+	unsigned long t;
+
+	for(t = 0; t < RANDOM_TESTS; t++)
+	{
+		len = rand() % (MAXNAME + 1);
+		for(i = 0; i < len; i++)
+			name[i] = name_alpha[rand() % 7];
+		name[len] = '\0';
+
+		ml = 0;
+		pos = 0;
+		if(rand() % 2)
+			mask[ml++] = '*';
+		while(ml < 40 && rand() % 6 != 0)
+		{
+			switch (rand() % 5)
+			{
+			case 0:
+				/* a run of '*' or '?' */
+				for(i = 1 + rand() % 3; i > 0; i--)
+					mask[ml++] = rand() % 2 ? '*' : '?';
+				break;
+			case 1:
+				mask[ml++] = mask_alpha[rand() % 6];
+				break;
+			default:
+				/* copy a bit of the name from further on */
+				if(len > 0)
+					pos += rand() % (len / 4 + 1);
+				for(i = 1 + rand() % 4; i > 0 && pos < len; i--)
+					mask[ml++] = name[pos++];
+				break;
+			}
+		}
+		if(rand() % 2)
+			mask[ml++] = '*';
+		mask[ml] = '\0';
+
+		check(mask, name, match_ref(mask, name), len < 20);
+	}
+}
+
+int
+main(void)
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 256, 1024, 256);
+
+	check_cases();
+	check_all_short();
+	srand(1);
+	check_random();
+
+	printf("%zu cases, all short masks and %d random ones, %d failures\n",
+	       sizeof(cases) / sizeof(cases[0]), RANDOM_TESTS, failures);
+	return failures ? 1 : 0;
+}
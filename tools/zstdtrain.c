@@ -0,0 +1,201 @@
+/*
+ *  ratbox-zstdtrain: build a zstd dictionary for ziplinks out of captured
+ *  server to server traffic.
+ *
+ *  Copyright (C) 2026 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *  The input files are plain server protocol as it would go over the
+ *  link before compression, one message per line: a burst captured off
+ *  an uncompressed test link, or a raw log of one.  Lines are grouped
+ *  into samples about the size of what ssld compresses at a time, which
+ *  is what the dictionary ends up being used on.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zdict.h>
+
+#define DEFAULT_DICT_SIZE	(110 * 1024)
+#define DEFAULT_SAMPLE_SIZE	1024
+
+extern char *optarg;
+extern int optind;
+
+static char *samples;
+static size_t samples_len, samples_alloc;
+static size_t *sample_sizes;
+static unsigned int nsamples, sizes_alloc;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "ratbox-zstdtrain [-o dictfile] [-d dictsize] [-s samplesize] capture...\n");
+	fprintf(stderr, "-o Where to write the dictionary [ircd.zdict]\n");
+	fprintf(stderr, "-d Maximum dictionary size in bytes [%d]\n", DEFAULT_DICT_SIZE);
+	fprintf(stderr, "-s Bytes of traffic per sample [%d]\n", DEFAULT_SAMPLE_SIZE);
+	exit(1);
+}
+
+static void
+add_sample(const char *buf, size_t len)
+{
+	if(len == 0)
+		return;
+
+	if(samples_len + len > samples_alloc)
+	{
+		samples_alloc = (samples_alloc + len) * 2;
+		samples = realloc(samples, samples_alloc);
+	}
+	if(nsamples == sizes_alloc)
+	{
+		sizes_alloc = sizes_alloc ? sizes_alloc * 2 : 1024;
+		sample_sizes = realloc(sample_sizes, sizes_alloc * sizeof(size_t));
+	}
+	if(samples == NULL || sample_sizes == NULL)
+	{
+		fprintf(stderr, "ratbox-zstdtrain: out of memory\n");
+		exit(1);
+	}
+
+	memcpy(samples + samples_len, buf, len);
+	samples_len += len;
+	sample_sizes[nsamples++] = len;
+}
+
+/* cut a capture into samples of whole lines, with \r\n line endings as
+ * they are on the wire
+ */
+static int
+read_capture(const char *path, size_t sample_size)
+{
+	char line[1024];
+	char *sample;
+	size_t len = 0, linelen;
+	FILE *in;
+
+	if((in = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "ratbox-zstdtrain: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	sample = malloc(sample_size + sizeof(line) + 2);
+	if(sample == NULL)
+	{
+		fclose(in);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), in) != NULL)
+	{
+		linelen = strcspn(line, "\r\n");
+		if(linelen == 0)
+			continue;
+
+		memcpy(sample + len, line, linelen);
+		len += linelen;
+		sample[len++] = '\r';
+		sample[len++] = '\n';
+
+		if(len >= sample_size)
+		{
+			add_sample(sample, len);
+			len = 0;
+		}
+	}
+	add_sample(sample, len);
+
+	free(sample);
+	fclose(in);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *outfile = "ircd.zdict";
+	size_t dict_size = DEFAULT_DICT_SIZE, sample_size = DEFAULT_SAMPLE_SIZE;
+	size_t ret;
+	void *dict;
+	FILE *out;
+	int c, i;
+
+	while((c = getopt(argc, argv, "o:d:s:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'd':
+			dict_size = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			sample_size = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if(optind >= argc || dict_size < 1024 || sample_size < 64)
+		usage();
+
+	for(i = optind; i < argc; i++)
+	{
+		if(read_capture(argv[i], sample_size) < 0)
+			exit(1);
+	}
+
+	if(nsamples < 10)
+	{
+		fprintf(stderr, "ratbox-zstdtrain: only %u samples, need a bigger capture\n",
+			nsamples);
+		exit(1);
+	}
+
+	if((dict = malloc(dict_size)) == NULL)
+	{
+		fprintf(stderr, "ratbox-zstdtrain: out of memory\n");
+		exit(1);
+	}
+
+	ret = ZDICT_trainFromBuffer(dict, dict_size, samples, sample_sizes, nsamples);
+	if(ZDICT_isError(ret))
+	{
+		fprintf(stderr, "ratbox-zstdtrain: training failed: %s\n", ZDICT_getErrorName(ret));
+		exit(1);
+	}
+
+	if((out = fopen(outfile, "w")) == NULL || fwrite(dict, ret, 1, out) != 1
+	   || fclose(out) != 0)
+	{
+		fprintf(stderr, "ratbox-zstdtrain: %s: %s\n", outfile, strerror(errno));
+		exit(1);
+	}
+
+	printf("Wrote %zu byte dictionary %08x to %s from %u samples (%zu bytes)\n",
+	       ret, ZDICT_getDictID(dict, ret), outfile, nsamples, samples_len);
+	free(dict);
+	free(samples);
+	free(sample_sizes);
+	return 0;
+}